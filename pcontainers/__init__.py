@@ -9,9 +9,15 @@ from ._pdict import PRawDict
 from ._pdict import PDict
 from ._pdict import PRawQueue
 from ._pdict import PQueue
-from ._pdict import ExpiryDict
+from ._pdict import PRawWorkQueue, PWorkQueue
+from ._pdict import PRawPriorityQueue, PPriorityQueue
+from ._pdict import ExpiryDict, PRawExpiryDict
+from ._pdict import PRawMultiDict
+from ._pdict import PShardedDict
+from ._pdict import PBlobStore
 
 from ._pdict import LmdbOptions
+from ._pdict import AsyncioBridge, asyncio_bridge
 
 from ._pdict import set_logger, set_python_logger
 
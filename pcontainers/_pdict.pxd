@@ -12,10 +12,10 @@ from libcpp.vector cimport vector
 from libcpp.utility cimport pair
 # noinspection PyUnresolvedReferences
 from libc.time cimport time_t
-from libc.stdint cimport uint64_t
+from libc.stdint cimport uint64_t, int64_t
 from libc.stdlib cimport malloc
 from libc.string cimport memcpy
-from cpython.buffer cimport PyBUF_SIMPLE, PyBuffer_FillInfo
+from cpython.buffer cimport PyBUF_SIMPLE, PyBUF_WRITABLE, PyBuffer_FillInfo, PyObject_GetBuffer, PyBuffer_Release, PyObject_CheckBuffer
 from cpython.mem cimport PyMem_Malloc
 from cpython.ref cimport Py_INCREF, Py_DECREF, Py_CLEAR
 
@@ -42,18 +42,33 @@ include "pxi_wrappers/pyutils.pxi"
 include "pxi_wrappers/lmdb_options.pxi"
 include "pxi_wrappers/persistentdict.pxi"
 include "pxi_wrappers/persistentqueue.pxi"
+include "pxi_wrappers/persistentworkqueue.pxi"
+include "pxi_wrappers/persistentpriorityqueue.pxi"
+include "pxi_wrappers/persistentmultidict.pxi"
+include "pxi_wrappers/expirypersistentdict.pxi"
+include "pxi_wrappers/shardedpersistentdict.pxi"
+include "pxi_wrappers/blobstore.pxi"
 include "pxi_wrappers/bufferedpersistentdict.pxi"
 include "pxi_wrappers/bufferedpersistentqueue.pxi"
 include "pxi_wrappers/utils.pxi"
+include "pxi_wrappers/completion_queue.pxi"
 include "pxi_wrappers/mutex.pxi"
+include "pxi_wrappers/single_flight.pxi"
 
 
 cpdef set_logger(int level=?)
 cpdef set_python_logger(name)
 
+include "single_flight.pxi"
 include "pdict.pxi"
 include "pqueue.pxi"
+include "workqueue.pxi"
+include "priorityqueue.pxi"
+include "multidict.pxi"
+include "sharded.pxi"
+include "blobstore.pxi"
 include "cpp_future_wrapper.pxi"
+include "asyncio_bridge.pxi"
 include "buffered_pdict.pxi"
 include "buffered_pqueue.pxi"
 include "expiry_dict.pxi"
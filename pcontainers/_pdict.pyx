@@ -4,14 +4,20 @@
 from cpython.ref cimport PyObject, Py_DECREF
 # noinspection PyUnresolvedReferences
 from cython.operator cimport dereference as deref
+from cpython cimport array
 from libc.string cimport memcpy
 from libc.time cimport time as c_time
 
 import logging
 import uuid
 import shutil
+import struct
 import collections
+import itertools
+from functools import partial
 import threading
+import weakref
+import array
 from time import sleep
 from queue import Empty, Full
 from os.path import join
@@ -26,9 +32,16 @@ from mbufferio import MBufferIO
 from ._py_exceptions import EmptyDatabase, NotFound, EmptyKey, BadValSize, NotInitialized, LmdbError
 
 include "lmdb_options_impl.pxi"
+include "single_flight_impl.pxi"
 include "pdict_impl.pxi"
 include "pqueue_impl.pxi"
+include "workqueue_impl.pxi"
+include "priorityqueue_impl.pxi"
+include "multidict_impl.pxi"
+include "sharded_impl.pxi"
+include "blobstore_impl.pxi"
 include "cpp_future_wrapper_impl.pxi"
+include "asyncio_bridge_impl.pxi"
 include "buffered_pdict_impl.pxi"
 include "buffered_pqueue_impl.pxi"
 include "expiry_dict_impl.pxi"
@@ -66,6 +79,31 @@ def _adapt_unary_predicate(unary_pred, Chain value_chain):
     return predicate
 
 
+def _adapt_batch_functor(batch_funct, Chain key_chain, Chain value_chain):
+    def functor(items):
+        new_values = batch_funct([(key_chain.loads(k), value_chain.loads(v)) for (k, v) in items])
+        return [value_chain.dumps(v).tobytes() for v in new_values]
+    return functor
+
+
+def _adapt_batch_predicate(batch_pred, Chain key_chain, Chain value_chain):
+    def predicate(items):
+        return batch_pred([(key_chain.loads(k), value_chain.loads(v)) for (k, v) in items])
+    return predicate
+
+
+def _adapt_values_batch_functor(batch_funct, Chain value_chain):
+    def functor(values):
+        return [value_chain.dumps(v).tobytes() for v in batch_funct([value_chain.loads(v) for v in values])]
+    return functor
+
+
+def _adapt_values_batch_predicate(batch_pred, Chain value_chain):
+    def predicate(values):
+        return batch_pred([value_chain.loads(v) for v in values])
+    return predicate
+
+
 def _adapt_binary_predicate(binary_pred, Chain key_chain, Chain value_chain):
     def predicate(x, y):
         return bool(
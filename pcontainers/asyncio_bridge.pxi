@@ -0,0 +1,23 @@
+# -*- coding: utf-8 -*-
+
+cdef class AsyncioBridge(object):
+    cdef shared_ptr[CompletionQueue] queue
+    cdef dict pending
+    cdef uint64_t next_token
+    cdef size_t batch_size
+    cdef object loop_ref
+    cdef int fd
+
+    cdef new_future(self)
+    cdef watch_cbstring(self, shared_future[CBString] f, loads, canceller=?, orphan=?)
+    cdef watch_bool(self, shared_future[cpp_bool] f)
+
+cdef class _PendingCBString(object):
+    cdef shared_future[CBString] f
+    cdef object aio_future
+    cdef object loads
+    cdef object orphan
+
+cdef class _PendingBool(object):
+    cdef shared_future[cpp_bool] f
+    cdef object aio_future
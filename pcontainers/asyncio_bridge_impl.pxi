@@ -0,0 +1,164 @@
+# -*- coding: utf-8 -*-
+
+try:
+    import asyncio
+except ImportError:
+    asyncio = None
+
+_ASYNCIO_BRIDGES = weakref.WeakKeyDictionary()
+
+
+def asyncio_bridge(loop=None):
+    """
+    Return the AsyncioBridge of an event loop (by default the running loop), and create it on first use.
+    """
+    if asyncio is None:
+        raise RuntimeError("asyncio is not available")
+    if loop is None:
+        try:
+            loop = asyncio.get_running_loop()
+        except (AttributeError, RuntimeError):
+            loop = asyncio.get_event_loop()
+    bridge = _ASYNCIO_BRIDGES.get(loop)
+    if bridge is None:
+        bridge = AsyncioBridge(loop)
+        _ASYNCIO_BRIDGES[loop] = bridge
+    return bridge
+
+
+def _cancel_if_cancelled(canceller, aio_future):
+    if aio_future.cancelled():
+        canceller()
+
+
+# noinspection PyPep8Naming
+cdef class _PendingCBString(object):
+    def resolve(self):
+        cdef CBString result
+        fut = self.aio_future
+        try:
+            try:
+                result = self.f.get()
+            except Exception as ex:
+                if not fut.cancelled():
+                    fut.set_exception(ex)
+                return
+            if fut.cancelled():
+                # nobody will get the value
+                if self.orphan is not None:
+                    self.orphan(topy(result))
+                return
+            try:
+                value = self.loads(make_mbufferio_from_cbstring(result))
+            except Exception as ex:
+                fut.set_exception(ex)
+            else:
+                fut.set_result(value)
+        finally:
+            self.f = shared_future[CBString]()
+
+
+# noinspection PyPep8Naming
+cdef class _PendingBool(object):
+    def resolve(self):
+        fut = self.aio_future
+        try:
+            if fut.cancelled():
+                return
+            try:
+                result = bool(self.f.get())
+            except Exception as ex:
+                fut.set_exception(ex)
+            else:
+                fut.set_result(result)
+        finally:
+            self.f = shared_future[cpp_bool]()
+
+
+# noinspection PyPep8Naming
+cdef class AsyncioBridge(object):
+    """
+    Resolves asyncio futures from the completions of the C++ futures.
+
+    The C++ side pushes the completions into a lock-free queue and signals a file descriptor that the event loop
+    watches: no thread and no GIL handoff is involved per completion. The loop drains the completions in batches of
+    batch_size. The aio_* methods of the queues and of the buffered wrappers use the bridge of the running loop, and
+    must be called from the thread of that loop.
+    """
+    def __cinit__(self, loop, size_t batch_size=1024):
+        self.queue = make_completion_queue()
+        self.fd = self.queue.get().fileno()
+        self.next_token = 1
+
+    def __init__(self, loop, size_t batch_size=1024):
+        if batch_size == 0:
+            raise ValueError()
+        self.pending = {}
+        self.batch_size = batch_size
+        self.loop_ref = weakref.ref(loop)
+        loop.add_reader(self.fd, self._drain)
+
+    def __dealloc__(self):
+        with nogil:
+            self.queue.reset()
+
+    property loop:
+        def __get__(self):
+            return self.loop_ref()
+
+    property in_flight:
+        def __get__(self):
+            return len(self.pending)
+
+    def close(self):
+        """
+        Stop watching the completions. The futures that are still pending will never be resolved.
+        """
+        loop = self.loop_ref()
+        if loop is not None and not loop.is_closed():
+            loop.remove_reader(self.fd)
+        _ASYNCIO_BRIDGES.pop(loop, None)
+        self.pending.clear()
+
+    cdef new_future(self):
+        loop = self.loop_ref()
+        if loop is None:
+            raise RuntimeError("the event loop does not exist anymore")
+        return loop.create_future()
+
+    cdef watch_cbstring(self, shared_future[CBString] f, loads, canceller=None, orphan=None):
+        # canceller(): called when the asyncio future is cancelled. orphan(raw): receives a value that was produced
+        # for a cancelled future.
+        cdef _PendingCBString entry = _PendingCBString()
+        cdef uint64_t token = self.next_token
+        entry.f = f
+        entry.loads = loads
+        entry.orphan = orphan
+        entry.aio_future = self.new_future()
+        if canceller is not None:
+            entry.aio_future.add_done_callback(partial(_cancel_if_cancelled, canceller))
+        self.next_token += 1
+        self.pending[token] = entry
+        with nogil:
+            self.queue.get().watch(f, token)
+        return entry.aio_future
+
+    cdef watch_bool(self, shared_future[cpp_bool] f):
+        cdef _PendingBool entry = _PendingBool()
+        cdef uint64_t token = self.next_token
+        entry.f = f
+        entry.aio_future = self.new_future()
+        self.next_token += 1
+        self.pending[token] = entry
+        with nogil:
+            self.queue.get().watch(f, token)
+        return entry.aio_future
+
+    def _drain(self):
+        cdef vector[uint64_t] tokens
+        with nogil:
+            self.queue.get().drain(tokens, self.batch_size)
+        for token in tokens:
+            entry = self.pending.pop(token, None)
+            if entry is not None:
+                entry.resolve()
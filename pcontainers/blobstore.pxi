@@ -0,0 +1,34 @@
+# -*- coding: utf-8 -*-
+
+cdef class PBlobWriter(object):
+    cdef shared_ptr[cppBlobWriter] ptr
+    cdef PBlobStore store
+
+    cpdef write(self, data)
+    cpdef tell(self)
+    cpdef close(self)
+    cpdef abort(self)
+
+
+cdef class PBlobReader(object):
+    cdef shared_ptr[cppBlobReader] ptr
+    cdef PBlobStore store
+
+    cpdef read(self, ssize_t n=?)
+    cpdef readinto(self, buf)
+    cpdef read_range(self, uint64_t offset, size_t n)
+    cpdef seek(self, int64_t offset, int whence=?)
+    cpdef tell(self)
+    cpdef close(self)
+
+
+cdef class PBlobStore(object):
+    cdef shared_ptr[cppBlobStore] ptr
+    cdef PRawDict the_dict
+
+    cpdef open_writer(self, name)
+    cpdef open_reader(self, name)
+    cpdef exists(self, name)
+    cpdef size(self, name)
+    cpdef delete(self, name)
+    cpdef names(self)
@@ -0,0 +1,246 @@
+# -*- coding: utf-8 -*-
+
+# noinspection PyPep8Naming
+cdef class PBlobWriter(object):
+    """
+    Streaming writer for a blob: the content is visible to readers once the writer is closed. A writer that is
+    aborted, or left by an exception in a 'with' block, discards what was written.
+    """
+
+    def __dealloc__(self):
+        with nogil:
+            self.ptr.reset()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        if exc_type is None:
+            self.close()
+        else:
+            self.abort()
+
+    property closed:
+        def __get__(self):
+            return not self.ptr.get() or self.ptr.get().is_closed()
+
+    def writable(self):
+        return True
+
+    cpdef write(self, data):
+        if not self.ptr.get():
+            raise ValueError("writer is closed")
+        cdef PyBufferWrap view = move(PyBufferWrap(data))
+        cdef MDB_val v = view.get_mdb_val()
+        with nogil:
+            self.ptr.get().write(v.mv_data, v.mv_size)
+        return v.mv_size
+
+    cpdef tell(self):
+        if not self.ptr.get():
+            raise ValueError("writer is closed")
+        return self.ptr.get().tell()
+
+    cpdef close(self):
+        if not self.ptr.get():
+            return
+        if not self.ptr.get().is_closed():
+            with nogil:
+                self.ptr.get().commit()
+        with nogil:
+            self.ptr.reset()
+
+    cpdef abort(self):
+        if not self.ptr.get():
+            return
+        with nogil:
+            self.ptr.get().abort()
+            self.ptr.reset()
+
+
+# noinspection PyPep8Naming
+cdef class PBlobReader(object):
+    """
+    Seekable, file-like reader for a blob. The reader sees a consistent snapshot of the blob until it is closed, and
+    it must be closed promptly: the snapshot prevents LMDB from reusing the pages of replaced blobs.
+    """
+
+    def __dealloc__(self):
+        with nogil:
+            self.ptr.reset()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    def __len__(self):
+        return self.size
+
+    property size:
+        def __get__(self):
+            if not self.ptr.get():
+                raise ValueError("reader is closed")
+            return self.ptr.get().get_size()
+
+    property closed:
+        def __get__(self):
+            return not self.ptr.get()
+
+    def readable(self):
+        return True
+
+    def seekable(self):
+        return True
+
+    cpdef read(self, ssize_t n=-1):
+        if not self.ptr.get():
+            raise ValueError("reader is closed")
+        cdef CBString result
+        with nogil:
+            result = self.ptr.get().read(n)
+        return topy(result)
+
+    cpdef readinto(self, buf):
+        """
+        Read into a writable buffer, straight from the memory map. Return the number of bytes read.
+        """
+        if not self.ptr.get():
+            raise ValueError("reader is closed")
+        cdef Py_buffer view
+        cdef size_t n
+        PyObject_GetBuffer(buf, &view, PyBUF_WRITABLE)
+        try:
+            with nogil:
+                n = self.ptr.get().readinto(view.buf, view.len)
+        finally:
+            PyBuffer_Release(&view)
+        return n
+
+    cpdef read_range(self, uint64_t offset, size_t n):
+        """
+        Read at most n bytes at offset, without moving the position.
+        """
+        if not self.ptr.get():
+            raise ValueError("reader is closed")
+        cdef CBString result
+        with nogil:
+            result = self.ptr.get().read_range(offset, n)
+        return topy(result)
+
+    cpdef seek(self, int64_t offset, int whence=0):
+        if not self.ptr.get():
+            raise ValueError("reader is closed")
+        return self.ptr.get().seek(offset, whence)
+
+    cpdef tell(self):
+        if not self.ptr.get():
+            raise ValueError("reader is closed")
+        return self.ptr.get().tell()
+
+    cpdef close(self):
+        with nogil:
+            self.ptr.reset()
+
+
+# noinspection PyPep8Naming
+cdef class PBlobStore(object):
+    """
+    Large values stored in a PRawDict as fixed-size chunks, written and read in a streaming way. The PRawDict should
+    be dedicated to the blobs.
+    """
+
+    def __cinit__(self, PRawDict d, size_t chunk_size=65520, size_t chunks_per_txn=16):
+        if d is None:
+            raise ValueError()
+        self.the_dict = d
+        self.ptr = shared_ptr[cppBlobStore](new cppBlobStore(d.ptr, chunk_size, chunks_per_txn))
+
+    def __dealloc__(self):
+        with nogil:
+            self.ptr.reset()
+
+    def __init__(self, PRawDict d, size_t chunk_size=65520, size_t chunks_per_txn=16):
+        pass
+
+    def __contains__(self, name):
+        return self.exists(name)
+
+    property chunk_size:
+        def __get__(self):
+            return self.ptr.get().get_chunk_size()
+
+    cpdef open_writer(self, name):
+        cdef CBString n = tocbstring(name)
+        cdef PBlobWriter writer = PBlobWriter()
+        with nogil:
+            writer.ptr = self.ptr.get().open_writer(n)
+        writer.store = self
+        return writer
+
+    cpdef open_reader(self, name):
+        cdef CBString n = tocbstring(name)
+        cdef PBlobReader reader = PBlobReader()
+        with nogil:
+            reader.ptr = self.ptr.get().open_reader(n)
+        reader.store = self
+        return reader
+
+    cpdef exists(self, name):
+        cdef CBString n = tocbstring(name)
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().exists(n)
+        return res
+
+    cpdef size(self, name):
+        cdef CBString n = tocbstring(name)
+        cdef uint64_t res
+        with nogil:
+            res = self.ptr.get().size(n)
+        return res
+
+    cpdef delete(self, name):
+        cdef CBString n = tocbstring(name)
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().erase(n)
+        return res
+
+    cpdef names(self):
+        cdef vector[CBString] ns
+        with nogil:
+            ns = self.ptr.get().names()
+        return [topy(n) for n in ns]
+
+    def sweep(self):
+        """
+        Delete the chunks left by writers that were never committed nor aborted (a crashed process). Return the number
+        of such writers. The uncommitted writers of this process are left alone, not the ones of other processes.
+        """
+        cdef size_t swept
+        with nogil:
+            swept = self.ptr.get().sweep()
+        return swept
+
+    def put(self, name, content, size_t read_size=65520):
+        """
+        Store bytes, or the content of a file-like object read by pieces of read_size bytes. Return the blob size.
+        """
+        cdef PBlobWriter writer = self.open_writer(name)
+        with writer:
+            if hasattr(content, 'read'):
+                while True:
+                    piece = content.read(read_size)
+                    if not piece:
+                        break
+                    writer.write(piece)
+            else:
+                writer.write(content)
+            return writer.tell()
+
+    def get(self, name):
+        cdef PBlobReader reader = self.open_reader(name)
+        with reader:
+            return reader.read()
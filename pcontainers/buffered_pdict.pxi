@@ -7,5 +7,11 @@ cdef class BufferedPDictWrapper(object):
     cpdef getitem(self, key)
     cpdef async_setitem(self, key, value)
     cpdef async_delitem(self, key)
-    cpdef async_getitem(self, key)
+    cpdef async_getitem(self, key, timeout=?)
+    cpdef async_merge(self, key, operand)
+
+    cdef shared_future[cpp_bool] setitem_future(self, key, value) except *
+    cdef shared_future[cpp_bool] delitem_future(self, key) except *
+    cdef shared_future[CBString] getitem_future(self, encoded_key, timeout, uint64_t* read_id) except *
+    cdef shared_future[cpp_bool] merge_future(self, key, operand) except *
 
@@ -2,34 +2,49 @@
 
 # noinspection PyPep8Naming
 cdef class BufferedPDictWrapper(object):
-    def __cinit__(self, PRawDict d, interval):
+    def __cinit__(self, PRawDict d, interval, merge_operator=None, reader_threads=1):
         if d is None:
             raise ValueError()
-        if not isinstance(interval, Number):
+        if not isinstance(interval, Number) or not isinstance(reader_threads, Number):
             raise TypeError()
-        if interval <= 0:
+        if interval <= 0 or reader_threads <= 0:
             raise ValueError()
         cdef uint64_t ms_interval = int(interval * 1000)
+        cdef size_t nb_readers = reader_threads
+        cdef binary_scalar_functor merge_op
 
         self.the_dict = d
-        self.ptr = shared_ptr[cppBufferedPersistentDict](new cppBufferedPersistentDict(d.ptr, ms_interval))
+        if merge_operator is None:
+            pass
+        elif isinstance(merge_operator, (bytes, unicode)):
+            # one of the builtin merge operators: 'add', 'max', 'min', 'append' or 'union'
+            merge_op = merge_operator_by_name(tocbstring(merge_operator))
+        elif callable(merge_operator):
+            # merge_operator(existing, operand) is called with raw bytes and must return bytes
+            merge_op = make_binary_scalar_functor(merge_operator)
+        else:
+            raise TypeError("merge_operator must be a name or a callable")
+        self.ptr = shared_ptr[cppBufferedPersistentDict](
+            new cppBufferedPersistentDict(d.ptr, ms_interval, merge_op, nb_readers)
+        )
 
     def __dealloc__(self):
         with nogil:
             self.ptr.reset()
 
-    def __init__(self, PRawDict d, interval):
+    def __init__(self, PRawDict d, interval, merge_operator=None, reader_threads=1):
         pass
 
     cpdef getitem(self, key):
         encoded_key = self.the_dict.key_chain.dumps(key)
-        cdef CBString result = self.ptr.get().at(
-            PyBufferWrap(encoded_key).get_mdb_val()
-        )
+        cdef MDB_val k = PyBufferWrap(encoded_key).get_mdb_val()
+        cdef CBString result
+        # a python merge operator may need the GIL while the buffers are locked
+        with nogil:
+            result = self.ptr.get().at(k)
         return self.the_dict.value_chain.loads(make_mbufferio_from_cbstring(result))
 
-    cpdef async_setitem(self, key, value):
-        cdef BoolFutureWrapper py_future = BoolFutureWrapper()
+    cdef shared_future[cpp_bool] setitem_future(self, key, value) except *:
         encoded_key = self.the_dict.key_chain.dumps(key)
         encoded_value = self.the_dict.key_chain.dumps(value)
         cdef MDB_val k = PyBufferWrap(encoded_key).get_mdb_val()
@@ -37,26 +52,124 @@ cdef class BufferedPDictWrapper(object):
         cdef shared_future[cpp_bool] cpp_future
         with nogil:
             cpp_future = self.ptr.get().insert_key_value(k, v)
-        py_future.set_boost_future(cpp_future)
-        return py_future
+        return cpp_future
 
-    cpdef async_delitem(self, key):
-        cdef BoolFutureWrapper py_future = BoolFutureWrapper()
+    cdef shared_future[cpp_bool] delitem_future(self, key) except *:
         encoded_key = self.the_dict.key_chain.dumps(key)
         cdef MDB_val k = PyBufferWrap(encoded_key).get_mdb_val()
         cdef shared_future[cpp_bool] cpp_future
         with nogil:
             cpp_future = self.ptr.get().erase(k)
-        py_future.set_boost_future(cpp_future)
-        return py_future
+        return cpp_future
 
-    cpdef async_getitem(self, key):
-        cdef CBStringFutureWrapper py_future = CBStringFutureWrapper(self.the_dict.value_chain.pyloads)
-        encoded_key = self.the_dict.key_chain.dumps(key)
+    cdef shared_future[CBString] getitem_future(self, encoded_key, timeout, uint64_t* read_id) except *:
+        # read_id: receives the id of the read, for cancel_read
         cdef MDB_val k = PyBufferWrap(encoded_key).get_mdb_val()
+        cdef uint64_t ms_timeout = 0
+        if timeout is not None:
+            if not isinstance(timeout, Number):
+                raise TypeError()
+            # 0 means "no deadline" for the C++ side
+            ms_timeout = max(1, int(timeout * 1000))
         cdef shared_future[CBString] cpp_future
         with nogil:
-            cpp_future = self.ptr.get().async_at(k)
+            cpp_future = self.ptr.get().async_at(k, ms_timeout, read_id[0])
+        return cpp_future
+
+    cdef shared_future[cpp_bool] merge_future(self, key, operand) except *:
+        cdef vector[CBString] members
+        encoded_key = self.the_dict.key_chain.dumps(key)
+        if isinstance(operand, (set, frozenset)):
+            for member in operand:
+                members.push_back(tocbstring(member))
+            operand = topy(pack_set(members))
+        elif isinstance(operand, Number):
+            operand = str(int(operand)).encode('ascii')
+        cdef MDB_val k = PyBufferWrap(encoded_key).get_mdb_val()
+        cdef MDB_val v = PyBufferWrap(operand).get_mdb_val()
+        cdef shared_future[cpp_bool] cpp_future
+        with nogil:
+            cpp_future = self.ptr.get().merge(k, v)
+        return cpp_future
+
+    cpdef async_setitem(self, key, value):
+        cdef BoolFutureWrapper py_future = BoolFutureWrapper()
+        py_future.set_boost_future(self.setitem_future(key, value))
+        return py_future
+
+    cpdef async_delitem(self, key):
+        cdef BoolFutureWrapper py_future = BoolFutureWrapper()
+        py_future.set_boost_future(self.delitem_future(key))
+        return py_future
+
+    cpdef async_getitem(self, key, timeout=None):
+        """
+        Read key in one of the reader threads. If the read has not started after timeout seconds, it is dropped and
+        the future fails with Expired. Reads of the same key that are in flight at the same time are shared. Cancelling
+        the future withdraws it from the read, which is dropped when nobody waits for it anymore.
+        """
+        cdef CBStringFutureWrapper py_future = CBStringFutureWrapper(self.the_dict.value_chain.pyloads)
+        encoded_key = self.the_dict.key_chain.dumps(key)
+        cdef uint64_t read_id
+        cdef shared_future[CBString] cpp_future = self.getitem_future(encoded_key, timeout, &read_id)
+        py_future._canceller = partial(self.cancel_read, read_id)
         py_future.set_boost_future(cpp_future)
         return py_future
 
+    def cancel_read(self, uint64_t read_id):
+        # read_id: as set by getitem_future. Only that read is withdrawn, not a later read of the same key.
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().cancel_read(read_id)
+        return res
+
+    def read_stats(self):
+        cdef buffered_read_stats stats = self.ptr.get().get_read_stats()
+        return {
+            'submitted': stats.submitted,
+            'coalesced': stats.coalesced,
+            'expired': stats.expired,
+            'cancelled': stats.cancelled,
+            'steals': stats.steals,
+            'reader_threads': stats.reader_threads
+        }
+
+
+    cpdef async_merge(self, key, operand):
+        """
+        Record a merge operand for key. Operands are folded in memory and applied by the next flush; getitem already
+        sees the merged value. Integers are merged as decimal strings and sets (of bytes) as packed sets.
+        """
+        cdef BoolFutureWrapper py_future = BoolFutureWrapper()
+        py_future.set_boost_future(self.merge_future(key, operand))
+        return py_future
+
+    # the aio_* methods return asyncio futures of the event loop (by default the running loop), resolved through its
+    # AsyncioBridge. They must be called from the thread of the loop.
+
+    def aio_setitem(self, key, value, loop=None):
+        cdef AsyncioBridge bridge = asyncio_bridge(loop)
+        return bridge.watch_bool(self.setitem_future(key, value))
+
+    def aio_delitem(self, key, loop=None):
+        cdef AsyncioBridge bridge = asyncio_bridge(loop)
+        return bridge.watch_bool(self.delitem_future(key))
+
+    def aio_getitem(self, key, timeout=None, loop=None):
+        cdef AsyncioBridge bridge = asyncio_bridge(loop)
+        encoded_key = self.the_dict.key_chain.dumps(key)
+        cdef uint64_t read_id
+        cdef shared_future[CBString] cpp_future = self.getitem_future(encoded_key, timeout, &read_id)
+        return bridge.watch_cbstring(cpp_future, self.the_dict.value_chain.pyloads, partial(self.cancel_read, read_id))
+
+    def aio_merge(self, key, operand, loop=None):
+        cdef AsyncioBridge bridge = asyncio_bridge(loop)
+        return bridge.watch_bool(self.merge_future(key, operand))
+
+
+def unpack_merged_set(packed):
+    """
+    Decode a value produced by the 'union' merge operator
+    """
+    cdef vector[CBString] members = unpack_set(tocbstring(packed))
+    return set([topy(member) for member in members])
@@ -5,3 +5,4 @@ cdef class BufferedPQueueWrapper(object):
     cdef PRawQueue the_queue
 
     cpdef push_back(self, value)
+    cdef shared_future[cpp_bool] push_back_future(self, value) except *
@@ -20,12 +20,22 @@ cdef class BufferedPQueueWrapper(object):
     def __init__(self, PRawQueue q, interval):
         pass
 
-    cpdef push_back(self, value):
-        cdef BoolFutureWrapper py_future = BoolFutureWrapper()
+    cdef shared_future[cpp_bool] push_back_future(self, value) except *:
         encoded_value = self.the_queue.value_chain.dumps(value)
         cdef MDB_val v = PyBufferWrap(encoded_value).get_mdb_val()
         cdef shared_future[cpp_bool] cpp_future
         with nogil:
             cpp_future = self.ptr.get().push_back(v)
-        py_future.set_boost_future(cpp_future)
+        return cpp_future
+
+    cpdef push_back(self, value):
+        cdef BoolFutureWrapper py_future = BoolFutureWrapper()
+        py_future.set_boost_future(self.push_back_future(value))
         return py_future
+
+    def aio_push_back(self, value, loop=None):
+        """
+        Like push_back, but return an asyncio future of the event loop (by default the running loop).
+        """
+        cdef AsyncioBridge bridge = asyncio_bridge(loop)
+        return bridge.watch_bool(self.push_back_future(value))
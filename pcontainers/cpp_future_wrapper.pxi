@@ -12,6 +12,7 @@ cdef class BaseFutureWrapper(object):
 cdef class CBStringFutureWrapper(BaseFutureWrapper):
     cdef shared_future[CBString] _boost_future_after_then
     cdef shared_future[CBString] _boost_future
+    cdef object _canceller
     cdef set_boost_future(self, shared_future[CBString] f)
     cpdef _wait(self, timeout)
 
@@ -106,6 +106,15 @@ cdef class CBStringFutureWrapper(BaseFutureWrapper):
     def __init__(self, loads):
         super(CBStringFutureWrapper, self).__init__()
         self.loads = loads
+        self._canceller = None
+
+    def cancel(self):
+        # a running future can still be cancelled if the producer withdraws it before the work starts
+        if self._state.load() == _running and self._canceller is not None and self._canceller():
+            self._state.store(_cancelled)
+            self._invoke_callbacks()
+            return True
+        return super(CBStringFutureWrapper, self).cancel()
 
     cdef set_boost_future(self, shared_future[CBString] f):
         self._boost_future = f
@@ -118,6 +127,11 @@ cdef class CBStringFutureWrapper(BaseFutureWrapper):
         # print("future is ready")
         cdef CBString result
         # _future_is_ready_callback will be called from a foreign C++ thread...
+        if self._state.load() in [_cancelled, _cancelled_and_notified]:
+            self._boost_future = shared_future[CBString]()
+            self._boost_future_after_then = shared_future[CBString]()
+            self._canceller = None
+            return
         try:
             result = self._boost_future.get()
         except Exception as ex:
@@ -132,6 +146,7 @@ cdef class CBStringFutureWrapper(BaseFutureWrapper):
         # avoid circular references: here self._boost_future_after_then contains a reference to self
         self._boost_future = shared_future[CBString]()
         self._boost_future_after_then = shared_future[CBString]()
+        self._canceller = None
         self._invoke_callbacks()
 
     cpdef _wait(self, timeout):
@@ -0,0 +1,433 @@
+#include <string.h>
+#include <set>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <boost/throw_exception.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "blobstore.h"
+
+
+namespace quiet {
+
+using std::vector;
+using namespace utils;
+using Bstrlib::CBString;
+
+static const CBString generation_key("\0generation", 11);
+
+// std::string: the comparisons of CBString stop at the first NUL byte
+static boost::mutex live_writers_mutex;
+static std::set<std::string> live_writers;
+
+static std::string to_std_string(const CBString& s) {
+    return std::string((const char*) s.data, s.length());
+}
+
+static bool has_prefix(MDB_val key, const CBString& prefix) BOOST_NOEXCEPT_OR_NOTHROW {
+    return key.mv_size >= (size_t) prefix.length() && memcmp(key.mv_data, prefix.data, prefix.length()) == 0;
+}
+
+// the length of the blob name at the start of a key, or -1 if the key is not a blob key (no NUL byte)
+static ssize_t name_length(MDB_val key) BOOST_NOEXCEPT_OR_NOTHROW {
+    const char* nul = (const char*) memchr(key.mv_data, 0, key.mv_size);
+    return nul == NULL ? -1 : nul - (const char*) key.mv_data;
+}
+
+// the smallest key after every key of the blob 'name': the header and the chunks of a blob share the prefix 'name \0'
+static CBString after_name(MDB_val key, size_t name_len) {
+    CBString next((const char*) key.mv_data, (int) name_len);
+    next += '\1';
+    return next;
+}
+
+static void check_name(const CBString& name) {
+    if (!name.length()) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    if (memchr(name.data, 0, name.length()) != NULL) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("blob names can't contain NUL bytes"));
+    }
+}
+
+CBString BlobStore::header_key(const CBString& name) {
+    check_name(name);
+    CBString k(name);
+    k += '\0';
+    return k;
+}
+
+CBString BlobStore::chunks_prefix(const CBString& name, uint64_t generation) {
+    CBString k(header_key(name));
+    k += uint64_to_cbstring_be(generation);
+    return k;
+}
+
+CBString BlobStore::chunk_key(const CBString& name, uint64_t generation, uint64_t index) {
+    CBString k(chunks_prefix(name, generation));
+    k += uint64_to_cbstring_be(index);
+    return k;
+}
+
+bool BlobStore::read_header(PersistentDict::abstract_iterator& it, const CBString& name, header& h) {
+    it.set_position(make_mdb_val(header_key(name)));
+    if (it.has_reached_end()) {
+        return false;
+    }
+    MDB_val v = it.get_value_buffer();
+    if (v.mv_size != 24) {
+        BOOST_THROW_EXCEPTION(mdb_currupted() << lmdb_error::what("invalid blob header"));
+    }
+    MDB_val field = v;
+    field.mv_size = 8;
+    h.generation = cbstring_be_to_uint64(field);
+    field.mv_data = (char*) v.mv_data + 8;
+    h.size = cbstring_be_to_uint64(field);
+    field.mv_data = (char*) v.mv_data + 16;
+    h.chunk_size = cbstring_be_to_uint64(field);
+    return true;
+}
+
+void BlobStore::delete_chunks(PersistentDict::iterator& it, const CBString& prefix) {
+    MDB_val p = make_mdb_val(prefix);
+    for (it.set_range(p); !it.has_reached_end() && has_prefix(it.get_key_buffer(), prefix); it.set_range(p)) {
+        it.del();
+    }
+}
+
+uint64_t BlobStore::new_generation() {
+    PersistentDict::iterator it(the_dict, generation_key, false);
+    uint64_t generation = 1;
+    if (!it.has_reached_end()) {
+        generation = cbstring_be_to_uint64(it.get_value_buffer()) + 1;
+    }
+    it.set_key_value(generation_key, uint64_to_cbstring_be(generation));
+    return generation;
+}
+
+BlobStore::BlobStore(shared_ptr<PersistentDict> d, size_t chunk_sz, size_t chunks_txn):
+    the_dict(d), chunk_size(chunk_sz), chunks_per_txn(chunks_txn) {
+    if (!the_dict || !*the_dict) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (chunk_size == 0 || chunks_per_txn == 0) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("chunk_size and chunks_per_txn must be positive"));
+    }
+    if (chunk_size > MAX_STRING_SIZE) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("chunk_size is too big"));
+    }
+}
+
+bool BlobStore::exists(const CBString& name) const {
+    return the_dict->contains(header_key(name));
+}
+
+uint64_t BlobStore::size(const CBString& name) const {
+    PersistentDict::const_iterator it(the_dict->cbegin());
+    header h;
+    if (!read_header(it, name, h)) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    return h.size;
+}
+
+bool BlobStore::erase(const CBString& name) {
+    PersistentDict::iterator it(the_dict, 0, false);
+    header h;
+    if (!read_header(it, name, h)) {
+        return false;
+    }
+    it.del(header_key(name));
+    delete_chunks(it, chunks_prefix(name, h.generation));
+    return true;
+}
+
+vector<CBString> BlobStore::names() const {
+    vector<CBString> result;
+    PersistentDict::const_iterator it(the_dict->cbegin());
+    while (!it.has_reached_end()) {
+        MDB_val k = it.get_key_buffer();
+        ssize_t name_len = name_length(k);
+        if (name_len < 0) {
+            // not a blob key
+            ++it;
+            continue;
+        }
+        // the header sorts before the chunks of its blob, which are skipped with one lookup
+        if (name_len > 0 && size_t(name_len) == k.mv_size - 1) {
+            result.push_back(CBString(k.mv_data, (int) name_len));
+        }
+        it.set_range(make_mdb_val(after_name(k, name_len)));
+    }
+    return result;
+}
+
+size_t BlobStore::sweep() {
+    size_t swept = 0;
+    PersistentDict::iterator it(the_dict, 0, false);
+    try {
+        // the generation key is the only key that starts with a NUL byte
+        it.set_range(make_mdb_val(CBString('\1')));
+        while (!it.has_reached_end()) {
+            MDB_val k = it.get_key_buffer();
+            ssize_t name_len = name_length(k);
+            if (name_len < 0) {
+                ++it;
+                continue;
+            }
+            CBString name((const char*) k.mv_data, (int) name_len);
+            CBString next(after_name(k, name_len));
+            header h;
+            bool has_header = read_header(it, name, h);
+            CBString prefix(header_key(name));
+            it.set_range(make_mdb_val(prefix));
+            while (!it.has_reached_end() && has_prefix(it.get_key_buffer(), prefix)) {
+                k = it.get_key_buffer();
+                if (k.mv_size != (size_t) prefix.length() + 16) {
+                    // the header, or a key that is not a chunk
+                    ++it;
+                    continue;
+                }
+                MDB_val g;
+                g.mv_data = (char*) k.mv_data + prefix.length();
+                g.mv_size = 8;
+                uint64_t generation = cbstring_be_to_uint64(g);
+                bool live;
+                {
+                    boost::lock_guard<boost::mutex> guard(live_writers_mutex);
+                    live = live_writers.count(to_std_string(writer_id(*the_dict, generation))) > 0;
+                }
+                if ((has_header && generation == h.generation) || live) {
+                    it.set_range(make_mdb_val(chunks_prefix(name, generation + 1)));
+                } else {
+                    // leaves the iterator after the chunks of the generation
+                    delete_chunks(it, chunks_prefix(name, generation));
+                    ++swept;
+                }
+            }
+            it.set_range(make_mdb_val(next));
+        }
+    } catch (...) {
+        it.set_rollback();
+        throw;
+    }
+    if (swept) {
+        _LOG_INFO << "BlobStore: deleted the chunks of " << swept << " uncommitted writers";
+    }
+    return swept;
+}
+
+CBString BlobStore::writer_id(const PersistentDict& d, uint64_t generation) {
+    CBString id(d.get_dirname());
+    id += '\0';
+    id += d.get_dbname();
+    id += '\0';
+    id += uint64_to_cbstring_be(generation);
+    return id;
+}
+
+void BlobStore::register_writer(const CBString& id) {
+    boost::lock_guard<boost::mutex> guard(live_writers_mutex);
+    live_writers.insert(to_std_string(id));
+}
+
+void BlobStore::unregister_writer(const CBString& id) BOOST_NOEXCEPT_OR_NOTHROW {
+    boost::lock_guard<boost::mutex> guard(live_writers_mutex);
+    live_writers.erase(to_std_string(id));
+}
+
+BlobStore::writer_ptr BlobStore::open_writer(const CBString& name) {
+    check_name(name);
+    return writer_ptr(new Writer(the_dict, name, new_generation(), chunk_size, chunks_per_txn));
+}
+
+BlobStore::reader_ptr BlobStore::open_reader(const CBString& name) const {
+    return reader_ptr(new Reader(the_dict, name));
+}
+
+BlobStore::Writer::~Writer() {
+    if (!closed) {
+        try {
+            abort();
+        } catch (...) {
+            _LOG_WARNING << "BlobStore: failed to discard the chunks of an uncommitted writer";
+        }
+    }
+}
+
+void BlobStore::Writer::write_pending(PersistentDict::iterator& it) {
+    for (vector<CBString>::const_iterator chunk(pending.begin()); chunk != pending.end(); ++chunk) {
+        it.set_key_value(chunk_key(name, generation, next_index), *chunk);
+        ++next_index;
+    }
+    pending.clear();
+}
+
+void BlobStore::Writer::flush_pending() {
+    PersistentDict::iterator it(the_dict, 0, false);
+    try {
+        write_pending(it);
+    } catch (...) {
+        it.set_rollback();
+        throw;
+    }
+}
+
+void BlobStore::Writer::write(const void* data, size_t n) {
+    if (closed) {
+        BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("BlobStore::Writer: the writer is closed"));
+    }
+    const char* p = (const char*) data;
+    while (n > 0) {
+        size_t l = std::min(n, chunk_size - (size_t) current.length());
+        current += CBString(p, (int) l);
+        p += l;
+        n -= l;
+        total += l;
+        if ((size_t) current.length() == chunk_size) {
+            pending.push_back(current);
+            current = CBString();
+            if (pending.size() >= chunks_per_txn) {
+                flush_pending();
+            }
+        }
+    }
+}
+
+void BlobStore::Writer::commit() {
+    if (closed) {
+        BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("BlobStore::Writer: the writer is closed"));
+    }
+    if (current.length()) {
+        pending.push_back(current);
+        current = CBString();
+    }
+    // the last chunks, the new header and the removal of the previous content are commited together
+    PersistentDict::iterator it(the_dict, 0, false);
+    try {
+        write_pending(it);
+        header old;
+        bool replacing = read_header(it, name, old);
+        CBString h(uint64_to_cbstring_be(generation));
+        h += uint64_to_cbstring_be(total);
+        h += uint64_to_cbstring_be(chunk_size);
+        it.set_key_value(header_key(name), h);
+        if (replacing && old.generation != generation) {
+            delete_chunks(it, chunks_prefix(name, old.generation));
+        }
+    } catch (...) {
+        it.set_rollback();
+        throw;
+    }
+    closed = true;
+    BlobStore::unregister_writer(id);
+}
+
+void BlobStore::Writer::abort() {
+    if (closed) {
+        return;
+    }
+    closed = true;
+    // from now on, sweep may delete the chunks too
+    BlobStore::unregister_writer(id);
+    pending.clear();
+    current = CBString();
+    if (next_index > 0) {
+        PersistentDict::iterator it(the_dict, 0, false);
+        delete_chunks(it, chunks_prefix(name, generation));
+    }
+}
+
+BlobStore::Reader::Reader(shared_ptr<const PersistentDict> d, const CBString& n):
+    it(d, 0), name(n), h(), position(0), current_index(0), current_chunk(make_mdb_val()), has_current(false) {
+    if (!read_header(it, name, h)) {
+        BOOST_THROW_EXCEPTION(mdb_notfound() << lmdb_error::what("no such blob"));
+    }
+}
+
+MDB_val BlobStore::Reader::chunk(uint64_t index) {
+    if (has_current && current_index == index) {
+        return current_chunk;
+    }
+    it.set_position(make_mdb_val(chunk_key(name, h.generation, index)));
+    if (it.has_reached_end()) {
+        BOOST_THROW_EXCEPTION(mdb_currupted() << lmdb_error::what("missing blob chunk"));
+    }
+    current_chunk = it.get_value_buffer();
+    current_index = index;
+    has_current = true;
+    return current_chunk;
+}
+
+uint64_t BlobStore::Reader::seek(int64_t offset, int whence) {
+    int64_t base = 0;
+    if (whence == SEEK_CUR) {
+        base = (int64_t) position;
+    } else if (whence == SEEK_END) {
+        base = (int64_t) h.size;
+    } else if (whence != SEEK_SET) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("invalid whence"));
+    }
+    if (base + offset < 0) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("negative seek position"));
+    }
+    position = (uint64_t) (base + offset);
+    return position;
+}
+
+size_t BlobStore::Reader::pread(void* dst, size_t n, uint64_t offset) {
+    if (offset >= h.size) {
+        return 0;
+    }
+    n = (size_t) std::min((uint64_t) n, h.size - offset);
+    char* out = (char*) dst;
+    size_t copied = 0;
+    while (copied < n) {
+        MDB_val c = chunk(offset / h.chunk_size);
+        size_t in_chunk = (size_t) (offset % h.chunk_size);
+        if (in_chunk >= c.mv_size) {
+            BOOST_THROW_EXCEPTION(mdb_currupted() << lmdb_error::what("truncated blob chunk"));
+        }
+        size_t l = std::min(n - copied, c.mv_size - in_chunk);
+        memcpy(out + copied, (const char*) c.mv_data + in_chunk, l);
+        copied += l;
+        offset += l;
+    }
+    return copied;
+}
+
+size_t BlobStore::Reader::readinto(void* dst, size_t n) {
+    size_t copied = pread(dst, n, position);
+    position += copied;
+    return copied;
+}
+
+CBString BlobStore::Reader::read_range(uint64_t offset, size_t n) {
+    if (offset >= h.size) {
+        return CBString();
+    }
+    n = (size_t) std::min((uint64_t) n, h.size - offset);
+    if (n > MAX_STRING_SIZE) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("BlobStore::Reader: the read is too big for a string, use readinto"));
+    }
+    vector<char> buf(n);
+    size_t copied = n ? pread(&buf[0], n, offset) : 0;
+    return CBString(n ? &buf[0] : "", (int) copied);
+}
+
+CBString BlobStore::Reader::read(ssize_t n) {
+    if (position >= h.size) {
+        return CBString();
+    }
+    uint64_t remaining = h.size - position;
+    if (n < 0 || (uint64_t) n > remaining) {
+        n = (ssize_t) remaining;
+    }
+    CBString result(read_range(position, (size_t) n));
+    position += result.length();
+    return result;
+}
+
+}   // END NS quiet
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vector>
+#include <climits>
+#include <boost/shared_ptr.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+#include "lmdb.h"
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "../utils/utils.h"
+#include "persistentdict.h"
+
+namespace quiet {
+
+using std::vector;
+using boost::shared_ptr;
+using Bstrlib::CBString;
+
+// Stores large values ("blobs") in a PersistentDict as fixed-size chunks, so that they can be written and read in a
+// streaming way, without ever holding the whole value in memory.
+//
+// Keys layout (blob names must not be empty nor contain NUL bytes):
+//     \0 generation                        -> last allocated generation
+//     name \0                              -> header: generation, size, chunk size
+//     name \0 generation chunk_index       -> chunk data
+// (all numbers are 8 bytes big-endian)
+//
+// A writer stores its chunks under a new generation, and publishes the header when it is committed: readers see either
+// the old or the new content of a blob, never a mix of both. The chunks of a writer that died before its commit
+// belong to a generation that no header refers to: sweep deletes them.
+class BlobStore: private boost::noncopyable {
+public:
+    // 16 overflow pages of 4096 bytes, page header included: no space is lost in the last page of a chunk
+    static const size_t DEFAULT_CHUNK_SIZE = 65520;
+    // the writer memory is bounded by chunk_size * chunks_per_txn
+    static const size_t DEFAULT_CHUNKS_PER_TXN = 16;
+    // the length of a CBString is an int: bounds the chunk size, and the reads that return a string
+    static const size_t MAX_STRING_SIZE = INT_MAX - 1;
+
+    struct header {
+        uint64_t generation;
+        uint64_t size;
+        uint64_t chunk_size;
+    };
+
+    class Writer;
+    class Reader;
+    typedef shared_ptr<Writer> writer_ptr;
+    typedef shared_ptr<Reader> reader_ptr;
+
+private:
+    shared_ptr<PersistentDict> the_dict;
+    const size_t chunk_size;
+    const size_t chunks_per_txn;
+
+    static CBString header_key(const CBString& name);                                  // can throw
+    static CBString chunks_prefix(const CBString& name, uint64_t generation);          // can throw
+    static CBString chunk_key(const CBString& name, uint64_t generation, uint64_t index);  // can throw
+    static bool read_header(PersistentDict::abstract_iterator& it, const CBString& name, header& h);   // can throw
+    static void delete_chunks(PersistentDict::iterator& it, const CBString& prefix);   // can throw
+    uint64_t new_generation();                                                          // can throw
+    // the writers of this process that are not committed yet, so that sweep leaves their chunks alone
+    static CBString writer_id(const PersistentDict& d, uint64_t generation);           // can throw
+    static void register_writer(const CBString& id);                                   // can throw
+    static void unregister_writer(const CBString& id) BOOST_NOEXCEPT_OR_NOTHROW;
+
+public:
+    BlobStore(shared_ptr<PersistentDict> d, size_t chunk_sz=DEFAULT_CHUNK_SIZE, size_t chunks_txn=DEFAULT_CHUNKS_PER_TXN);
+
+    size_t get_chunk_size() const BOOST_NOEXCEPT_OR_NOTHROW { return chunk_size; }
+
+    bool exists(const CBString& name) const;            // can throw
+    uint64_t size(const CBString& name) const;          // can throw
+    bool erase(const CBString& name);                   // can throw
+    vector<CBString> names() const;                     // can throw
+    // deletes, in one transaction, the chunks of the generations that no header refers to. returns the number of
+    // deleted generations. the uncommitted writers of this process are skipped, not the ones of other processes:
+    // don't sweep while another process writes blobs
+    size_t sweep();                                     // can throw
+
+    writer_ptr open_writer(const CBString& name);       // can throw
+    reader_ptr open_reader(const CBString& name) const; // can throw
+
+    // Streaming writer: the content becomes visible when 'commit' is called. A writer that is destroyed before
+    // 'commit' discards what was written.
+    class Writer: private boost::noncopyable {
+    friend class BlobStore;
+    private:
+        shared_ptr<PersistentDict> the_dict;
+        const CBString name;
+        const uint64_t generation;
+        const size_t chunk_size;
+        const size_t chunks_per_txn;
+        vector<CBString> pending;       // full chunks, not written to LMDB yet
+        CBString current;               // the chunk being filled
+        uint64_t next_index;            // index of the first pending chunk
+        uint64_t total;
+        bool closed;
+        const CBString id;              // registered until the writer is closed
+
+        Writer(shared_ptr<PersistentDict> d, const CBString& n, uint64_t gen, size_t chunk_sz, size_t chunks_txn):
+            the_dict(d), name(n), generation(gen), chunk_size(chunk_sz), chunks_per_txn(chunks_txn),
+            pending(), current(), next_index(0), total(0), closed(false), id(writer_id(*d, gen)) {
+            register_writer(id);
+        }
+
+        void write_pending(PersistentDict::iterator& it);       // can throw
+        void flush_pending();                                   // can throw
+
+    public:
+        ~Writer();
+
+        void write(const void* data, size_t n);                 // can throw
+        void write(const CBString& data) { write(data.data, data.length()); }
+        uint64_t tell() const BOOST_NOEXCEPT_OR_NOTHROW { return total; }
+        bool is_closed() const BOOST_NOEXCEPT_OR_NOTHROW { return closed; }
+        void commit();                                          // can throw
+        void abort();                                           // can throw
+
+    };  // END CLASS Writer
+
+    // Seekable reader. It holds a LMDB read transaction, hence a consistent snapshot of the blob, until it is destroyed.
+    class Reader: private boost::noncopyable {
+    friend class BlobStore;
+    private:
+        PersistentDict::const_iterator it;
+        const CBString name;
+        header h;
+        uint64_t position;
+        uint64_t current_index;
+        MDB_val current_chunk;          // valid as long as the read transaction is alive
+        bool has_current;
+
+        Reader(shared_ptr<const PersistentDict> d, const CBString& n);  // can throw
+        MDB_val chunk(uint64_t index);                                  // can throw
+
+    public:
+        uint64_t get_size() const BOOST_NOEXCEPT_OR_NOTHROW { return h.size; }
+        uint64_t tell() const BOOST_NOEXCEPT_OR_NOTHROW { return position; }
+        uint64_t seek(int64_t offset, int whence=SEEK_SET);             // can throw
+        // copies at most n bytes at 'offset' into dst, without moving the position; returns the number of copied bytes
+        size_t pread(void* dst, size_t n, uint64_t offset);             // can throw
+        size_t readinto(void* dst, size_t n);                           // can throw
+        // read and read_range throw if they would return more than MAX_STRING_SIZE bytes: use readinto for those
+        CBString read(ssize_t n=-1);                                    // can throw
+        CBString read_range(uint64_t offset, size_t n);                 // can throw
+
+    };  // END CLASS Reader
+
+};  // END CLASS BlobStore
+
+}   // END NS quiet
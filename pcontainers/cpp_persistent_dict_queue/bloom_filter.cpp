@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include "../logging/logging.h"
+#include "bloom_filter.h"
+
+
+namespace quiet {
+
+using boost::lock_guard;
+using namespace utils;
+
+static const char SIDECAR_MAGIC[8] = {'P', 'C', 'B', 'L', 'O', 'O', 'M', '1'};
+static const size_t BUILD_BATCH = 1024;
+
+BloomFilter::bits::bits(size_t nkeys): words(), nblocks(0), capacity(std::max(nkeys, MIN_KEYS)) {
+    nblocks = (capacity * BITS_PER_KEY + 511) / 512;
+    words.assign(nblocks * 8, 0);
+}
+
+void BloomFilter::bits::add(uint64_t h) {
+    uint64_t* block = &words[((h >> 32) % nblocks) * 8];
+    // the block is chosen by the high half of the hash, the K probes take 9 bits each of a remix of the hash
+    uint64_t probes = (h * 0x9E3779B97F4A7C15ULL) ^ (h >> 29);
+    for (unsigned int i = 0; i < K; ++i) {
+        unsigned int bit = (unsigned int) (probes >> (i * 9)) & 511;
+        block[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+    }
+}
+
+bool BloomFilter::bits::test(uint64_t h) const {
+    const uint64_t* block = &words[((h >> 32) % nblocks) * 8];
+    uint64_t probes = (h * 0x9E3779B97F4A7C15ULL) ^ (h >> 29);
+    for (unsigned int i = 0; i < K; ++i) {
+        unsigned int bit = (unsigned int) (probes >> (i * 9)) & 511;
+        if (!(block[bit >> 6] & ((uint64_t) 1 << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t BloomFilter::hash(MDB_val key) BOOST_NOEXCEPT_OR_NOTHROW {
+    return fnv1a(key.mv_data, key.mv_size);
+}
+
+BloomFilter::BloomFilter(shared_ptr<environment> e, MDB_dbi d, bool w, const CBString& sidecar_path):
+        env(e), dbi(d), writable(w), sidecar(sidecar_path), lock(), current(), building(), ready(false), validated(0),
+        local_commits(), in_flight(), built_keys(0), inserts(0), deletes(0), counters(),
+        builder(), build_requested(false), stopping(false) { }
+
+shared_ptr<BloomFilter> BloomFilter::factory(shared_ptr<environment> e, MDB_dbi d, bool writable, const CBString& sidecar_path) {
+    shared_ptr<BloomFilter> filter(new BloomFilter(e, d, writable, sidecar_path));
+    if (!filter->load()) {
+        lock_guard<mutex> guard(filter->lock);
+        filter->request_build();
+    }
+    return filter;
+}
+
+BloomFilter::~BloomFilter() {
+    stopping.store(true);
+    if (builder.joinable()) {
+        if (builder.get_id() == boost::this_thread::get_id()) {
+            builder.detach();
+        } else {
+            builder.join();
+        }
+    }
+}
+
+void BloomFilter::request_build() {
+    // called with the lock held
+    if (stopping.load() || build_requested.exchange(true)) {
+        return;
+    }
+    if (builder.joinable()) {
+        // the previous build is over (build_requested was cleared at its very end)
+        builder.join();
+    }
+    builder = boost::thread(boost::bind(&BloomFilter::build, shared_from_this()));
+}
+
+void BloomFilter::build() {
+    try {
+        environment::transaction_ptr txn;
+        size_t snapshot;
+        size_t nkeys;
+        {
+            // with the write lock held, no local write transaction is in progress when the snapshot is taken: the
+            // local writes that come after go to the new filter too
+            environment::transaction_ptr write_txn;
+            if (writable) {
+                write_txn = env->start_transaction(false);
+            }
+            txn = env->start_transaction();
+            snapshot = txn->id();
+            nkeys = txn->size(dbi);
+            lock_guard<mutex> guard(lock);
+            // room to grow before the filter is too loose
+            building.reset(new bits(nkeys * 2));
+            inserts = 0;
+            deletes = 0;
+        }
+        environment::cursor_ptr cursor(txn->make_cursor(dbi));
+        vector<uint64_t> batch;
+        batch.reserve(BUILD_BATCH);
+        MDB_val k = make_mdb_val();
+        for (int res = cursor->first(); ; res = cursor->next()) {
+            if (res == 0) {
+                cursor->get_current_key(k);
+                batch.push_back(hash(k));
+            }
+            if (batch.size() == BUILD_BATCH || (res != 0 && !batch.empty())) {
+                if (stopping.load()) {
+                    break;
+                }
+                lock_guard<mutex> guard(lock);
+                for (vector<uint64_t>::const_iterator h(batch.begin()); h != batch.end(); ++h) {
+                    building->add(*h);
+                }
+                batch.clear();
+            }
+            if (res != 0) {
+                break;
+            }
+        }
+        lock_guard<mutex> guard(lock);
+        if (!stopping.load()) {
+            current.swap(building);
+            validated = snapshot;
+            built_keys = nkeys;
+            ready = true;
+            ++counters.rebuilds;
+            advance();
+        }
+        building.reset();
+    } catch (...) {
+        _LOG_WARNING << "BloomFilter: the build has failed";
+        lock_guard<mutex> guard(lock);
+        building.reset();
+    }
+    build_requested.store(false);
+}
+
+void BloomFilter::advance() {
+    // called with the lock held
+    local_commits.erase(local_commits.begin(), local_commits.upper_bound(validated));
+    while (!local_commits.empty() && *local_commits.begin() == validated + 1) {
+        validated = *local_commits.begin();
+        local_commits.erase(local_commits.begin());
+    }
+}
+
+bool BloomFilter::too_loose() const {
+    // called with the lock held
+    return built_keys + inserts > current->capacity || deletes > std::max(MIN_KEYS, built_keys / 4);
+}
+
+void BloomFilter::track(environment::transaction& txn) {
+    // called with the lock held
+    if (in_flight.insert(txn.id()).second) {
+        txn.on_end(boost::bind(&BloomFilter::transaction_end, shared_from_this(), _1, _2));
+    }
+}
+
+void BloomFilter::transaction_end(size_t txnid, bool commited) {
+    lock_guard<mutex> guard(lock);
+    in_flight.erase(txnid);
+    if (commited) {
+        local_commits.insert(txnid);
+        advance();
+        if (ready && too_loose()) {
+            request_build();
+        }
+    }
+}
+
+bool BloomFilter::may_contain(MDB_val key, size_t last_txnid) {
+    uint64_t h = hash(key);
+    lock_guard<mutex> guard(lock);
+    ++counters.checks;
+    if (!ready || last_txnid > validated) {
+        ++counters.unknown;
+        // no local transaction explains the new commit: it comes from someone else
+        if (ready && in_flight.empty()) {
+            request_build();
+        }
+        return true;
+    }
+    if (!current->test(h)) {
+        ++counters.negatives;
+        return false;
+    }
+    return true;
+}
+
+void BloomFilter::added(environment::transaction& txn, MDB_val key) {
+    uint64_t h = hash(key);
+    lock_guard<mutex> guard(lock);
+    track(txn);
+    if (current) {
+        current->add(h);
+    }
+    if (building) {
+        building->add(h);
+    }
+    ++inserts;
+}
+
+void BloomFilter::deleted(environment::transaction& txn, size_t n) {
+    lock_guard<mutex> guard(lock);
+    track(txn);
+    deletes += n;
+}
+
+void BloomFilter::cleared(environment::transaction& txn) {
+    lock_guard<mutex> guard(lock);
+    track(txn);
+    // forces a rebuild after the commit
+    deletes = std::max(MIN_KEYS, built_keys + inserts) + 1;
+}
+
+bool BloomFilter::load() {
+    if (!sidecar.length()) {
+        return false;
+    }
+    FILE* f = fopen(sidecar, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    char magic[8];
+    uint64_t header[3];     // validated txnid, number of keys, number of blocks
+    bool ok = fread(magic, 1, 8, f) == 8 && memcmp(magic, SIDECAR_MAGIC, 8) == 0 && fread(header, sizeof(uint64_t), 3, f) == 3;
+    scoped_ptr<bits> loaded;
+    if (ok && header[0] == env->last_txnid()) {
+        loaded.reset(new bits(0));
+        loaded->nblocks = (size_t) header[2];
+        loaded->capacity = loaded->nblocks * 512 / BITS_PER_KEY;
+        loaded->words.assign(loaded->nblocks * 8, 0);
+        ok = loaded->nblocks > 0 && fread(&loaded->words[0], sizeof(uint64_t), loaded->words.size(), f) == loaded->words.size();
+    } else {
+        ok = false;
+    }
+    fclose(f);
+    // the file is only valid for the transaction id it was written at
+    remove(sidecar);
+    if (!ok) {
+        return false;
+    }
+    lock_guard<mutex> guard(lock);
+    current.swap(loaded);
+    validated = (size_t) header[0];
+    built_keys = (size_t) header[1];
+    ready = true;
+    return true;
+}
+
+void BloomFilter::save() {
+    if (!sidecar.length()) {
+        return;
+    }
+    lock_guard<mutex> guard(lock);
+    if (!ready || !in_flight.empty() || validated != env->last_txnid()) {
+        return;
+    }
+    CBString tmp(sidecar);
+    tmp += ".tmp";
+    FILE* f = fopen(tmp, "wb");
+    if (f == NULL) {
+        return;
+    }
+    uint64_t header[3] = {validated, built_keys + inserts, current->nblocks};
+    bool ok = fwrite(SIDECAR_MAGIC, 1, 8, f) == 8 && fwrite(header, sizeof(uint64_t), 3, f) == 3
+        && fwrite(&current->words[0], sizeof(uint64_t), current->words.size(), f) == current->words.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, sidecar) != 0) {
+        remove(tmp);
+    }
+}
+
+void BloomFilter::stop() BOOST_NOEXCEPT_OR_NOTHROW {
+    stopping.store(true);
+    try {
+        if (builder.joinable() && builder.get_id() != boost::this_thread::get_id()) {
+            builder.join();
+        }
+        save();
+    } catch (...) {
+        _LOG_WARNING << "BloomFilter: failed to write the sidecar file";
+    }
+}
+
+bool BloomFilter::is_ready() const {
+    lock_guard<mutex> guard(lock);
+    return ready;
+}
+
+BloomFilter::stats BloomFilter::get_stats() const {
+    lock_guard<mutex> guard(lock);
+    stats result(counters);
+    result.bits = current ? current->words.size() * 64 : 0;
+    result.keys = built_keys + inserts;
+    result.ready = ready;
+    return result;
+}
+
+}   // END NS quiet
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+#include "lmdb.h"
+#include "../lmdb_environment/lmdb_environment.h"
+#include "../utils/utils.h"
+
+namespace quiet {
+
+using std::vector;
+using std::set;
+using boost::shared_ptr;
+using boost::scoped_ptr;
+using boost::enable_shared_from_this;
+using boost::mutex;
+using Bstrlib::CBString;
+using lmdb::environment;
+
+// A blocked Bloom filter over the keys of a database, to answer negative lookups without opening a transaction.
+//
+// The filter is built by a background scan of a snapshot (or loaded from a sidecar file written when the dict was
+// closed, if nothing was commited since then). Like ReadCache, it is valid as of one transaction id: the keys written
+// by the dict itself are added when they are written, and their commit moves the filter forward. A commit by anyone
+// else makes the filter unusable (every lookup is a 'maybe') until a background rebuild completes. The filter is also
+// rebuilt when the deletes or the inserts since the last build make it too loose.
+class BloomFilter: public enable_shared_from_this<BloomFilter>, private boost::noncopyable {
+public:
+    static const size_t BITS_PER_KEY = 10;          // ~1% false positives with K = 7
+    static const unsigned int K = 7;
+    static const size_t MIN_KEYS = 1024;
+
+    struct stats {
+        uint64_t checks;
+        uint64_t negatives;             // lookups answered "absent" without LMDB
+        uint64_t unknown;               // lookups while the filter was not usable
+        uint64_t rebuilds;
+        size_t bits;
+        size_t keys;                    // keys at the last build, plus the inserts since then
+        bool ready;
+    };
+
+private:
+    // 512-bit blocks: the K probes of a key hit a single cache line
+    struct bits {
+        vector<uint64_t> words;
+        size_t nblocks;
+        size_t capacity;                // number of keys the filter was sized for
+        explicit bits(size_t nkeys);
+        void add(uint64_t h);
+        bool test(uint64_t h) const;
+    };
+
+    shared_ptr<environment> env;
+    const MDB_dbi dbi;
+    const bool writable;
+    const CBString sidecar;             // empty: no sidecar file
+
+    mutable mutex lock;
+    scoped_ptr<bits> current;
+    scoped_ptr<bits> building;
+    bool ready;
+    size_t validated;
+    set<size_t> local_commits;          // commited local transactions, beyond 'validated'
+    set<size_t> in_flight;              // local write transactions not finished yet
+    size_t built_keys;
+    size_t inserts;
+    size_t deletes;
+    mutable stats counters;
+
+    boost::thread builder;
+    boost::atomic_bool build_requested;
+    boost::atomic_bool stopping;
+
+    BloomFilter(shared_ptr<environment> e, MDB_dbi d, bool w, const CBString& sidecar_path);
+
+    static uint64_t hash(MDB_val key) BOOST_NOEXCEPT_OR_NOTHROW;
+    void track(environment::transaction& txn);
+    void transaction_end(size_t txnid, bool commited);
+    void advance();
+    void request_build();
+    void build();
+    bool load();
+    void save();
+    bool too_loose() const;
+
+public:
+    // writable: false if the environment is read-only
+    static shared_ptr<BloomFilter> factory(shared_ptr<environment> e, MDB_dbi d, bool writable,
+                                           const CBString& sidecar_path=CBString());      // can throw
+    ~BloomFilter();
+
+    // false: the key is certainly absent. last_txnid is the last commited transaction id of the environment.
+    bool may_contain(MDB_val key, size_t last_txnid);
+    // the write transaction inserts a key, or deletes n keys
+    void added(environment::transaction& txn, MDB_val key);
+    void deleted(environment::transaction& txn, size_t n=1);
+    void cleared(environment::transaction& txn);
+    // stops the background build, and writes the sidecar file if the filter is up to date
+    void stop() BOOST_NOEXCEPT_OR_NOTHROW;
+
+    bool is_ready() const;
+    stats get_stats() const;
+
+};  // END CLASS BloomFilter
+
+}   // END NS quiet
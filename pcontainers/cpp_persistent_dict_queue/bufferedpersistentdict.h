@@ -1,7 +1,10 @@
 #pragma once
 
 #include <map>
+#include <algorithm>
+#include <stdexcept>
 #include <set>
+#include <vector>
 #include <utility>
 
 #include <boost/chrono/chrono.hpp>
@@ -28,12 +31,16 @@
 
 #include "../logging/logging.h"
 #include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "../utils/merge_operators.h"
 #include "persistentdict.h"
+#include "reader_pool.h"
 
 namespace quiet {
 
 using std::map;
+using std::multimap;
 using std::set;
+using std::vector;
 using std::pair;
 using std::make_pair;
 
@@ -61,8 +68,10 @@ using boost::make_shared;
 using boost::scoped_ptr;
 using boost::atomic_bool;
 using boost::chrono::milliseconds;
+using boost::chrono::steady_clock;
 
 using Bstrlib::CBString;
+using utils::merge_operator;
 
 typedef shared_future<CBString> s_future;
 typedef future<CBString> _future;
@@ -78,14 +87,37 @@ public:
     typedef promise < bool > MyPromise;
     typedef shared_ptr < MyPromise > PromisePtr;
 
+    struct read_stats {
+        uint64_t submitted;             // reads sent to the reader threads
+        uint64_t coalesced;             // async_at calls that joined an in-flight read of the same key
+        uint64_t expired;               // reads dropped because their deadline had passed
+        uint64_t cancelled;             // reads dropped because every caller withdrew
+        uint64_t steals;                // reads run by another thread than the one they were queued for
+        size_t reader_threads;
+    };
+
 private:
 
-    mutable deque < TaskPtr > reads_queue;
+    // a pending async read, shared by every async_at call that was coalesced with it
+    struct read_request {
+        uint64_t id;                    // handed to the callers, so that each of them can withdraw from this very read
+        CBString key;
+        shared_ptr<DictIterator> it;    // positioned on the key, in the snapshot taken when the read was submitted
+        promise<CBString> prom;
+        MySharedFuture result;
+        bool has_deadline;
+        steady_clock::time_point deadline;
+        size_t waiters;                 // guarded by reads_mutex
+        bool started;                   // guarded by reads_mutex
+        read_request(): id(0), key(), it(), prom(), result(), has_deadline(false), deadline(), waiters(1), started(false) { }
+    };
+    typedef shared_ptr < read_request > ReadRequestPtr;
+
     mutable shared_mutex buffers_mutex;
     mutable shared_mutex current_buffers_mutex;
     mutable mutex flush_mutex;
     mutable mutex flush_stopping_mutex;
-    mutable mutex queue_mutex;
+    mutable mutex reads_mutex;
 
     shared_ptr<PersistentDict> the_dict;
 
@@ -93,17 +125,32 @@ private:
     mutable map < CBString, pair < CBString, PromisePtr > > current_inserts;
     mutable map < CBString, PromisePtr > current_deletes;
     mutable map < CBString, PromisePtr > buffered_deletes;
+    // pending merge operands, already folded together
+    mutable map < CBString, pair < CBString, PromisePtr > > buffered_merges;
+    mutable map < CBString, pair < CBString, PromisePtr > > current_merges;
+    // promises of the merges that were folded into another pending operation, by key: resolved with the same flush
+    mutable multimap < CBString, PromisePtr > buffered_folded;
+    mutable multimap < CBString, PromisePtr > current_folded;
+
+    const merge_operator merge_op;
+
+    // the reads that were submitted and are not resolved yet. they are forgotten when a flush commits, so that a
+    // later call never joins a read of an older snapshot.
+    mutable map < CBString, ReadRequestPtr > in_flight_reads;
+    // the reads that have not started yet, by id: a flush does not forget them, they can still be cancelled
+    mutable map < uint64_t, ReadRequestPtr > unstarted_reads;
+    mutable uint64_t next_read_id;
+    mutable read_stats read_counters;
 
-    mutable condition_variable queue_not_empty_condition;
     mutable condition_variable flush_stopping_condition;
 
     mutable atomic_bool stopping_flag;
     mutable atomic_bool flush_thread_is_running;
-    mutable atomic_bool reader_thread_is_running;
 
     const milliseconds flushing_interval;
+    const size_t reader_threads;
     mutable scoped_ptr<boost::thread> flush_thread_ptr;
-    mutable scoped_ptr<boost::thread> reader_thread_ptr;
+    mutable scoped_ptr<ReaderPool> readers;
 
     void flush_thread_fun() const {
         flush_thread_is_running.store(true);
@@ -115,42 +162,51 @@ private:
         flush();
     }
 
-    void reader_thread_fun() const {
-        reader_thread_is_running.store(true);
-        TaskPtr task_ptr;
+    // drops the pending read of the key of r if it is r. reads_mutex must be held
+    void forget_read(const ReadRequestPtr& r) const {
+        map < CBString, ReadRequestPtr >::iterator it(in_flight_reads.find(r->key));
+        if (it != in_flight_reads.end() && it->second == r) {
+            in_flight_reads.erase(it);
+        }
+    }
+
+    // runs in a reader thread
+    void run_read(ReadRequestPtr r) const {
+        bool dropped = false;
         {
-            while (!stopping_flag.load()) {
-                unique_lock<mutex> queue_lock(queue_mutex);
-                // queue_lock is locked
-                if (!reads_queue.empty()) {
-                    task_ptr = reads_queue.front();
-                    reads_queue.pop_front();
-                    queue_lock.unlock();
-                    if (task_ptr) {
-                        // execute the (potentially blocking) task
-                        (task_ptr->operator())();
-                    } else {
-                        // the 'stop' method sent us an empty pointer for stopping notification
-                        break;
-                    }
-                } else {
-                    // queue_lock should be locked before 'wait'
-                    queue_not_empty_condition.wait(queue_lock);
-                    // queue_lock is locked after 'wait' returns
-                }
-            // here queue_lock will be destroyed, so the queue_mutex will be released in every case
+            lock_guard<mutex> reads_lock(reads_mutex);
+            r->started = true;
+            unstarted_reads.erase(r->id);
+            if (r->waiters == 0) {
+                // cancel_read has already forgotten it
+                dropped = true;
+            } else if (r->has_deadline && steady_clock::now() > r->deadline) {
+                ++read_counters.expired;
+                forget_read(r);
+                dropped = true;
             }
         }
-        // consume any task that could remain in the queue, so that waiting futures can be resolved
-        {
-            unique_lock<mutex> queue_lock(queue_mutex);
-            while (!reads_queue.empty()) {
-                task_ptr = reads_queue.front();
-                reads_queue.pop_front();
-                if (task_ptr) {
-                    (task_ptr->operator())();
-                }
+        // the promise is resolved without the lock: its continuations may call async_at
+        if (dropped) {
+            r->it.reset();
+            r->prom.set_exception(boost::copy_exception(expired() << lmdb_error::what("the read was dropped before it started")));
+            return;
+        }
+        try {
+            CBString value(r->it->get_value());     // can block
+            r->it.reset();
+            {
+                lock_guard<mutex> reads_lock(reads_mutex);
+                forget_read(r);
+            }
+            r->prom.set_value(value);
+        } catch (...) {
+            r->it.reset();
+            {
+                lock_guard<mutex> reads_lock(reads_mutex);
+                forget_read(r);
             }
+            r->prom.set_exception(boost::current_exception());
         }
     }
 
@@ -159,9 +215,8 @@ private:
         while (!flush_thread_is_running.load()) { }
     }
 
-    void start_reader_thread() const {
-        reader_thread_ptr.reset(new boost::thread(boost::bind(&BufferedPersistentDict::reader_thread_fun, this)));
-        while (!reader_thread_is_running.load()) { }
+    void start_reader_threads() const {
+        readers.reset(new ReaderPool(reader_threads));
     }
 
     void stop_flush_thread() const {
@@ -176,30 +231,21 @@ private:
 
     }
 
-    void stop_reader_thread() const {
-        {
-            unique_lock<mutex> queue_lock(queue_mutex);
-            reads_queue.push_back(shared_ptr < packaged_task < CBString() > >());
-            queue_not_empty_condition.notify_all();
-        }
-
-        if (reader_thread_ptr && reader_thread_ptr->joinable()) {
-            reader_thread_ptr->join();
-            reader_thread_is_running.store(false);
-            reader_thread_ptr.reset();
+    void stop_reader_threads() const {
+        // the reads that are still queued are run, so that waiting futures are resolved
+        if (readers) {
+            readers->stop();
         }
-
-        reader_thread_is_running.store(false);
     }
 
     void start() const {
+        start_reader_threads();
         start_flush_thread();
-        start_reader_thread();
     }
 
     void stop() const {
         stopping_flag.store(true);
-        stop_reader_thread();
+        stop_reader_threads();
         stop_flush_thread();
     }
 
@@ -207,23 +253,23 @@ private:
         _LOG_DEBUG << "BufferedPersistentDict::flush";
         lock_guard<mutex> flush_lock(flush_mutex);
         {
-            /*
-            map < CBString, pair < CBString, PromisePtr > > buffered_inserts;
-            map < CBString, pair < CBString, PromisePtr > > current_inserts;
-            map < CBString, PromisePtr > current_deletes;
-            map < CBString, PromisePtr > buffered_deletes;
-            */
-
             // we lock buffers_lock for a small time to copy the "top" buffers to the "current" buffers
-            // (here 'at', 'insert' and 'erase' are blocked)
+            // (here 'at', 'insert', 'erase' and 'merge' are blocked)
             unique_lock<shared_mutex> buffers_lock(buffers_mutex);
             unique_lock<shared_mutex> current_buffers_lock(current_buffers_mutex);
             current_deletes.swap(buffered_deletes);
             current_inserts.swap(buffered_inserts);
+            current_merges.swap(buffered_merges);
+            current_folded.swap(buffered_folded);
         }
         // every operation is possible at this precise point
         {
             upgrade_lock<shared_mutex> current_buffers_lock(current_buffers_mutex);
+            // taken just before the commit: merges are not idempotent, so a reader must never see both the
+            // committed merge and the current buffers
+            scoped_ptr < upgrade_to_unique_lock<shared_mutex> > commit_lock;
+            // the merges whose stored value the operator rejected: they fail alone, after the commit of the others
+            vector < pair < CBString, boost::exception_ptr > > failed_merges;
             // currents buffers are in read mode: every operation is possible while flushing to LMDB
             // in particular updates can be posted to the "top" buffers
             try {
@@ -237,6 +283,25 @@ private:
                 for(map < CBString, PromisePtr >::iterator it(current_deletes.begin()); it != current_deletes.end(); ++it) {
                     dict_it.del(it->first);
                 }
+                for(map < CBString, pair < CBString, PromisePtr > >::iterator it(current_merges.begin()); it != current_merges.end(); ++it) {
+                    dict_it.set_position(make_mdb_val(it->first));
+                    if (dict_it.has_reached_end()) {
+                        dict_it.set_key_value(it->first, (it->second).first);
+                        continue;
+                    }
+                    CBString stored(dict_it.get_value());
+                    CBString merged;
+                    try {
+                        merged = merge_op(stored, (it->second).first);
+                    } catch (...) {
+                        // e.g. 'add' on a value that is not an integer: the stored value is left as it is
+                        failed_merges.push_back(make_pair(it->first, boost::current_exception()));
+                        continue;
+                    }
+                    dict_it.set_key_value(it->first, merged);
+                }
+                commit_lock.reset(new upgrade_to_unique_lock<shared_mutex>(current_buffers_lock));
+                // dict_it is destroyed here: the LMDB transaction is commited while 'at' is blocked
             } catch (...) {
                 // ohhh, shit happens: some exceptions occured, and the LMDB transaction was rollbacked
                 // let's notify the client
@@ -246,51 +311,136 @@ private:
                 for(map < CBString, PromisePtr >::iterator it(current_deletes.begin()); it != current_deletes.end(); ++it) {
                     (it->second)->set_exception(boost::current_exception());
                 }
+                for(map < CBString, pair < CBString, PromisePtr > >::iterator it(current_merges.begin()); it != current_merges.end(); ++it) {
+                    ((it->second).second)->set_exception(boost::current_exception());
+                }
+                for(multimap < CBString, PromisePtr >::iterator it(current_folded.begin()); it != current_folded.end(); ++it) {
+                    (it->second)->set_exception(boost::current_exception());
+                }
                 // we clear the current buffers anyway: the client will have to try to deal with the exception
                 // and try insert/delete again if needed... strange behaviour is *going to happen* unfortunately, as
                 // previously deleted values is going to come back alive !!!
                 {
-                    upgrade_to_unique_lock<shared_mutex> ulock(current_buffers_lock);
-                    current_deletes.clear();
-                    current_inserts.clear();
+                    if (!commit_lock) {
+                        commit_lock.reset(new upgrade_to_unique_lock<shared_mutex>(current_buffers_lock));
+                    }
+                    clear_current_buffers();
                 }
                 return;
            }
 
-            // end of LMDB transaction: changes were commited. let's confirm it to the client using the promises
+            // end of LMDB transaction: changes were commited. the current buffers are cleared right away, so that
+            // readers now get the values from LMDB
+            fail_merges(failed_merges);
+            clear_current_buffers(true);
+            {
+                lock_guard<mutex> reads_lock(reads_mutex);
+                in_flight_reads.clear();
+            }
+            commit_lock.reset();
+        }
+
+    }
+
+    // current_buffers_mutex must be held in unique mode
+    void clear_current_buffers(bool confirm=false) const {
+        // let's confirm the commit to the client using the promises
+        if (confirm) {
             for(map < CBString, pair < CBString, PromisePtr > >::iterator it(current_inserts.begin()); it != current_inserts.end(); ++it) {
                 ((it->second).second)->set_value(true);
             }
             for(map < CBString, PromisePtr >::iterator it(current_deletes.begin()); it != current_deletes.end(); ++it) {
                 (it->second)->set_value(true);
             }
+            for(map < CBString, pair < CBString, PromisePtr > >::iterator it(current_merges.begin()); it != current_merges.end(); ++it) {
+                ((it->second).second)->set_value(true);
+            }
+            for(multimap < CBString, PromisePtr >::iterator it(current_folded.begin()); it != current_folded.end(); ++it) {
+                (it->second)->set_value(true);
+            }
+        }
+        current_deletes.clear();
+        current_inserts.clear();
+        current_merges.clear();
+        current_folded.clear();
+    }
 
-            {
-                // current buffers are locked for very small time to clear them
-                // here 'at' is blocked
-                upgrade_to_unique_lock<shared_mutex> ulock(current_buffers_lock);
-                current_deletes.clear();
-                current_inserts.clear();
+    // fails the merges of the given keys, and the merges that were folded into them (current_buffers_mutex must be
+    // held in unique mode)
+    void fail_merges(const vector < pair < CBString, boost::exception_ptr > >& failed) const {
+        for (vector < pair < CBString, boost::exception_ptr > >::const_iterator f(failed.begin()); f != failed.end(); ++f) {
+            map < CBString, pair < CBString, PromisePtr > >::iterator it(current_merges.find(f->first));
+            if (it != current_merges.end()) {
+                ((it->second).second)->set_exception(f->second);
+                current_merges.erase(it);
+            }
+            pair < multimap < CBString, PromisePtr >::iterator, multimap < CBString, PromisePtr >::iterator >
+                folded(current_folded.equal_range(f->first));
+            for (multimap < CBString, PromisePtr >::iterator it(folded.first); it != folded.second; ++it) {
+                (it->second)->set_exception(f->second);
             }
+            current_folded.erase(folded.first, folded.second);
         }
+    }
 
+    // applies a pending merge operand on top of a value (that may be missing)
+    void apply_merge(const map < CBString, pair < CBString, PromisePtr > >& merges, const CBString& key, bool& found, CBString& value) const {
+        map < CBString, pair < CBString, PromisePtr > >::const_iterator it(merges.find(key));
+        if (it == merges.end()) {
+            return;
+        }
+        value = found ? merge_op(value, (it->second).first) : (it->second).first;
+        found = true;
     }
 
-    CBString read_value(shared_ptr<DictIterator> it_ptr) const {
-        return it_ptr->get_value();
+    // the value of 'key' as readers must see it: the top buffers, then the current buffers, then LMDB
+    // both buffers mutexes must be held
+    bool lookup(const CBString& key, const DictConstIterator& it, CBString& value) const {
+        if (buffered_deletes.count(key)) {
+            return false;
+        }
+        if (buffered_inserts.count(key)) {
+            value = buffered_inserts[key].first;
+            return true;
+        }
+        bool found = false;
+        if (current_deletes.count(key)) {
+            found = false;
+        } else if (current_inserts.count(key)) {
+            value = current_inserts[key].first;
+            found = true;
+        } else {
+            found = !it.has_reached_end();
+            if (found) {
+                value = it.get_value();     // can block
+            }
+            apply_merge(current_merges, key, found, value);
+        }
+        apply_merge(buffered_merges, key, found, value);
+        return found;
     }
 
 public:
-    BufferedPersistentDict(shared_ptr<PersistentDict> d, uint64_t flush_interval):
+    // nb_reader_threads: the number of threads that run the async_at reads
+    BufferedPersistentDict(shared_ptr<PersistentDict> d, uint64_t flush_interval, merge_operator op=merge_operator(),
+                           size_t nb_reader_threads=1):
         the_dict(d),
+        merge_op(op),
+        in_flight_reads(),
+        unstarted_reads(),
+        next_read_id(1),
+        read_counters(),
         stopping_flag(false),
         flush_thread_is_running(false),
-        reader_thread_is_running(false),
-        flushing_interval(flush_interval)
+        flushing_interval(flush_interval),
+        reader_threads(nb_reader_threads)
     {
         if (!the_dict || !*the_dict) {
             BOOST_THROW_EXCEPTION ( not_initialized() );
         }
+        if (reader_threads == 0) {
+            BOOST_THROW_EXCEPTION( std::invalid_argument("the number of reader threads must be positive") );
+        }
 
         start();
     }
@@ -316,44 +466,44 @@ public:
         shared_lock<shared_mutex> buffers_lock(buffers_mutex);
         shared_lock<shared_mutex> current_buffers_lock(current_buffers_mutex);
         DictConstIterator it(the_dict->cfind(key));
-
-        if (buffered_deletes.count(key)) {
+        CBString value;
+        if (!lookup(key, it, value)) {    // can block
             BOOST_THROW_EXCEPTION( mdb_notfound() );
         }
+        return value;
+    }
 
-        if (buffered_inserts.count(key)) {
-            return buffered_inserts[key].first;
-        }
-
-        if (current_deletes.count(key)) {
-            BOOST_THROW_EXCEPTION(mdb_notfound());
-        }
-
-        if (current_inserts.count(key)) {
-            return current_inserts[key].first;
-        }
-
-        return it.get_value();  // can block
+    MySharedFuture async_at(MDB_val key, uint64_t timeout=0) const {
+        uint64_t read_id;
+        return async_at(key, timeout, read_id);
     }
 
-    MySharedFuture async_at(MDB_val key) const {
+    MySharedFuture async_at(MDB_val key, uint64_t timeout, uint64_t& read_id) const {
         if (stopping_flag.load()) {
             BOOST_THROW_EXCEPTION( stopping_ops() );
         }
-        return async_at(CBString(key.mv_data, key.mv_size));
+        return async_at(CBString(key.mv_data, key.mv_size), timeout, read_id);
     }
 
-    MySharedFuture async_at(const CBString& key) const {
+    MySharedFuture async_at(const CBString& key, uint64_t timeout=0) const {
+        uint64_t read_id;
+        return async_at(key, timeout, read_id);
+    }
+
+    // reads key in a reader thread. timeout (ms, 0 for none): the read is dropped, and the future fails with
+    // 'expired', if it has not started by then. a read of the same key that is already in flight is shared.
+    // read_id: set to the id to give to cancel_read, or to 0 if the future is already resolved.
+    MySharedFuture async_at(const CBString& key, uint64_t timeout, uint64_t& read_id) const {
+        read_id = 0;
         if (stopping_flag.load()) {
             BOOST_THROW_EXCEPTION( stopping_ops() );
         }
-        if (!reader_thread_is_running.load()) {
+        if (!readers) {
             BOOST_THROW_EXCEPTION(not_initialized());
         }
 
         shared_lock<shared_mutex> buffers_lock(buffers_mutex);
         shared_lock<shared_mutex> current_buffers_lock(current_buffers_mutex);
-        shared_ptr<DictIterator> it_ptr = make_shared<DictIterator>(the_dict, key, true);
 
         if (buffered_deletes.count(key)) {
             return make_ready_future<CBString>(boost::copy_exception(mdb_notfound())).share();
@@ -371,17 +521,78 @@ public:
             return make_ready_future(CBString(current_inserts[key].first)).share();
         }
 
-        TaskPtr task_ptr = make_shared < MyPackagedTask > (
-            boost::bind( &BufferedPersistentDict::read_value, this, it_ptr )
-        );
+        if (buffered_merges.count(key) || current_merges.count(key)) {
+            // the merged value depends on the LMDB value: resolve it right now
+            CBString value;
+            try {
+                if (lookup(key, the_dict->cfind(key), value)) {
+                    return make_ready_future(value).share();
+                }
+                return make_ready_future<CBString>(boost::copy_exception(mdb_notfound())).share();
+            } catch (...) {
+                return make_ready_future<CBString>(boost::current_exception()).share();
+            }
+        }
 
-        {
-            unique_lock<mutex> queue_lock(queue_mutex);
-            reads_queue.push_back(task_ptr);
-            queue_not_empty_condition.notify_one();
+        lock_guard<mutex> reads_lock(reads_mutex);
+        map < CBString, ReadRequestPtr >::iterator found(in_flight_reads.find(key));
+        if (found != in_flight_reads.end()) {
+            read_request& r = *(found->second);
+            if (!r.started) {
+                // the shared read waits for the most patient caller
+                if (!timeout) {
+                    r.has_deadline = false;
+                } else if (r.has_deadline) {
+                    r.deadline = std::max(r.deadline, steady_clock::now() + milliseconds(timeout));
+                }
+            }
+            ++r.waiters;
+            ++read_counters.coalesced;
+            read_id = r.id;
+            return r.result;
         }
 
-        return (task_ptr->get_future()).share();
+        ReadRequestPtr r = make_shared<read_request>();
+        r->id = next_read_id++;
+        r->key = key;
+        // the snapshot is taken now, while the buffers are locked: the reader threads see the same state
+        r->it = make_shared<DictIterator>(the_dict, key, true);
+        r->result = r->prom.get_future().share();
+        if (timeout) {
+            r->has_deadline = true;
+            r->deadline = steady_clock::now() + milliseconds(timeout);
+        }
+        in_flight_reads[key] = r;
+        unstarted_reads[r->id] = r;
+        read_id = r->id;
+        ++read_counters.submitted;
+        readers->submit(boost::bind(&BufferedPersistentDict::run_read, this, r));
+        return r->result;
+    }
+
+    // withdraws one of the callers of the async read read_id (as set by async_at). the read is dropped when no caller
+    // is left. false if the read has already started, or was dropped.
+    bool cancel_read(uint64_t read_id) const {
+        lock_guard<mutex> reads_lock(reads_mutex);
+        map < uint64_t, ReadRequestPtr >::iterator found(unstarted_reads.find(read_id));
+        if (found == unstarted_reads.end()) {
+            return false;
+        }
+        ReadRequestPtr r(found->second);
+        if (--(r->waiters) == 0) {
+            ++read_counters.cancelled;
+            unstarted_reads.erase(found);
+            forget_read(r);
+        }
+        return true;
+    }
+
+    read_stats get_read_stats() const {
+        lock_guard<mutex> reads_lock(reads_mutex);
+        read_stats result(read_counters);
+        result.steals = readers ? readers->steals() : 0;
+        result.reader_threads = reader_threads;
+        return result;
     }
 
     MySharedBoolFuture erase(MDB_val key) {
@@ -404,6 +615,10 @@ public:
         if (buffered_deletes.count(key)) {
             (buffered_deletes[key])->set_value(false);
         }
+        if (buffered_merges.count(key)) {
+            ((buffered_merges[key]).second)->set_value(false);
+            buffered_merges.erase(key);
+        }
         buffered_deletes[key] = prom;
         return (prom->get_future()).share();
     }
@@ -428,10 +643,51 @@ public:
         if (buffered_inserts.count(key)) {
             ((buffered_inserts[key]).second)->set_value(false);
         }
+        if (buffered_merges.count(key)) {
+            ((buffered_merges[key]).second)->set_value(false);
+            buffered_merges.erase(key);
+        }
         buffered_inserts[key] = make_pair(value, prom);
         return (prom->get_future()).share();
     }
 
+    MySharedBoolFuture merge(MDB_val key, MDB_val operand) {
+        if (stopping_flag.load()) {
+            BOOST_THROW_EXCEPTION( stopping_ops() );
+        }
+        return merge(CBString(key.mv_data, key.mv_size), CBString(operand.mv_data, operand.mv_size));
+    }
+
+    // records an operand for the merge operator: consecutive operands are folded in memory, and applied to the LMDB
+    // value by the next flush. the future resolves to true when the merge has been commited.
+    MySharedBoolFuture merge(const CBString& key, const CBString& operand) {
+        if (stopping_flag.load()) {
+            BOOST_THROW_EXCEPTION( stopping_ops() );
+        }
+        if (!merge_op) {
+            BOOST_THROW_EXCEPTION( not_initialized() << lmdb_error::what("no merge operator was registered") );
+        }
+        unique_lock<shared_mutex> buffers_lock(buffers_mutex);
+        PromisePtr prom = make_shared<MyPromise>();
+        if (buffered_deletes.count(key)) {
+            // merging into a deleted value gives the operand: the delete becomes an insert
+            buffered_folded.insert(make_pair(key, buffered_deletes[key]));
+            buffered_deletes.erase(key);
+            buffered_inserts[key] = make_pair(operand, prom);
+        } else if (buffered_inserts.count(key)) {
+            pair < CBString, PromisePtr >& pending = buffered_inserts[key];
+            pending.first = merge_op(pending.first, operand);   // can throw
+            buffered_folded.insert(make_pair(key, prom));
+        } else if (buffered_merges.count(key)) {
+            pair < CBString, PromisePtr >& pending = buffered_merges[key];
+            pending.first = merge_op(pending.first, operand);   // can throw
+            buffered_folded.insert(make_pair(key, prom));
+        } else {
+            buffered_merges[key] = make_pair(operand, prom);
+        }
+        return (prom->get_future()).share();
+    }
+
 };  // END CLASS BufferedPersistentDict
 
 }   // END NS quiet
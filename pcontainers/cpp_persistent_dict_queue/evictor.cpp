@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <vector>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/throw_exception.hpp>
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "evictor.h"
+
+
+namespace quiet {
+
+using std::vector;
+using boost::lock_guard;
+using namespace utils;
+
+// the first key of the index: it holds the total size and the policy
+static const CBString HEADER_KEY(uint64_to_cbstring_be(0));
+
+static inline uint64_t now_ms() BOOST_NOEXCEPT_OR_NOTHROW {
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(
+        boost::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+static inline CBString rank_key(MDB_val key, uint64_t rank) {      // can throw
+    CBString k(uint64_to_cbstring_be(rank));
+    k += CBString(key.mv_data, (int) key.mv_size);
+    return k;
+}
+
+Evictor::Evictor(shared_ptr<environment> e, MDB_dbi values, const CBString& dbname, policy_type p, size_t entries,
+                 size_t bytes):
+        env(e), values_dbi(values), access_dbi(), index_dbi(), policy(p), max_entries(entries), max_bytes(bytes),
+        max_indexed_key(e->get_maxkeysize() - 8), lock(), pending(), nb_pending(0), counters() {
+    if (!dbname.length()) {
+        BOOST_THROW_EXCEPTION(lmdb::access_error() << lmdb::lmdb_error::what("the eviction needs a named database"));
+    }
+    access_dbi = env->get_dbi(dbname + ".access");
+    index_dbi = env->get_dbi(dbname + ".eviction");
+    counters.policy = policy;
+    reconcile();
+}
+
+void Evictor::set_limits(size_t entries, size_t bytes) {
+    lock_guard<mutex> guard(lock);
+    max_entries = entries;
+    max_bytes = bytes;
+}
+
+bool Evictor::read_access(environment::transaction& txn, MDB_val key, uint64_t& rank, uint64_t& size) const {
+    environment::cursor_ptr cursor = txn.make_cursor(access_dbi);
+    if (cursor->position(key) == MDB_NOTFOUND) {
+        return false;
+    }
+    MDB_val v = make_mdb_val();
+    cursor->get_current_value(v);
+    rank = cbstring_be_to_uint64(v);
+    MDB_val size_part;
+    size_part.mv_data = (char*) v.mv_data + 8;
+    size_part.mv_size = v.mv_size > 8 ? v.mv_size - 8 : 0;
+    size = cbstring_be_to_uint64(size_part);
+    return true;
+}
+
+void Evictor::write_access(environment::transaction& txn, MDB_val key, bool had_access, uint64_t old_rank,
+                           uint64_t rank, uint64_t size) {
+    if (!had_access || old_rank != rank) {
+        environment::cursor_ptr index = txn.make_cursor(index_dbi);
+        if (had_access && index->position(make_mdb_val(rank_key(key, old_rank))) == 0) {
+            index->del();
+        }
+        index->set_key_value(make_mdb_val(rank_key(key, rank)), make_mdb_val());
+    }
+    CBString record(uint64_to_cbstring_be(rank));
+    record += uint64_to_cbstring_be(size);
+    txn.make_cursor(access_dbi)->set_key_value(key, make_mdb_val(record));
+}
+
+uint64_t Evictor::total_bytes(environment::transaction& txn) const {
+    environment::cursor_ptr index = txn.make_cursor(index_dbi);
+    if (index->position(make_mdb_val(HEADER_KEY)) == MDB_NOTFOUND) {
+        return 0;
+    }
+    MDB_val v = make_mdb_val();
+    index->get_current_value(v);
+    return cbstring_be_to_uint64(v);
+}
+
+void Evictor::add_bytes(environment::transaction& txn, int64_t delta) {
+    int64_t total = (int64_t) total_bytes(txn) + delta;
+    CBString header(uint64_to_cbstring_be(total < 0 ? 0 : (uint64_t) total));
+    header += CBString((char) policy, 1);
+    txn.make_cursor(index_dbi)->set_key_value(make_mdb_val(HEADER_KEY), make_mdb_val(header));
+}
+
+void Evictor::reconcile() {
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        // the ranks of another policy are meaningless: start over
+        environment::cursor_ptr index = txn->make_cursor(index_dbi);
+        if (index->position(make_mdb_val(HEADER_KEY)) == 0) {
+            MDB_val v = make_mdb_val();
+            index->get_current_value(v);
+            if (v.mv_size < 9 || ((const char*) v.mv_data)[8] != (char) policy) {
+                env->drop(access_dbi);
+                env->drop(index_dbi);
+            }
+        }
+        index.reset();
+        if (txn->size(access_dbi) == txn->size(values_dbi)) {
+            return;
+        }
+        // merge join of the values and of the access records
+        vector<CBString> untracked;
+        vector<CBString> orphans;
+        environment::cursor_ptr values = txn->make_cursor(values_dbi);
+        environment::cursor_ptr accesses = txn->make_cursor(access_dbi);
+        MDB_val vk = make_mdb_val();
+        MDB_val ak = make_mdb_val();
+        int vres = values->first();
+        int ares = accesses->first();
+        while (vres == 0 || ares == 0) {
+            if (vres == 0) {
+                values->get_current_key(vk);
+            }
+            if (ares == 0) {
+                accesses->get_current_key(ak);
+            }
+            int cmp = vres != 0 ? 1 : (ares != 0 ? -1 : compare_keys(vk, ak));
+            if (cmp < 0) {
+                if (indexed(vk)) {
+                    untracked.push_back(make_string(vk));
+                }
+                vres = values->next();
+            } else if (cmp > 0) {
+                orphans.push_back(make_string(ak));
+                ares = accesses->next();
+            } else {
+                vres = values->next();
+                ares = accesses->next();
+            }
+        }
+        values.reset();
+        accesses.reset();
+        for (vector<CBString>::const_iterator it = orphans.begin(); it != orphans.end(); ++it) {
+            deleted(*txn, make_mdb_val(*it));
+        }
+        // the entries that were written without eviction are the first victims
+        for (vector<CBString>::const_iterator it = untracked.begin(); it != untracked.end(); ++it) {
+            MDB_val key = make_mdb_val(*it);
+            environment::cursor_ptr cursor = txn->make_cursor(values_dbi);
+            cursor->position(key);
+            MDB_val v = make_mdb_val();
+            cursor->get_current_value(v);
+            write_access(*txn, key, false, 0, 0, key.mv_size + v.mv_size);
+            add_bytes(*txn, key.mv_size + v.mv_size);
+        }
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+void Evictor::accessed(MDB_val key) const {
+    if (!indexed(key)) {
+        return;
+    }
+    lock_guard<mutex> guard(lock);
+    ++counters.accesses;
+    CBString k(make_string(key));
+    map<CBString, uint64_t>::iterator it = pending.find(k);
+    if (it != pending.end()) {
+        it->second = policy == LRU ? now_ms() : it->second + 1;
+    } else if (pending.size() >= MAX_PENDING_ACCESSES) {
+        ++counters.dropped;
+    } else {
+        pending.insert(std::make_pair(k, policy == LRU ? now_ms() : 1));
+        nb_pending.store(pending.size());
+    }
+}
+
+void Evictor::apply_accesses(environment::transaction& txn) {
+    if (nb_pending.load() == 0) {
+        return;
+    }
+    map<CBString, uint64_t> reads;
+    {
+        lock_guard<mutex> guard(lock);
+        reads.swap(pending);
+        nb_pending.store(0);
+    }
+    uint64_t rank;
+    uint64_t size;
+    for (map<CBString, uint64_t>::const_iterator it = reads.begin(); it != reads.end(); ++it) {
+        MDB_val key = make_mdb_val(it->first);
+        if (!read_access(txn, key, rank, size)) {
+            continue;
+        }
+        uint64_t new_rank = policy == LRU ? std::max(rank, it->second) : rank + it->second;
+        write_access(txn, key, true, rank, new_rank, size);
+    }
+}
+
+void Evictor::added(environment::transaction& txn, MDB_val key) {
+    if (!indexed(key)) {
+        return;
+    }
+    environment::cursor_ptr cursor = txn.make_cursor(values_dbi);
+    if (cursor->position(key) == MDB_NOTFOUND) {
+        return;
+    }
+    MDB_val v = make_mdb_val();
+    cursor->get_current_value(v);
+    uint64_t size = key.mv_size + v.mv_size;
+    uint64_t old_rank = 0;
+    uint64_t old_size = 0;
+    bool had_access = read_access(txn, key, old_rank, old_size);
+    // a write counts as an access
+    uint64_t rank = policy == LRU ? now_ms() : old_rank + 1;
+    write_access(txn, key, had_access, old_rank, rank, size);
+    if (size != old_size) {
+        add_bytes(txn, (int64_t) size - (int64_t) old_size);
+    }
+}
+
+void Evictor::deleted(environment::transaction& txn, MDB_val key) {
+    uint64_t rank;
+    uint64_t size;
+    if (!indexed(key) || !read_access(txn, key, rank, size)) {
+        return;
+    }
+    environment::cursor_ptr cursor = txn.make_cursor(index_dbi);
+    if (cursor->position(make_mdb_val(rank_key(key, rank))) == 0) {
+        cursor->del();
+    }
+    cursor = txn.make_cursor(access_dbi);
+    if (cursor->position(key) == 0) {
+        cursor->del();
+    }
+    add_bytes(txn, -(int64_t) size);
+}
+
+void Evictor::cleared(environment::transaction&) {
+    // the drops join the write transaction of this thread
+    env->drop(access_dbi);
+    env->drop(index_dbi);
+    lock_guard<mutex> guard(lock);
+    pending.clear();
+    nb_pending.store(0);
+}
+
+bool Evictor::over(environment::transaction& txn, size_t entries_limit, size_t bytes_limit) const {
+    return (entries_limit && txn.size(values_dbi) > entries_limit) ||
+           (bytes_limit && total_bytes(txn) > bytes_limit);
+}
+
+bool Evictor::needs_eviction(environment::transaction& txn) const {
+    size_t entries;
+    size_t bytes;
+    {
+        lock_guard<mutex> guard(lock);
+        entries = max_entries;
+        bytes = max_bytes;
+    }
+    return over(txn, entries, bytes);
+}
+
+size_t Evictor::evict(environment::transaction& txn, remover remove, MDB_val keep) {
+    apply_accesses(txn);
+    size_t entries;
+    size_t bytes;
+    {
+        lock_guard<mutex> guard(lock);
+        entries = max_entries;
+        bytes = max_bytes;
+    }
+    if (!over(txn, entries, bytes)) {
+        return 0;
+    }
+    // down to the low watermark
+    entries -= entries / SLACK;
+    bytes -= bytes / SLACK;
+    size_t n = 0;
+    environment::cursor_ptr index = txn.make_cursor(index_dbi);
+    environment::cursor_ptr values = txn.make_cursor(values_dbi);
+    MDB_val k = make_mdb_val();
+    int res = index->first();
+    while (res == 0 && over(txn, entries, bytes)) {
+        index->get_current_key(k);
+        if (k.mv_size <= 8) {
+            res = index->next();
+            continue;
+        }
+        CBString record(make_string(k));
+        MDB_val key;
+        key.mv_data = (char*) record.data + 8;
+        key.mv_size = record.length() - 8;
+        if (compare_keys(key, keep) == 0) {
+            res = index->next();
+            continue;
+        }
+        if (values->position(key) == 0) {
+            remove(key);
+            ++n;
+        }
+        // the remover calls deleted(), unless the entry was already gone
+        deleted(txn, key);
+        res = index->after(make_mdb_val(record));
+    }
+    lock_guard<mutex> guard(lock);
+    counters.evictions += n;
+    if (n) {
+        ++counters.batches;
+    }
+    return n;
+}
+
+Evictor::stats Evictor::get_stats() const {
+    environment::transaction_ptr txn = env->start_transaction();
+    size_t entries = txn->size(values_dbi);
+    size_t bytes = total_bytes(*txn);
+    lock_guard<mutex> guard(lock);
+    stats s(counters);
+    s.entries = entries;
+    s.bytes = bytes;
+    s.max_entries = max_entries;
+    s.max_bytes = max_bytes;
+    return s;
+}
+
+}   // END NS quiet
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/atomic.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+#include "lmdb.h"
+#include "../lmdb_environment/lmdb_environment.h"
+#include "../utils/utils.h"
+
+namespace quiet {
+
+using std::map;
+using boost::shared_ptr;
+using boost::enable_shared_from_this;
+using boost::mutex;
+using Bstrlib::CBString;
+using lmdb::environment;
+
+// Size-bounded eviction of the entries of a database (approximate LRU or LFU).
+//
+// Two companion databases, written in the transactions of the dict:
+//     <dbname>.access      key -> rank, size
+//     <dbname>.eviction    rank key -> ''      (the access-order index), plus a header record with the total size
+// The rank is the time of the last access in milliseconds (LRU) or the number of accesses (LFU), 8 bytes big-endian:
+// the victims are a prefix of the index. The size of an entry is the length of its key and of its value.
+//
+// The writes of the dict update the ranks right away. The reads don't write: they are buffered in memory (the reads of
+// the same key are coalesced) and applied by the next write transaction of the dict. When a write makes the dict go
+// over max_entries or max_bytes, the same transaction evicts a batch of victims, down to a low watermark 1/SLACK under
+// the limit, so that the next writes don't evict one entry each. The keys that are too long to be indexed (longer
+// than the maximal key size minus 8 bytes) are never evicted.
+class Evictor: public enable_shared_from_this<Evictor>, private boost::noncopyable {
+public:
+    enum policy_type { LRU = 0, LFU = 1 };
+    static const size_t SLACK = 64;
+    // the reads of new keys are dropped beyond this number of buffered reads
+    static const size_t MAX_PENDING_ACCESSES = 65536;
+
+    struct stats {
+        uint64_t evictions;
+        uint64_t batches;               // write transactions that evicted
+        uint64_t accesses;              // buffered reads
+        uint64_t dropped;               // reads dropped because the buffer was full
+        size_t entries;
+        size_t bytes;
+        size_t max_entries;
+        size_t max_bytes;
+        int policy;
+    };
+
+    // removes the entry of key from the dict, in the write transaction that evicts (the dict then calls deleted)
+    typedef boost::function<void (MDB_val)> remover;
+
+private:
+    shared_ptr<environment> env;
+    const MDB_dbi values_dbi;
+    MDB_dbi access_dbi;
+    MDB_dbi index_dbi;
+    const policy_type policy;
+    size_t max_entries;
+    size_t max_bytes;
+    const size_t max_indexed_key;
+
+    mutable mutex lock;
+    mutable map<CBString, uint64_t> pending;        // key -> last access (LRU) or number of accesses (LFU)
+    mutable boost::atomic<size_t> nb_pending;
+    mutable stats counters;                         // guarded by lock
+
+    Evictor(shared_ptr<environment> e, MDB_dbi values, const CBString& dbname, policy_type p, size_t entries,
+            size_t bytes);  // can throw
+
+    bool indexed(MDB_val key) const BOOST_NOEXCEPT_OR_NOTHROW {
+        return key.mv_size > 0 && key.mv_size <= max_indexed_key;
+    }
+    // the rank and the size of key; false if key is not tracked
+    bool read_access(environment::transaction& txn, MDB_val key, uint64_t& rank, uint64_t& size) const;   // can throw
+    void write_access(environment::transaction& txn, MDB_val key, bool had_access, uint64_t old_rank,
+                      uint64_t rank, uint64_t size);                                                       // can throw
+    uint64_t total_bytes(environment::transaction& txn) const;                                             // can throw
+    void add_bytes(environment::transaction& txn, int64_t delta);                                          // can throw
+    void apply_accesses(environment::transaction& txn);                                                    // can throw
+    bool over(environment::transaction& txn, size_t entries_limit, size_t bytes_limit) const;            // can throw
+    // tracks the entries of the values database that are not tracked yet, and forgets the others
+    void reconcile();                                                                                      // can throw
+
+public:
+    static shared_ptr<Evictor> factory(shared_ptr<environment> e, MDB_dbi values, const CBString& dbname,
+                                       policy_type p, size_t entries, size_t bytes) {      // can throw
+        return shared_ptr<Evictor>(new Evictor(e, values, dbname, p, entries, bytes));
+    }
+
+    policy_type get_policy() const BOOST_NOEXCEPT_OR_NOTHROW { return policy; }
+    // 0: no limit
+    void set_limits(size_t entries, size_t bytes);
+
+    // a read of key
+    void accessed(MDB_val key) const;
+    // the write transaction has written key (it exists in the values database)
+    void added(environment::transaction& txn, MDB_val key);                                  // can throw
+    // the write transaction deletes key
+    void deleted(environment::transaction& txn, MDB_val key);                                // can throw
+    // the write transaction clears the dict
+    void cleared(environment::transaction& txn);                                             // can throw
+    // true if the dict is over one of its limits in txn
+    bool needs_eviction(environment::transaction& txn) const;                                // can throw
+    // evicts entries (never 'keep') while the dict is over a limit; returns their number
+    size_t evict(environment::transaction& txn, remover remove, MDB_val keep);               // can throw
+
+    stats get_stats() const;                                                                 // can throw
+
+};  // END CLASS Evictor
+
+}   // END NS quiet
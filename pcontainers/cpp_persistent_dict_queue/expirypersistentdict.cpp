@@ -0,0 +1,919 @@
+#include <algorithm>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <boost/bind.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include "expirypersistentdict.h"
+
+
+namespace quiet {
+
+using boost::lock_guard;
+using boost::unique_lock;
+
+static inline CBString index_key(MDB_val key, uint64_t deadline) {     // can throw
+    CBString k(uint64_to_cbstring_be(deadline));
+    k += CBString(key.mv_data, key.mv_size);
+    return k;
+}
+
+static inline CBString deadline_record(uint64_t deadline, uint64_t sliding) {  // can throw
+    CBString v(uint64_to_cbstring_be(deadline));
+    if (sliding) {
+        v += uint64_to_cbstring_be(sliding);
+    }
+    return v;
+}
+
+static inline uint64_t sliding_ttl(MDB_val record) BOOST_NOEXCEPT_OR_NOTHROW {
+    if (record.mv_size < 16) {
+        return 0;
+    }
+    MDB_val v;
+    v.mv_data = (char*) record.mv_data + 8;
+    v.mv_size = 8;
+    return cbstring_be_to_uint64(v);
+}
+
+uint64_t ExpiryPersistentDict::now_ms() BOOST_NOEXCEPT_OR_NOTHROW {
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(
+        boost::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+void ExpiryPersistentDict::init() {
+    dbname.trim();
+    if (!dbname.length()) {
+        // the companion databases are named after the dict
+        BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("ExpiryPersistentDict needs a database name"));
+    }
+    env = lmdb::environment::factory(dirname, opts);
+    dirname = env->get_dirname();
+    values_dbi = env->get_dbi(dbname);
+    deadlines_dbi = env->get_dbi(dbname + ".deadlines");
+    expiry_dbi = env->get_dbi(dbname + ".expiry");
+    metadata_dbi = env->get_dbi(dbname + ".metadata");
+}
+
+bool ExpiryPersistentDict::live_deadline(environment::transaction& txn, MDB_val key, uint64_t now, uint64_t& deadline,
+                                         uint64_t* sliding) const {
+    environment::cursor_ptr cursor = txn.make_cursor(deadlines_dbi);
+    if (cursor->position(key) == MDB_NOTFOUND) {
+        return false;
+    }
+    MDB_val v = make_mdb_val();
+    cursor->get_current_value(v);
+    deadline = cbstring_be_to_uint64(v);
+    if (sliding) {
+        *sliding = sliding_ttl(v);
+    }
+    if (deadline == NEVER || now < deadline) {
+        return true;
+    }
+    // the entry was read before its deadline, and the touch is not flushed yet
+    return now < pending_deadline(key);
+}
+
+uint64_t ExpiryPersistentDict::pending_deadline(MDB_val key) const {
+    if (nb_touches.load() == 0) {
+        return NEVER;
+    }
+    lock_guard<boost::mutex> guard(touches_mutex);
+    map<CBString, uint64_t>::const_iterator it = touches.find(make_string(key));
+    return it == touches.end() ? NEVER : it->second;
+}
+
+void ExpiryPersistentDict::touch(MDB_val key, uint64_t deadline) const {
+    bool wake;
+    {
+        lock_guard<boost::mutex> guard(touches_mutex);
+        ++counters.touches;
+        std::pair<map<CBString, uint64_t>::iterator, bool> res = touches.insert(std::make_pair(make_string(key), deadline));
+        if (!res.second) {
+            ++counters.coalesced;
+            if (res.first->second < deadline) {
+                res.first->second = deadline;
+            }
+        }
+        nb_touches.store(touches.size());
+        wake = touches.size() >= MAX_PENDING_TOUCHES;
+    }
+    if (wake) {
+        lock_guard<boost::mutex> guard(flushing_mutex);
+        flushing_woken = true;
+        flushing_condition.notify_all();
+    }
+}
+
+void ExpiryPersistentDict::forget_touch(MDB_val key) {
+    if (nb_touches.load() == 0) {
+        return;
+    }
+    lock_guard<boost::mutex> guard(touches_mutex);
+    touches.erase(make_string(key));
+    nb_touches.store(touches.size());
+}
+
+size_t ExpiryPersistentDict::write_touches(environment::transaction& txn, const map<CBString, uint64_t>& pending) {
+    environment::cursor_ptr cursor = txn.make_cursor(deadlines_dbi);
+    MDB_val v = make_mdb_val();
+    size_t n = 0;
+    for (map<CBString, uint64_t>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+        MDB_val key = make_mdb_val(it->first);
+        if (cursor->position(key) == MDB_NOTFOUND) {
+            continue;
+        }
+        cursor->get_current_value(v);
+        uint64_t deadline = cbstring_be_to_uint64(v);
+        uint64_t sliding = sliding_ttl(v);
+        // a touch only pushes back the deadline of an entry that still has a sliding ttl
+        if (sliding == 0 || deadline == NEVER || it->second <= deadline) {
+            continue;
+        }
+        write_deadline(txn, key, deadline, true, it->second, sliding);
+        ++n;
+    }
+    return n;
+}
+
+void ExpiryPersistentDict::drop_touches(const map<CBString, uint64_t>& written) {
+    lock_guard<boost::mutex> guard(touches_mutex);
+    for (map<CBString, uint64_t>::const_iterator it = written.begin(); it != written.end(); ++it) {
+        map<CBString, uint64_t>::iterator found = touches.find(it->first);
+        if (found != touches.end() && found->second <= it->second) {
+            touches.erase(found);
+        }
+    }
+    nb_touches.store(touches.size());
+}
+
+void ExpiryPersistentDict::remove(environment::transaction& txn, MDB_val key, uint64_t deadline) {
+    forget_touch(key);
+    if (evictor_enabled.load()) {
+        evictor->deleted(txn, key);
+    }
+    environment::cursor_ptr cursor = txn.make_cursor(values_dbi);
+    if (cursor->position(key) == 0) {
+        cursor->del();
+    }
+    cursor = txn.make_cursor(deadlines_dbi);
+    if (cursor->position(key) == 0) {
+        cursor->del();
+    }
+    cursor = txn.make_cursor(metadata_dbi);
+    if (cursor->position(key) == 0) {
+        cursor->del();
+    }
+    if (deadline != NEVER) {
+        cursor = txn.make_cursor(expiry_dbi);
+        if (cursor->position(make_mdb_val(index_key(key, deadline))) == 0) {
+            cursor->del();
+        }
+    }
+}
+
+void ExpiryPersistentDict::read_entry(environment::transaction& txn, MDB_val key, CBString& value,
+                                      CBString& metadata) const {
+    MDB_val v = make_mdb_val();
+    environment::cursor_ptr cursor = txn.make_cursor(values_dbi);
+    value = CBString();
+    if (cursor->position(key) == 0) {
+        cursor->get_current_value(v);
+        value = make_string(v);
+    }
+    cursor = txn.make_cursor(metadata_dbi);
+    metadata = CBString();
+    if (cursor->position(key) == 0) {
+        cursor->get_current_value(v);
+        metadata = make_string(v);
+    }
+}
+
+void ExpiryPersistentDict::write_deadline(environment::transaction& txn, MDB_val key, uint64_t old_deadline,
+                                          bool had_deadline, uint64_t deadline, uint64_t sliding) {
+    if (!had_deadline || old_deadline != deadline) {
+        environment::cursor_ptr index = txn.make_cursor(expiry_dbi);
+        if (had_deadline && old_deadline != NEVER) {
+            if (index->position(make_mdb_val(index_key(key, old_deadline))) == 0) {
+                index->del();
+            }
+        }
+        if (deadline != NEVER) {
+            index->set_key_value(make_mdb_val(index_key(key, deadline)), make_mdb_val());
+        }
+    }
+    txn.make_cursor(deadlines_dbi)->set_key_value(key, make_mdb_val(deadline_record(deadline, sliding)));
+}
+
+void ExpiryPersistentDict::clear() {
+    if (!*this) {
+        return;
+    }
+    // the drops join the write transaction of this thread
+    environment::transaction_ptr txn = env->start_transaction(false);
+    env->drop(values_dbi);
+    env->drop(deadlines_dbi);
+    env->drop(expiry_dbi);
+    env->drop(metadata_dbi);
+    if (evictor_enabled.load()) {
+        evictor->cleared(*txn);
+    }
+    lock_guard<boost::mutex> guard(touches_mutex);
+    touches.clear();
+    nb_touches.store(0);
+}
+
+bool ExpiryPersistentDict::lookup(MDB_val key, CBString& value, uint64_t grace, bool& fresh) const {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        return false;
+    }
+    environment::transaction_ptr txn = env->start_transaction();
+    uint64_t now = now_ms();
+    uint64_t deadline = NEVER;
+    uint64_t sliding = 0;
+    fresh = live_deadline(*txn, key, now, deadline, &sliding);
+    // a NEVER deadline is always live: here it means that key is absent
+    if (!fresh && (deadline == NEVER || deadline + grace <= now)) {
+        return false;
+    }
+    environment::cursor_ptr cursor = txn->make_cursor(values_dbi);
+    if (cursor->position(key) == MDB_NOTFOUND) {
+        return false;
+    }
+    MDB_val v = make_mdb_val();
+    cursor->get_current_value(v);
+    value = make_string(v);
+    if (!fresh) {
+        return true;
+    }
+    if (sliding) {
+        touch(key, now + sliding);
+    }
+    if (evictor_enabled.load()) {
+        evictor->accessed(key);
+    }
+    return true;
+}
+
+bool ExpiryPersistentDict::get(MDB_val key, CBString& value) const {
+    bool fresh;
+    return lookup(key, value, 0, fresh);
+}
+
+bool ExpiryPersistentDict::get_stale(MDB_val key, CBString& value, bool& fresh) const {
+    return lookup(key, value, stale_grace.load(), fresh);
+}
+
+CBString ExpiryPersistentDict::at(MDB_val key) const {
+    CBString value;
+    if (!get(key, value)) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    return value;
+}
+
+bool ExpiryPersistentDict::contains(MDB_val key) const {
+    if (key.mv_size == 0 || key.mv_data == NULL || (!*this)) {
+        return false;
+    }
+    uint64_t deadline;
+    return live_deadline(*env->start_transaction(), key, now_ms(), deadline);
+}
+
+uint64_t ExpiryPersistentDict::get_deadline(MDB_val key) const {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    uint64_t deadline;
+    if (key.mv_size == 0 || key.mv_data == NULL || !live_deadline(*env->start_transaction(), key, now_ms(), deadline)) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    if (deadline == NEVER) {
+        return NEVER;
+    }
+    return std::max(deadline, pending_deadline(key));
+}
+
+void ExpiryPersistentDict::write(environment::transaction& txn, MDB_val key, MDB_val value, uint64_t deadline,
+                                 MDB_val metadata, uint64_t sliding) {
+    forget_touch(key);
+    uint64_t old_deadline = NEVER;
+    // an expired entry that is not pruned yet still has its index record
+    environment::cursor_ptr cursor = txn.make_cursor(deadlines_dbi);
+    bool had_deadline = cursor->position(key) == 0;
+    if (had_deadline) {
+        MDB_val v = make_mdb_val();
+        cursor->get_current_value(v);
+        old_deadline = cbstring_be_to_uint64(v);
+    }
+    write_deadline(txn, key, old_deadline, had_deadline, deadline, deadline == NEVER ? 0 : sliding);
+    txn.make_cursor(values_dbi)->set_key_value(key, value);
+    cursor = txn.make_cursor(metadata_dbi);
+    if (metadata.mv_size) {
+        cursor->set_key_value(key, metadata);
+    } else if (cursor->position(key) == 0) {
+        cursor->del();
+    }
+    if (evictor_enabled.load()) {
+        evictor->added(txn, key);
+        if (evictor->needs_eviction(txn)) {
+            // the expired entries go first. txn is committed by the caller: the touches that are written here stay
+            // pending, the next flush writes the same deadlines again
+            map<CBString, uint64_t> written;
+            size_t flushed;
+            prune_touched(txn, now_ms(), PRUNE_BATCH, written, flushed);
+            evictor->evict(txn, boost::bind(&ExpiryPersistentDict::evict_entry, this, boost::ref(txn), _1), key);
+        }
+    }
+}
+
+void ExpiryPersistentDict::evict_entry(environment::transaction& txn, MDB_val key) {
+    environment::cursor_ptr cursor = txn.make_cursor(deadlines_dbi);
+    uint64_t deadline = NEVER;
+    if (cursor->position(key) == 0) {
+        MDB_val v = make_mdb_val();
+        cursor->get_current_value(v);
+        deadline = cbstring_be_to_uint64(v);
+    }
+    remove(txn, key, deadline);
+}
+
+void ExpiryPersistentDict::enable_eviction(Evictor::policy_type policy, size_t max_entries, size_t max_bytes) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    lock_guard<boost::mutex> guard(evictor_lock);
+    if (evictor) {
+        if (evictor->get_policy() != policy) {
+            BOOST_THROW_EXCEPTION(std::invalid_argument("the eviction policy of a dict can't change"));
+        }
+        evictor->set_limits(max_entries, max_bytes);
+        return;
+    }
+    evictor = Evictor::factory(env, values_dbi, dbname, policy, max_entries, max_bytes);
+    evictor_enabled.store(true);
+}
+
+Evictor::stats ExpiryPersistentDict::get_eviction_stats() const {
+    if (evictor_enabled.load()) {
+        return evictor->get_stats();
+    }
+    Evictor::stats empty_stats = Evictor::stats();
+    return empty_stats;
+}
+
+void ExpiryPersistentDict::insert(MDB_val key, MDB_val value, uint64_t deadline, MDB_val metadata, uint64_t sliding) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        write(*txn, key, value, deadline, metadata, sliding);
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+void ExpiryPersistentDict::insert_many(const vector<CBString>& keys, const vector<CBString>& values,
+                                       const vector<CBString>& metadata, uint64_t deadline, uint64_t sliding) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (values.size() != keys.size() || (!metadata.empty() && metadata.size() != keys.size())) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("insert_many: the vectors don't have the same size"));
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (!keys[i].length()) {
+                BOOST_THROW_EXCEPTION(empty_key());
+            }
+            write(*txn, make_mdb_val(keys[i]), make_mdb_val(values[i]), deadline,
+                  metadata.empty() ? make_mdb_val() : make_mdb_val(metadata[i]), sliding);
+        }
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+size_t ExpiryPersistentDict::migrate_legacy_layout(const CBString& old_dirname) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    CBString index_path(old_dirname + "/index");
+    CBString values_path(old_dirname + "/values");
+    CBString metadata_path(old_dirname + "/metadata");
+    struct stat st;
+    if (stat(index_path, &st) != 0) {
+        return 0;
+    }
+    size_t n = 0;
+    {
+        shared_ptr<environment> index_env = lmdb::environment::factory(index_path, opts);
+        shared_ptr<environment> values_env = lmdb::environment::factory(values_path, opts);
+        shared_ptr<environment> metadata_env = lmdb::environment::factory(metadata_path, opts);
+        MDB_dbi old_index_dbi = index_env->get_dbi("");
+        MDB_dbi old_values_dbi = values_env->get_dbi("");
+        MDB_dbi old_metadata_dbi = metadata_env->get_dbi("");
+        environment::transaction_ptr index_txn = index_env->start_transaction();
+        environment::transaction_ptr values_txn = values_env->start_transaction();
+        environment::transaction_ptr metadata_txn = metadata_env->start_transaction();
+        environment::cursor_ptr index = index_txn->make_cursor(old_index_dbi);
+        environment::cursor_ptr old_values = values_txn->make_cursor(old_values_dbi);
+        environment::cursor_ptr old_metadata = metadata_txn->make_cursor(old_metadata_dbi);
+
+        environment::transaction_ptr txn = env->start_transaction(false);
+        try {
+            environment::cursor_ptr values = txn->make_cursor(values_dbi);
+            uint64_t now = now_ms();
+            MDB_val k = make_mdb_val();
+            MDB_val v = make_mdb_val();
+            MDB_val value = make_mdb_val();
+            MDB_val metadata = make_mdb_val();
+            for (int res = index->first(); res == 0; res = index->next()) {
+                index->get_current_key_value(k, v);
+                // a crash between the commit and the deletion of the former environments migrates them again
+                if (values->position(k) == 0 || old_values->position(k) != 0) {
+                    continue;
+                }
+                uint64_t deadline = NEVER;
+                CBString s_deadline(make_string(v));
+                if (s_deadline != "none") {
+                    char* end = NULL;
+                    uint64_t seconds = strtoull((const char*) s_deadline.data, &end, 10);
+                    if (!s_deadline.length() || *end != '\0') {
+                        BOOST_THROW_EXCEPTION(mdb_incompatible() << lmdb_error::what(
+                            "ExpiryPersistentDict: the index of the former layout has a deadline that is not a number"));
+                    }
+                    deadline = seconds * 1000;
+                    if (deadline <= now) {
+                        continue;
+                    }
+                }
+                old_values->get_current_value(value);
+                metadata = make_mdb_val();
+                if (old_metadata->position(k) == 0) {
+                    old_metadata->get_current_value(metadata);
+                }
+                write(*txn, k, value, deadline, metadata, 0);
+                ++n;
+            }
+        } catch (...) {
+            txn->set_rollback();
+            throw;
+        }
+    }
+    // committed, and the former environments are closed. the index goes first: without it, nothing is migrated again
+    rmrf(index_path);
+    rmrf(values_path);
+    rmrf(metadata_path);
+    if (opts.no_subdir) {
+        rmrf(index_path + "-lock");
+        rmrf(values_path + "-lock");
+        rmrf(metadata_path + "-lock");
+    }
+    _LOG_INFO << "ExpiryPersistentDict: migrated " << n << " entries of the former layout";
+    return n;
+}
+
+bool ExpiryPersistentDict::get_metadata(MDB_val key, CBString& metadata) const {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        return false;
+    }
+    environment::transaction_ptr txn = env->start_transaction();
+    uint64_t deadline;
+    if (!live_deadline(*txn, key, now_ms(), deadline)) {
+        return false;
+    }
+    environment::cursor_ptr cursor = txn->make_cursor(metadata_dbi);
+    if (cursor->position(key) == MDB_NOTFOUND) {
+        return false;
+    }
+    MDB_val v = make_mdb_val();
+    cursor->get_current_value(v);
+    metadata = make_string(v);
+    return true;
+}
+
+bool ExpiryPersistentDict::set_metadata(MDB_val key, MDB_val metadata) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        return false;
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        uint64_t deadline;
+        if (!live_deadline(*txn, key, now_ms(), deadline)) {
+            return false;
+        }
+        environment::cursor_ptr cursor = txn->make_cursor(metadata_dbi);
+        if (metadata.mv_size) {
+            cursor->set_key_value(key, metadata);
+        } else if (cursor->position(key) == 0) {
+            cursor->del();
+        }
+        return true;
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+bool ExpiryPersistentDict::set_deadline(MDB_val key, uint64_t deadline) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        return false;
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        uint64_t old_deadline;
+        if (!live_deadline(*txn, key, now_ms(), old_deadline)) {
+            return false;
+        }
+        forget_touch(key);
+        write_deadline(*txn, key, old_deadline, true, deadline, 0);
+        return true;
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+bool ExpiryPersistentDict::erase(MDB_val key) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        return false;
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        uint64_t deadline;
+        if (!live_deadline(*txn, key, now_ms(), deadline)) {
+            return false;
+        }
+        remove(*txn, key, deadline);
+        return true;
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+bool ExpiryPersistentDict::pop(MDB_val key, CBString& value) {
+    CBString metadata;
+    return pop(key, value, metadata);
+}
+
+bool ExpiryPersistentDict::pop(MDB_val key, CBString& value, CBString& metadata) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        return false;
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        uint64_t deadline;
+        if (!live_deadline(*txn, key, now_ms(), deadline)) {
+            return false;
+        }
+        read_entry(*txn, key, value, metadata);
+        remove(*txn, key, deadline);
+        return true;
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+bool ExpiryPersistentDict::pop_first(CBString& key, CBString& value) {
+    CBString metadata;
+    return pop_first(key, value, metadata);
+}
+
+bool ExpiryPersistentDict::pop_first(CBString& key, CBString& value, CBString& metadata) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        uint64_t now = now_ms();
+        environment::cursor_ptr cursor = txn->make_cursor(values_dbi);
+        MDB_val k = make_mdb_val();
+        uint64_t deadline;
+        for (int res = cursor->first(); res == 0; res = cursor->next()) {
+            cursor->get_current_key(k);
+            if (live_deadline(*txn, k, now, deadline)) {
+                key = make_string(k);
+                read_entry(*txn, make_mdb_val(key), value, metadata);
+                remove(*txn, make_mdb_val(key), deadline);
+                return true;
+            }
+        }
+        return false;
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+size_t ExpiryPersistentDict::prune(environment::transaction& txn, uint64_t now, size_t max_entries) {
+    size_t n = 0;
+    environment::cursor_ptr index = txn.make_cursor(expiry_dbi);
+    environment::cursor_ptr values = txn.make_cursor(values_dbi);
+    environment::cursor_ptr deadlines = txn.make_cursor(deadlines_dbi);
+    environment::cursor_ptr metadata = txn.make_cursor(metadata_dbi);
+    bool evicting = evictor_enabled.load();
+    uint64_t grace = stale_grace.load();
+    MDB_val k = make_mdb_val();
+    // the index is sorted by deadline: stop at the first entry that is still alive (or that may still be read stale)
+    for (int res = index->first(); res == 0 && (max_entries == 0 || n < max_entries); res = index->next()) {
+        index->get_current_key(k);
+        if (cbstring_be_to_uint64(k) + grace > now) {
+            break;
+        }
+        MDB_val key;
+        key.mv_data = (char*) k.mv_data + 8;
+        key.mv_size = k.mv_size - 8;
+        if (evicting) {
+            // key points into the index page: the evictor writes before the index record is deleted
+            CBString copy(make_string(key));
+            evictor->deleted(txn, make_mdb_val(copy));
+        }
+        forget_touch(key);
+        if (values->position(key) == 0) {
+            values->del();
+        }
+        if (deadlines->position(key) == 0) {
+            deadlines->del();
+        }
+        if (metadata->position(key) == 0) {
+            metadata->del();
+        }
+        index->del();
+        ++n;
+    }
+    pruned.fetch_add(n);
+    return n;
+}
+
+size_t ExpiryPersistentDict::prune_touched(environment::transaction& txn, uint64_t now, size_t max_entries,
+                                           map<CBString, uint64_t>& written, size_t& flushed) {
+    // the pending touches are written first, in the same transaction
+    {
+        lock_guard<boost::mutex> guard(touches_mutex);
+        written = touches;
+    }
+    flushed = write_touches(txn, written);
+    return prune(txn, now, max_entries);
+}
+
+size_t ExpiryPersistentDict::prune_expired(size_t max_entries) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    map<CBString, uint64_t> pending;
+    size_t n = 0;
+    size_t flushed = 0;
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        n = prune_touched(*txn, now_ms(), max_entries, pending, flushed);
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+    txn.reset();    // commit
+    if (!pending.empty()) {
+        drop_touches(pending);
+        lock_guard<boost::mutex> guard(touches_mutex);
+        counters.flushed += flushed;
+    }
+    return n;
+}
+
+size_t ExpiryPersistentDict::flush_touches() {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    // the touches stay pending (and keep their entries alive) until the transaction is committed
+    map<CBString, uint64_t> pending;
+    {
+        lock_guard<boost::mutex> guard(touches_mutex);
+        pending = touches;
+    }
+    if (pending.empty()) {
+        return 0;
+    }
+    size_t n = 0;
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        n = write_touches(*txn, pending);
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+    txn.reset();    // commit
+    drop_touches(pending);
+    lock_guard<boost::mutex> guard(touches_mutex);
+    counters.flushed += n;
+    ++counters.flushes;
+    return n;
+}
+
+ExpiryPersistentDict::touch_stats ExpiryPersistentDict::get_touch_stats() const {
+    lock_guard<boost::mutex> guard(touches_mutex);
+    touch_stats stats(counters);
+    stats.pending = touches.size();
+    return stats;
+}
+
+void ExpiryPersistentDict::pruning_thread_fun(uint64_t period_ms) {
+    unique_lock<boost::mutex> lock(pruning_mutex);
+    while (!pruning_stopping) {
+        pruning_condition.wait_for(lock, boost::chrono::milliseconds(period_ms));
+        if (pruning_stopping) {
+            break;
+        }
+        lock.unlock();
+        try {
+            // small transactions: the writers are not blocked for long
+            while (prune_expired(PRUNE_BATCH) == PRUNE_BATCH) { }
+        } catch (...) {
+            _LOG_ERROR << "ExpiryPersistentDict: pruning failed: " << boost::current_exception_diagnostic_information();
+        }
+        lock.lock();
+    }
+}
+
+void ExpiryPersistentDict::start_pruning(uint64_t period_ms) {
+    if (period_ms == 0) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("the pruning period must be positive"));
+    }
+    stop_pruning();
+    lock_guard<boost::mutex> guard(pruning_mutex);
+    pruning_stopping = false;
+    pruning_thread_ptr.reset(new boost::thread(boost::bind(&ExpiryPersistentDict::pruning_thread_fun, this, period_ms)));
+}
+
+void ExpiryPersistentDict::stop_pruning() {
+    {
+        lock_guard<boost::mutex> guard(pruning_mutex);
+        if (!pruning_thread_ptr) {
+            return;
+        }
+        pruning_stopping = true;
+        pruning_condition.notify_all();
+    }
+    pruning_thread_ptr->join();
+    pruning_thread_ptr.reset();
+}
+
+void ExpiryPersistentDict::flushing_thread_fun(uint64_t period_ms) {
+    unique_lock<boost::mutex> lock(flushing_mutex);
+    while (!flushing_stopping) {
+        if (!flushing_woken) {
+            flushing_condition.wait_for(lock, boost::chrono::milliseconds(period_ms));
+        }
+        if (flushing_stopping) {
+            break;
+        }
+        flushing_woken = false;
+        lock.unlock();
+        try {
+            flush_touches();
+        } catch (...) {
+            _LOG_ERROR << "ExpiryPersistentDict: flushing the touches failed: "
+                       << boost::current_exception_diagnostic_information();
+        }
+        lock.lock();
+    }
+}
+
+void ExpiryPersistentDict::start_flushing_touches(uint64_t period_ms) {
+    if (period_ms == 0) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("the flushing period must be positive"));
+    }
+    stop_flushing_touches();
+    lock_guard<boost::mutex> guard(flushing_mutex);
+    flushing_stopping = false;
+    flushing_woken = false;
+    flushing_thread_ptr.reset(new boost::thread(boost::bind(&ExpiryPersistentDict::flushing_thread_fun, this,
+                                                            period_ms)));
+}
+
+void ExpiryPersistentDict::stop_flushing_touches() {
+    {
+        lock_guard<boost::mutex> guard(flushing_mutex);
+        if (!flushing_thread_ptr) {
+            return;
+        }
+        flushing_stopping = true;
+        flushing_condition.notify_all();
+    }
+    flushing_thread_ptr->join();
+    flushing_thread_ptr.reset();
+    // the last touches are not lost
+    try {
+        flush_touches();
+    } catch (...) {
+        _LOG_ERROR << "ExpiryPersistentDict: flushing the touches failed: "
+                   << boost::current_exception_diagnostic_information();
+    }
+}
+
+ExpiryPersistentDict::const_iterator::const_iterator(shared_ptr<const ExpiryPersistentDict> d):
+        dict(d), txn(), values_cursor(), deadlines_cursor(), metadata_cursor(), now(ExpiryPersistentDict::now_ms()),
+        reached_end(true) {
+    if (!dict || !*dict) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    txn = dict->env->start_transaction();
+    values_cursor = txn->make_cursor(dict->values_dbi);
+    deadlines_cursor = txn->make_cursor(dict->deadlines_dbi);
+    metadata_cursor = txn->make_cursor(dict->metadata_dbi);
+    reached_end = values_cursor->first() == MDB_NOTFOUND;
+    skip_expired();
+}
+
+void ExpiryPersistentDict::const_iterator::skip_expired() {
+    MDB_val k = make_mdb_val();
+    uint64_t deadline;
+    while (!reached_end) {
+        values_cursor->get_current_key(k);
+        if (dict->live_deadline(*txn, k, now, deadline)) {
+            return;
+        }
+        reached_end = values_cursor->next() == MDB_NOTFOUND;
+    }
+}
+
+CBString ExpiryPersistentDict::const_iterator::get_key() const {
+    if (reached_end) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    MDB_val k = make_mdb_val();
+    values_cursor->get_current_key(k);
+    return make_string(k);
+}
+
+CBString ExpiryPersistentDict::const_iterator::get_value() const {
+    if (reached_end) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    MDB_val v = make_mdb_val();
+    values_cursor->get_current_value(v);
+    return make_string(v);
+}
+
+uint64_t ExpiryPersistentDict::const_iterator::get_deadline() const {
+    if (reached_end) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    MDB_val k = make_mdb_val();
+    values_cursor->get_current_key(k);
+    uint64_t deadline = NEVER;
+    dict->live_deadline(*txn, k, now, deadline);
+    return deadline;
+}
+
+CBString ExpiryPersistentDict::const_iterator::get_metadata() const {
+    if (reached_end) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    MDB_val k = make_mdb_val();
+    values_cursor->get_current_key(k);
+    if (metadata_cursor->position(k) == MDB_NOTFOUND) {
+        return CBString();
+    }
+    MDB_val v = make_mdb_val();
+    metadata_cursor->get_current_value(v);
+    return make_string(v);
+}
+
+ExpiryPersistentDict::const_iterator& ExpiryPersistentDict::const_iterator::operator++() {
+    if (!reached_end) {
+        reached_end = values_cursor->next() == MDB_NOTFOUND;
+        skip_expired();
+    }
+    return *this;
+}
+
+}   // END NS quiet
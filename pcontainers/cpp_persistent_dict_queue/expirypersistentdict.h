@@ -0,0 +1,283 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/core/explicit_operator_bool.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+#include "lmdb.h"
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "../utils/lmdb_options.h"
+#include "../lmdb_environment/lmdb_environment.h"
+#include "../utils/utils.h"
+#include "../logging/logging.h"
+#include "evictor.h"
+
+namespace quiet {
+
+using std::vector;
+using std::map;
+using boost::shared_ptr;
+using boost::scoped_ptr;
+using boost::enable_shared_from_this;
+using Bstrlib::CBString;
+using namespace lmdb;
+using namespace utils;
+
+// A persistent dict whose entries expire. Four databases of one environment, always updated in the same transaction:
+//     dbname               key -> value
+//     dbname.deadlines     key -> deadline [sliding ttl]
+//     dbname.expiry        deadline key -> ''      (only the entries that expire)
+//     dbname.metadata      key -> metadata         (only the entries that have metadata)
+// Deadlines are 8 bytes big-endian milliseconds since the epoch, 0 meaning "never expires": the expiry index is sorted
+// by deadline, so pruning deletes a prefix of the index and never visits an entry that is still alive. The reads check
+// the deadline of the entry, so an expired entry is never returned, even before it is pruned.
+// Pruning can also run periodically in a native thread (start_pruning).
+//
+// An entry with a sliding ttl (milliseconds, stored after its deadline) gets the deadline now + ttl each time it is
+// read. A read does not write: it records a touch in memory, the touches of the same key are coalesced, and
+// flush_touches writes all of them in one write transaction (periodically in a native thread, see
+// start_flushing_touches). Until then, the pending touches count for the reads, and the pruning writes them before
+// deleting anything: an entry never expires before its last read + its sliding ttl.
+//
+// The size can be bounded (enable_eviction, see Evictor): a write that goes over the limit first prunes the expired
+// entries, then evicts the least recently or least frequently used ones, in the same transaction.
+//
+// With a stale grace period, the pruning keeps the expired entries for stale_grace more milliseconds: get_stale can
+// still return them (flagged as not fresh), so that a caller serves the stale value while it computes a new one.
+class ExpiryPersistentDict: public enable_shared_from_this<ExpiryPersistentDict>, private boost::noncopyable {
+public:
+    static const uint64_t NEVER = 0;
+    // the number of expired entries deleted by one transaction of the pruning thread
+    static const size_t PRUNE_BATCH = 10000;
+    // the number of pending touches that wakes the flushing thread before the end of its period
+    static const size_t MAX_PENDING_TOUCHES = 65536;
+
+    struct touch_stats {
+        uint64_t touches;       // reads of entries with a sliding ttl
+        uint64_t coalesced;     // touches merged into a pending touch of the same key
+        uint64_t flushed;       // deadlines written by the flushes
+        uint64_t flushes;       // write transactions of the flushes
+        size_t pending;
+        touch_stats(): touches(0), coalesced(0), flushed(0), flushes(0), pending(0) { }
+    };
+
+private:
+    ExpiryPersistentDict(const CBString& directory_name, const CBString& database_name, const lmdb_options& options):
+            dirname(directory_name), dbname(database_name), env(), values_dbi(), deadlines_dbi(), expiry_dbi(),
+            metadata_dbi(), opts(options), pruned(0), pruning_mutex(), pruning_condition(), pruning_stopping(false),
+            pruning_thread_ptr(), touches_mutex(), touches(), nb_touches(0), counters(), flushing_mutex(),
+            flushing_condition(), flushing_stopping(false), flushing_woken(false), flushing_thread_ptr(), evictor(),
+            evictor_enabled(false), evictor_lock(), stale_grace(0) { init(); }
+
+    void init();                    // can throw
+    void close() BOOST_NOEXCEPT_OR_NOTHROW { env.reset(); }
+
+    // the stored deadline of key in txn (and its sliding ttl, 0 if none), or false if key is absent or expired at
+    // 'now'. a pending touch keeps an entry alive.
+    bool live_deadline(environment::transaction& txn, MDB_val key, uint64_t now, uint64_t& deadline,
+                       uint64_t* sliding=NULL) const;                                                    // can throw
+    // the deadline of a pending touch of key, or NEVER
+    uint64_t pending_deadline(MDB_val key) const;                                                       // can throw
+    // records that key was read at 'now'
+    void touch(MDB_val key, uint64_t deadline) const;                                                   // can throw
+    // drops the pending touch of a key that is written or deleted
+    void forget_touch(MDB_val key);                                                                     // can throw
+    // writes the deadlines of 'pending' in txn; returns their number
+    size_t write_touches(environment::transaction& txn, const map<CBString, uint64_t>& pending);        // can throw
+    // drops the touches that were written, unless a later read moved them
+    void drop_touches(const map<CBString, uint64_t>& written);
+    // removes key (that must exist), its index record and its metadata
+    void remove(environment::transaction& txn, MDB_val key, uint64_t deadline);                              // can throw
+    void write_deadline(environment::transaction& txn, MDB_val key, uint64_t old_deadline, bool had_deadline,
+                        uint64_t deadline, uint64_t sliding);                                               // can throw
+    void write(environment::transaction& txn, MDB_val key, MDB_val value, uint64_t deadline, MDB_val metadata,
+               uint64_t sliding);                                                                           // can throw
+    // copies the value of key if it is live, or expired for less than 'grace' milliseconds ('fresh' is then false)
+    bool lookup(MDB_val key, CBString& value, uint64_t grace, bool& fresh) const;                        // can throw
+    // copies the value and the metadata (empty if none) of key
+    void read_entry(environment::transaction& txn, MDB_val key, CBString& value, CBString& metadata) const;  // can throw
+
+    // deletes at most max_entries (0: all) entries that are expired at 'now'
+    size_t prune(environment::transaction& txn, uint64_t now, size_t max_entries);                      // can throw
+    // writes the pending touches, then prunes: pruning never deletes an entry that was read. 'written' gets the
+    // touches that were written (drop_touches after the commit), 'flushed' the number of deadlines that moved
+    size_t prune_touched(environment::transaction& txn, uint64_t now, size_t max_entries,
+                         map<CBString, uint64_t>& written, size_t& flushed);                             // can throw
+    void evict_entry(environment::transaction& txn, MDB_val key);                                       // can throw
+
+    void pruning_thread_fun(uint64_t period_ms);
+    void flushing_thread_fun(uint64_t period_ms);
+
+protected:
+    CBString dirname;
+    CBString dbname;
+    shared_ptr<environment> env;
+    MDB_dbi values_dbi;
+    MDB_dbi deadlines_dbi;
+    MDB_dbi expiry_dbi;
+    MDB_dbi metadata_dbi;
+    const lmdb_options opts;
+
+    boost::atomic<uint64_t> pruned;
+    boost::mutex pruning_mutex;
+    boost::condition_variable pruning_condition;
+    bool pruning_stopping;
+    scoped_ptr<boost::thread> pruning_thread_ptr;
+
+    // the pending touches: key -> new deadline
+    mutable boost::mutex touches_mutex;
+    mutable map<CBString, uint64_t> touches;
+    mutable boost::atomic<size_t> nb_touches;       // lets the writes skip touches_mutex when there is no touch
+    mutable touch_stats counters;                   // guarded by touches_mutex
+    mutable boost::mutex flushing_mutex;
+    mutable boost::condition_variable flushing_condition;
+    bool flushing_stopping;
+    mutable bool flushing_woken;
+    scoped_ptr<boost::thread> flushing_thread_ptr;
+
+    shared_ptr<Evictor> evictor;
+    boost::atomic_bool evictor_enabled;
+    boost::mutex evictor_lock;
+
+    boost::atomic<uint64_t> stale_grace;
+
+public:
+    BOOST_EXPLICIT_OPERATOR_BOOL_NOEXCEPT()
+    bool operator!() const BOOST_NOEXCEPT_OR_NOTHROW {
+        return !env;
+    }
+
+    static inline shared_ptr<ExpiryPersistentDict> factory(const CBString& directory_name, const CBString& database_name,
+                                                           const lmdb_options& options=lmdb_options()) {    // can throw
+        return shared_ptr<ExpiryPersistentDict>(new ExpiryPersistentDict(directory_name, database_name, options));
+    }
+
+    ~ExpiryPersistentDict() {
+        stop_flushing_touches();
+        stop_pruning();
+        close();
+    }
+
+    static uint64_t now_ms() BOOST_NOEXCEPT_OR_NOTHROW;
+
+    CBString get_dirname() const BOOST_NOEXCEPT_OR_NOTHROW { return dirname; }
+    CBString get_dbname() const BOOST_NOEXCEPT_OR_NOTHROW { return dbname; }
+
+    // number of entries, including the expired entries that are not pruned yet
+    size_t size() const {                                                           // can throw
+        if (!*this) {
+            return 0;
+        }
+        return env->size(values_dbi);
+    }
+
+    void clear();                                                                   // can throw
+
+    // false if key is absent or expired
+    bool get(MDB_val key, CBString& value) const;                                   // can throw
+    // true if key is live (fresh) or expired for less than the stale grace period (not fresh). A stale read is not a
+    // use of the entry: it neither slides nor counts for the eviction.
+    bool get_stale(MDB_val key, CBString& value, bool& fresh) const;                // can throw
+    CBString at(MDB_val key) const;                                                 // can throw mdb_notfound
+    CBString at(const CBString& key) const { return at(make_mdb_val(key)); }
+    bool contains(MDB_val key) const;                                               // can throw
+    // the deadline of a live entry (NEVER if it does not expire), pending touch included
+    uint64_t get_deadline(MDB_val key) const;                                       // can throw mdb_notfound
+
+    // deadline: milliseconds since the epoch, or NEVER. an empty metadata removes the metadata of key. sliding: the
+    // ttl in milliseconds that each read gives to the entry again, or 0
+    void insert(MDB_val key, MDB_val value, uint64_t deadline, MDB_val metadata=make_mdb_val(),
+                uint64_t sliding=0);                                                // can throw
+    void insert(const CBString& key, const CBString& value, uint64_t deadline) {
+        insert(make_mdb_val(key), make_mdb_val(value), deadline);
+    }
+    // inserts the entries in one write transaction. 'metadata' is either empty or as long as 'keys'
+    void insert_many(const vector<CBString>& keys, const vector<CBString>& values, const vector<CBString>& metadata,
+                     uint64_t deadline, uint64_t sliding=0);                        // can throw
+    // moves the entries of the former layout of ExpiryDict to this dict, in one write transaction, then deletes the
+    // former environments: old_dirname/index (key -> 'none' or the deadline in decimal seconds), old_dirname/values
+    // and old_dirname/metadata. The expired entries and the keys that this dict already has are skipped. Returns the
+    // number of entries moved, 0 if there is no former layout in old_dirname
+    size_t migrate_legacy_layout(const CBString& old_dirname);                      // can throw
+    // false if key is absent, expired or has no metadata
+    bool get_metadata(MDB_val key, CBString& metadata) const;                       // can throw
+    // changes the metadata of a live entry; false if key is absent or expired
+    bool set_metadata(MDB_val key, MDB_val metadata);                               // can throw
+    // changes the deadline of a live entry (and drops its sliding ttl); false if key is absent or expired
+    bool set_deadline(MDB_val key, uint64_t deadline);                              // can throw
+    // false if key is absent or expired
+    bool erase(MDB_val key);                                                        // can throw
+    bool pop(MDB_val key, CBString& value);                                         // can throw
+    bool pop(MDB_val key, CBString& value, CBString& metadata);                     // can throw
+    // removes the first live entry (in key order); false if there is none
+    bool pop_first(CBString& key, CBString& value);                                 // can throw
+    bool pop_first(CBString& key, CBString& value, CBString& metadata);             // can throw
+
+    // deletes at most max_entries expired entries (0: all of them) in one write transaction; returns their number
+    size_t prune_expired(size_t max_entries=0);                                     // can throw
+    // number of entries deleted by the pruning so far
+    uint64_t get_pruned() const BOOST_NOEXCEPT_OR_NOTHROW { return pruned.load(); }
+
+    // the pruning keeps the expired entries for 'grace' more milliseconds, for get_stale
+    void set_stale_grace(uint64_t grace) BOOST_NOEXCEPT_OR_NOTHROW { stale_grace.store(grace); }
+    uint64_t get_stale_grace() const BOOST_NOEXCEPT_OR_NOTHROW { return stale_grace.load(); }
+
+    // prunes every period_ms milliseconds, in batches of PRUNE_BATCH entries per transaction
+    void start_pruning(uint64_t period_ms);                                         // can throw
+    void stop_pruning();
+    bool is_pruning() const BOOST_NOEXCEPT_OR_NOTHROW { return bool(pruning_thread_ptr); }
+
+    // writes the pending touches in one write transaction; returns the number of deadlines that moved
+    size_t flush_touches();                                                         // can throw
+    touch_stats get_touch_stats() const;
+    // flushes the touches every period_ms milliseconds, or sooner when MAX_PENDING_TOUCHES are pending
+    void start_flushing_touches(uint64_t period_ms);                                // can throw
+    void stop_flushing_touches();
+    bool is_flushing_touches() const BOOST_NOEXCEPT_OR_NOTHROW { return bool(flushing_thread_ptr); }
+
+    // bounds the number of entries or the bytes of the keys and values (0: no limit). The reads by 'get' count as
+    // uses. Enabling it again changes the limits.
+    void enable_eviction(Evictor::policy_type policy, size_t max_entries, size_t max_bytes);   // can throw
+    Evictor::stats get_eviction_stats() const;                                  // can throw
+
+    // iterates over the live entries in key order, in one read snapshot. An entry that expires during the iteration is
+    // still returned.
+    class const_iterator: private boost::noncopyable {
+    private:
+        shared_ptr<const ExpiryPersistentDict> dict;
+        environment::transaction_ptr txn;
+        environment::cursor_ptr values_cursor;
+        environment::cursor_ptr deadlines_cursor;
+        environment::cursor_ptr metadata_cursor;
+        const uint64_t now;
+        bool reached_end;
+
+        // moves forward to the first live entry
+        void skip_expired();                                                        // can throw
+
+    public:
+        explicit const_iterator(shared_ptr<const ExpiryPersistentDict> d);         // can throw
+
+        bool has_reached_end() const BOOST_NOEXCEPT_OR_NOTHROW { return reached_end; }
+        CBString get_key() const;                                                   // can throw
+        CBString get_value() const;                                                 // can throw
+        uint64_t get_deadline() const;                                              // can throw
+        CBString get_metadata() const;                                              // empty if none; can throw
+        const_iterator& operator++();                                               // can throw
+
+    };  // END CLASS const_iterator
+
+};  // END CLASS ExpiryPersistentDict
+
+}   // END NS quiet
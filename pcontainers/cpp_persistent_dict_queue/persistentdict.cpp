@@ -3,10 +3,14 @@
 #include <stdexcept>
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <string.h>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/throw_exception.hpp>
 #include <boost/function.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/thread.hpp>
 #include "../lmdb_exceptions/lmdb_exceptions.h"
 #include "persistentdict.h"
 
@@ -27,6 +31,10 @@ void PersistentDict::init() {
     dirname = env->get_dirname();
     dbname.trim();
     dbi = env->get_dbi(dbname);
+    if (dbname.length() && env->has_dbi(dbname + ".changes")) {
+        changes_dbi = env->get_dbi(dbname + ".changes");
+        changes_opened.store(true);
+    }
 }
 
 void PersistentDict::copy_to(shared_ptr<PersistentDict> other, const CBString& first_key, const CBString& last_key, ssize_t chunk_size) const {
@@ -217,6 +225,137 @@ void PersistentDict::remove_if(binary_predicate binary_pred, const CBString& fir
 }
 
 
+// fills 'batch' with at most n items, starting from the current position of 'it'
+// returns false when the end of the interval has been reached
+static bool fill_batch(PersistentDict::abstract_iterator& it, const CBString& last_key, ssize_t n, items_batch& batch) {
+    batch.clear();
+    while ((ssize_t) batch.size() < n) {
+        if (it.has_reached_end()) {
+            return false;
+        }
+        pair<const CBString, CBString> p(it.get_item());
+        if (!key_is_in_interval(p.first, CBString(), last_key)) {
+            return false;
+        }
+        batch.push_back(make_pair(p.first, p.second));
+        ++it;
+    }
+    return true;
+}
+
+// moves 'it' to the first key strictly greater than 'key'
+static void skip_past(PersistentDict::abstract_iterator& it, const CBString& key) {
+    it.set_range(make_mdb_val(key));
+    if (!it.has_reached_end() && it.get_key() == key) {
+        ++it;
+    }
+}
+
+void PersistentDict::transform_values_batch(batch_functor batch_funct, const CBString& first_key, const CBString& last_key, ssize_t batch_size, ssize_t chunk_size) {
+    // values = f([(key, value), ...])
+    _LOG_DEBUG << "transform_values_batch(batch_functor)";
+    if (!*this) {
+        _LOG_INFO << "transform_values_batch: cancelled cause the dict is not initialized";
+        return;
+    }
+    if (!batch_funct) {
+        _LOG_INFO << "transform_values_batch: cancelled cause batch_funct is empty";
+        return;
+    }
+    if (chunk_size <= 0) {
+        chunk_size = SSIZE_MAX;
+    }
+    if (batch_size <= 0) {
+        batch_size = DEFAULT_BATCH_SIZE;
+    }
+    CBString next_key(first_key);
+    bool started = false;
+    bool key_in_range = true;
+    items_batch batch;
+    while (key_in_range) {
+        iterator it(iterator::range(shared_from_this(), next_key, false));
+        try {
+            if (started) {
+                skip_past(it, next_key);
+            }
+            for(ssize_t done = 0; key_in_range && done < chunk_size; done += batch.size()) {
+                key_in_range = fill_batch(it, last_key, std::min(batch_size, chunk_size - done), batch);
+                if (batch.empty()) {
+                    break;
+                }
+                vector<CBString> new_values(batch_funct(batch));
+                if (new_values.size() != batch.size()) {
+                    BOOST_THROW_EXCEPTION(runtime_error() << lmdb_error::what("transform_values_batch: the functor must return one value per item"));
+                }
+                for(size_t i = 0; i < batch.size(); ++i) {
+                    if (new_values[i] != batch[i].second) {
+                        it.set_key_value(batch[i].first, new_values[i]);
+                    }
+                }
+                next_key = batch.back().first;
+                started = true;
+                skip_past(it, next_key);
+            }
+        } catch (...) {
+            it.set_rollback();
+            throw;
+        }
+    }
+}
+
+void PersistentDict::remove_if_batch(batch_predicate batch_pred, const CBString& first_key, const CBString& last_key, ssize_t batch_size, ssize_t chunk_size) {
+    // remove_if(predicate([(key, value), ...]))
+    _LOG_DEBUG << "remove_if_batch(batch_predicate)";
+    if (!*this) {
+        _LOG_INFO << "remove_if_batch: cancelled cause the dict is not initialized";
+        return;
+    }
+    if (!batch_pred) {
+        _LOG_INFO << "remove_if_batch: cancelled cause batch_pred is empty";
+        return;
+    }
+    if (chunk_size <= 0) {
+        chunk_size = SSIZE_MAX;
+    }
+    if (batch_size <= 0) {
+        batch_size = DEFAULT_BATCH_SIZE;
+    }
+    CBString next_key(first_key);
+    bool started = false;
+    bool key_in_range = true;
+    items_batch batch;
+    while (key_in_range) {
+        iterator it(iterator::range(shared_from_this(), next_key, false));
+        try {
+            if (started) {
+                skip_past(it, next_key);
+            }
+            for(ssize_t done = 0; key_in_range && done < chunk_size; done += batch.size()) {
+                key_in_range = fill_batch(it, last_key, std::min(batch_size, chunk_size - done), batch);
+                if (batch.empty()) {
+                    break;
+                }
+                vector<bool> results(batch_pred(batch));
+                if (results.size() != batch.size()) {
+                    BOOST_THROW_EXCEPTION(runtime_error() << lmdb_error::what("remove_if_batch: the predicate must return one result per item"));
+                }
+                for(size_t i = 0; i < batch.size(); ++i) {
+                    if (results[i]) {
+                        it.del(make_mdb_val(batch[i].first));
+                    }
+                }
+                next_key = batch.back().first;
+                started = true;
+                skip_past(it, next_key);
+            }
+        } catch (...) {
+            it.set_rollback();
+            throw;
+        }
+    }
+}
+
+
 void PersistentDict::remove_duplicates(const CBString& first_key, const CBString& last_key) {
     _LOG_DEBUG << "PersistentDict::remove_duplicates()";
     if (!*this) {
@@ -272,6 +411,96 @@ void PersistentDict::remove_duplicates(const CBString& first_key, const CBString
     }
 }
 
+// counts the keys from the cursor position (included) up to last_key (excluded, or the end if empty)
+static size_t count_from(environment::cursor_ptr cursor, int res, const CBString& last_key) {
+    size_t n = 0;
+    if (!last_key.length()) {
+        for (; res == 0; res = cursor->next()) {
+            ++n;
+        }
+        return n;
+    }
+    MDB_val last = make_mdb_val(last_key);
+    MDB_val k = make_mdb_val();
+    for (; res == 0; res = cursor->next()) {
+        cursor->get_current_key(k);
+        if (compare_keys(k, last) >= 0) {
+            break;
+        }
+        ++n;
+    }
+    return n;
+}
+
+// position of the cursor in the B-tree, 1.0 when the cursor is past the end
+static double position_fraction(environment::cursor_ptr cursor, int res, double& uncertainty) {
+    double f = 1.0;
+    uncertainty = 0.0;
+    if (res == 0) {
+        cursor->fraction(f, uncertainty);
+    }
+    return f;
+}
+
+size_t PersistentDict::count_interval(const CBString& first_key, const CBString& last_key) const {
+    if (!*this) {
+        return 0;
+    }
+    if (first_key.length() && last_key.length() && first_key >= last_key) {
+        return 0;
+    }
+    environment::transaction_ptr txn = env->start_transaction();
+    size_t total = txn->size(dbi);
+    if (!first_key.length() && !last_key.length()) {
+        return total;
+    }
+    environment::cursor_ptr cursor = txn->make_cursor(dbi);
+    if (first_key.length() && last_key.length()) {
+        return count_from(cursor, cursor->after(make_mdb_val(first_key)), last_key);
+    }
+    // half-open interval: count the smallest side of the bound and deduce the other one from the total
+    const CBString& bound = first_key.length() ? first_key : last_key;
+    int res = cursor->after(make_mdb_val(bound));
+    double uncertainty;
+    double f = position_fraction(cursor, res, uncertainty);
+    size_t after_bound;
+    if (f >= 0.5) {
+        after_bound = count_from(cursor, res, CBString());
+    } else {
+        after_bound = total - count_from(cursor, cursor->first(), bound);
+    }
+    return first_key.length() ? after_bound : total - after_bound;
+}
+
+PersistentDict::count_estimate PersistentDict::estimate_interval(const CBString& first_key, const CBString& last_key) const {
+    count_estimate result;
+    result.estimate = result.low = result.high = 0;
+    if (!*this || (first_key.length() && last_key.length() && first_key >= last_key)) {
+        return result;
+    }
+    environment::transaction_ptr txn = env->start_transaction();
+    size_t total = txn->size(dbi);
+    environment::cursor_ptr cursor = txn->make_cursor(dbi);
+    double f_first = 0.0, u_first = 0.0, f_last = 1.0, u_last = 0.0;
+    if (first_key.length()) {
+        f_first = position_fraction(cursor, cursor->after(make_mdb_val(first_key)), u_first);
+    }
+    if (last_key.length()) {
+        f_last = position_fraction(cursor, cursor->after(make_mdb_val(last_key)), u_last);
+    }
+    double estimate = std::max(0.0, f_last - f_first) * total;
+    double error = (u_first + u_last) * total;
+    result.estimate = std::min(total, (size_t) (estimate + 0.5));
+    result.low = estimate > error ? (size_t) (estimate - error) : 0;
+    result.high = std::min(total, (size_t) (estimate + error) + 1);
+    result.low = std::min(result.low, result.estimate);
+    if (result.high <= EXACT_COUNT_THRESHOLD) {
+        // a few pages at most
+        result.estimate = result.low = result.high = count_interval(first_key, last_key);
+    }
+    return result;
+}
+
 size_t PersistentDict::count_interval_if(binary_predicate predicate, const CBString& first_key, const CBString& last_key) const {
     if (!*this) {
         return 0;
@@ -291,6 +520,32 @@ size_t PersistentDict::count_interval_if(binary_predicate predicate, const CBStr
 }
 
 
+size_t PersistentDict::count_interval_if_batch(batch_predicate batch_pred, const CBString& first_key, const CBString& last_key, ssize_t batch_size) const {
+    if (!*this || !batch_pred) {
+        return 0;
+    }
+    if (batch_size <= 0) {
+        batch_size = DEFAULT_BATCH_SIZE;
+    }
+    const_iterator it(const_iterator::range(shared_from_this(), first_key));
+    size_t n = 0;
+    bool key_in_range = true;
+    items_batch batch;
+    while (key_in_range) {
+        key_in_range = fill_batch(it, last_key, batch_size, batch);
+        if (batch.empty()) {
+            break;
+        }
+        vector<bool> results(batch_pred(batch));
+        if (results.size() != batch.size()) {
+            BOOST_THROW_EXCEPTION(runtime_error() << lmdb_error::what("count_interval_if_batch: the predicate must return one result per item"));
+        }
+        n += std::count(results.begin(), results.end(), true);
+    }
+    return n;
+}
+
+
 CBString PersistentDict::operator[] (const CBString& key) const {
     if (!key.length()) {
         BOOST_THROW_EXCEPTION(empty_key());
@@ -306,18 +561,133 @@ CBString PersistentDict::operator[] (const CBString& key) const {
 }
 
 
-CBString PersistentDict::at(MDB_val k) const {
+CBString PersistentDict::at(MDB_val k, uint64_t* entry_id) const {
     if (k.mv_size == 0 || k.mv_data == NULL) {
         BOOST_THROW_EXCEPTION(empty_key());
     }
-    if (!*this) {
+    if (!*this || !may_contain(k)) {
         BOOST_THROW_EXCEPTION(mdb_notfound());
     }
-    const_iterator it(shared_from_this(), k);
-    if (it.has_reached_end()) {
+    if (!read_cache_enabled.load()) {
+        if (entry_id) {
+            *entry_id = 0;
+        }
+        const_iterator it(shared_from_this(), k);
+        if (it.has_reached_end()) {
+            BOOST_THROW_EXCEPTION(mdb_notfound());
+        }
+        record_access(k);
+        return it.get_value();
+    }
+    CBString value;
+    if (read_cache->get(k, env->last_txnid(), &value, entry_id)) {
+        record_access(k);
+        return value;
+    }
+    if (entry_id) {
+        *entry_id = 0;
+    }
+    environment::transaction_ptr txn(env->start_transaction());
+    environment::cursor_ptr cursor(txn->make_cursor(dbi));
+    if (cursor->position(k) == MDB_NOTFOUND) {
         BOOST_THROW_EXCEPTION(mdb_notfound());
     }
-    return it.get_value();
+    MDB_val v = make_mdb_val();
+    cursor->get_current_value(v);
+    value = make_string(v);
+    uint64_t id = read_cache->put(k, value, txn->id());
+    if (entry_id) {
+        *entry_id = id;
+    }
+    record_access(k);
+    return value;
+}
+
+void PersistentDict::enable_read_cache(size_t capacity) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    lock_guard<mutex> guard(read_cache_lock);
+    // the write transactions in progress in the other threads finish first. The one of the current thread may have
+    // modified keys before the cache tracked them.
+    size_t untracked_until = 0;
+    if (!opts.read_only) {
+        bool in_write = env->in_write_transaction();
+        environment::transaction_ptr txn(env->start_transaction(false));
+        untracked_until = in_write ? txn->id() : 0;
+    }
+    if (read_cache) {
+        read_cache->resize(capacity, untracked_until);
+    } else {
+        read_cache = ReadCache::factory(capacity, untracked_until);
+    }
+    // once created, the cache object is never replaced: readers only need the flag
+    read_cache_enabled.store(capacity > 0);
+}
+
+void PersistentDict::enable_bloom_filter(bool sidecar) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    lock_guard<mutex> guard(bloom_lock);
+    if (bloom) {
+        return;
+    }
+    CBString sidecar_path;
+    if (sidecar) {
+        sidecar_path = dirname + "/" + (dbname.length() ? dbname : CBString("__default__")) + ".bloom";
+    }
+    bloom = BloomFilter::factory(env, dbi, !opts.read_only, sidecar_path);
+    bloom_enabled.store(true);
+}
+
+void PersistentDict::enable_eviction(Evictor::policy_type policy, size_t max_entries, size_t max_bytes) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    lock_guard<mutex> guard(evictor_lock);
+    if (evictor) {
+        if (evictor->get_policy() != policy) {
+            BOOST_THROW_EXCEPTION(std::invalid_argument("the eviction policy of a dict can't change"));
+        }
+        evictor->set_limits(max_entries, max_bytes);
+        return;
+    }
+    evictor = Evictor::factory(env, dbi, dbname, policy, max_entries, max_bytes);
+    evictor_enabled.store(true);
+}
+
+void PersistentDict::evict_entry(environment::transaction_ptr txn, MDB_val key) {
+    // the same bookkeeping as a deletion (change feed, read cache, Bloom filter)
+    record_change(txn, CHANGE_DEL, key);
+    environment::cursor_ptr cursor(txn->make_cursor(dbi));
+    if (cursor->position(key) == 0) {
+        cursor->del();
+    }
+}
+
+Evictor::stats PersistentDict::get_eviction_stats() const {
+    if (evictor_enabled.load()) {
+        return evictor->get_stats();
+    }
+    Evictor::stats empty_stats = Evictor::stats();
+    return empty_stats;
+}
+
+BloomFilter::stats PersistentDict::get_bloom_filter_stats() const {
+    if (bloom_enabled.load()) {
+        return bloom->get_stats();
+    }
+    BloomFilter::stats empty_stats = BloomFilter::stats();
+    return empty_stats;
+}
+
+ReadCache::stats PersistentDict::get_read_cache_stats() const {
+    if (read_cache_enabled.load()) {
+        return read_cache->get_stats();
+    }
+    ReadCache::stats empty_stats = ReadCache::stats();
+    return empty_stats;
 }
 
 CBString PersistentDict::pop(MDB_val k) {
@@ -351,6 +721,384 @@ CBString PersistentDict::setdefault(MDB_val k, MDB_val dflt) {
 }
 
 
+static inline bool equal_mdb_vals(MDB_val one, MDB_val other) BOOST_NOEXCEPT_OR_NOTHROW {
+    return one.mv_size == other.mv_size && (one.mv_size == 0 || memcmp(one.mv_data, other.mv_data, one.mv_size) == 0);
+}
+
+bool PersistentDict::compare_and_swap(MDB_val k, MDB_val expected, MDB_val new_value) {
+    if (k.mv_size == 0 || k.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    iterator it(shared_from_this(), k, false);
+    if (it.has_reached_end()) {
+        return false;
+    }
+    if (!equal_mdb_vals(it.get_value_buffer(), expected)) {
+        return false;
+    }
+    it.set_value(new_value);
+    return true;
+}
+
+bool PersistentDict::insert_if_absent(MDB_val k, MDB_val v) {
+    if (k.mv_size == 0 || k.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    iterator it(shared_from_this(), k, false);
+    if (!it.has_reached_end()) {
+        return false;
+    }
+    it.set_key_value(k, v);
+    return true;
+}
+
+bool PersistentDict::replace_if_present(MDB_val k, MDB_val v) {
+    if (k.mv_size == 0 || k.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    iterator it(shared_from_this(), k, false);
+    if (it.has_reached_end()) {
+        return false;
+    }
+    it.set_value(v);
+    return true;
+}
+
+MDB_dbi PersistentDict::get_versions_dbi() const {
+    if (!versions_opened.load()) {
+        lock_guard<mutex> guard(versions_lock);
+        if (!versions_opened.load()) {
+            if (!dbname.length()) {
+                // with the unnamed database, the companion database name would show up as a key of the dict
+                BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("versioned writes need a named database"));
+            }
+            versions_dbi = env->get_dbi(dbname + ".versions");
+            versions_opened.store(true);
+        }
+    }
+    return versions_dbi;
+}
+
+uint64_t PersistentDict::get_version(MDB_val k) const {
+    if (k.mv_size == 0 || k.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    MDB_dbi vdbi = get_versions_dbi();
+    environment::transaction_ptr txn(env->start_transaction());
+    environment::cursor_ptr vcursor(txn->make_cursor(vdbi));
+    if (vcursor->position(k) == MDB_NOTFOUND) {
+        return 0;
+    }
+    MDB_val v = make_mdb_val();
+    vcursor->get_current_value(v);
+    return cbstring_be_to_uint64(v);
+}
+
+pair<uint64_t, CBString> PersistentDict::versioned_at(MDB_val k) const {
+    if (k.mv_size == 0 || k.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    MDB_dbi vdbi = get_versions_dbi();
+    environment::transaction_ptr txn(env->start_transaction());
+    environment::cursor_ptr cursor(txn->make_cursor(dbi));
+    environment::cursor_ptr vcursor(txn->make_cursor(vdbi));
+    if (cursor->position(k) == MDB_NOTFOUND) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    MDB_val v = make_mdb_val();
+    cursor->get_current_value(v);
+    CBString value(make_string(v));
+    uint64_t version = 0;
+    if (vcursor->position(k) != MDB_NOTFOUND) {
+        vcursor->get_current_value(v);
+        version = cbstring_be_to_uint64(v);
+    }
+    return make_pair(version, value);
+}
+
+uint64_t PersistentDict::versioned_insert(MDB_val k, MDB_val v, uint64_t expected_version) {
+    if (k.mv_size == 0 || k.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    MDB_dbi vdbi = get_versions_dbi();
+    environment::transaction_ptr txn(env->start_transaction(false));
+    environment::cursor_ptr cursor(txn->make_cursor(dbi));
+    environment::cursor_ptr vcursor(txn->make_cursor(vdbi));
+    uint64_t version = 0;
+    if (vcursor->position(k) != MDB_NOTFOUND) {
+        MDB_val current = make_mdb_val();
+        vcursor->get_current_value(current);
+        version = cbstring_be_to_uint64(current);
+    }
+    if (version != expected_version) {
+        return 0;
+    }
+    CBString new_version(uint64_to_cbstring_be(version + 1));
+    vcursor->set_key_value(k, make_mdb_val(new_version));
+    cursor->set_key_value(k, v);
+    record_change(txn, CHANGE_SET, k);
+    return version + 1;
+}
+
+uint64_t PersistentDict::versioned_erase(MDB_val k, uint64_t expected_version) {
+    // the version stamp is kept (and incremented) so that a stale writer can't recreate the key
+    if (k.mv_size == 0 || k.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    MDB_dbi vdbi = get_versions_dbi();
+    environment::transaction_ptr txn(env->start_transaction(false));
+    environment::cursor_ptr cursor(txn->make_cursor(dbi));
+    environment::cursor_ptr vcursor(txn->make_cursor(vdbi));
+    if (cursor->position(k) == MDB_NOTFOUND) {
+        return 0;
+    }
+    uint64_t version = 0;
+    if (vcursor->position(k) != MDB_NOTFOUND) {
+        MDB_val current = make_mdb_val();
+        vcursor->get_current_value(current);
+        version = cbstring_be_to_uint64(current);
+    }
+    if (version != expected_version) {
+        return 0;
+    }
+    CBString new_version(uint64_to_cbstring_be(version + 1));
+    vcursor->set_key_value(k, make_mdb_val(new_version));
+    record_change(txn, CHANGE_DEL, k);
+    cursor->del();
+    return version + 1;
+}
+
+void PersistentDict::enable_changes() {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    lock_guard<mutex> guard(changes_lock);
+    if (changes_opened.load()) {
+        return;
+    }
+    if (!dbname.length()) {
+        BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("the change feed needs a named database"));
+    }
+    changes_dbi = env->get_dbi(dbname + ".changes");
+    changes_opened.store(true);
+}
+
+void PersistentDict::record_change(environment::transaction_ptr txn, char op, MDB_val key) {
+    if (read_cache_enabled.load()) {
+        if (op == CHANGE_CLEAR) {
+            read_cache->invalidate_all(*txn);
+        } else {
+            read_cache->invalidate(*txn, key);
+        }
+    }
+    if (bloom_enabled.load()) {
+        if (op == CHANGE_SET) {
+            bloom->added(*txn, key);
+        } else if (op == CHANGE_DEL) {
+            bloom->deleted(*txn);
+        } else {
+            bloom->cleared(*txn);
+        }
+    }
+    if (evictor_enabled.load()) {
+        if (op == CHANGE_SET) {
+            evictor->added(*txn, key);
+            evictor->evict(*txn, boost::bind(&PersistentDict::evict_entry, this, txn, _1), key);
+        } else if (op == CHANGE_DEL) {
+            evictor->deleted(*txn, key);
+        } else {
+            evictor->cleared(*txn);
+        }
+    }
+    if (!changes_opened.load()) {
+        return;
+    }
+    CBString record(&op, 1);
+    if (key.mv_size) {
+        record += CBString(key.mv_data, (int) key.mv_size);
+    }
+    environment::cursor_ptr cursor(txn->make_cursor(changes_dbi));
+    uint64_t seq = 1;
+    if (cursor->last() != MDB_NOTFOUND) {
+        MDB_val last_seq = make_mdb_val();
+        cursor->get_current_key(last_seq);
+        seq = cbstring_be_to_uint64(last_seq) + 1;
+    }
+    cursor->append_key_value(make_mdb_val(uint64_to_cbstring_be(seq)), make_mdb_val(record));
+}
+
+uint64_t PersistentDict::last_change() const {
+    if (!*this || !changes_opened.load()) {
+        return 0;
+    }
+    environment::transaction_ptr txn(env->start_transaction());
+    environment::cursor_ptr cursor(txn->make_cursor(changes_dbi));
+    if (cursor->last() == MDB_NOTFOUND) {
+        return 0;
+    }
+    MDB_val k = make_mdb_val();
+    cursor->get_current_key(k);
+    return cbstring_be_to_uint64(k);
+}
+
+vector<PersistentDict::change> PersistentDict::changes_since(uint64_t seq, size_t limit) const {
+    vector<change> result;
+    if (!*this || !changes_opened.load() || limit == 0) {
+        return result;
+    }
+    environment::transaction_ptr txn(env->start_transaction());
+    environment::cursor_ptr cursor(txn->make_cursor(changes_dbi));
+    CBString start(uint64_to_cbstring_be(seq + 1));
+    MDB_val k = make_mdb_val();
+    MDB_val v = make_mdb_val();
+    for (int res = cursor->after(make_mdb_val(start)); res == 0 && result.size() < limit; res = cursor->next()) {
+        cursor->get_current_key_value(k, v);
+        if (v.mv_size == 0) {
+            BOOST_THROW_EXCEPTION(mdb_currupted() << lmdb_error::what("invalid change record"));
+        }
+        change c;
+        c.seq = cbstring_be_to_uint64(k);
+        c.op = *((const char*) v.mv_data);
+        c.key = CBString((const char*) v.mv_data + 1, (int) v.mv_size - 1);
+        result.push_back(c);
+    }
+    return result;
+}
+
+uint64_t PersistentDict::wait_changes(uint64_t seq, long timeout_ms) const {
+    // the commits of the other processes are not signaled: poll the last sequence, with an increasing delay
+    boost::chrono::steady_clock::time_point deadline(boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeout_ms));
+    long delay_ms = 1;
+    while (true) {
+        uint64_t last = last_change();
+        if (last > seq) {
+            return last;
+        }
+        long remaining_ms = delay_ms;
+        if (timeout_ms >= 0) {
+            remaining_ms = (long) boost::chrono::duration_cast<boost::chrono::milliseconds>(deadline - boost::chrono::steady_clock::now()).count();
+            if (remaining_ms <= 0) {
+                return last;
+            }
+        }
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(std::min(delay_ms, remaining_ms)));
+        delay_ms = (delay_ms * 2 < MAX_CHANGES_POLL_MS) ? delay_ms * 2 : (long) MAX_CHANGES_POLL_MS;
+    }
+}
+
+size_t PersistentDict::truncate_changes(uint64_t seq) {
+    if (!*this || !changes_opened.load()) {
+        return 0;
+    }
+    environment::transaction_ptr txn(env->start_transaction(false));
+    environment::cursor_ptr cursor(txn->make_cursor(changes_dbi));
+    if (cursor->last() == MDB_NOTFOUND) {
+        return 0;
+    }
+    MDB_val k = make_mdb_val();
+    cursor->get_current_key(k);
+    seq = std::min(seq, cbstring_be_to_uint64(k));
+    size_t removed = 0;
+    for (int res = cursor->first(); res == 0; res = cursor->first()) {
+        cursor->get_current_key(k);
+        if (cbstring_be_to_uint64(k) >= seq) {
+            break;
+        }
+        cursor->del();
+        ++removed;
+    }
+    return removed;
+}
+
+PersistentDict::sync_summary PersistentDict::sync_to(shared_ptr<PersistentDict> other, const CBString& first_key,
+                                                     const CBString& last_key, bool remove_extra, ssize_t chunk_size) const {
+    sync_summary summary;
+    summary.inserted = summary.updated = summary.deleted = summary.unchanged = 0;
+    if (!*this) {
+        _LOG_DEBUG << "sync_to cancelled: source dict is not initialized";
+        return summary;
+    }
+    if (!other || !*other) {
+        BOOST_THROW_EXCEPTION(not_initialized() << lmdb_error::what("sync_to: the other dict is not initialized"));
+    }
+    if (*this == *other) {
+        _LOG_DEBUG << "sync_to cancelled: source and dest are the same dict";
+        return summary;
+    }
+    if (chunk_size <= 0) {
+        chunk_size = SSIZE_MAX;
+    }
+    MDB_val last = make_mdb_val(last_key);
+    const_iterator src_it(const_iterator::range(shared_from_this(), first_key));
+    bool src_in_range = !src_it.has_reached_end() && (!last_key.length() || compare_keys(src_it.get_key_buffer(), last) < 0);
+    CBString resume_key(first_key);
+    bool dest_in_range = true;
+    while (src_in_range || (remove_extra && dest_in_range)) {
+        iterator dest_it(iterator::range(other, resume_key, false));
+        dest_in_range = !dest_it.has_reached_end() && (!last_key.length() || compare_keys(dest_it.get_key_buffer(), last) < 0);
+        for (ssize_t visited = 0; visited < chunk_size && (src_in_range || (remove_extra && dest_in_range)); ++visited) {
+            int order = !src_in_range ? 1 : (!dest_in_range ? -1 : compare_keys(src_it.get_key_buffer(), dest_it.get_key_buffer()));
+            if (order < 0) {
+                dest_it.set_key_value(src_it.get_key_buffer(), src_it.get_value_buffer());
+                ++summary.inserted;
+            } else if (order == 0) {
+                MDB_val v = src_it.get_value_buffer();
+                if (equal_mdb_vals(v, dest_it.get_value_buffer())) {
+                    ++summary.unchanged;
+                } else {
+                    dest_it.set_value(v);
+                    ++summary.updated;
+                }
+            } else if (remove_extra) {
+                dest_it.del();
+                ++summary.deleted;
+            }
+            // after an insertion the destination cursor is on the new key: the next one is the same as before
+            ++dest_it;
+            if (order >= 0) {
+                dest_in_range = !dest_it.has_reached_end() && (!last_key.length() || compare_keys(dest_it.get_key_buffer(), last) < 0);
+            }
+            if (order <= 0) {
+                ++src_it;
+                src_in_range = !src_it.has_reached_end() && (!last_key.length() || compare_keys(src_it.get_key_buffer(), last) < 0);
+            }
+        }
+        // the next transaction starts at the first key that was not visited
+        if (src_in_range && dest_in_range) {
+            MDB_val s = src_it.get_key_buffer();
+            MDB_val d = dest_it.get_key_buffer();
+            resume_key = make_string(compare_keys(s, d) < 0 ? s : d);
+        } else if (src_in_range) {
+            resume_key = src_it.get_key();
+        } else if (dest_in_range) {
+            resume_key = dest_it.get_key();
+        }
+    }
+    return summary;
+}
+
+
 pair<CBString, CBString> PersistentDict::popitem() {
     if (!*this) {
         BOOST_THROW_EXCEPTION(empty_database());
@@ -407,6 +1155,7 @@ bool PersistentDict::iterator::del() {
     if (reached_end || reached_beginning) {
         return false;
     }
+    record_current_change(CHANGE_DEL);
     cursor->del();
     return true;
 }
@@ -420,6 +1169,7 @@ bool PersistentDict::iterator::del(MDB_val key) {
         reached_end = true;
         return false;
     }
+    dict->record_change(txn, CHANGE_DEL, key);
     cursor->del();
     return true;
 }
@@ -436,6 +1186,7 @@ void PersistentDict::iterator::append_key_value(MDB_val key, MDB_val value) {
     }
     unique_lock<shared_mutex> lock(lockable());
     cursor->append_key_value(key, value);
+    dict->record_change(txn, CHANGE_SET, key);
     reached_beginning = false;
     reached_end = false;
 }
@@ -451,6 +1202,7 @@ CBString PersistentDict::iterator::pop() {
     MDB_val v = make_mdb_val();
     cursor->get_current_value(v);
     CBString result = make_string(v);
+    record_current_change(CHANGE_DEL);
     cursor->del();
     return result;
 }
@@ -464,6 +1216,7 @@ void PersistentDict::iterator::set_value(const CBString& value) {
         BOOST_THROW_EXCEPTION(mdb_notfound());
     }
     cursor->set_current_value(make_mdb_val(value));
+    record_current_change(CHANGE_SET);
 }
 
 void PersistentDict::iterator::set_value(MDB_val v) {
@@ -478,6 +1231,7 @@ void PersistentDict::iterator::set_value(MDB_val v) {
         BOOST_THROW_EXCEPTION(mdb_notfound());
     }
     cursor->set_current_value(v);
+    record_current_change(CHANGE_SET);
 }
 
 void PersistentDict::iterator::set_key_value(MDB_val key, MDB_val value) {
@@ -492,6 +1246,7 @@ void PersistentDict::iterator::set_key_value(MDB_val key, MDB_val value) {
     }
     unique_lock<shared_mutex> lock(lockable());
     cursor->set_key_value(key, value);
+    dict->record_change(txn, CHANGE_SET, key);
     reached_beginning = false;
     reached_end = false;
 }
@@ -31,6 +31,9 @@
 #include "../lmdb_environment/lmdb_environment.h"
 #include "../utils/utils.h"
 #include "../logging/logging.h"
+#include "read_cache.h"
+#include "bloom_filter.h"
+#include "evictor.h"
 
 namespace quiet {
 
@@ -62,10 +65,20 @@ friend class BufferedPersistentDict;
 
 private:
     PersistentDict(const CBString& directory_name, const CBString& database_name, const lmdb_options& options):
-            dirname(directory_name), dbname(database_name), env(), dbi(), opts(options) { init(); }
+            dirname(directory_name), dbname(database_name), env(), dbi(), opts(options),
+            versions_dbi(), versions_opened(false), versions_lock(),
+            changes_dbi(), changes_opened(false), changes_lock(),
+            read_cache(), read_cache_enabled(false), read_cache_lock(),
+            bloom(), bloom_enabled(false), bloom_lock(),
+            evictor(), evictor_enabled(false), evictor_lock() { init(); }
 
     void init();                    // can throw
-    void close() BOOST_NOEXCEPT_OR_NOTHROW { env.reset(); }
+    void close() BOOST_NOEXCEPT_OR_NOTHROW {
+        if (bloom) {
+            bloom->stop();
+        }
+        env.reset();
+    }
 
 protected:
     CBString dirname;
@@ -74,6 +87,36 @@ protected:
     MDB_dbi dbi;
     const lmdb_options opts;
 
+    // companion database that stores the version stamps of the versioned writes
+    mutable MDB_dbi versions_dbi;
+    mutable boost::atomic_bool versions_opened;
+    mutable mutex versions_lock;
+    MDB_dbi get_versions_dbi() const;       // can throw
+
+    // companion database that logs the mutations of the dict, when the change feed is enabled
+    MDB_dbi changes_dbi;
+    boost::atomic_bool changes_opened;
+    mutex changes_lock;
+    // bookkeeping of a mutation, in its write transaction: invalidates the read cache, and appends a change
+    // record when the feed is enabled
+    void record_change(environment::transaction_ptr txn, char op, MDB_val key);     // can throw
+
+    // optional cache of the values read by 'at'
+    shared_ptr<ReadCache> read_cache;
+    boost::atomic_bool read_cache_enabled;
+    mutex read_cache_lock;
+
+    // optional filter of the absent keys, consulted by 'at' and 'contains'
+    shared_ptr<BloomFilter> bloom;
+    boost::atomic_bool bloom_enabled;
+    mutex bloom_lock;
+
+    // optional size bound, see Evictor
+    shared_ptr<Evictor> evictor;
+    boost::atomic_bool evictor_enabled;
+    mutex evictor_lock;
+    // the eviction of key, in the write transaction that crossed the limit
+    void evict_entry(environment::transaction_ptr txn, MDB_val key);                // can throw
 
 public:
     typedef CBString key_type;
@@ -108,6 +151,18 @@ public:
     void copy_to(shared_ptr<PersistentDict> other, const CBString& first_key=CBString(), const CBString& last_key=CBString(), ssize_t chunk_size=-1) const;
     void move_to(shared_ptr<PersistentDict> other, const CBString& first_key=CBString(), const CBString& last_key=CBString(), ssize_t chunk_size=-1);
 
+    // differential copy: walks both dicts in key order (merge-join) and only writes the missing keys, the changed
+    // values and, with remove_extra, the deletions of the keys that are not in this dict. The source is read in
+    // a single snapshot, the destination is written in transactions of 'chunk_size' visited keys.
+    struct sync_summary {
+        size_t inserted;
+        size_t updated;
+        size_t deleted;
+        size_t unchanged;
+    };
+    sync_summary sync_to(shared_ptr<PersistentDict> other, const CBString& first_key=CBString(), const CBString& last_key=CBString(),
+                         bool remove_extra=false, ssize_t chunk_size=-1) const;     // can throw
+
     bool erase(const CBString& key);
     bool erase(MDB_val key);
 
@@ -150,6 +205,88 @@ public:
 
     CBString setdefault(MDB_val k, MDB_val dflt);
 
+    // conditional writes: each one is done in a single write transaction
+    bool compare_and_swap(MDB_val k, MDB_val expected, MDB_val new_value);     // can throw
+    bool compare_and_swap(const CBString& key, const CBString& expected, const CBString& new_value) {
+        return compare_and_swap(make_mdb_val(key), make_mdb_val(expected), make_mdb_val(new_value));
+    }
+    bool insert_if_absent(MDB_val k, MDB_val v);                                // can throw
+    bool insert_if_absent(const CBString& key, const CBString& value) { return insert_if_absent(make_mdb_val(key), make_mdb_val(value)); }
+    bool replace_if_present(MDB_val k, MDB_val v);                              // can throw
+    bool replace_if_present(const CBString& key, const CBString& value) { return replace_if_present(make_mdb_val(key), make_mdb_val(value)); }
+
+    // versioned writes: each key written by versioned_insert or versioned_erase gets a version stamp that is
+    // incremented by each of these writes. Version 0 means that the key was never written by a versioned write.
+    // The stamps live in a companion database ("<dbname>.versions"), so a named database is required.
+    // The plain writes (insert, erase...) don't update the version stamps.
+    uint64_t get_version(MDB_val k) const;                                      // can throw
+    uint64_t get_version(const CBString& key) const { return get_version(make_mdb_val(key)); }
+    pair<uint64_t, CBString> versioned_at(MDB_val k) const;                     // can throw
+    pair<uint64_t, CBString> versioned_at(const CBString& key) const { return versioned_at(make_mdb_val(key)); }
+    // the write only happens if the current version of the key is 'expected_version'.
+    // returns the new version, or 0 if the version did not match
+    uint64_t versioned_insert(MDB_val k, MDB_val v, uint64_t expected_version);    // can throw
+    uint64_t versioned_insert(const CBString& key, const CBString& value, uint64_t expected_version) {
+        return versioned_insert(make_mdb_val(key), make_mdb_val(value), expected_version);
+    }
+    uint64_t versioned_erase(MDB_val k, uint64_t expected_version);             // can throw
+    uint64_t versioned_erase(const CBString& key, uint64_t expected_version) { return versioned_erase(make_mdb_val(key), expected_version); }
+
+    // change feed: once enabled, each mutation of the dict appends a (sequence, op, key) record to a companion
+    // database ("<dbname>.changes"), in the same write transaction as the mutation. Sequences start at 1 and
+    // increase by one per record. The feed is enabled for good: the dicts opened afterwards on the same database
+    // record the changes too (the dicts that were already opened by other processes don't).
+    enum change_op { CHANGE_SET = 's', CHANGE_DEL = 'd', CHANGE_CLEAR = 'c' };
+    struct change {
+        uint64_t seq;
+        char op;
+        CBString key;       // empty for CHANGE_CLEAR
+    };
+    void enable_changes();                                                      // can throw
+    bool has_changes() const BOOST_NOEXCEPT_OR_NOTHROW { return changes_opened.load(); }
+    // sequence of the last record, 0 if there is none
+    uint64_t last_change() const;                                               // can throw
+    // at most 'limit' records with a sequence greater than 'seq'
+    vector<change> changes_since(uint64_t seq, size_t limit=DEFAULT_BATCH_SIZE) const;   // can throw
+    // waits until there is a record with a sequence greater than 'seq', or timeout (negative: no timeout).
+    // returns the last sequence
+    uint64_t wait_changes(uint64_t seq, long timeout_ms=-1) const;              // can throw
+    static const long MAX_CHANGES_POLL_MS = 50;
+    // retention: removes the records with a sequence lower than 'seq', except the last record, which holds the
+    // current sequence. Returns the number of removed records.
+    size_t truncate_changes(uint64_t seq);                                      // can throw
+
+    // read cache: a bounded cache of the values returned by 'at', see ReadCache. It sees the writes of the other
+    // processes (the whole cache is dropped when they commit). A capacity of 0 disables it.
+    void enable_read_cache(size_t capacity);                                    // can throw
+    size_t get_read_cache_capacity() const { return read_cache_enabled.load() ? read_cache->get_capacity() : 0; }
+    ReadCache::stats get_read_cache_stats() const;
+
+    // Bloom filter of the keys, see BloomFilter: negative lookups don't open a transaction. It is built by a
+    // background scan, unless the sidecar file ("<dbname>.bloom" in the directory) written when the dict was
+    // closed is still valid.
+    void enable_bloom_filter(bool sidecar=true);                                // can throw
+    bool has_bloom_filter() const BOOST_NOEXCEPT_OR_NOTHROW { return bloom_enabled.load(); }
+    BloomFilter::stats get_bloom_filter_stats() const;
+
+    // size bound: the writes that make the dict go over max_entries entries or max_bytes bytes (keys and values, 0:
+    // no limit) evict the least recently (LRU) or the least frequently (LFU) used entries, in the same transaction.
+    // The ranks live in companion databases ("<dbname>.access" and "<dbname>.eviction"), so a named database is
+    // required. The reads by 'at' count as accesses. Enabling it again changes the limits.
+    void enable_eviction(Evictor::policy_type policy, size_t max_entries, size_t max_bytes);   // can throw
+    bool has_eviction() const BOOST_NOEXCEPT_OR_NOTHROW { return evictor_enabled.load(); }
+    // counts a read of key for the eviction (the reads that don't go through 'at')
+    void record_access(MDB_val key) const {
+        if (evictor_enabled.load()) {
+            evictor->accessed(key);
+        }
+    }
+    Evictor::stats get_eviction_stats() const;                                  // can throw
+    // false: the key is certainly absent
+    bool may_contain(MDB_val k) const {                                         // can throw
+        return !bloom_enabled.load() || bloom->may_contain(k, env->last_txnid());
+    }
+
     void transform_values(unary_functor unary_funct, const CBString& first_key="", const CBString& last_key="", ssize_t chunk_size=-1) {
         // value = f(value)
         binary_scalar_functor binary_funct = boost::bind(unary_funct, _2);
@@ -171,6 +308,11 @@ public:
     }
 
     void remove_if(binary_predicate binary_pred, const CBString& first_key="", const CBString& last_key="", ssize_t chunk_size=-1);
+
+    // batched variants: the callbacks are called once per batch of 'batch_size' (key, value) pairs
+    static const ssize_t DEFAULT_BATCH_SIZE = 1000;
+    void transform_values_batch(batch_functor batch_funct, const CBString& first_key="", const CBString& last_key="", ssize_t batch_size=-1, ssize_t chunk_size=-1);
+    void remove_if_batch(batch_predicate batch_pred, const CBString& first_key="", const CBString& last_key="", ssize_t batch_size=-1, ssize_t chunk_size=-1);
     void remove_duplicates(const CBString& first_key="", const CBString& last_key="");
     CBString get_dirname() const BOOST_NOEXCEPT_OR_NOTHROW { return dirname; }
     CBString get_dbname() const BOOST_NOEXCEPT_OR_NOTHROW { return dbname; }
@@ -194,15 +336,32 @@ public:
         return 0;
     }
 
-    size_t count_interval(const CBString& first_key=CBString(), const CBString& last_key=CBString()) const {
-        return count_interval_if(binary_predicate(), first_key, last_key);
-    }
+    // exact number of keys in [first_key, last_key): the keys are counted on the cursor, values are never copied
+    size_t count_interval(const CBString& first_key=CBString(), const CBString& last_key=CBString()) const;   // can throw
+
+    // approximate count, from the position of both bounds in the B-tree. [low, high] is the likely range of the exact
+    // count, assuming the sibling subtrees are of similar sizes: it is not a guaranteed bound.
+    struct count_estimate {
+        size_t estimate;
+        size_t low;
+        size_t high;
+    };
+
+    // below this bound the estimate is replaced by an exact count
+    static const size_t EXACT_COUNT_THRESHOLD = 4096;
+    count_estimate estimate_interval(const CBString& first_key=CBString(), const CBString& last_key=CBString()) const;   // can throw
 
     size_t count_interval_if(binary_predicate predicate, const CBString& first_key=CBString(), const CBString& last_key=CBString()) const;
+    size_t count_interval_if_batch(batch_predicate batch_pred, const CBString& first_key=CBString(), const CBString& last_key=CBString(), ssize_t batch_size=-1) const;
 
     void clear() {
         if (*this) {
+            environment::transaction_ptr txn = env->start_transaction(false);
             env->drop(dbi);
+            if (versions_opened.load()) {
+                env->drop(versions_dbi);
+            }
+            record_change(txn, CHANGE_CLEAR, make_mdb_val());
         }
     }
 
@@ -216,14 +375,16 @@ public:
     CBString operator[] (const CBString& key) const;
     CBString at(const CBString& key) const { return at(make_mdb_val(key)); }
     // todo: at, pop, contains, erase methods with iterator of keys
-    CBString at(MDB_val k) const;
+    // with the read cache, entry_id receives the id of the cache entry that holds the value (0 if not cached).
+    // When it already holds that id, the value is not copied and an empty string is returned.
+    CBString at(MDB_val k, uint64_t* entry_id=NULL) const;
     CBString pop(MDB_val k);
     CBString pop(const CBString& key) { return pop(make_mdb_val(key)); }
     pair<CBString, CBString> popitem();
     bool contains(const CBString& key) const { return contains(make_mdb_val(key)); }
 
     bool contains(MDB_val key) const {
-        if (key.mv_size == 0 || key.mv_data == NULL || (!*this)) {
+        if (key.mv_size == 0 || key.mv_data == NULL || (!*this) || !may_contain(key)) {
             return false;
         }
         return !const_iterator(shared_from_this(), key).has_reached_end();
@@ -300,27 +461,50 @@ public:
         insert_iterator& operator++(int) { return *this; }
 
         insert_iterator& operator=(const pair<CBString, CBString>& p) {
-            if (cursor) {
-                cursor->set_key_value(make_mdb_val(p.first), make_mdb_val(p.second));
-            }
-            return *this;
+            return operator=(make_pair(make_mdb_val(p.first), make_mdb_val(p.second)));
         }
 
         insert_iterator& operator=(const pair<const CBString, CBString>& p) {
-            if (cursor) {
-                cursor->set_key_value(make_mdb_val(p.first), make_mdb_val(p.second));
-            }
-            return *this;
+            return operator=(make_pair(make_mdb_val(p.first), make_mdb_val(p.second)));
         }
 
         insert_iterator& operator=(pair<MDB_val, MDB_val> p) {
             if (cursor) {
                 cursor->set_key_value(p.first, p.second);
+                dict->record_change(txn, CHANGE_SET, p.first);
             }
             return *this;
         }
     }; // end class insert_iterator
 
+    // a column of fields in Arrow's binary layout: field i is data[offsets[i]:offsets[i+1]] and offsets starts at 0.
+    // when width is not 0 the fields all have that size and are packed in data without offsets.
+    struct column {
+        size_t width;
+        vector<char> data;
+        vector<uint64_t> offsets;
+
+        explicit column(size_t w=0): width(w), data(), offsets() {
+            if (width == 0) {
+                offsets.push_back(0);
+            }
+        }
+
+        size_t size() const {
+            return width ? data.size() / width : offsets.size() - 1;
+        }
+
+        void append(const MDB_val& v) {         // can throw
+            if (width && v.mv_size != width) {
+                BOOST_THROW_EXCEPTION(std::invalid_argument("a field does not have the width of its column"));
+            }
+            data.insert(data.end(), (const char*) v.mv_data, (const char*) v.mv_data + v.mv_size);
+            if (!width) {
+                offsets.push_back(data.size());
+            }
+        }
+    };
+
     class abstract_iterator: public shared_lockable_adapter<shared_mutex> {
     protected:
         shared_ptr<environment::transaction::cursor> cursor;
@@ -423,6 +607,75 @@ public:
             }
         }
 
+        // copies at most n records, from the current position, to the end of 'data' (the key then the value when
+        // both are asked for), and moves past them. 'offsets' receives the end offset of each copied field.
+        // bound (if not empty) ends the iteration: at the first key >= bound, or at the first key < bound in reverse.
+        // returns the number of copied records.
+        size_t fill_batch(size_t n, bool with_keys, bool with_values, bool reverse, MDB_val bound,
+                          vector<char>& data, vector<size_t>& offsets) {                  // can throw
+            if (!cursor) {
+                BOOST_THROW_EXCEPTION(not_initialized());
+            }
+            unique_lock<shared_mutex> lock(lockable());
+            bool& finished = reverse ? reached_beginning : reached_end;
+            size_t count = 0;
+            MDB_val k = make_mdb_val();
+            MDB_val v = make_mdb_val();
+            while (count < n && !finished && !(reverse ? reached_end : reached_beginning)) {
+                cursor->get_current_key(k);
+                if (bound.mv_size && (reverse ? compare_keys(k, bound) < 0 : compare_keys(k, bound) >= 0)) {
+                    finished = true;
+                    break;
+                }
+                if (with_keys) {
+                    data.insert(data.end(), (const char*) k.mv_data, (const char*) k.mv_data + k.mv_size);
+                    offsets.push_back(data.size());
+                }
+                if (with_values) {
+                    cursor->get_current_value(v);
+                    data.insert(data.end(), (const char*) v.mv_data, (const char*) v.mv_data + v.mv_size);
+                    offsets.push_back(data.size());
+                }
+                ++count;
+                if ((reverse ? cursor->prev() : cursor->next()) == MDB_NOTFOUND) {
+                    finished = true;
+                }
+            }
+            return count;
+        }
+
+        // appends the keys and/or the values (a NULL column is skipped) of the records from the current position to
+        // the bound (see fill_batch) to their columns, and returns the number of records.
+        size_t fill_columns(bool reverse, MDB_val bound, column* keys, column* values) {     // can throw
+            if (!cursor) {
+                BOOST_THROW_EXCEPTION(not_initialized());
+            }
+            unique_lock<shared_mutex> lock(lockable());
+            bool& finished = reverse ? reached_beginning : reached_end;
+            size_t count = 0;
+            MDB_val k = make_mdb_val();
+            MDB_val v = make_mdb_val();
+            while (!finished && !(reverse ? reached_end : reached_beginning)) {
+                cursor->get_current_key(k);
+                if (bound.mv_size && (reverse ? compare_keys(k, bound) < 0 : compare_keys(k, bound) >= 0)) {
+                    finished = true;
+                    break;
+                }
+                if (keys) {
+                    keys->append(k);
+                }
+                if (values) {
+                    cursor->get_current_value(v);
+                    values->append(v);
+                }
+                ++count;
+                if ((reverse ? cursor->prev() : cursor->next()) == MDB_NOTFOUND) {
+                    finished = true;
+                }
+            }
+            return count;
+        }
+
     };
 
     template<bool B>
@@ -787,12 +1040,13 @@ public:
                 }
 
                 const CBString& operator=(const CBString& new_value) {
-                    (isecond.cursor)->set_current_value(make_mdb_val(new_value));
+                    operator=(make_mdb_val(new_value));
                     return new_value;
                 }
 
                 void operator=(MDB_val v) {
                     (isecond.cursor)->set_current_value(v);
+                    isecond.record_current_change(CHANGE_SET);
                 }
 
             }; // end class SecondFieldProxy
@@ -871,6 +1125,12 @@ public:
         PairProxy& operator*() { return pproxy; }
         PairProxy& operator->() { return pproxy; }
 
+        void record_current_change(char op) const {
+            MDB_val k = make_mdb_val();
+            cursor->get_current_key(k);
+            dict->record_change(txn, op, k);
+        }
+
         CBString pop();
         void set_value(const CBString& value);
         void set_value(MDB_val v);
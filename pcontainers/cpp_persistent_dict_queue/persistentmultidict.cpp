@@ -0,0 +1,182 @@
+#include <vector>
+#include <algorithm>
+#include <boost/throw_exception.hpp>
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "persistentmultidict.h"
+
+
+namespace quiet {
+
+using std::vector;
+using namespace utils;
+using Bstrlib::CBString;
+
+void PersistentMultiDict::init() {
+    dbname.trim();
+    if (!dbname.length()) {
+        // the main database also holds the names of the other databases: it can't have duplicates
+        BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("PersistentMultiDict needs a database name"));
+    }
+    env = lmdb::environment::factory(dirname, opts);
+    dirname = env->get_dirname();
+    unsigned int flags = MDB_DUPSORT;
+    if (fixed_size) {
+        flags |= MDB_DUPFIXED;
+    }
+    dbi = env->get_dbi(dbname, flags);
+    unsigned int actual_flags = env->start_transaction()->dbi_flags(dbi);
+    if ((actual_flags & flags) != flags) {
+        BOOST_THROW_EXCEPTION(mdb_incompatible() << lmdb_error::what("the database was not created as a multi dict"));
+    }
+}
+
+bool PersistentMultiDict::insert(MDB_val key, MDB_val value) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    return txn->make_cursor(dbi)->add_key_value(key, value);
+}
+
+size_t PersistentMultiDict::insert(const CBString& key, const vector<CBString>& values) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (!key.length()) {
+        BOOST_THROW_EXCEPTION(empty_key());
+    }
+    // sorted insertion: the cursor moves forward in the duplicates tree
+    vector<CBString> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    MDB_val k = make_mdb_val(key);
+    size_t added = 0;
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        environment::cursor_ptr cursor = txn->make_cursor(dbi);
+        for (vector<CBString>::const_iterator it(sorted.begin()); it != sorted.end(); ++it) {
+            if (cursor->add_key_value(k, make_mdb_val(*it))) {
+                ++added;
+            }
+        }
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+    return added;
+}
+
+bool PersistentMultiDict::erase(MDB_val key, MDB_val value) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        return false;
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    environment::cursor_ptr cursor = txn->make_cursor(dbi);
+    if (cursor->position(key, value) == MDB_NOTFOUND) {
+        return false;
+    }
+    cursor->del();      // only the current duplicate is deleted
+    return true;
+}
+
+size_t PersistentMultiDict::erase(MDB_val key) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    if (key.mv_size == 0 || key.mv_data == NULL) {
+        return 0;
+    }
+    environment::transaction_ptr txn = env->start_transaction(false);
+    environment::cursor_ptr cursor = txn->make_cursor(dbi);
+    if (cursor->position(key) == MDB_NOTFOUND) {
+        return 0;
+    }
+    size_t n = cursor->count_dups();
+    cursor->del_dups();
+    return n;
+}
+
+bool PersistentMultiDict::contains(MDB_val key) const {
+    if (key.mv_size == 0 || key.mv_data == NULL || (!*this)) {
+        return false;
+    }
+    return env->start_transaction()->make_cursor(dbi)->position(key) == 0;
+}
+
+bool PersistentMultiDict::contains(MDB_val key, MDB_val value) const {
+    if (key.mv_size == 0 || key.mv_data == NULL || (!*this)) {
+        return false;
+    }
+    return env->start_transaction()->make_cursor(dbi)->position(key, value) == 0;
+}
+
+size_t PersistentMultiDict::count(MDB_val key) const {
+    if (key.mv_size == 0 || key.mv_data == NULL || (!*this)) {
+        return 0;
+    }
+    environment::transaction_ptr txn = env->start_transaction();
+    environment::cursor_ptr cursor = txn->make_cursor(dbi);
+    if (cursor->position(key) == MDB_NOTFOUND) {
+        return 0;
+    }
+    return cursor->count_dups();
+}
+
+vector<CBString> PersistentMultiDict::values(MDB_val key) const {
+    vector<CBString> result;
+    if (key.mv_size == 0 || key.mv_data == NULL || (!*this)) {
+        return result;
+    }
+    environment::transaction_ptr txn = env->start_transaction();
+    environment::cursor_ptr cursor = txn->make_cursor(dbi);
+    if (cursor->position(key) == MDB_NOTFOUND) {
+        return result;
+    }
+    result.reserve(cursor->count_dups());
+    MDB_val v = make_mdb_val();
+    cursor->get_current_value(v);
+    size_t item_size = v.mv_size;
+    if (fixed_size && item_size > 0) {
+        // a page of values at a time: the values are contiguous in the page
+        MDB_val page = make_mdb_val();
+        int res = cursor->get_multiple(page);
+        while (res == 0) {
+            const char* p = (const char*) page.mv_data;
+            for (size_t offset = 0; offset + item_size <= page.mv_size; offset += item_size) {
+                result.push_back(CBString(p + offset, (int) item_size));
+            }
+            res = cursor->next_multiple(page);
+        }
+        return result;
+    }
+    do {
+        cursor->get_current_value(v);
+        result.push_back(make_string(v));
+    } while (cursor->next_dup() == 0);
+    return result;
+}
+
+vector<CBString> PersistentMultiDict::keys() const {
+    vector<CBString> result;
+    if (!*this) {
+        return result;
+    }
+    environment::transaction_ptr txn = env->start_transaction();
+    environment::cursor_ptr cursor = txn->make_cursor(dbi);
+    if (cursor->first() == MDB_NOTFOUND) {
+        return result;
+    }
+    MDB_val k = make_mdb_val();
+    do {
+        cursor->get_current_key(k);
+        result.push_back(make_string(k));
+    } while (cursor->next_nodup() == 0);
+    return result;
+}
+
+}   // END NS quiet
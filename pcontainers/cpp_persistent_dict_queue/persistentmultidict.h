@@ -0,0 +1,272 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <boost/shared_ptr.hpp>
+#include <boost/move/move.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/core/explicit_operator_bool.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <bstrlib/bstrwrap.h>
+
+#include "lmdb.h"
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "../utils/lmdb_options.h"
+#include "../lmdb_environment/lmdb_environment.h"
+#include "../utils/utils.h"
+#include "../logging/logging.h"
+
+namespace quiet {
+
+using std::pair;
+using std::make_pair;
+using std::vector;
+using boost::shared_ptr;
+using boost::enable_shared_from_this;
+using Bstrlib::CBString;
+using namespace lmdb;
+using namespace utils;
+
+// A persistent multimap, stored in a MDB_DUPSORT database: each key maps to a sorted set of values.
+// With fixed_size, all the values of the database must have the same length (MDB_DUPFIXED): the values of a key are
+// then read by whole pages (MDB_GET_MULTIPLE / MDB_NEXT_MULTIPLE).
+// Values must not be longer than the maximum key size (511 bytes by default).
+class PersistentMultiDict: public enable_shared_from_this<PersistentMultiDict>, private boost::noncopyable {
+private:
+    PersistentMultiDict(const CBString& directory_name, const CBString& database_name, const lmdb_options& options, bool fixed):
+            dirname(directory_name), dbname(database_name), env(), dbi(), opts(options), fixed_size(fixed) { init(); }
+
+    void init();                    // can throw
+    void close() BOOST_NOEXCEPT_OR_NOTHROW { env.reset(); }
+
+protected:
+    CBString dirname;
+    CBString dbname;
+    shared_ptr<environment> env;
+    MDB_dbi dbi;
+    const lmdb_options opts;
+    const bool fixed_size;
+
+public:
+    typedef CBString key_type;
+    typedef CBString mapped_type;
+    typedef pair<CBString, CBString> value_type;
+
+    BOOST_EXPLICIT_OPERATOR_BOOL_NOEXCEPT()
+    bool operator!() const BOOST_NOEXCEPT_OR_NOTHROW {
+        return !env;
+    }
+
+    static inline shared_ptr<PersistentMultiDict> factory(const CBString& directory_name, const CBString& database_name,
+                                                          const lmdb_options& options=lmdb_options(), bool fixed_size=false) {
+        return shared_ptr<PersistentMultiDict>(new PersistentMultiDict(directory_name, database_name, options, fixed_size));
+    }
+
+    ~PersistentMultiDict() { close(); }
+
+    CBString get_dirname() const BOOST_NOEXCEPT_OR_NOTHROW { return dirname; }
+    CBString get_dbname() const BOOST_NOEXCEPT_OR_NOTHROW { return dbname; }
+    bool is_fixed_size() const BOOST_NOEXCEPT_OR_NOTHROW { return fixed_size; }
+
+    // number of (key, value) pairs
+    size_t size() const {
+        if (!*this) {
+            return 0;
+        }
+        return env->size(dbi);
+    }
+
+    bool empty() const { return size() == 0; }
+
+    void clear() {
+        if (*this) {
+            env->drop(dbi);
+        }
+    }
+
+    // returns false if the (key, value) pair was already present
+    bool insert(const CBString& key, const CBString& value) { return insert(make_mdb_val(key), make_mdb_val(value)); }
+    bool insert(MDB_val key, MDB_val value);                                        // can throw
+    // adds several values to a key in one transaction; returns the number of new pairs
+    size_t insert(const CBString& key, const vector<CBString>& values);            // can throw
+
+    // removes a single (key, value) pair
+    bool erase(const CBString& key, const CBString& value) { return erase(make_mdb_val(key), make_mdb_val(value)); }
+    bool erase(MDB_val key, MDB_val value);                                         // can throw
+    // removes all the values of a key; returns the number of removed pairs
+    size_t erase(const CBString& key) { return erase(make_mdb_val(key)); }
+    size_t erase(MDB_val key);                                                      // can throw
+
+    bool contains(const CBString& key) const { return contains(make_mdb_val(key)); }
+    bool contains(MDB_val key) const;                                               // can throw
+    bool contains(const CBString& key, const CBString& value) const { return contains(make_mdb_val(key), make_mdb_val(value)); }
+    bool contains(MDB_val key, MDB_val value) const;                                // can throw
+
+    // number of values for key
+    size_t count(const CBString& key) const { return count(make_mdb_val(key)); }
+    size_t count(MDB_val key) const;                                                // can throw
+
+    // the sorted values of key
+    vector<CBString> values(const CBString& key) const { return values(make_mdb_val(key)); }
+    vector<CBString> values(MDB_val key) const;                                     // can throw
+
+    vector<CBString> keys() const;                                                  // can throw
+
+    // iterates over the (key, value) pairs, sorted by key and then by value
+    class iterator {
+    private:
+        BOOST_MOVABLE_BUT_NOT_COPYABLE(iterator)
+
+    protected:
+        shared_ptr<const PersistentMultiDict> dict;
+        environment::transaction_ptr txn;
+        environment::cursor_ptr cursor;
+        bool reached_end;
+
+        void swap(iterator& other) {
+            using std::swap;
+            swap(reached_end, other.reached_end);
+            dict.swap(other.dict);
+            cursor.swap(other.cursor);
+            txn.swap(other.txn);
+        }
+
+        void init(bool readonly) {
+            if (!dict || !*dict) {
+                BOOST_THROW_EXCEPTION(not_initialized());
+            }
+            txn = dict->env->start_transaction(readonly);
+            cursor = txn->make_cursor(dict->dbi);
+        }
+
+    public:
+        iterator(): dict(), txn(), cursor(), reached_end(true) { }
+
+        // positioned on the first pair
+        iterator(shared_ptr<const PersistentMultiDict> d, bool readonly=true): dict(d), txn(), cursor(), reached_end(true) {
+            init(readonly);
+            reached_end = cursor->first() == MDB_NOTFOUND;
+        }
+
+        // positioned on the first value of key
+        iterator(shared_ptr<const PersistentMultiDict> d, MDB_val key, bool readonly=true): dict(d), txn(), cursor(), reached_end(true) {
+            init(readonly);
+            set_position(key);
+        }
+
+        iterator(BOOST_RV_REF(iterator) other): dict(), txn(), cursor(), reached_end(true) {
+            swap(other);
+        }
+
+        iterator& operator=(BOOST_RV_REF(iterator) other) {
+            cursor.reset();
+            txn.reset();
+            dict.reset();
+            reached_end = true;
+            swap(other);
+            return *this;
+        }
+
+        ~iterator() {
+            cursor.reset();
+            txn.reset();
+        }
+
+        BOOST_EXPLICIT_OPERATOR_BOOL()
+        bool operator!() const { return !cursor; }
+
+        bool has_reached_end() const { return reached_end; }
+        void set_rollback(bool val=true) { if (txn) { txn->set_rollback(val); } }
+
+        bool set_position(MDB_val key) {
+            reached_end = cursor->position(key) == MDB_NOTFOUND;
+            return !reached_end;
+        }
+
+        bool set_position(MDB_val key, MDB_val value) {
+            reached_end = cursor->position(key, value) == MDB_NOTFOUND;
+            return !reached_end;
+        }
+
+        // next pair, whatever the key
+        iterator& operator++() {
+            if (!reached_end) {
+                reached_end = cursor->next() == MDB_NOTFOUND;
+            }
+            return *this;
+        }
+
+        // next value of the current key: returns false (and stays in place) after the last value
+        bool next_value() {
+            if (reached_end) {
+                return false;
+            }
+            return cursor->next_dup() == 0;
+        }
+
+        // first value of the next key
+        bool next_key() {
+            if (!reached_end) {
+                reached_end = cursor->next_nodup() == MDB_NOTFOUND;
+            }
+            return !reached_end;
+        }
+
+        // number of values of the current key
+        size_t count_values() {
+            if (reached_end) {
+                BOOST_THROW_EXCEPTION(mdb_notfound());
+            }
+            return cursor->count_dups();
+        }
+
+        CBString get_key() const {
+            if (reached_end) {
+                BOOST_THROW_EXCEPTION(mdb_notfound());
+            }
+            MDB_val k = make_mdb_val();
+            cursor->get_current_key(k);
+            return make_string(k);
+        }
+
+        CBString get_value() const {
+            return make_string(get_value_buffer());
+        }
+
+        MDB_val get_value_buffer() const {
+            if (reached_end) {
+                BOOST_THROW_EXCEPTION(mdb_notfound());
+            }
+            MDB_val v = make_mdb_val();
+            cursor->get_current_value(v);
+            return v;
+        }
+
+        pair<CBString, CBString> get_item() const {
+            if (reached_end) {
+                BOOST_THROW_EXCEPTION(mdb_notfound());
+            }
+            MDB_val k = make_mdb_val();
+            MDB_val v = make_mdb_val();
+            cursor->get_current_key_value(k, v);
+            return make_pair(make_string(k), make_string(v));
+        }
+
+        // removes the current pair
+        bool del() {
+            if (reached_end) {
+                return false;
+            }
+            cursor->del();
+            return true;
+        }
+
+    };  // END CLASS iterator
+
+    iterator begin(bool readonly=true) const { return iterator(shared_from_this(), readonly); }
+    iterator find(const CBString& key, bool readonly=true) const { return iterator(shared_from_this(), make_mdb_val(key), readonly); }
+
+};  // END CLASS PersistentMultiDict
+
+}   // END NS quiet
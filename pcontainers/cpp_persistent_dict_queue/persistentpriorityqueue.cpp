@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include "persistentpriorityqueue.h"
+
+
+namespace quiet {
+
+static const uint64_t SIGN_BIT = 0x8000000000000000ULL;
+// the key of the counter in sequence_dbi
+static const CBString SEQUENCE_KEY("next");
+
+void PersistentPriorityQueue::init(const CBString& directory_name, const CBString& database_name,
+                                   const lmdb_options& options) {
+    queue = shared_ptr<PersistentQueue>(new PersistentQueue(directory_name, database_name, options, true));
+    env = lmdb::environment::factory(queue->get_dirname(), options);
+    dbi = env->get_dbi(queue->get_dbname());
+    sequence_dbi = env->get_dbi(queue->get_dbname() + ".sequence");
+}
+
+CBString PersistentPriorityQueue::priority_prefix(int64_t priority) {
+    return uint64_to_cbstring_be(uint64_t(priority) ^ SIGN_BIT);
+}
+
+int64_t PersistentPriorityQueue::priority_of(MDB_val element) {
+    if (element.mv_size < 8) {
+        BOOST_THROW_EXCEPTION(mdb_incompatible() << lmdb_error::what("PersistentPriorityQueue: truncated element"));
+    }
+    MDB_val v;
+    v.mv_data = element.mv_data;
+    v.mv_size = 8;
+    return int64_t(cbstring_be_to_uint64(v) ^ SIGN_BIT);
+}
+
+CBString PersistentPriorityQueue::value_of(MDB_val element) {
+    if (element.mv_size < 8) {
+        BOOST_THROW_EXCEPTION(mdb_incompatible() << lmdb_error::what("PersistentPriorityQueue: truncated element"));
+    }
+    return CBString((char*) element.mv_data + 8, element.mv_size - 8);
+}
+
+uint64_t PersistentPriorityQueue::next_sequence(environment::transaction& txn, size_t n) {
+    environment::cursor_ptr cursor = txn.make_cursor(sequence_dbi);
+    uint64_t seq = 0;
+    if (cursor->position(make_mdb_val(SEQUENCE_KEY)) == 0) {
+        MDB_val v = make_mdb_val();
+        cursor->get_current_value(v);
+        seq = cbstring_be_to_uint64(v);
+    }
+    CBString next(uint64_to_cbstring_be(seq + n));
+    cursor->set_key_value(make_mdb_val(SEQUENCE_KEY), make_mdb_val(next));
+    return seq;
+}
+
+CBString PersistentPriorityQueue::insert(environment::transaction::cursor& cursor, int64_t priority, uint64_t seq,
+                                         MDB_val value) {
+    CBString prefix(priority_prefix(priority));
+    // the counter only grows: the new key is the last one of its priority
+    CBString key(prefix + uint64_to_cbstring_be(seq));
+    CBString element(prefix);
+    element += make_string(value);
+    cursor.set_key_value(make_mdb_val(key), make_mdb_val(element));
+    return key;
+}
+
+CBString PersistentPriorityQueue::push(int64_t priority, MDB_val value) {
+    CBString key;
+    {
+        boost::interprocess::scoped_lock<named_mutex> queue_lock(*queue->mutex);
+        environment::transaction_ptr txn = env->start_transaction(false);
+        try {
+            key = insert(*txn->make_cursor(dbi), priority, next_sequence(*txn, 1), value);
+        } catch (...) {
+            txn->set_rollback();
+            throw;
+        }
+    }
+    // after the commit and the unlock, like the pushes of the queue
+    queue->wakeup->notify(1);
+    return key;
+}
+
+vector<CBString> PersistentPriorityQueue::push(const vector<int64_t>& priorities, const vector<CBString>& values) {
+    if (priorities.size() != values.size()) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("one priority per value"));
+    }
+    vector<CBString> keys;
+    if (values.empty()) {
+        return keys;
+    }
+    keys.reserve(values.size());
+    {
+        boost::interprocess::scoped_lock<named_mutex> queue_lock(*queue->mutex);
+        environment::transaction_ptr txn = env->start_transaction(false);
+        try {
+            uint64_t seq = next_sequence(*txn, values.size());
+            environment::cursor_ptr cursor = txn->make_cursor(dbi);
+            for (size_t i = 0; i < values.size(); ++i) {
+                keys.push_back(insert(*cursor, priorities[i], seq + i, make_mdb_val(values[i])));
+            }
+        } catch (...) {
+            txn->set_rollback();
+            throw;
+        }
+    }
+    queue->wakeup->notify(std::min<size_t>(keys.size(), std::numeric_limits<uint32_t>::max()));
+    return keys;
+}
+
+bool PersistentPriorityQueue::peek(CBString& handle, CBString& element) const {
+    environment::transaction_ptr txn = env->start_transaction();
+    environment::cursor_ptr cursor = txn->make_cursor(dbi);
+    if (cursor->first() == MDB_NOTFOUND) {
+        return false;
+    }
+    MDB_val k = make_mdb_val();
+    MDB_val v = make_mdb_val();
+    cursor->get_current_key_value(k, v);
+    handle = make_string(k);
+    element = make_string(v);
+    return true;
+}
+
+bool PersistentPriorityQueue::change_priority(const CBString& handle, int64_t priority, CBString& new_handle) {
+    if (handle.length() != (int) KEY_SIZE) {
+        return false;
+    }
+    boost::interprocess::scoped_lock<named_mutex> queue_lock(*queue->mutex);
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        environment::cursor_ptr cursor = txn->make_cursor(dbi);
+        if (cursor->position(make_mdb_val(handle)) == MDB_NOTFOUND) {
+            return false;
+        }
+        MDB_val v = make_mdb_val();
+        cursor->get_current_value(v);
+        CBString value(value_of(v));
+        cursor->del();
+        new_handle = insert(*cursor, priority, next_sequence(*txn, 1), make_mdb_val(value));
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+    return true;
+}
+
+}   // END NS quiet
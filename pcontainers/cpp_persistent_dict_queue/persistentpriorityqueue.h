@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/core/explicit_operator_bool.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+#include "lmdb.h"
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "../utils/lmdb_options.h"
+#include "../lmdb_environment/lmdb_environment.h"
+#include "../utils/utils.h"
+#include "../logging/logging.h"
+#include "persistentqueue.h"
+
+namespace quiet {
+
+using std::vector;
+using boost::shared_ptr;
+using boost::chrono::milliseconds;
+using Bstrlib::CBString;
+using namespace lmdb;
+
+// A queue whose elements come out lowest priority first, and in the order of their pushes for one priority.
+//
+// The keys are the priority (8 bytes big-endian, sign bit flipped so that the negative priorities sort first) + a
+// sequence number (8 bytes big-endian). The sequence numbers come from a counter that is stored in the database
+// dbname.sequence and that never goes back (not even on clear): a push follows the last element of its priority, and a
+// handle is never given to two elements. The smallest element is the first key of the database, so a pop costs one
+// lookup in the B-tree, and a push one lookup plus the read and the write of the counter. The values are the priority
+// + the value, so that the pops, which only see the values, give the priority back (priority_of, value_of).
+//
+// The pops, the waiting pops (blocking or async) and the wakeups of the consumers of every process are the ones of
+// PersistentQueue: the queue is a PersistentQueue that pops the first key of the database instead of the head of its
+// sequence numbers. The key of an element is its handle: push returns it, peek and change_priority use it.
+class PersistentPriorityQueue: private boost::noncopyable {
+private:
+    PersistentPriorityQueue(const CBString& directory_name, const CBString& database_name,
+                            const lmdb_options& options): queue(), env(), dbi(), sequence_dbi() {
+        init(directory_name, database_name, options);
+    }
+
+    void init(const CBString& directory_name, const CBString& database_name, const lmdb_options& options);  // can throw
+
+    // reserves n sequence numbers in txn; returns the first one
+    uint64_t next_sequence(environment::transaction& txn, size_t n);                                    // can throw
+    // writes an element after the last element of its priority; returns its key
+    static CBString insert(environment::transaction::cursor& cursor, int64_t priority, uint64_t seq,
+                           MDB_val value);                                                              // can throw
+
+protected:
+    shared_ptr<PersistentQueue> queue;
+    shared_ptr<environment> env;
+    MDB_dbi dbi;
+    MDB_dbi sequence_dbi;
+
+public:
+    static const size_t KEY_SIZE = 16;
+
+    BOOST_EXPLICIT_OPERATOR_BOOL_NOEXCEPT()
+    bool operator!() const BOOST_NOEXCEPT_OR_NOTHROW {
+        return !env;
+    }
+
+    static inline shared_ptr<PersistentPriorityQueue> factory(const CBString& directory_name,
+                                                              const CBString& database_name="",
+                                                              const lmdb_options& options=lmdb_options()) {  // can throw
+        return shared_ptr<PersistentPriorityQueue>(new PersistentPriorityQueue(directory_name, database_name, options));
+    }
+
+    // the first 8 bytes of the keys and of the values
+    static CBString priority_prefix(int64_t priority);
+    // the priority and the value of a popped element
+    static int64_t priority_of(MDB_val element);                                    // can throw
+    static CBString value_of(MDB_val element);                                      // can throw
+
+    CBString get_dirname() const BOOST_NOEXCEPT_OR_NOTHROW { return queue->get_dirname(); }
+    CBString get_dbname() const BOOST_NOEXCEPT_OR_NOTHROW { return queue->get_dbname(); }
+
+    size_t size() const { return queue->size(); }                                   // can throw
+    bool empty() const { return queue->empty(); }                                   // can throw
+    void clear() { queue->clear(); }                                                // can throw
+
+    // pushes in one transaction, then wakes up one waiting consumer per element. returns the handles
+    CBString push(int64_t priority, MDB_val value);                                 // can throw
+    vector<CBString> push(const vector<int64_t>& priorities, const vector<CBString>& values);   // can throw
+
+    // copies the smallest element and its handle; false if the queue is empty
+    bool peek(CBString& handle, CBString& element) const;                           // can throw
+    // moves the element of 'handle' behind the elements of the new priority; false if it is not in the queue
+    // anymore (the handles are not reused). new_handle is the handle of the element from now on
+    bool change_priority(const CBString& handle, int64_t priority, CBString& new_handle);      // can throw
+
+    // the elements are returned as stored: priority + value
+    CBString pop() { return queue->pop_front(); }                                   // can throw
+    // up to n elements, smallest first, in one transaction; max_bytes as in PersistentQueue::pop_front_many
+    vector<CBString> pop_many(size_t n, size_t max_bytes=0) { return queue->pop_front_many(n, max_bytes); }
+    CBString wait_and_pop(milliseconds ms) { return queue->wait_and_pop_front(ms); }
+    CBString wait_and_pop() { return queue->wait_and_pop_front(); }
+    vector<CBString> wait_and_pop_many(size_t n, size_t max_bytes, milliseconds ms) {
+        return queue->wait_and_pop_front_many(n, max_bytes, ms);
+    }
+    vector<CBString> wait_and_pop_many(size_t n, size_t max_bytes=0) {
+        return queue->wait_and_pop_front_many(n, max_bytes);
+    }
+    PersistentQueue::SharedFuture async_wait_and_pop() { return queue->async_wait_and_pop_front(); }
+    PersistentQueue::SharedFuture async_wait_and_pop(milliseconds ms) { return queue->async_wait_and_pop_front(ms); }
+
+};  // END CLASS PersistentPriorityQueue
+
+}   // END NS quiet
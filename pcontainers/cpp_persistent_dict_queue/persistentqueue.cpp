@@ -7,6 +7,7 @@
 #include <map>
 #include <utility>
 #include <algorithm>
+#include <limits>
 #include <stdlib.h>
 #include <bstrlib/bstrwrap.h>
 #include "persistentqueue.h"
@@ -80,62 +81,343 @@ void PersistentQueue::move_to(shared_ptr<PersistentQueue> other, ssize_t chunk_s
 }
 
 
-PersistentQueue::back_insert_iterator& PersistentQueue::back_insert_iterator::operator=(MDB_val v) {
-    if (!*this) {
-        BOOST_THROW_EXCEPTION(not_initialized());
+uint64_t PersistentQueue::sequence_of(MDB_val key) {
+    if (key.mv_size != 8) {
+        BOOST_THROW_EXCEPTION( lmdb_error() << lmdb_error::what("A key in the database is not a sequence number") );
     }
-    MDB_val k = make_mdb_val();
-    CBString insert_key;
+    return cbstring_be_to_uint64(key);
+}
 
-    int res = (direction > 0) ? cursor->last() : cursor->first();
-    if (res == MDB_NOTFOUND) {
-        insert_key = longlong_to_cbstring(MIDDLE);
+void PersistentQueue::load_sequences(environment::transaction::cursor& cursor) {
+    sequence_cache& cache = *sequences;
+    size_t last = the_dict->env->last_txnid();
+    if (cache.valid && cache.txnid == last) {
+        return;
+    }
+    cache.valid = false;
+    MDB_val k = make_mdb_val();
+    if (cursor.first() == MDB_NOTFOUND) {
+        cache.empty = true;
     } else {
+        cursor.get_current_key(k);
+        cache.head = sequence_of(k);
+        cursor.last();
+        cursor.get_current_key(k);
+        cache.tail = sequence_of(k);
+        cache.empty = false;
+    }
+    cache.txnid = last;
+    cache.valid = true;
+}
+
+void PersistentQueue::sequences_ended(shared_ptr<sequence_cache> cache, size_t txnid, bool commited) {
+    lock_guard<boost::mutex> guard(cache->lock);
+    // a transaction that didn't write the queue leaves the cache as it was: it commits nothing, so its id would never
+    // be the id of the last commited transaction
+    if (cache->dirty) {
+        if (!commited) {
+            cache->valid = false;
+        } else if (cache->valid) {
+            // the cache describes the queue as of this commit
+            cache->txnid = txnid;
+        }
+    }
+    cache->dirty = false;
+}
+
+void PersistentQueue::migrate_keys() {
+    if (!*this) {
+        return;
+    }
+    boost::interprocess::scoped_lock<named_mutex> queue_lock(*mutex);
+    environment::transaction_ptr txn = the_dict->env->start_transaction(false);
+    try {
+        environment::cursor_ptr cursor = txn->make_cursor(the_dict->dbi);
+        MDB_val k = make_mdb_val();
+        if (cursor->first() == MDB_NOTFOUND) {
+            return;
+        }
+        // the decimal keys sort before the sequence numbers of the current format (the first byte of a digit is lower)
         cursor->get_current_key(k);
-        insert_key = make_string(k);
-        long long int_k = strtoull(insert_key, NULL, 10);
-        if (int_k == 0) {
-            BOOST_THROW_EXCEPTION( lmdb_error() << lmdb_error::what("A key in the database in not an integer key") );
+        if (k.mv_size != (size_t) NDIGITS) {
+            return;
+        }
+        vector<CBString> old_keys;
+        for (int res = 0; res == 0; res = cursor->next()) {
+            cursor->get_current_key(k);
+            if (k.mv_size != (size_t) NDIGITS) {
+                break;
+            }
+            old_keys.push_back(make_string(k));
+        }
+        MDB_val v = make_mdb_val();
+        for (vector<CBString>::const_iterator it = old_keys.begin(); it != old_keys.end(); ++it) {
+            unsigned long long seq = strtoull((const char*) it->data, NULL, 10);
+            if (seq == 0) {
+                BOOST_THROW_EXCEPTION( lmdb_error() << lmdb_error::what("A key in the database is not an integer key") );
+            }
+            cursor->position(make_mdb_val(*it));
+            cursor->get_current_value(v);
+            CBString value(make_string(v));
+            cursor->del();
+            cursor->set_key_value(make_mdb_val(uint64_to_cbstring_be(seq)), make_mdb_val(value));
         }
-        insert_key = longlong_to_cbstring(int_k + direction, NDIGITS);
+        _LOG_INFO << "PersistentQueue: migrated " << old_keys.size() << " decimal keys to sequence numbers";
+    } catch (...) {
+        txn->set_rollback();
+        throw;
     }
-    k = make_mdb_val(insert_key);
-    if (direction > 0) {
-        cursor->append_key_value(k, v);
-    } else {
-        cursor->set_key_value(k, v);
+}
+
+PersistentQueue::back_insert_iterator& PersistentQueue::back_insert_iterator::operator=(MDB_val v) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
     }
-    new_elements = true;
+    sequence_cache& cache = *the_queue->sequences;
+    lock_guard<boost::mutex> guard(cache.lock);
+    try {
+        the_queue->load_sequences(*cursor);
+        uint64_t seq;
+        if (cache.empty) {
+            seq = MIDDLE;
+        } else {
+            seq = (direction > 0) ? cache.tail + 1 : cache.head - 1;
+        }
+        CBString key(uint64_to_cbstring_be(seq));
+        MDB_val k = make_mdb_val(key);
+        if (direction > 0) {
+            cursor->append_key_value(k, v);
+        } else {
+            cursor->set_key_value(k, v);
+        }
+        cache.dirty = true;
+        if (cache.empty) {
+            cache.head = cache.tail = seq;
+            cache.empty = false;
+        } else if (direction > 0) {
+            cache.tail = seq;
+        } else {
+            cache.head = seq;
+        }
+    } catch (...) {
+        cache.valid = false;
+        throw;
+    }
+    ++new_elements;
     return *this;
 }
 
+bool PersistentQueue::pop_end(environment::transaction::cursor& cursor, int direction, size_t max_size,
+                              CBString& value) {
+    if (priority_keys) {
+        if ((direction > 0 ? cursor.last() : cursor.first()) == MDB_NOTFOUND) {
+            return false;
+        }
+        MDB_val v = make_mdb_val();
+        cursor.get_current_value(v);
+        if (v.mv_size > max_size) {
+            return false;
+        }
+        value = CBString(v.mv_data, v.mv_size);
+        cursor.del();
+        return true;
+    }
+    sequence_cache& cache = *sequences;
+    try {
+        load_sequences(cursor);
+        if (cache.empty) {
+            return false;
+        }
+        // the cached end of the queue may be a hole left by remove_if: then look for the actual end
+        bool hole = false;
+        CBString end_key(uint64_to_cbstring_be(direction > 0 ? cache.tail : cache.head));
+        if (cursor.position(make_mdb_val(end_key)) == MDB_NOTFOUND) {
+            hole = true;
+            if ((direction > 0 ? cursor.last() : cursor.first()) == MDB_NOTFOUND) {
+                cache.empty = true;
+                return false;
+            }
+        }
+        MDB_val k = make_mdb_val();
+        MDB_val v = make_mdb_val();
+        cursor.get_current_key_value(k, v);
+        if (v.mv_size > max_size) {
+            return false;
+        }
+        uint64_t seq = sequence_of(k);
+        value = CBString(v.mv_data, v.mv_size);
+        cursor.del();
+        cache.dirty = true;
+        if (hole) {
+            // the next user reloads the cache
+            cache.valid = false;
+        } else if (seq == (direction > 0 ? cache.head : cache.tail)) {
+            cache.empty = true;
+        } else if (direction > 0) {
+            cache.tail = seq - 1;
+        } else {
+            cache.head = seq + 1;
+        }
+        return true;
+    } catch (...) {
+        cache.valid = false;
+        throw;
+    }
+}
 
-void PersistentQueue::iiterator::_next_value() {
-    unique_lock<shared_mutex> lock(lockable());
-    if (bool(cursor) && cursor->first() != MDB_NOTFOUND) {
-        MDB_val v;
-        cursor->get_current_value(v);
-        current_value.reset(new CBString(v.mv_data, v.mv_size));
-        cursor->del();
-    } else {
-        _LOG_DEBUG << "iiterator: no next_value";
-        current_value.reset();
+bool PersistentQueue::pop_many(int direction, size_t n, size_t max_bytes, vector<CBString>& values) {
+    shared_ptr<environment::transaction> txn(the_dict->env->start_transaction(false));
+    txn->on_end(boost::bind(&PersistentQueue::sequences_ended, sequences, _1, _2));
+    bool more;
+    try {
+        shared_ptr<environment::transaction::cursor> cursor(txn->make_cursor(the_dict->dbi));
+        lock_guard<boost::mutex> guard(sequences->lock);
+        size_t bytes = 0;
+        CBString value;
+        while (values.size() < n) {
+            // the first element is taken whatever its size, so that a big element can't block the queue
+            size_t room = std::numeric_limits<size_t>::max();
+            if (max_bytes && !values.empty()) {
+                room = bytes < max_bytes ? max_bytes - bytes : 0;
+            }
+            if (!pop_end(*cursor, direction, room, value)) {
+                break;
+            }
+            bytes += value.length();
+            values.push_back(value);
+        }
+        if (priority_keys) {
+            more = cursor->first() != MDB_NOTFOUND;
+        } else {
+            more = !(sequences->valid && sequences->empty);
+        }
+    } catch (...) {
+        txn->set_rollback();
+        throw;
     }
+    // commit, not under the lock of the cache: the hooks of the transaction take it
+    txn.reset();
+    return more;
 }
 
-void PersistentQueue::iiterator::_last_value() {
+bool PersistentQueue::wait_and_pop(size_t n, size_t max_bytes, const ptime& deadline, vector<CBString>& values) {
+    bool woken = true;
+    while (true) {
+        // read the sequence before looking at the queue: a push after the look moves it, and the wait returns at once
+        uint32_t seen = wakeup->sequence();
+        bool more;
+        {
+            boost::interprocess::scoped_lock<named_mutex> queue_lock(*mutex);
+            more = pop_many(-1, n, max_bytes, values);
+        }
+        if (!values.empty()) {
+            if (more) {
+                // the wakeup that this call consumed may have been meant for one of the elements that are left
+                wakeup->notify(1);
+            }
+            return true;
+        }
+        if (!woken || stopping_flag.load()) {
+            return false;
+        }
+        woken = wakeup->wait(seen, deadline);
+    }
+}
+
+ptime PersistentQueue::deadline_after(milliseconds ms) {
+    long duration_in_ms = LongLong2Long::convert(ms.count());
+    return boost::date_time::microsec_clock<boost::posix_time::ptime>::universal_time() + millisec(duration_in_ms);
+}
+
+CBString PersistentQueue::wait_and_pop_front(milliseconds ms) {
+    vector<CBString> values;
+    if (!wait_and_pop(1, 0, deadline_after(ms), values)) {
+        BOOST_THROW_EXCEPTION ( empty_database() );
+    }
+    return values.front();
+}
+
+CBString PersistentQueue::wait_and_pop_front() {
+    vector<CBString> values;
+    if (!wait_and_pop(1, 0, ptime(boost::posix_time::not_a_date_time), values)) {
+        BOOST_THROW_EXCEPTION ( lmdb::stopping_ops() );
+    }
+    return values.front();
+}
+
+vector<CBString> PersistentQueue::pop_front_many(size_t n, size_t max_bytes) {
+    vector<CBString> values;
+    boost::interprocess::scoped_lock<named_mutex> queue_lock(*mutex);
+    pop_many(-1, n, max_bytes, values);
+    return values;
+}
+
+vector<CBString> PersistentQueue::pop_back_many(size_t n, size_t max_bytes) {
+    vector<CBString> values;
+    boost::interprocess::scoped_lock<named_mutex> queue_lock(*mutex);
+    pop_many(1, n, max_bytes, values);
+    return values;
+}
+
+bool PersistentQueue::try_pop_front_many(vector<CBString>& values, size_t n, size_t max_bytes) {
+    boost::interprocess::scoped_lock<named_mutex> queue_lock(*mutex, boost::interprocess::try_to_lock);
+    if (!queue_lock) {
+        return false;
+    }
+    pop_many(-1, n, max_bytes, values);
+    return true;
+}
+
+vector<CBString> PersistentQueue::wait_and_pop_front_many(size_t n, size_t max_bytes, milliseconds ms) {
+    vector<CBString> values;
+    if (n == 0) {
+        return values;
+    }
+    if (!wait_and_pop(n, max_bytes, deadline_after(ms), values)) {
+        BOOST_THROW_EXCEPTION ( empty_database() );
+    }
+    return values;
+}
+
+vector<CBString> PersistentQueue::wait_and_pop_front_many(size_t n, size_t max_bytes) {
+    vector<CBString> values;
+    if (n == 0) {
+        return values;
+    }
+    if (!wait_and_pop(n, max_bytes, ptime(boost::posix_time::not_a_date_time), values)) {
+        BOOST_THROW_EXCEPTION ( lmdb::stopping_ops() );
+    }
+    return values;
+}
+
+void PersistentQueue::iiterator::_pop(int direction) {
     unique_lock<shared_mutex> lock(lockable());
-    if (bool(cursor) && cursor->last() != MDB_NOTFOUND) {
-        MDB_val v;
-        cursor->get_current_value(v);
-        current_value.reset(new CBString(v.mv_data, v.mv_size));
-        cursor->del();
+    if (!cursor) {
+        current_value.reset();
+        return;
+    }
+    CBString value;
+    bool popped;
+    {
+        lock_guard<boost::mutex> guard(the_queue->sequences->lock);
+        popped = the_queue->pop_end(*cursor, direction, std::numeric_limits<size_t>::max(), value);
+    }
+    if (popped) {
+        current_value.reset(new CBString(value));
     } else {
-        _LOG_DEBUG << "iiterator: no last_value";
+        _LOG_DEBUG << "iiterator: no value";
         current_value.reset();
     }
 }
 
+void PersistentQueue::iiterator::_next_value() {
+    _pop(-1);
+}
+
+void PersistentQueue::iiterator::_last_value() {
+    _pop(1);
+}
+
 
 
 }
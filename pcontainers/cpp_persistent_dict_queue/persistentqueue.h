@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <limits>
+#include <algorithm>
 #include <boost/core/ref.hpp>
 #include <boost/container/vector.hpp>
 #include <boost/numeric/conversion/converter.hpp>
@@ -22,7 +24,6 @@
 #include <boost/thread/future.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/interprocess/sync/named_mutex.hpp>
-#include <boost/interprocess/sync/named_condition.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/chrono/chrono.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
@@ -32,6 +33,7 @@
 #include "persistentdict.h"
 #include "../utils/promise_queue.h"
 #include "../utils/packaged_task_queue.h"
+#include "../utils/wakeup_signal.h"
 #include "../logging/logging.h"
 #include "lmdb.h"
 
@@ -57,7 +59,6 @@ using boost::make_exceptional;
 
 // interprocess locks
 using boost::interprocess::named_mutex;
-using boost::interprocess::named_condition;
 using boost::interprocess::open_or_create;
 
 // chrono
@@ -77,7 +78,15 @@ using Bstrlib::CBString;
 
 typedef boost::numeric::converter<long, long long> LongLong2Long ;
 
+class PersistentWorkQueue;
+class PersistentPriorityQueue;
+
 class PersistentQueue: public enable_shared_from_this<PersistentQueue>, private boost::noncopyable {
+    // leases elements in the transactions of the queue
+    friend class PersistentWorkQueue;
+    // pushes with priority keys, pops and waits with the queue
+    friend class PersistentPriorityQueue;
+
 public:
     typedef CBString value_type;
     typedef CBString& reference;
@@ -100,15 +109,55 @@ private:
     mutable scoped_ptr<utils::packaged_task_queue> push_queue;
 
     scoped_ptr<named_mutex> mutex;
-    scoped_ptr<named_condition> queue_is_empty;
+    // the pushes of every process wake up the waiting pops through it
+    scoped_ptr<utils::WakeupSignal> wakeup;
+
+    // The sequence numbers of the first and of the last element, so that the pushes and the pops don't look for them.
+    // Only used under the named mutex, in a write transaction; 'lock' protects it from the hooks of the transactions.
+    // The cache is valid as long as the last commited transaction of the environment is the one that last updated it:
+    // a transaction commited by another process (or by another object of this process) makes the next user reload it.
+    struct sequence_cache {
+        boost::mutex lock;
+        bool valid;
+        bool empty;
+        bool dirty;             // the current write transaction changed the queue
+        uint64_t head;
+        uint64_t tail;
+        size_t txnid;
+        sequence_cache(): lock(), valid(false), empty(true), dirty(false), head(0), tail(0), txnid(0) { }
+    };
+    shared_ptr<sequence_cache> sequences;
+    // the keys are not sequence numbers but sorted keys of a PersistentPriorityQueue: the pops take the first or the
+    // last key of the database, the cache is not used
+    bool priority_keys;
+
+    // reloads the cache from the database if another transaction was commited since it was updated (lock held)
+    void load_sequences(environment::transaction::cursor& cursor);                                 // can throw
+    // the commit or the abort of a write transaction that used the cache
+    static void sequences_ended(shared_ptr<sequence_cache> cache, size_t txnid, bool commited);
+    // rewrites the decimal keys of the previous format as sequence numbers
+    void migrate_keys();                                                                            // can throw
+    // pops the first (direction < 0) or the last (direction > 0) element into value, unless it is longer than
+    // max_size. returns false if nothing was popped. the lock of the cache is held
+    bool pop_end(environment::transaction::cursor& cursor, int direction, size_t max_size, CBString& value);  // can throw
+    // pops up to n elements from one end, in one transaction (the named mutex is held). returns false if the queue
+    // is known to be empty afterwards
+    bool pop_many(int direction, size_t n, size_t max_bytes, vector<CBString>& values);             // can throw
+    // pops up to n elements from the front, waiting until deadline for the first one if the queue is empty.
+    // false on timeout, or if the queue is stopping
+    bool wait_and_pop(size_t n, size_t max_bytes, const ptime& deadline, vector<CBString>& values); // can throw
+    static ptime deadline_after(milliseconds ms);
 
     PersistentQueue(const PersistentQueue& other);
     PersistentQueue& operator=(const PersistentQueue&);
 
-    PersistentQueue(const CBString& directory_name, const CBString& database_name, const lmdb_options& options):
+    PersistentQueue(const CBString& directory_name, const CBString& database_name, const lmdb_options& options,
+                    bool priority_keys=false):
             stopping_flag(false),
             dispatcher_is_running_flag(false),
             pusher_is_running_flag(false),
+            sequences(new sequence_cache()),
+            priority_keys(priority_keys),
             the_dict(PersistentDict::factory(directory_name, database_name, options))
 
         {
@@ -119,21 +168,25 @@ private:
         boost::hash<std::string> string_hash;
         CBString cb_name(the_dict->get_dirname() + "/###/" + the_dict->get_dbname());
         CBString cb_mutex_name(cb_name + "/mutex");
-        CBString cb_condition_name(cb_name + "/condition");
+        CBString cb_wakeup_name(cb_name + "/wakeup");
         std::string mutex_name((const char*)cb_mutex_name, cb_mutex_name.length());
-        std::string condition_name((const char*)cb_condition_name, cb_condition_name.length());
+        std::string wakeup_name((const char*)cb_wakeup_name, cb_wakeup_name.length());
         size_t mutex_h = string_hash(mutex_name);
-        size_t condition_h = string_hash(condition_name);
+        size_t wakeup_h = string_hash(wakeup_name);
         cb_mutex_name.format("%u", mutex_h);
-        cb_condition_name.format("%u", condition_h);
+        cb_wakeup_name.format("pqueue-%u.wakeup", wakeup_h);
         cb_mutex_name = "persistent_mutex" + cb_mutex_name;
-        cb_condition_name = "persistent_condition" + cb_condition_name;
+        // the file of the wakeup channel lives beside the files of the environment
+        cb_wakeup_name = the_dict->get_dirname() + (the_dict->get_options().no_subdir ? "-" : "/") + cb_wakeup_name;
         mutex.reset(new named_mutex(open_or_create, cb_mutex_name));
-        queue_is_empty.reset(new named_condition(open_or_create, cb_condition_name));
+        wakeup.reset(new utils::WakeupSignal(std::string((const char*)cb_wakeup_name, cb_wakeup_name.length())));
     }
 
     void start() {
         create_interprocess_sync_objects();
+        if (!priority_keys) {
+            migrate_keys();
+        }
         start_dispatcher_thread();
         start_pusher_thread();
     }
@@ -197,7 +250,7 @@ private:
     void stop_dispatcher_thread() {
         _LOG_DEBUG << "Stopping dispatcher thread";
         waiters.reset();    // the promise_queue destructor unblocks waiters->wait_and_pop() in the dispatcher
-        queue_is_empty->notify_all();
+        wakeup->notify_all();
         if (dispatcher_thread_ptr && dispatcher_thread_ptr->joinable()) {
             dispatcher_thread_ptr->join();
             dispatcher_thread_ptr.reset();
@@ -213,26 +266,23 @@ private:
             PromisePtr waiter = waiters->wait_and_pop();
             if (waiter) {   // waiter can be NULL if the promise_queue was stopped cause of end of operations
                 _LOG_DEBUG << "dispatcher_thread: got a waiter";
-                boost::interprocess::scoped_lock<named_mutex> queue_lock(*mutex);
-                while (empty() && !stopping_flag.load() && !waiter.expired()) {
-                    queue_is_empty->timed_wait(queue_lock, waiter.get_next_waiting_point());
+                vector<CBString> values;
+                bool popped;
+                try {
+                    popped = wait_and_pop(1, 0, waiter.get_expiry_point(), values);
+                } catch (...) {
+                    waiter->set_exception(boost::current_exception());
+                    continue;
                 }
-                if (stopping_flag.load()) {
+                if (popped) {
+                    _LOG_DEBUG << "dispatcher_thread: pushing the element to the waiter";
+                    waiter->set_value(values.front());
+                } else if (stopping_flag.load()) {
                     _LOG_DEBUG << "dispatcher_thread: cancelling the waiter: stopping";
-                    queue_lock.unlock();
                     waiter->set_exception(boost::copy_exception(lmdb::stopping_ops()));
-                } else if (waiter.expired()) {
+                } else {
                     _LOG_DEBUG << "dispatcher_thread: waiter is expired";
-                    queue_lock.unlock();
                     waiter->set_exception(copy_exception(lmdb::expired()));
-                } else {
-                    _LOG_DEBUG << "dispatcher_thread: pushing the element to the waiter";
-                    try {
-                        CBString value(*iiterator(shared_from_this(), 0, queue_lock));
-                        waiter->set_value(value);
-                    } catch (...) {
-                        waiter->set_exception(boost::current_exception());
-                    }
                 }
             } else {
                 _LOG_DEBUG << "dispatcher_thread: waiter is empty (stopping indication)";
@@ -260,9 +310,15 @@ private:
 
 protected:
     shared_ptr<PersistentDict> the_dict;        // PersistentDict is a member: implemented in terms of
-    static const long long MIDDLE = 4611686018427387903;
+    // the keys are 8 bytes big-endian sequence numbers: the first element of an empty queue gets MIDDLE, push_back
+    // increments the sequence of the last element, push_front decrements the sequence of the first one
+    static const uint64_t MIDDLE = 4611686018427387903ULL;
+    // the length of the decimal keys of the previous format
     static const int NDIGITS = 19;
 
+    // the sequence number of a key; throws if the key is not a sequence number
+    static uint64_t sequence_of(MDB_val key);                                                       // can throw
+
 
 public:
     BOOST_EXPLICIT_OPERATOR_BOOL_NOEXCEPT()
@@ -306,7 +362,7 @@ public:
     protected:
         boost::atomic_bool initialized;
         int direction;
-        bool new_elements;
+        size_t new_elements;
         boost::interprocess::scoped_lock<named_mutex> queue_lock;
         shared_ptr<PersistentQueue> the_queue;
         shared_ptr<environment::transaction> txn;
@@ -326,11 +382,12 @@ public:
                 initialized.store(false);
                 cursor.reset();
                 txn.reset();
+                queue_lock.unlock();
                 if (new_elements) {
-                    the_queue->queue_is_empty->notify_all();
+                    // one sleeper per new element
+                    the_queue->wakeup->notify(std::min<size_t>(new_elements, std::numeric_limits<uint32_t>::max()));
                 }
-                queue_lock.unlock();
-                new_elements = false;
+                new_elements = 0;
                 the_queue.reset();
             }
         }
@@ -344,14 +401,15 @@ public:
         BOOST_EXPLICIT_OPERATOR_BOOL()
         bool operator!() const { return !initialized.load(); }
 
-        back_insert_iterator(): initialized(false), direction(1), new_elements(false), the_queue(), txn(), cursor() { }
+        back_insert_iterator(): initialized(false), direction(1), new_elements(0), the_queue(), txn(), cursor() { }
 
         back_insert_iterator(shared_ptr<PersistentQueue> q):
-                initialized(false), direction(1), new_elements(false), queue_lock(), the_queue(), txn(), cursor() {
+                initialized(false), direction(1), new_elements(0), queue_lock(), the_queue(), txn(), cursor() {
             if (bool(q) && bool(*q)) {
                 the_queue = q;
                 queue_lock = boost::interprocess::scoped_lock<named_mutex>(*(the_queue->mutex));
                 txn = the_queue->the_dict->env->start_transaction(false);
+                txn->on_end(boost::bind(&PersistentQueue::sequences_ended, the_queue->sequences, _1, _2));
                 cursor = txn->make_cursor(the_queue->the_dict->dbi);
                 initialized.store(true);
             }
@@ -464,6 +522,8 @@ public:
         shared_ptr<environment::transaction> txn;
         shared_ptr<environment::transaction::cursor> cursor;
 
+        // pops the first (direction < 0) or the last (direction > 0) element into current_value
+        void _pop(int direction);
         void _next_value();
         void _last_value();
 
@@ -504,6 +564,7 @@ public:
                 the_queue = q;
                 queue_lock = boost::move(lock);
                 txn = the_queue->the_dict->env->start_transaction(false);
+                txn->on_end(boost::bind(&PersistentQueue::sequences_ended, the_queue->sequences, _1, _2));
                 cursor = txn->make_cursor(the_queue->the_dict->dbi);
                 if (pos > 0) {
                     _last_value();
@@ -523,6 +584,7 @@ public:
                 the_queue = q;
                 queue_lock = boost::interprocess::scoped_lock<named_mutex>(*(the_queue->mutex));
                 txn = the_queue->the_dict->env->start_transaction(false);
+                txn->on_end(boost::bind(&PersistentQueue::sequences_ended, the_queue->sequences, _1, _2));
                 cursor = txn->make_cursor(the_queue->the_dict->dbi);
                 if (pos > 0) {
                     _last_value();
@@ -640,6 +702,8 @@ public:
 
     void remove_if(unary_predicate unary_pred) { the_dict->remove_if_pred_value(unary_pred); }
     void transform_values(unary_functor unary_funct) { the_dict->transform_values(unary_funct); }
+    void remove_if_batch(batch_predicate batch_pred, ssize_t batch_size=-1) { the_dict->remove_if_batch(batch_pred, "", "", batch_size); }
+    void transform_values_batch(batch_functor batch_funct, ssize_t batch_size=-1) { the_dict->transform_values_batch(batch_funct, "", "", batch_size); }
     void move_to(shared_ptr<PersistentQueue> other, ssize_t chunk_size=-1);
 
 
@@ -734,6 +798,16 @@ public:
     CBString pop_back() { return CBString(*iiterator(shared_from_this(), 1)); }
     CBString pop_front() { return CBString(*iiterator(shared_from_this())); }
 
+    // pop up to n elements in one transaction. when max_bytes is not 0, stop before the element that would make the
+    // total size bigger than max_bytes; the first element is always popped though. empty if the queue is empty
+    vector<CBString> pop_front_many(size_t n, size_t max_bytes=0);                                 // can throw
+    vector<CBString> pop_back_many(size_t n, size_t max_bytes=0);                                  // can throw
+    // like pop_front_many, but returns false at once if another thread or process holds the queue
+    bool try_pop_front_many(vector<CBString>& values, size_t n, size_t max_bytes=0);              // can throw
+    // wait for one element at least, then pop up to n elements like pop_front_many
+    vector<CBString> wait_and_pop_front_many(size_t n, size_t max_bytes, milliseconds ms);         // can throw
+    vector<CBString> wait_and_pop_front_many(size_t n, size_t max_bytes=0);                        // can throw
+
     SharedFuture async_wait_and_pop_front() {
         //_LOG_DEBUG << "wait_and_pop_front_in_thread";
         return waiters->create();
@@ -744,30 +818,8 @@ public:
         return waiters->create(ms);
     }
 
-    CBString wait_and_pop_front(milliseconds ms) {
-        boost::interprocess::scoped_lock<named_mutex> queue_lock(*mutex);
-
-        long duration_in_ms = LongLong2Long::convert(ms.count());
-        ptime now = boost::date_time::microsec_clock<boost::posix_time::ptime>::universal_time();
-        ptime stop_point = now + millisec(duration_in_ms);
-
-        bool no_timeout = true;
-        while (empty() && no_timeout) {
-            no_timeout = queue_is_empty->timed_wait(queue_lock, stop_point);
-        }
-        if (no_timeout) {
-            return CBString(*iiterator(shared_from_this(), 0, queue_lock));
-        }
-        BOOST_THROW_EXCEPTION ( empty_database() );
-    }
-
-    CBString wait_and_pop_front() {
-        boost::interprocess::scoped_lock<named_mutex> queue_lock(*mutex);
-        while (empty()) {
-            queue_is_empty->wait(queue_lock);
-        }
-        return CBString(*iiterator(shared_from_this(), 0, queue_lock));
-    }
+    CBString wait_and_pop_front(milliseconds ms);                                                 // can throw
+    CBString wait_and_pop_front();                                                                // can throw
 
     template <class OutputIterator>
     void pop_all(OutputIterator oit) {
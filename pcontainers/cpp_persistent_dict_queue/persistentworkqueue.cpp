@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include "persistentworkqueue.h"
+
+
+namespace quiet {
+
+using boost::lock_guard;
+using boost::unique_lock;
+
+// the key of the counter in lease_ids_dbi
+static const CBString NEXT_LEASE_ID_KEY("next");
+
+static inline uint64_t now_ms() BOOST_NOEXCEPT_OR_NOTHROW {
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(
+        boost::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+// the 8 bytes big-endian number at 'offset' of a record
+static inline uint64_t read_number(MDB_val record, size_t offset) {     // can throw
+    if (record.mv_size < offset + 8) {
+        BOOST_THROW_EXCEPTION(mdb_incompatible() << lmdb_error::what("PersistentWorkQueue: truncated record"));
+    }
+    MDB_val v;
+    v.mv_data = (char*) record.mv_data + offset;
+    v.mv_size = 8;
+    return cbstring_be_to_uint64(v);
+}
+
+// the bytes of a record after 'offset'
+static inline CBString read_value(MDB_val record, size_t offset) {      // can throw
+    return CBString((char*) record.mv_data + offset, record.mv_size - offset);
+}
+
+static inline CBString ready_record(uint64_t attempts, MDB_val value) {     // can throw
+    CBString r(uint64_to_cbstring_be(attempts));
+    r += make_string(value);
+    return r;
+}
+
+void PersistentWorkQueue::init(const CBString& directory_name, const CBString& database_name,
+                               const lmdb_options& options) {
+    CBString name(database_name);
+    name.trim();
+    if (!name.length()) {
+        // the companion databases are named after the queue
+        BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("PersistentWorkQueue needs a database name"));
+    }
+    queue = PersistentQueue::factory(directory_name, name, options);
+    env = lmdb::environment::factory(queue->get_dirname(), options);
+    inflight_dbi = env->get_dbi(name + ".inflight");
+    leases_dbi = env->get_dbi(name + ".leases");
+    dead_dbi = env->get_dbi(name + ".dead");
+    lease_ids_dbi = env->get_dbi(name + ".lease_ids");
+}
+
+uint64_t PersistentWorkQueue::next_lease_id(environment::transaction& txn, size_t n) {
+    environment::cursor_ptr cursor = txn.make_cursor(lease_ids_dbi);
+    uint64_t id = 1;
+    if (cursor->position(make_mdb_val(NEXT_LEASE_ID_KEY)) == 0) {
+        MDB_val v = make_mdb_val();
+        cursor->get_current_value(v);
+        id = cbstring_be_to_uint64(v);
+    }
+    CBString next(uint64_to_cbstring_be(id + n));
+    cursor->set_key_value(make_mdb_val(NEXT_LEASE_ID_KEY), make_mdb_val(next));
+    return id;
+}
+
+void PersistentWorkQueue::clear() {
+    // the drops join the write transaction of this thread
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        queue->clear();
+        env->drop(inflight_dbi);
+        env->drop(leases_dbi);
+        env->drop(dead_dbi);
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+}
+
+void PersistentWorkQueue::push_back(MDB_val value) {
+    queue->push_back(ready_record(0, value));
+}
+
+void PersistentWorkQueue::push_back(const vector<CBString>& values) {
+    PersistentQueue::back_insert_iterator it(queue);
+    for (vector<CBString>::const_iterator v = values.begin(); v != values.end(); ++v) {
+        it = ready_record(0, make_mdb_val(*v));
+    }
+}
+
+bool PersistentWorkQueue::lease_locked(size_t n, uint64_t visibility_ms, vector<leased_element>& leased) {
+    environment::transaction_ptr txn = env->start_transaction(false);
+    bool more;
+    try {
+        vector<CBString> values;
+        // the pop joins this transaction: an element is never both out of the queue and not in flight
+        more = queue->pop_many(-1, n < MAX_LEASE ? n : MAX_LEASE, 0, values);
+        if (values.empty()) {
+            return more;
+        }
+        uint64_t deadline = now_ms() + visibility_ms;
+        uint64_t first_id = next_lease_id(*txn, values.size());
+        environment::cursor_ptr inflight = txn->make_cursor(inflight_dbi);
+        environment::cursor_ptr leases = txn->make_cursor(leases_dbi);
+        leased.reserve(values.size());
+        for (size_t i = 0; i < values.size(); ++i) {
+            MDB_val ready = make_mdb_val(values[i]);
+            uint64_t attempts = read_number(ready, 0) + 1;
+            CBString value(read_value(ready, 8));
+            CBString key(uint64_to_cbstring_be(first_id + i));
+            CBString record(uint64_to_cbstring_be(deadline));
+            record += uint64_to_cbstring_be(attempts);
+            record += value;
+            // the ids of a lease are bigger than the ids of the previous leases
+            inflight->append_key_value(make_mdb_val(key), make_mdb_val(record));
+            CBString index(uint64_to_cbstring_be(deadline));
+            index += key;
+            leases->set_key_value(make_mdb_val(index), make_mdb_val());
+            leased.push_back(leased_element(first_id + i, attempts, value));
+        }
+    } catch (...) {
+        txn->set_rollback();
+        leased.clear();
+        throw;
+    }
+    return more;
+}
+
+vector<PersistentWorkQueue::leased_element> PersistentWorkQueue::lease(size_t n, uint64_t visibility_ms) {
+    vector<leased_element> leased;
+    boost::interprocess::scoped_lock<named_mutex> queue_lock(*queue->mutex);
+    lease_locked(n, visibility_ms, leased);
+    return leased;
+}
+
+vector<PersistentWorkQueue::leased_element> PersistentWorkQueue::wait_and_lease(size_t n, uint64_t visibility_ms,
+                                                                                const ptime& deadline) {
+    vector<leased_element> leased;
+    if (n == 0) {
+        return leased;
+    }
+    bool woken = true;
+    while (true) {
+        // the same protocol as the waiting pops of the queue
+        uint32_t seen = queue->wakeup->sequence();
+        bool more;
+        {
+            boost::interprocess::scoped_lock<named_mutex> queue_lock(*queue->mutex);
+            more = lease_locked(n, visibility_ms, leased);
+        }
+        if (!leased.empty()) {
+            if (more) {
+                queue->wakeup->notify(1);
+            }
+            return leased;
+        }
+        if (!woken) {
+            BOOST_THROW_EXCEPTION ( empty_database() );
+        }
+        woken = queue->wakeup->wait(seen, deadline);
+    }
+}
+
+bool PersistentWorkQueue::take(environment::transaction& txn, uint64_t id, uint64_t& attempts, CBString& value) {
+    CBString key(uint64_to_cbstring_be(id));
+    environment::cursor_ptr inflight = txn.make_cursor(inflight_dbi);
+    if (inflight->position(make_mdb_val(key)) == MDB_NOTFOUND) {
+        return false;
+    }
+    MDB_val record = make_mdb_val();
+    inflight->get_current_value(record);
+    uint64_t deadline = read_number(record, 0);
+    attempts = read_number(record, 8);
+    value = read_value(record, 16);
+    inflight->del();
+    CBString index(uint64_to_cbstring_be(deadline));
+    index += key;
+    environment::cursor_ptr leases = txn.make_cursor(leases_dbi);
+    if (leases->position(make_mdb_val(index)) == 0) {
+        leases->del();
+    }
+    return true;
+}
+
+void PersistentWorkQueue::requeue(environment::transaction& txn, PersistentQueue::front_insert_iterator& front,
+                                  uint64_t id, uint64_t attempts, const CBString& value) {
+    uint64_t max = max_attempts.load();
+    if (max && attempts >= max) {
+        _LOG_WARNING << "PersistentWorkQueue: element leased " << attempts << " times goes to the dead letters";
+        CBString key(uint64_to_cbstring_be(id));
+        txn.make_cursor(dead_dbi)->set_key_value(make_mdb_val(key),
+                                                 make_mdb_val(ready_record(attempts, make_mdb_val(value))));
+    } else {
+        front = ready_record(attempts, make_mdb_val(value));
+    }
+}
+
+size_t PersistentWorkQueue::ack(const vector<uint64_t>& ids) {
+    environment::transaction_ptr txn = env->start_transaction(false);
+    size_t acked = 0;
+    try {
+        uint64_t attempts;
+        CBString value;
+        for (vector<uint64_t>::const_iterator id = ids.begin(); id != ids.end(); ++id) {
+            if (take(*txn, *id, attempts, value)) {
+                ++acked;
+            }
+        }
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+    return acked;
+}
+
+size_t PersistentWorkQueue::release(const vector<uint64_t>& ids) {
+    // the iterator locks the queue and starts the write transaction that the rest joins: it commits last
+    PersistentQueue::front_insert_iterator front(queue);
+    environment::transaction_ptr txn = env->start_transaction(false);
+    size_t released = 0;
+    try {
+        uint64_t attempts;
+        CBString value;
+        for (vector<uint64_t>::const_iterator id = ids.begin(); id != ids.end(); ++id) {
+            if (take(*txn, *id, attempts, value)) {
+                requeue(*txn, front, *id, attempts, value);
+                ++released;
+            }
+        }
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+    return released;
+}
+
+size_t PersistentWorkQueue::reap(size_t max_leases) {
+    uint64_t now = now_ms();
+    {
+        // most of the time nothing expired: don't lock the queue for nothing
+        environment::transaction_ptr txn = env->start_transaction();
+        environment::cursor_ptr leases = txn->make_cursor(leases_dbi);
+        MDB_val index = make_mdb_val();
+        if (leases->first() == MDB_NOTFOUND) {
+            return 0;
+        }
+        leases->get_current_key(index);
+        if (read_number(index, 0) > now) {
+            return 0;
+        }
+    }
+    PersistentQueue::front_insert_iterator front(queue);
+    environment::transaction_ptr txn = env->start_transaction(false);
+    size_t count = 0;
+    try {
+        environment::cursor_ptr leases = txn->make_cursor(leases_dbi);
+        MDB_val index = make_mdb_val();
+        uint64_t attempts;
+        CBString value;
+        while ((max_leases == 0 || count < max_leases) && leases->first() != MDB_NOTFOUND) {
+            leases->get_current_key(index);
+            if (read_number(index, 0) > now) {
+                break;
+            }
+            uint64_t id = read_number(index, 8);
+            if (take(*txn, id, attempts, value)) {
+                requeue(*txn, front, id, attempts, value);
+            } else {
+                // an index record without its lease
+                leases->first();
+                leases->del();
+            }
+            ++count;
+        }
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+    if (count) {
+        _LOG_DEBUG << "PersistentWorkQueue: reaped " << count << " expired leases";
+        reaped.fetch_add(count);
+    }
+    return count;
+}
+
+vector<PersistentWorkQueue::leased_element> PersistentWorkQueue::pop_dead(size_t n) {
+    vector<leased_element> dead;
+    environment::transaction_ptr txn = env->start_transaction(false);
+    try {
+        environment::cursor_ptr cursor = txn->make_cursor(dead_dbi);
+        MDB_val k = make_mdb_val();
+        MDB_val v = make_mdb_val();
+        while (dead.size() < n && cursor->first() != MDB_NOTFOUND) {
+            cursor->get_current_key_value(k, v);
+            dead.push_back(leased_element(cbstring_be_to_uint64(k), read_number(v, 0), read_value(v, 8)));
+            cursor->del();
+        }
+    } catch (...) {
+        txn->set_rollback();
+        throw;
+    }
+    return dead;
+}
+
+void PersistentWorkQueue::reaping_thread_fun(uint64_t period_ms) {
+    unique_lock<boost::mutex> lock(reaping_mutex);
+    while (!reaping_stopping) {
+        reaping_condition.wait_for(lock, boost::chrono::milliseconds(period_ms));
+        if (reaping_stopping) {
+            break;
+        }
+        lock.unlock();
+        try {
+            // small transactions: the consumers are not blocked for long
+            while (reap(REAP_BATCH) == REAP_BATCH) { }
+        } catch (...) {
+            _LOG_ERROR << "PersistentWorkQueue: reaping failed: " << boost::current_exception_diagnostic_information();
+        }
+        lock.lock();
+    }
+}
+
+void PersistentWorkQueue::start_reaping(uint64_t period_ms) {
+    if (period_ms == 0) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("the reaping period must be positive"));
+    }
+    stop_reaping();
+    lock_guard<boost::mutex> guard(reaping_mutex);
+    reaping_stopping = false;
+    reaping_thread_ptr.reset(new boost::thread(boost::bind(&PersistentWorkQueue::reaping_thread_fun, this, period_ms)));
+}
+
+void PersistentWorkQueue::stop_reaping() {
+    {
+        lock_guard<boost::mutex> guard(reaping_mutex);
+        if (!reaping_thread_ptr) {
+            return;
+        }
+        reaping_stopping = true;
+        reaping_condition.notify_all();
+    }
+    reaping_thread_ptr->join();
+    reaping_thread_ptr.reset();
+}
+
+}   // END NS quiet
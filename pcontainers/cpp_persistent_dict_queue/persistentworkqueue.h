@@ -0,0 +1,170 @@
+#pragma once
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/core/explicit_operator_bool.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+#include "lmdb.h"
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "../utils/lmdb_options.h"
+#include "../lmdb_environment/lmdb_environment.h"
+#include "../utils/utils.h"
+#include "../logging/logging.h"
+#include "persistentqueue.h"
+
+namespace quiet {
+
+using std::vector;
+using boost::shared_ptr;
+using boost::scoped_ptr;
+using boost::enable_shared_from_this;
+using boost::chrono::milliseconds;
+using Bstrlib::CBString;
+using namespace lmdb;
+
+// A queue whose consumers lease the elements instead of popping them, so that the element of a consumer that dies is
+// delivered again. Five databases of one environment:
+//     dbname               the ready elements, a PersistentQueue: attempts + value
+//     dbname.inflight      lease id -> deadline + attempts + value
+//     dbname.leases        deadline + lease id -> ''      (sorted by deadline)
+//     dbname.dead          lease id -> attempts + value   (the dead letters)
+//     dbname.lease_ids     'next' -> the next lease id
+// Deadlines are 8 bytes big-endian milliseconds since the epoch, attempts 8 bytes big-endian.
+//
+// lease moves elements from the front of the queue to the in-flight database, in one transaction, and counts an
+// attempt for each of them. ack deletes leased elements. A lease that is not acknowledged before its deadline (the
+// visibility timeout) is reaped: its element goes back to the front of the queue, or to the dead letters when it was
+// leased max_attempts times already. release gives leased elements back at once.
+//
+// The lease ids come from a counter that is stored with the leases and never goes back (not even on clear): they are
+// never reused, so an ack that comes after the lease expired never deletes a later lease of the same element.
+class PersistentWorkQueue: public enable_shared_from_this<PersistentWorkQueue>, private boost::noncopyable {
+public:
+    // the maximum number of elements of one lease
+    static const size_t MAX_LEASE = 1 << 20;
+    // the number of expired leases handled by one transaction of the reaping thread
+    static const size_t REAP_BATCH = 10000;
+
+    struct leased_element {
+        uint64_t id;
+        uint64_t attempts;      // the leases of the element, this one included
+        CBString value;
+        leased_element(): id(0), attempts(0), value() { }
+        leased_element(uint64_t i, uint64_t a, const CBString& v): id(i), attempts(a), value(v) { }
+    };
+
+private:
+    PersistentWorkQueue(const CBString& directory_name, const CBString& database_name, const lmdb_options& options,
+                        uint64_t max_attempts):
+            queue(), env(), inflight_dbi(), leases_dbi(), dead_dbi(), lease_ids_dbi(), max_attempts(max_attempts),
+            reaped(0),
+            reaping_mutex(), reaping_condition(), reaping_stopping(false), reaping_thread_ptr() {
+        init(directory_name, database_name, options);
+    }
+
+    void init(const CBString& directory_name, const CBString& database_name, const lmdb_options& options);  // can throw
+
+    // reserves n lease ids in txn; returns the first one
+    uint64_t next_lease_id(environment::transaction& txn, size_t n);                            // can throw
+    // leases up to n elements in one transaction; the named mutex of the queue is held. returns false if the queue is
+    // known to be empty afterwards
+    bool lease_locked(size_t n, uint64_t visibility_ms, vector<leased_element>& leased);        // can throw
+    // removes the lease 'id' and copies its element; false if it is not in flight anymore
+    bool take(environment::transaction& txn, uint64_t id, uint64_t& attempts, CBString& value);  // can throw
+    // puts an element that was taken back in the queue, or in the dead letters
+    void requeue(environment::transaction& txn, PersistentQueue::front_insert_iterator& front, uint64_t id,
+                 uint64_t attempts, const CBString& value);                                      // can throw
+
+    // waits until deadline (not_a_date_time: no deadline) for one ready element, then leases up to n elements
+    vector<leased_element> wait_and_lease(size_t n, uint64_t visibility_ms, const ptime& deadline);    // can throw
+
+    void reaping_thread_fun(uint64_t period_ms);
+
+protected:
+    shared_ptr<PersistentQueue> queue;
+    shared_ptr<environment> env;
+    MDB_dbi inflight_dbi;
+    MDB_dbi leases_dbi;
+    MDB_dbi dead_dbi;
+    MDB_dbi lease_ids_dbi;
+    boost::atomic<uint64_t> max_attempts;
+
+    boost::atomic<uint64_t> reaped;
+    boost::mutex reaping_mutex;
+    boost::condition_variable reaping_condition;
+    bool reaping_stopping;
+    scoped_ptr<boost::thread> reaping_thread_ptr;
+
+public:
+    BOOST_EXPLICIT_OPERATOR_BOOL_NOEXCEPT()
+    bool operator!() const BOOST_NOEXCEPT_OR_NOTHROW {
+        return !env;
+    }
+
+    static inline shared_ptr<PersistentWorkQueue> factory(const CBString& directory_name,
+                                                          const CBString& database_name,
+                                                          const lmdb_options& options=lmdb_options(),
+                                                          uint64_t max_attempts=5) {    // can throw
+        return shared_ptr<PersistentWorkQueue>(
+            new PersistentWorkQueue(directory_name, database_name, options, max_attempts)
+        );
+    }
+
+    ~PersistentWorkQueue() {
+        stop_reaping();
+    }
+
+    CBString get_dirname() const BOOST_NOEXCEPT_OR_NOTHROW { return queue->get_dirname(); }
+    CBString get_dbname() const BOOST_NOEXCEPT_OR_NOTHROW { return queue->get_dbname(); }
+
+    // the ready elements
+    size_t size() const { return queue->size(); }                                   // can throw
+    size_t inflight_size() const { return env->size(inflight_dbi); }                // can throw
+    size_t dead_size() const { return env->size(dead_dbi); }                        // can throw
+    void clear();                                                                   // can throw
+
+    void push_back(MDB_val value);                                                  // can throw
+    void push_back(const vector<CBString>& values);                                 // can throw
+
+    // leases up to n ready elements for visibility_ms milliseconds; empty if the queue is empty
+    vector<leased_element> lease(size_t n, uint64_t visibility_ms);                 // can throw
+    // waits at most ms for one ready element, then leases up to n elements. throws empty_database on timeout
+    vector<leased_element> wait_and_lease(size_t n, uint64_t visibility_ms, milliseconds ms) {  // can throw
+        return wait_and_lease(n, visibility_ms, PersistentQueue::deadline_after(ms));
+    }
+    vector<leased_element> wait_and_lease(size_t n, uint64_t visibility_ms) {                   // can throw
+        return wait_and_lease(n, visibility_ms, ptime(boost::posix_time::not_a_date_time));
+    }
+    // deletes the leased elements in one transaction; returns the number of leases that were still in flight
+    size_t ack(const vector<uint64_t>& ids);                                        // can throw
+    // gives the leased elements back to the front of the queue (or to the dead letters); returns their number
+    size_t release(const vector<uint64_t>& ids);                                    // can throw
+    // handles at most max_leases (0: all) expired leases in one transaction; returns their number
+    size_t reap(size_t max_leases=0);                                               // can throw
+    uint64_t get_reaped() const BOOST_NOEXCEPT_OR_NOTHROW { return reaped.load(); }
+
+    // removes up to n dead letters, oldest lease first
+    vector<leased_element> pop_dead(size_t n);                                      // can throw
+
+    void set_max_attempts(uint64_t attempts) BOOST_NOEXCEPT_OR_NOTHROW { max_attempts.store(attempts); }
+    uint64_t get_max_attempts() const BOOST_NOEXCEPT_OR_NOTHROW { return max_attempts.load(); }
+
+    // reaps the expired leases every period_ms milliseconds, in batches of REAP_BATCH leases per transaction
+    void start_reaping(uint64_t period_ms);                                         // can throw
+    void stop_reaping();
+    bool is_reaping() const BOOST_NOEXCEPT_OR_NOTHROW { return bool(reaping_thread_ptr); }
+
+};  // END CLASS PersistentWorkQueue
+
+}   // END NS quiet
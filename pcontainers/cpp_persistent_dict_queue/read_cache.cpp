@@ -0,0 +1,206 @@
+#include <string.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include "read_cache.h"
+
+
+namespace quiet {
+
+using boost::lock_guard;
+using namespace utils;
+
+ReadCache::ReadCache(size_t capacity, size_t untracked): lock(), slots(capacity), index(), hand(0), used(0), validated(0),
+                                                         untracked_until(untracked), next_id(1), pending(), counters() {
+    counters.capacity = capacity;
+}
+
+size_t ReadCache::get_capacity() const {
+    lock_guard<mutex> guard(lock);
+    return slots.size();
+}
+
+void ReadCache::resize(size_t capacity, size_t untracked) {
+    lock_guard<mutex> guard(lock);
+    slots.assign(capacity, slot());
+    untracked_until = std::max(untracked_until, untracked);
+    index.clear();
+    hand = 0;
+    used = 0;
+    counters.capacity = capacity;
+}
+
+ReadCache::index_type::iterator ReadCache::find(MDB_val key, uint64_t h) {
+    std::pair<index_type::iterator, index_type::iterator> range(index.equal_range(h));
+    for (index_type::iterator it(range.first); it != range.second; ++it) {
+        const slot& s = slots[it->second];
+        if ((size_t) s.key.length() == key.mv_size && memcmp(s.key.data, key.mv_data, key.mv_size) == 0) {
+            return it;
+        }
+    }
+    return index.end();
+}
+
+void ReadCache::remove(index_type::iterator it) {
+    slots[it->second] = slot();
+    index.erase(it);
+    --used;
+}
+
+void ReadCache::flush(size_t txnid) {
+    if (used > 0) {
+        slots.assign(slots.size(), slot());
+        index.clear();
+        used = 0;
+        ++counters.flushes;
+    }
+    validated = txnid;
+}
+
+size_t ReadCache::victim() {
+    // CLOCK: the hand clears the reference bits until it finds an entry that was not read since its last pass
+    for (;;) {
+        slot& s = slots[hand];
+        size_t current = hand;
+        hand = (hand + 1) % slots.size();
+        if (!s.used) {
+            return current;
+        }
+        if (s.referenced) {
+            s.referenced = false;
+            continue;
+        }
+        remove(find(make_mdb_val(s.key), s.hash));
+        ++counters.evictions;
+        return current;
+    }
+}
+
+bool ReadCache::get(MDB_val key, size_t last_txnid, CBString* value, uint64_t* entry_id) {
+    lock_guard<mutex> guard(lock);
+    // last_txnid < validated: a tracked commit happened after last_txnid was read, the cache is fresher
+    if (last_txnid > validated) {
+        flush(last_txnid);
+    }
+    index_type::iterator it(used ? find(key, fnv1a(key.mv_data, key.mv_size)) : index.end());
+    if (it == index.end()) {
+        ++counters.misses;
+        return false;
+    }
+    slot& s = slots[it->second];
+    s.referenced = true;
+    ++counters.hits;
+    if (entry_id) {
+        if (*entry_id == s.id) {
+            return true;
+        }
+        *entry_id = s.id;
+    }
+    if (value) {
+        *value = s.value;
+    }
+    return true;
+}
+
+uint64_t ReadCache::put(MDB_val key, const CBString& value, size_t snapshot_txnid) {
+    lock_guard<mutex> guard(lock);
+    if (slots.empty() || snapshot_txnid != validated) {
+        return 0;
+    }
+    uint64_t h = fnv1a(key.mv_data, key.mv_size);
+    index_type::iterator it(find(key, h));
+    if (it != index.end()) {
+        // same snapshot, hence same value
+        return slots[it->second].id;
+    }
+    size_t i = victim();
+    slot& s = slots[i];
+    s.key = make_string(key);
+    s.value = value;
+    s.hash = h;
+    s.id = next_id++;
+    s.referenced = false;
+    s.used = true;
+    index.insert(std::make_pair(h, i));
+    ++used;
+    return s.id;
+}
+
+ReadCache::pending_write& ReadCache::pending_for(environment::transaction& txn) {
+    size_t txnid = txn.id();
+    map<size_t, pending_write>::iterator it(pending.find(txnid));
+    if (it == pending.end()) {
+        txn.on_end(boost::bind(&ReadCache::transaction_end, shared_from_this(), _1, _2));
+        it = pending.insert(std::make_pair(txnid, pending_write())).first;
+        it->second.all = false;
+    }
+    return it->second;
+}
+
+void ReadCache::invalidate(environment::transaction& txn, MDB_val key) {
+    lock_guard<mutex> guard(lock);
+    if (slots.empty()) {
+        return;
+    }
+    if (used) {
+        index_type::iterator it(find(key, fnv1a(key.mv_data, key.mv_size)));
+        if (it != index.end()) {
+            remove(it);
+            ++counters.invalidations;
+        }
+    }
+    pending_write& p = pending_for(txn);
+    if (p.all) {
+        return;
+    }
+    if (p.keys.size() >= slots.size()) {
+        // big write transaction: cheaper to drop the cache at commit time
+        p.all = true;
+        p.keys.clear();
+        return;
+    }
+    p.keys.push_back(make_string(key));
+}
+
+void ReadCache::invalidate_all(environment::transaction& txn) {
+    lock_guard<mutex> guard(lock);
+    pending_write& p = pending_for(txn);
+    p.all = true;
+    p.keys.clear();
+}
+
+void ReadCache::transaction_end(size_t txnid, bool commited) {
+    lock_guard<mutex> guard(lock);
+    map<size_t, pending_write>::iterator it(pending.find(txnid));
+    if (it == pending.end()) {
+        return;
+    }
+    if (commited && txnid > validated) {
+        if (it->second.all || txnid <= untracked_until) {
+            flush(txnid);
+        } else {
+            // a reader of the previous snapshot may have cached the old value again since the invalidation
+            for (vector<CBString>::const_iterator key(it->second.keys.begin()); key != it->second.keys.end(); ++key) {
+                MDB_val k = make_mdb_val(*key);
+                index_type::iterator entry(used ? find(k, fnv1a(k.mv_data, k.mv_size)) : index.end());
+                if (entry != index.end()) {
+                    remove(entry);
+                }
+            }
+            // otherwise another transaction was commited in between: the next lookup drops the cache
+            if (txnid == validated + 1) {
+                validated = txnid;
+            }
+        }
+    }
+    pending.erase(it);
+}
+
+ReadCache::stats ReadCache::get_stats() const {
+    lock_guard<mutex> guard(lock);
+    stats result(counters);
+    result.size = used;
+    return result;
+}
+
+}   // END NS quiet
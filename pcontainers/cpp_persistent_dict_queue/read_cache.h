@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+#include "lmdb.h"
+#include "../lmdb_environment/lmdb_environment.h"
+#include "../utils/utils.h"
+
+namespace quiet {
+
+using std::vector;
+using std::map;
+using boost::shared_ptr;
+using boost::enable_shared_from_this;
+using boost::mutex;
+using Bstrlib::CBString;
+using lmdb::environment;
+
+// A bounded in-process cache of the values of a PersistentDict, with CLOCK eviction.
+//
+// The cache content is valid as of one LMDB transaction id ('validated'). Lookups compare it with the last commited
+// transaction id: when another process (or an untracked writer) has commited, the whole cache is dropped. The writes
+// of the dict itself are tracked: their keys are invalidated, and after the commit the cache moves to the new
+// transaction id without being dropped, provided that no other transaction was commited in between.
+//
+// Each cached entry gets a unique id, so that a layer above (the Python wrapper) can cache its own representation of
+// a value and check that it is still current.
+class ReadCache: public enable_shared_from_this<ReadCache>, private boost::noncopyable {
+public:
+    struct stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t invalidations;         // entries removed by the dict writes
+        uint64_t flushes;               // whole cache dropped because of an untracked commit
+        size_t size;
+        size_t capacity;
+    };
+
+private:
+    struct slot {
+        CBString key;
+        CBString value;
+        uint64_t hash;
+        uint64_t id;
+        bool referenced;
+        bool used;
+        slot(): key(), value(), hash(0), id(0), referenced(false), used(false) { }
+    };
+
+    // keys invalidated by a write transaction that is not commited yet
+    struct pending_write {
+        vector<CBString> keys;
+        bool all;
+    };
+
+    typedef boost::unordered_multimap<uint64_t, size_t> index_type;
+
+    mutable mutex lock;
+    vector<slot> slots;
+    index_type index;                   // hash of the key -> slot
+    size_t hand;
+    size_t used;
+    size_t validated;
+    size_t untracked_until;             // transactions that may have written before the cache tracked them
+    uint64_t next_id;
+    map<size_t, pending_write> pending;
+    mutable stats counters;
+
+    ReadCache(size_t capacity, size_t untracked);
+
+    index_type::iterator find(MDB_val key, uint64_t h);
+    void remove(index_type::iterator it);
+    void flush(size_t txnid);
+    size_t victim();
+    void transaction_end(size_t txnid, bool commited);
+    pending_write& pending_for(environment::transaction& txn);
+
+public:
+    // the writes of the transactions up to 'untracked' (included) are not tracked: their commit drops the cache
+    static shared_ptr<ReadCache> factory(size_t capacity, size_t untracked=0) {
+        return shared_ptr<ReadCache>(new ReadCache(capacity, untracked));
+    }
+
+    size_t get_capacity() const;
+    void resize(size_t capacity, size_t untracked=0);      // drops the content
+
+    // a hit returns the value and the entry id; the value is not copied when *entry_id is already the entry id.
+    // last_txnid is the last commited transaction id of the environment.
+    bool get(MDB_val key, size_t last_txnid, CBString* value, uint64_t* entry_id);
+    // caches a value read in the snapshot 'snapshot_txnid'; returns the entry id, or 0 when the snapshot is stale
+    uint64_t put(MDB_val key, const CBString& value, size_t snapshot_txnid);
+
+    // the write transaction modifies key (or clears the dict)
+    void invalidate(environment::transaction& txn, MDB_val key);
+    void invalidate_all(environment::transaction& txn);
+
+    stats get_stats() const;
+
+};  // END CLASS ReadCache
+
+}   // END NS quiet
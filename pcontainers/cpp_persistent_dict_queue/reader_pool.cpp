@@ -0,0 +1,106 @@
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/thread/locks.hpp>
+#include "../logging/logging.h"
+#include "reader_pool.h"
+
+
+namespace quiet {
+
+using boost::lock_guard;
+using boost::unique_lock;
+using boost::make_shared;
+
+ReaderPool::ReaderPool(size_t nthreads): queues(), threads(), sleep_mutex(), wake(), pending(0), next_queue(0),
+                                         stolen(0), stopping(false) {
+    if (nthreads == 0) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("the number of reader threads must be positive"));
+    }
+    for (size_t i = 0; i < nthreads; ++i) {
+        queues.push_back(make_shared<worker_queue>());
+    }
+    for (size_t i = 0; i < nthreads; ++i) {
+        threads.create_thread(boost::bind(&ReaderPool::worker_fun, this, i));
+    }
+}
+
+ReaderPool::~ReaderPool() {
+    stop();
+}
+
+void ReaderPool::submit(const job& j) {
+    worker_queue& q = *queues[next_queue.fetch_add(1) % queues.size()];
+    {
+        lock_guard<mutex> guard(q.lock);
+        q.jobs.push_back(j);
+    }
+    // the job is visible before it is counted: a worker that sees pending > 0 finds it
+    lock_guard<mutex> guard(sleep_mutex);
+    ++pending;
+    wake.notify_one();
+}
+
+bool ReaderPool::pop_local(size_t i, job& j) {
+    worker_queue& q = *queues[i];
+    lock_guard<mutex> guard(q.lock);
+    if (q.jobs.empty()) {
+        return false;
+    }
+    j.swap(q.jobs.front());
+    q.jobs.pop_front();
+    return true;
+}
+
+bool ReaderPool::steal(size_t i, job& j) {
+    for (size_t n = 1; n < queues.size(); ++n) {
+        worker_queue& q = *queues[(i + n) % queues.size()];
+        lock_guard<mutex> guard(q.lock);
+        if (!q.jobs.empty()) {
+            // the owner works from the front: the back is the job it would run last
+            j.swap(q.jobs.back());
+            q.jobs.pop_back();
+            ++stolen;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReaderPool::worker_fun(size_t i) {
+    for (;;) {
+        job j;
+        if (pop_local(i, j) || steal(i, j)) {
+            --pending;
+            try {
+                j();
+            } catch (...) {
+                // the jobs report their errors through their promises
+                _LOG_WARNING << "ReaderPool: a job has thrown an exception";
+            }
+            continue;
+        }
+        unique_lock<mutex> lock(sleep_mutex);
+        if (pending.load() == 0) {
+            if (stopping) {
+                return;
+            }
+            wake.wait(lock);
+        }
+    }
+}
+
+void ReaderPool::stop() {
+    {
+        lock_guard<mutex> guard(sleep_mutex);
+        if (stopping) {
+            return;
+        }
+        stopping = true;
+        wake.notify_all();
+    }
+    threads.join_all();
+}
+
+}   // END NS quiet
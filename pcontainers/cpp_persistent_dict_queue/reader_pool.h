@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/container/deque.hpp>
+#include <boost/atomic.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <stdint.h>
+
+namespace quiet {
+
+using std::vector;
+using boost::shared_ptr;
+using boost::mutex;
+using boost::condition_variable;
+
+// A fixed pool of threads that run the blocking reads of BufferedPersistentDict.
+//
+// Each worker owns a deque: jobs are spread round-robin over the deques, a worker runs the jobs of its own deque in
+// FIFO order, and when it is empty it steals from the back of the other deques. A slow read (a cold page) then only
+// delays the jobs that were queued behind it on the same deque until another worker steals them.
+class ReaderPool: private boost::noncopyable {
+public:
+    typedef boost::function<void()> job;
+
+private:
+    struct worker_queue {
+        mutex lock;
+        boost::container::deque<job> jobs;
+    };
+
+    vector< shared_ptr<worker_queue> > queues;
+    boost::thread_group threads;
+    mutex sleep_mutex;
+    condition_variable wake;
+    boost::atomic<size_t> pending;
+    boost::atomic<size_t> next_queue;
+    boost::atomic<uint64_t> stolen;
+    bool stopping;                      // guarded by sleep_mutex
+
+    bool pop_local(size_t i, job& j);
+    bool steal(size_t i, job& j);
+    void worker_fun(size_t i);
+
+public:
+    explicit ReaderPool(size_t nthreads);      // can throw
+    ~ReaderPool();
+
+    void submit(const job& j);
+    // runs the jobs that are still queued, then joins the workers. submit must not be called anymore.
+    void stop();
+
+    size_t size() const { return queues.size(); }
+    uint64_t steals() const { return stolen.load(); }
+
+};  // END CLASS ReaderPool
+
+}   // END NS quiet
@@ -0,0 +1,292 @@
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+#include <set>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/throw_exception.hpp>
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "shardedpersistentdict.h"
+
+
+namespace quiet {
+
+using std::vector;
+using std::set;
+using namespace utils;
+using Bstrlib::CBString;
+
+void ShardedPersistentDict::init(const vector<CBString>& directories, const lmdb_options& options) {
+    if (directories.empty()) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("ShardedPersistentDict needs at least one directory"));
+    }
+    if (part == HASH_PARTITIONING && !split_points.empty()) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("split points are only used by range partitioning"));
+    }
+    if (part == RANGE_PARTITIONING) {
+        if (split_points.size() != directories.size() - 1) {
+            BOOST_THROW_EXCEPTION(std::invalid_argument("range partitioning needs one split point less than the number of shards"));
+        }
+        for (size_t i = 1; i < split_points.size(); ++i) {
+            if (compare_keys(make_mdb_val(split_points[i - 1]), make_mdb_val(split_points[i])) >= 0) {
+                BOOST_THROW_EXCEPTION(std::invalid_argument("the split points must be sorted and distinct"));
+            }
+        }
+    }
+    dbname.trim();
+    set<CBString> opened;
+    for (vector<CBString>::const_iterator dir(directories.begin()); dir != directories.end(); ++dir) {
+        shared_ptr<PersistentDict> shard(PersistentDict::factory(*dir, dbname, options));
+        // an iterator holds a read transaction in each shard: two shards can't live in the same environment
+        if (!opened.insert(shard->get_dirname()).second) {
+            BOOST_THROW_EXCEPTION(std::invalid_argument("each shard needs its own directory"));
+        }
+        shards.push_back(shard);
+    }
+    if (dbname.length()) {
+        for (size_t i = 0; i < shards.size(); ++i) {
+            check_layout(i, options);
+        }
+    }
+}
+
+void ShardedPersistentDict::check_layout(size_t index, const lmdb_options& options) {
+    CBString layout;
+    layout.format("%s %u %u", part == HASH_PARTITIONING ? "hash" : "range", (unsigned int) shards.size(), (unsigned int) index);
+    if (part == RANGE_PARTITIONING) {
+        uint64_t h = fnv1a(NULL, 0);
+        for (vector<CBString>::const_iterator it(split_points.begin()); it != split_points.end(); ++it) {
+            CBString len(uint64_to_cbstring_be(it->length()));
+            h = fnv1a(len.data, len.length(), h);
+            h = fnv1a(it->data, it->length(), h);
+        }
+        CBString splits;
+        splits.format(" %016llx", (unsigned long long) h);
+        layout += splits;
+    }
+    shared_ptr<PersistentDict> layout_dict(PersistentDict::factory(shards[index]->get_dirname(), dbname + ".layout", options));
+    CBString key("layout");
+    if (!layout_dict->insert_if_absent(key, layout) && layout_dict->at(key) != layout) {
+        BOOST_THROW_EXCEPTION(mdb_incompatible() << lmdb_error::what("the shard was created with another layout"));
+    }
+}
+
+shared_ptr<PersistentDict> ShardedPersistentDict::get_shard(size_t i) const {
+    if (i >= shards.size()) {
+        BOOST_THROW_EXCEPTION(std::out_of_range("no such shard"));
+    }
+    return shards[i];
+}
+
+size_t ShardedPersistentDict::shard_of(MDB_val key) const BOOST_NOEXCEPT_OR_NOTHROW {
+    if (part == HASH_PARTITIONING) {
+        return (size_t) (fnv1a(key.mv_data, key.mv_size) % shards.size());
+    }
+    size_t lo = 0;
+    size_t hi = split_points.size();
+    // number of split points <= key
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (compare_keys(make_mdb_val(split_points[mid]), key) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t ShardedPersistentDict::size() const {
+    size_t n = 0;
+    for (vector< shared_ptr<PersistentDict> >::const_iterator it(shards.begin()); it != shards.end(); ++it) {
+        n += (*it)->size();
+    }
+    return n;
+}
+
+bool ShardedPersistentDict::empty() const {
+    for (vector< shared_ptr<PersistentDict> >::const_iterator it(shards.begin()); it != shards.end(); ++it) {
+        if (!(*it)->empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ShardedPersistentDict::clear() {
+    for (vector< shared_ptr<PersistentDict> >::iterator it(shards.begin()); it != shards.end(); ++it) {
+        (*it)->clear();
+    }
+}
+
+static void run_capturing(boost::function<void (size_t)> f, size_t i, boost::exception_ptr& error) {
+    try {
+        f(i);
+    } catch (...) {
+        error = boost::current_exception();
+    }
+}
+
+void ShardedPersistentDict::for_each_shard(const vector<size_t>& todo, boost::function<void (size_t)> f) {
+    if (todo.size() == 1) {
+        f(todo[0]);
+        return;
+    }
+    vector<boost::exception_ptr> errors(todo.size());
+    boost::thread_group threads;
+    try {
+        for (size_t i = 0; i < todo.size(); ++i) {
+            threads.create_thread(boost::bind(&run_capturing, f, todo[i], boost::ref(errors[i])));
+        }
+    } catch (...) {
+        threads.join_all();
+        throw;
+    }
+    threads.join_all();
+    for (vector<boost::exception_ptr>::const_iterator it(errors.begin()); it != errors.end(); ++it) {
+        if (*it) {
+            boost::rethrow_exception(*it);
+        }
+    }
+}
+
+struct insert_in_shard {
+    const vector< shared_ptr<PersistentDict> >* shards;
+    const vector<ShardedPersistentDict::items>* groups;
+    void operator()(size_t i) const { (*shards)[i]->insert((*groups)[i].begin(), (*groups)[i].end()); }
+};
+
+void ShardedPersistentDict::insert(const items& kvs) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    vector<items> groups(shards.size());
+    for (items::const_iterator it(kvs.begin()); it != kvs.end(); ++it) {
+        if (!it->first.length()) {
+            BOOST_THROW_EXCEPTION(empty_key());
+        }
+        groups[shard_of(it->first)].push_back(*it);
+    }
+    vector<size_t> todo;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        if (!groups[i].empty()) {
+            todo.push_back(i);
+        }
+    }
+    if (todo.empty()) {
+        return;
+    }
+    insert_in_shard f = {&shards, &groups};
+    for_each_shard(todo, f);
+}
+
+struct erase_in_shard {
+    const vector< shared_ptr<PersistentDict> >* shards;
+    const vector< vector<CBString> >* groups;
+    vector<size_t>* erased;
+    void operator()(size_t i) const {
+        PersistentDict::iterator it((*shards)[i], 0, false);
+        for (vector<CBString>::const_iterator k((*groups)[i].begin()); k != (*groups)[i].end(); ++k) {
+            if (it.del(*k)) {
+                ++(*erased)[i];
+            }
+        }
+    }
+};
+
+size_t ShardedPersistentDict::erase(const vector<CBString>& keys) {
+    if (!*this) {
+        return 0;
+    }
+    vector< vector<CBString> > groups(shards.size());
+    for (vector<CBString>::const_iterator it(keys.begin()); it != keys.end(); ++it) {
+        if (it->length()) {
+            groups[shard_of(*it)].push_back(*it);
+        }
+    }
+    vector<size_t> todo;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        if (!groups[i].empty()) {
+            todo.push_back(i);
+        }
+    }
+    if (todo.empty()) {
+        return 0;
+    }
+    vector<size_t> erased(shards.size(), 0);
+    erase_in_shard f = {&shards, &groups, &erased};
+    for_each_shard(todo, f);
+    size_t n = 0;
+    for (vector<size_t>::const_iterator it(erased.begin()); it != erased.end(); ++it) {
+        n += *it;
+    }
+    return n;
+}
+
+bool ShardedPersistentDict::const_iterator::greater_key::operator()(size_t a, size_t b) const {
+    int order = compare_keys((*its)[a]->get_key_buffer(), (*its)[b]->get_key_buffer());
+    // equal keys can only come from a shard that was reopened with another layout: keep the shards order
+    return order > 0 || (order == 0 && a > b);
+}
+
+bool ShardedPersistentDict::const_iterator::in_range(size_t i) const {
+    if (its[i]->has_reached_end()) {
+        return false;
+    }
+    return !last_key.length() || compare_keys(its[i]->get_key_buffer(), make_mdb_val(last_key)) < 0;
+}
+
+void ShardedPersistentDict::const_iterator::push(size_t i) {
+    if (in_range(i)) {
+        heap.push_back(i);
+        std::push_heap(heap.begin(), heap.end(), greater_key(&its));
+    }
+}
+
+ShardedPersistentDict::const_iterator::const_iterator(shared_ptr<const ShardedPersistentDict> d, const CBString& first_key,
+                                                      const CBString& last):
+        its(), heap(), last_key(last) {
+    if (!d || !*d) {
+        BOOST_THROW_EXCEPTION(not_initialized());
+    }
+    for (size_t i = 0; i < d->shards.size(); ++i) {
+        shared_ptr<PersistentDict::const_iterator> it(new PersistentDict::const_iterator(d->shards[i], 0));
+        it->set_range(make_mdb_val(first_key));
+        its.push_back(it);
+        push(i);
+    }
+}
+
+size_t ShardedPersistentDict::const_iterator::current_shard() const {
+    if (heap.empty()) {
+        BOOST_THROW_EXCEPTION(mdb_notfound());
+    }
+    return heap.front();
+}
+
+CBString ShardedPersistentDict::const_iterator::get_key() const {
+    return its[current_shard()]->get_key();
+}
+
+CBString ShardedPersistentDict::const_iterator::get_value() const {
+    return its[current_shard()]->get_value();
+}
+
+pair<CBString, CBString> ShardedPersistentDict::const_iterator::get_item() const {
+    pair<const CBString, CBString> p(its[current_shard()]->get_item());
+    return make_pair(p.first, p.second);
+}
+
+void ShardedPersistentDict::const_iterator::next() {
+    if (heap.empty()) {
+        return;
+    }
+    std::pop_heap(heap.begin(), heap.end(), greater_key(&its));
+    size_t i = heap.back();
+    heap.pop_back();
+    ++(*its[i]);
+    push(i);
+}
+
+}   // END NS quiet
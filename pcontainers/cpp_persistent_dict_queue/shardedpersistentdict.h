@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/core/explicit_operator_bool.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+#include "lmdb.h"
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "../utils/lmdb_options.h"
+#include "../utils/utils.h"
+#include "persistentdict.h"
+
+namespace quiet {
+
+using std::pair;
+using std::vector;
+using boost::shared_ptr;
+using boost::enable_shared_from_this;
+using Bstrlib::CBString;
+
+// A dict partitioned over several LMDB environments (one directory per shard), so that the writes to different
+// shards are commited in parallel.
+//
+// With HASH_PARTITIONING, a key goes to the shard FNV-1a(key) % N. With RANGE_PARTITIONING, the N - 1 sorted
+// split points delimit the shards: shard i holds the keys in [split_points[i - 1], split_points[i]).
+// With a named database, the layout is recorded in each shard ("<dbname>.layout") and checked when the dict is opened
+// again, so that a shard can't be reopened with a different partitioning.
+class ShardedPersistentDict: public enable_shared_from_this<ShardedPersistentDict>, private boost::noncopyable {
+public:
+    enum partitioning { HASH_PARTITIONING = 0, RANGE_PARTITIONING = 1 };
+    typedef vector< pair<CBString, CBString> > items;
+
+private:
+    ShardedPersistentDict(const vector<CBString>& directories, const CBString& database_name, const lmdb_options& options,
+                          partitioning p, const vector<CBString>& splits):
+            dbname(database_name), shards(), part(p), split_points(splits) { init(directories, options); }
+
+    void init(const vector<CBString>& directories, const lmdb_options& options);       // can throw
+    void check_layout(size_t index, const lmdb_options& options);                       // can throw
+    // calls f(i) for each shard i in todo, one thread per shard
+    static void for_each_shard(const vector<size_t>& todo, boost::function<void (size_t)> f);  // can throw
+
+protected:
+    CBString dbname;
+    vector< shared_ptr<PersistentDict> > shards;
+    const partitioning part;
+    const vector<CBString> split_points;
+
+public:
+    BOOST_EXPLICIT_OPERATOR_BOOL_NOEXCEPT()
+    bool operator!() const BOOST_NOEXCEPT_OR_NOTHROW { return shards.empty(); }
+
+    static inline shared_ptr<ShardedPersistentDict> factory(const vector<CBString>& directories, const CBString& database_name=CBString(),
+                                                            const lmdb_options& options=lmdb_options(),
+                                                            partitioning p=HASH_PARTITIONING,
+                                                            const vector<CBString>& split_points=vector<CBString>()) {
+        return shared_ptr<ShardedPersistentDict>(new ShardedPersistentDict(directories, database_name, options, p, split_points));
+    }
+
+    CBString get_dbname() const BOOST_NOEXCEPT_OR_NOTHROW { return dbname; }
+    partitioning get_partitioning() const BOOST_NOEXCEPT_OR_NOTHROW { return part; }
+    size_t num_shards() const BOOST_NOEXCEPT_OR_NOTHROW { return shards.size(); }
+    shared_ptr<PersistentDict> get_shard(size_t i) const;                           // can throw
+    size_t shard_of(MDB_val key) const BOOST_NOEXCEPT_OR_NOTHROW;
+    size_t shard_of(const CBString& key) const BOOST_NOEXCEPT_OR_NOTHROW { return shard_of(make_mdb_val(key)); }
+
+    size_t size() const;                                                            // can throw
+    bool empty() const;                                                             // can throw
+    void clear();                                                                   // can throw
+
+    void insert(MDB_val k, MDB_val v) { shards[shard_of(k)]->insert(k, v); }        // can throw
+    void insert(const CBString& key, const CBString& value) { insert(make_mdb_val(key), make_mdb_val(value)); }
+    CBString at(MDB_val k) const { return shards[shard_of(k)]->at(k); }             // can throw
+    CBString at(const CBString& key) const { return at(make_mdb_val(key)); }
+    bool contains(MDB_val k) const { return shards[shard_of(k)]->contains(k); }     // can throw
+    bool contains(const CBString& key) const { return contains(make_mdb_val(key)); }
+    bool erase(MDB_val k) { return shards[shard_of(k)]->erase(k); }                 // can throw
+    bool erase(const CBString& key) { return erase(make_mdb_val(key)); }
+
+    // batch operations: the items are grouped by shard, and each group is written in one transaction by its own thread
+    void insert(const items& kvs);                                                  // can throw
+    size_t erase(const vector<CBString>& keys);                                     // can throw
+
+    // ordered iteration over [first_key, last_key) of all the shards (k-way merge of the shards iterators).
+    // It holds a read transaction in each shard.
+    class const_iterator: private boost::noncopyable {
+    private:
+        struct greater_key {
+            const vector< shared_ptr<PersistentDict::const_iterator> >* its;
+            greater_key(const vector< shared_ptr<PersistentDict::const_iterator> >* i): its(i) { }
+            bool operator()(size_t a, size_t b) const;
+        };
+
+        vector< shared_ptr<PersistentDict::const_iterator> > its;
+        vector<size_t> heap;        // shards that are not exhausted, the smallest current key on top
+        const CBString last_key;
+
+        bool in_range(size_t i) const;
+        void push(size_t i);
+
+    public:
+        const_iterator(shared_ptr<const ShardedPersistentDict> d, const CBString& first_key, const CBString& last_key);  // can throw
+
+        bool has_reached_end() const BOOST_NOEXCEPT_OR_NOTHROW { return heap.empty(); }
+        size_t current_shard() const;                                               // can throw
+        CBString get_key() const;                                                   // can throw
+        CBString get_value() const;                                                 // can throw
+        pair<CBString, CBString> get_item() const;                                  // can throw
+        void next();                                                                // can throw
+        const_iterator& operator++() { next(); return *this; }
+
+    };  // END CLASS const_iterator
+
+    shared_ptr<const_iterator> make_iterator(const CBString& first_key=CBString(), const CBString& last_key=CBString()) const {
+        return shared_ptr<const_iterator>(new const_iterator(shared_from_this(), first_key, last_key));
+    }
+
+};  // END CLASS ShardedPersistentDict
+
+}   // END NS quiet
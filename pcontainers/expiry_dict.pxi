@@ -1,17 +1,44 @@
 # -*- coding: utf-8 -*-
 
+cdef class PRawExpiryDict(object):
+    cdef shared_ptr[cppExpiryPersistentDict] ptr
+    cdef bint rmrf_at_delete
+    cdef readonly double default_ttl
+    cdef readonly double prune_period
+    cdef readonly double flush_period
+    cdef readonly double stale_grace
+    cdef _SingleFlight flights
+    cdef uint64_t ttl_ms(self, ttl) except *
+    cdef uint64_t deadline(self, ttl) except *
+    cpdef get(self, key, default=?)
+    cpdef set(self, key, value, ttl=?, sliding=?)
+    cpdef get_or_compute(self, key, loader, ttl=?, sliding=?)
+    cpdef pop(self, key, default=?)
+    cpdef popitem(self)
+    cpdef ttl(self, key)
+    cpdef expire(self, key, ttl)
+    cpdef prune_expired(self, size_t max_entries=?)
+    cpdef flush_touches(self)
+    cpdef enable_eviction(self, size_t max_entries=?, size_t max_bytes=?, policy=?)
+
+
 cdef class ExpiryDict(object):
-    cdef time_t default_expiry
-    cdef time_t prune_period
-    cdef PDict values_dict
-    cdef PDict index_dict
-    cdef PDict metadata_dict
+    cdef PRawExpiryDict raw
+    cdef readonly time_t default_expiry
+    cdef readonly time_t prune_period
+    cdef readonly Chain key_chain
+    cdef readonly Chain value_chain
+    cdef readonly Chain metadata_chain
+    cdef _SingleFlight flights
+    cdef dumps_key(self, key)
+    cdef loads_value(self, CBString& value)
+    cdef loads_metadata(self, CBString& metadata)
     cpdef get_metadata(self, key)
-    cpdef set(self, key, value, time_t expiry=?, metadata=?)
+    cpdef set(self, key, value, time_t expiry=?, metadata=?, sliding=?)
+    cpdef get_or_compute(self, key, loader, time_t expiry=?, sliding=?)
     cpdef set_metadata(self, key, metadata)
     cpdef pop(self, key)
     cpdef popitem(self)
     cpdef prune_expired(self)
-
-    cdef object stopping
-    cdef object pruning_thread
+    cpdef flush_touches(self)
+    cpdef enable_eviction(self, size_t max_entries=?, size_t max_bytes=?, policy=?)
@@ -1,347 +1,724 @@
 # -*- coding: utf-8 -*-
 
 cdef class ExpiryDict(object):
+    """
+    A persistent dict whose entries expire 'expiry' seconds after they were set, with metadata for each entry.
+
+    The values, the expiry index and the metadata are named databases of a single LMDB environment (see
+    PRawExpiryDict): set, pop, __delitem__, update and prune_expired each run in one write transaction, so an entry is
+    never partially written or deleted. Used as a context manager, the dict prunes itself every prune_period seconds.
+    A directory written by the former layout (index, values and metadata environments) is migrated when it is opened.
+
+    An expiry of 0 means default_expiry, a negative expiry means that the entry never expires. An entry set with
+    sliding=True expires 'expiry' seconds after it was last read (see PRawExpiryDict): the reads are flushed to the
+    expiry index every flush_period seconds, while the dict is used as a context manager.
+
+    get_or_compute loads the missing or expired entries with a single computation per key, and serves the entries
+    that expired less than stale_grace seconds ago while it refreshes them (see PRawExpiryDict.get_or_compute).
+    """
     def __init__(self, bytes dirname, time_t default_expiry=3600, time_t prune_period=5, LmdbOptions opts=None,
-                 Chain key_chain=None, Chain value_chain=None):
+                 Chain key_chain=None, Chain value_chain=None, Chain metadata_chain=None, double flush_period=1,
+                 double stale_grace=0):
 
-        if opts is None:
-            opts = LmdbOptions()
         if key_chain is None:
             key_chain = Chain(None, None, None)
         if value_chain is None:
             value_chain = Chain(PickleSerializer(), None, None)
-        metadata_chain = Chain(MessagePackSerializer(), None, None)
+        if metadata_chain is None:
+            metadata_chain = Chain(MessagePackSerializer(), None, None)
         if prune_period <= 0:
             raise ValueError("prune_period must be strictly positive")
 
-        self.index_dict = PDict(dirname=join(dirname, 'index'), dbname=b'', opts=opts, mapping=None,
-                                key_chain=key_chain, value_chain=NoneChain())
-
-        self.values_dict = PDict(dirname=join(dirname, 'values'), dbname=b'', opts=opts, mapping=None,
-                                 key_chain=key_chain, value_chain=value_chain)
-
-        self.metadata_dict = PDict(dirname=join(dirname, 'metadata'), dbname=b'', opts=opts, mapping=None,
-                             key_chain=key_chain, value_chain=metadata_chain)
-
+        self.raw = PRawExpiryDict(dirname, dbname=b'entries', opts=opts, default_ttl=default_expiry,
+                                  prune_period=prune_period, flush_period=flush_period, stale_grace=stale_grace)
+        self.flights = _SingleFlight()
+        self.key_chain = key_chain
+        self.value_chain = value_chain
+        self.metadata_chain = metadata_chain
         self.default_expiry = default_expiry
         self.prune_period = prune_period
-        self.stopping = threading.Event()
+        self.raw.migrate_legacy_layout(dirname)
         self.prune_expired()
 
     def __enter__(self):
-        self.pruning_thread = threading.Thread(target=self.pruning_thread_fun)
-        self.pruning_thread.start()
+        self.raw.__enter__()
         return self
 
     def __exit__(self, exc_type, exc_val, exc_tb):
-        self.stopping.set()
-        self.pruning_thread.join()
+        self.raw.__exit__(exc_type, exc_val, exc_tb)
+
+    property dirname:
+        def __get__(self):
+            return self.raw.dirname
 
-    def pruning_thread_fun(self):
-        while not self.stopping.is_set():
-            self.stopping.wait(self.prune_period)
-            self.prune_expired()
+    property touch_stats:
+        def __get__(self):
+            return self.raw.touch_stats
+
+    property stale_grace:
+        def __get__(self):
+            return self.raw.stale_grace
+
+    property flight_stats:
+        def __get__(self):
+            return self.flights.stats
 
     cpdef prune_expired(self):
-        cdef time_t now = c_time(NULL)
-        cdef time_t expiry
-
-        cdef PRawDictIterator index_it = PRawDictIterator(self.index_dict)
-        cdef PRawDictIterator values_it = PRawDictIterator(self.values_dict)
-        cdef PRawDictIterator metadata_it = PRawDictIterator(self.metadata_dict)
-
-        with index_it:
-            with values_it:
-                with metadata_it:
-                    try:
-                        while not index_it.has_reached_end():
-                            s_expiry = index_it.get_value_buf()
-                            if s_expiry == b"none":
-                                continue
-                            expiry = int(s_expiry)
-                            if now >= expiry:
-                                key = index_it.get_key_buf()
-                                index_it.dlte()
-                                values_it.dlte(key)
-                                metadata_it.dlte(key)
-                            index_it.incr()
-
-                    except:
-                        index_it.set_rollback()
-                        values_it.set_rollback()
-                        metadata_it.set_rollback()
-                        raise
+        return self.raw.prune_expired()
+
+    cpdef flush_touches(self):
+        return self.raw.flush_touches()
+
+    cpdef enable_eviction(self, size_t max_entries=0, size_t max_bytes=0, policy='lru'):
+        """
+        Bound the size of the dict, see PRawExpiryDict.enable_eviction.
+        """
+        self.raw.enable_eviction(max_entries, max_bytes, policy)
+
+    def eviction_stats(self):
+        return self.raw.eviction_stats()
+
+    cdef dumps_key(self, key):
+        key = self.key_chain.dumps(key)
+        if not len(key):
+            raise EmptyKey()
+        return key
+
+    cdef loads_value(self, CBString& value):
+        return self.value_chain.loads(make_mbufferio_from_cbstring(value))
+
+    cdef loads_metadata(self, CBString& metadata):
+        if metadata.length() == 0:
+            return {}
+        return self.metadata_chain.loads(make_mbufferio_from_cbstring(metadata))
 
     def __getitem__(self, key):
-        cdef time_t expiry
-        cdef time_t now = c_time(NULL)
-        cdef PRawDictConstIterator index_it = PRawDictConstIterator(self.index_dict, key=key)
-        cdef PRawDictConstIterator values_it = PRawDictConstIterator(self.values_dict, key=key)
-
-        with index_it:
-            with values_it:
-                if index_it.has_reached_end():
-                    raise NotFound()
-                s_expiry = index_it.get_value_buf()
-                if s_expiry == b"none":
-                    return values_it.get_value_buf()
-                expiry = int(s_expiry)
-                if now < expiry:
-                    return values_it.get_value_buf()
-                raise NotFound()
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.dumps_key(key)))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString value
+        cdef cpp_bool found
+        with nogil:
+            found = self.raw.ptr.get().get(k, value)
+        if not found:
+            raise NotFound()
+        return self.loads_value(value)
 
     cpdef get_metadata(self, key):
-        cdef time_t expiry
-        cdef time_t now = c_time(NULL)
-        cdef PRawDictConstIterator index_it = PRawDictConstIterator(self.index_dict, key=key)
-        cdef PRawDictConstIterator metadata_it = PRawDictConstIterator(self.metadata_dict, key=key)
-
-        with index_it:
-            with metadata_it:
-                if index_it.has_reached_end():
-                    raise NotFound()
-                s_expiry = index_it.get_value_buf()
-                if s_expiry == b"none":
-                    return metadata_it.get_value_buf()
-                expiry = int(s_expiry)
-                if now < expiry:
-                    return metadata_it.get_value_buf()
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.dumps_key(key)))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString metadata
+        cdef cpp_bool found
+        with nogil:
+            found = self.raw.ptr.get().get_metadata(k, metadata)
+        if not found:
+            if key not in self:
                 raise NotFound()
+            return {}
+        return self.loads_metadata(metadata)
 
     def __setitem__(self, key, value):
         self.set(key, value)
 
-    cpdef set(self, key, value, time_t expiry=0, metadata=None):
-        cdef time_t now = c_time(NULL)
+    cpdef set(self, key, value, time_t expiry=0, metadata=None, sliding=False):
         if metadata is None:
             metadata = {}
-        if expiry == 0:
-            expiry = self.default_expiry
-        s_expiry = b"none" if expiry <= 0 else bytes(expiry + now)
-
-        cdef PRawDictIterator index_it = PRawDictIterator(self.index_dict)
-        cdef PRawDictIterator values_it = PRawDictIterator(self.values_dict)
-        cdef PRawDictIterator metadata_it = PRawDictIterator(self.metadata_dict)
-
-        with index_it:
-            with values_it:
-                with metadata_it:
-                    try:
-                        index_it.set_item_buf(key, s_expiry)
-                        values_it.set_item_buf(key, value)
-                        metadata_it.set_item_buf(key, metadata)
-                    except:
-                        index_it.set_rollback()
-                        values_it.set_rollback()
-                        metadata_it.set_rollback()
-                        raise
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.dumps_key(key)))
+        if key_view.length() > 503:
+            raise BadValSize("key is too long")
+        cdef uint64_t deadline = self.raw.deadline(expiry)
+        cdef uint64_t sliding_ms = self.raw.ttl_ms(expiry) if sliding else 0
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef PyBufferWrap value_view = move(PyBufferWrap(self.value_chain.dumps(value)))
+        cdef PyBufferWrap metadata_view = move(PyBufferWrap(self.metadata_chain.dumps(metadata)))
+        cdef MDB_val v = value_view.get_mdb_val()
+        cdef MDB_val m = metadata_view.get_mdb_val()
+        with nogil:
+            self.raw.ptr.get().insert(k, v, deadline, m, sliding_ms)
+
+    cpdef get_or_compute(self, key, loader, time_t expiry=0, sliding=False):
+        """
+        The value of key. When key is missing or expired, loader(key) computes the value, that is set (with empty
+        metadata) and returned. The concurrent misses of key wait for the computation in flight instead of calling
+        loader again; the entries that expired less than stale_grace seconds ago are returned right away while one
+        background thread refreshes them.
+        """
+        serialized_key = self.dumps_key(key)
+        cdef PyBufferWrap key_view = move(PyBufferWrap(serialized_key))
+        if key_view.length() > 503:
+            raise BadValSize("key is too long")
+        cdef MDB_val mk = key_view.get_mdb_val()
+        cdef CBString k = tocbstring(serialized_key)
+        cdef CBString value
+        cdef cpp_bool found
+        cdef cpp_bool fresh = False
+        cdef single_flight_ticket ticket
+        with nogil:
+            found = self.raw.ptr.get().get_stale(mk, value, fresh)
+        if found and fresh:
+            return self.loads_value(value)
+        if found:
+            with nogil:
+                ticket = self.flights.table.get().try_lead(k)
+            if ticket.leader:
+                self.flights.refresh_in_background(k, ticket.id, partial(self._load, key, loader, expiry, sliding))
+            return self.loads_value(value)
+        with nogil:
+            ticket = self.flights.table.get().join(k)
+        if not ticket.leader:
+            value = self.flights.wait(ticket.result, ticket.id)
+            return self.loads_value(value)
+        return self.flights.lead(k, ticket.id, partial(self._load, key, loader, expiry, sliding))
+
+    def _load(self, key, loader, time_t expiry, sliding):
+        cdef CBString value
+        cdef cpp_bool found
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.dumps_key(key)))
+        cdef MDB_val k = key_view.get_mdb_val()
+        # the flight that just completed may have set key already
+        with nogil:
+            found = self.raw.ptr.get().get(k, value)
+        if found:
+            return self.loads_value(value), topy(value)
+        result = loader(key)
+        serialized = self.value_chain.dumps(result)
+        cdef uint64_t deadline = self.raw.deadline(expiry)
+        cdef uint64_t sliding_ms = self.raw.ttl_ms(expiry) if sliding else 0
+        cdef PyBufferWrap value_view = move(PyBufferWrap(serialized))
+        cdef PyBufferWrap metadata_view = move(PyBufferWrap(self.metadata_chain.dumps({})))
+        cdef MDB_val v = value_view.get_mdb_val()
+        cdef MDB_val m = metadata_view.get_mdb_val()
+        with nogil:
+            self.raw.ptr.get().insert(k, v, deadline, m, sliding_ms)
+        return result, serialized
 
     cpdef set_metadata(self, key, metadata):
-        cdef time_t now = c_time(NULL)
         if not metadata:
             metadata = {}
-
-        cdef PRawDictConstIterator index_it = PRawDictConstIterator(self.index_dict, key=key)
-        cdef PRawDictIterator metadata_it = PRawDictIterator(self.metadata_dict)
-
-        with index_it:
-            with metadata_it:
-                try:
-                    if index_it.has_reached_end():
-                        raise NotFound()
-                    s_expiry = index_it.get_value_buf()
-                    if s_expiry == b"none":
-                        metadata_it.set_item_buf(key, metadata)
-                    expiry = int(s_expiry)
-                    if now < expiry:
-                        metadata_it.set_item_buf(key, metadata)
-                    else:
-                        raise NotFound()
-                except:
-                    metadata_it.set_rollback()
-                    raise
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.dumps_key(key)))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef PyBufferWrap metadata_view = move(PyBufferWrap(self.metadata_chain.dumps(metadata)))
+        cdef MDB_val m = metadata_view.get_mdb_val()
+        cdef cpp_bool found
+        with nogil:
+            found = self.raw.ptr.get().set_metadata(k, m)
+        if not found:
+            raise NotFound()
 
     def __delitem__(self, key):
-        if not key:
-            raise EmptyKey()
-        cdef time_t now = c_time(NULL)
-        before = bytes(now - 1)
-
-        cdef PRawDictIterator index_it = PRawDictIterator(self.index_dict, key=key)
-        cdef time_t expiry
-
-        with index_it:
-            if index_it.has_reached_end():
-                raise NotFound()
-            s_expiry = index_it.get_value_buf()
-            if s_expiry == b"none":
-                index_it.set_item_buf(key, before)
-                return
-            expiry = int(s_expiry)
-            if now < expiry:
-                index_it.set_item_buf(key, before)
-                return
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.dumps_key(key)))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef cpp_bool found
+        with nogil:
+            found = self.raw.ptr.get().erase(k)
+        if not found:
             raise NotFound()
 
     cpdef pop(self, key):
-        if not key:
-            raise EmptyKey()
-        cdef time_t now = c_time(NULL)
-        cdef time_t expiry
-        before = bytes(now - 1)
-
-        cdef PRawDictIterator index_it = PRawDictIterator(self.index_dict, key=key)
-        cdef PRawDictConstIterator values_it = PRawDictConstIterator(self.values_dict, key=key)
-        cdef PRawDictConstIterator metadata_it = PRawDictConstIterator(self.metadata_dict, key=key)
-
-        with index_it:
-            with values_it:
-                with metadata_it:
-                    try:
-                        if index_it.has_reached_end():
-                            raise NotFound()
-                        s_expiry = index_it.get_value_buf()
-                        if s_expiry == b"none":
-                            index_it.set_item_buf(key, before)
-                            return values_it.get_value_buf(), metadata_it.get_value_buf()
-                        expiry = int(s_expiry)
-                        if now < expiry:
-                            index_it.set_item_buf(key, before)
-                            return values_it.get_value_buf(), metadata_it.get_value_buf()
-                        raise NotFound()
-                    except:
-                        index_it.set_rollback()
-                        raise
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.dumps_key(key)))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString value
+        cdef CBString metadata
+        cdef cpp_bool found
+        with nogil:
+            found = self.raw.ptr.get().pop(k, value, metadata)
+        if not found:
+            raise NotFound()
+        return self.loads_value(value), self.loads_metadata(metadata)
 
     cpdef popitem(self):
-        cdef time_t expiry
-        cdef time_t now = c_time(NULL)
-        before = bytes(now - 1)
-        cdef PRawDictIterator index_it = PRawDictIterator(self.index_dict)
-        cdef PRawDictConstIterator values_it
-        cdef PRawDictConstIterator metadata_it
-        with index_it:
-            while not index_it.has_reached_end():
-                s_expiry = index_it.get_value_buf()
-                key = index_it.get_key_buf()
-                values_it = PRawDictConstIterator(self.values_dict, key=key)
-                metadata_it = PRawDictConstIterator(self.metadata_dict, key=key)
-
-                with values_it:
-                    with metadata_it:
-                        if s_expiry == b"none":
-                            index_it.set_item_buf(key, before)
-                            return key, values_it.get_value_buf(), metadata_it.get_value_buf()
-                        expiry = int(s_expiry)
-                        if now < expiry:
-                            index_it.set_item_buf(key, before)
-                            return key, values_it.get_value_buf(), metadata_it.get_value_buf()
-                index_it.incr()
+        cdef CBString key
+        cdef CBString value
+        cdef CBString metadata
+        cdef cpp_bool found
+        with nogil:
+            found = self.raw.ptr.get().pop_first(key, value, metadata)
+        if not found:
             raise EmptyDatabase()
+        return (self.key_chain.loads(make_mbufferio_from_cbstring(key)), self.loads_value(value),
+                self.loads_metadata(metadata))
+
+    def items(self):    # cpdef not possible because of yield
+        """
+        Iterate over the live (key, value, metadata) entries, in one read snapshot.
+        """
+        cdef shared_ptr[cppExpiryConstIterator] it
+        cdef CBString key
+        cdef CBString value
+        cdef CBString metadata
+        with nogil:
+            it.reset(new cppExpiryConstIterator(self.raw.ptr))
+        while not it.get().has_reached_end():
+            key = it.get().get_key()
+            value = it.get().get_value()
+            metadata = it.get().get_metadata()
+            yield (self.key_chain.loads(make_mbufferio_from_cbstring(key)), self.loads_value(value),
+                   self.loads_metadata(metadata))
+            it.get().incr()
 
     def __iter__(self):
-        cdef time_t expiry
-        cdef time_t now = c_time(NULL)
-        cdef PRawDictIterator index_it = PRawDictConstIterator(self.index_dict)
-        with index_it:
-            while not index_it.has_reached_end():
-                s_expiry = index_it.get_value_buf()
-                if s_expiry == b"none":
-                    yield index_it.get_key_buf()
-                else:
-                    expiry = int(s_expiry)
-                    if now < expiry:
-                        yield index_it.get_key_buf()
-                index_it.incr()
+        cdef shared_ptr[cppExpiryConstIterator] it
+        cdef CBString key
+        with nogil:
+            it.reset(new cppExpiryConstIterator(self.raw.ptr))
+        while not it.get().has_reached_end():
+            key = it.get().get_key()
+            yield self.key_chain.loads(make_mbufferio_from_cbstring(key))
+            it.get().incr()
 
     def keys(self):
-        return self.__iter__(self)
-
-    def values(self):       # cpdef not possible because of yield
-        cdef time_t expiry
-        cdef time_t now = c_time(NULL)
-        cdef PRawDictIterator index_it = PRawDictConstIterator(self.index_dict)
-        cdef PRawDictIterator values_it = PRawDictConstIterator(self.index_dict)
-        with index_it:
-            with values_it:
-                while not index_it.has_reached_end():
-                    s_expiry = index_it.get_value_buf()
-                    if s_expiry == b"none":
-                        yield values_it.get_value_buf()
-                    else:
-                        expiry = int(s_expiry)
-                        if now < expiry:
-                            yield values_it.get_value_buf()
-                    index_it.incr()
-                    values_it.incr()
+        return self.__iter__()
 
-    def items(self):    # cpdef not possible because of yield
-        cdef time_t expiry
-        cdef time_t now = c_time(NULL)
-        cdef PRawDictConstIterator index_it = PRawDictConstIterator(self.index_dict)
-        cdef PRawDictConstIterator values_it = PRawDictConstIterator(self.index_dict)
-        cdef PRawDictConstIterator metadata_it = PRawDictConstIterator(self.metadata_dict)
-        with index_it:
-            with values_it:
-                with metadata_it:
-                    while not index_it.has_reached_end():
-                        s_expiry = index_it.get_value_buf()
-                        if s_expiry == b"none":
-                            yield values_it.get_key_buf(), values_it.get_value_buf(), metadata_it.get_value_buf()
-                        else:
-                            expiry = int(s_expiry)
-                            if now < expiry:
-                                yield values_it.get_key_buf(), values_it.get_value_buf(), metadata_it.get_value_buf()
-                        index_it.incr()
-                        values_it.incr()
-                        metadata_it.incr()
+    def values(self):
+        for _, value, _ in self.items():
+            yield value
 
     def __contains__(self, key):
-        if not key:
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.dumps_key(key)))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef cpp_bool res
+        with nogil:
+            res = self.raw.ptr.get().contains(k)
+        return res
+
+    def __len__(self):
+        """
+        The number of entries, including the expired entries that are not pruned yet.
+        """
+        return len(self.raw)
+
+    def update(self, e=None, time_t expiry=0, sliding=False, **kwds):
+        """
+        Set several entries (with empty metadata) in one transaction.
+        """
+        cdef vector[CBString] keys
+        cdef vector[CBString] values
+        cdef vector[CBString] metadata
+        cdef uint64_t deadline = self.raw.deadline(expiry)
+        cdef uint64_t sliding_ms = self.raw.ttl_ms(expiry) if sliding else 0
+        cdef CBString empty = tocbstring(self.metadata_chain.dumps({}))
+        pairs = []
+        if e is not None:
+            pairs = e.items() if hasattr(e, 'keys') else e
+        for key, value in itertools.chain(pairs, kwds.items()):
+            keys.push_back(tocbstring(self.dumps_key(key)))
+            values.push_back(tocbstring(self.value_chain.dumps(value)))
+            metadata.push_back(empty)
+        with nogil:
+            self.raw.ptr.get().insert_many(keys, values, metadata, deadline, sliding_ms)
+
+
+# noinspection PyPep8Naming
+cdef class PRawExpiryDict(object):
+    """
+    A persistent dict of bytes whose entries expire after their time to live (in seconds).
+
+    The entries and their expiry index live in one LMDB environment and are updated in the same transaction. The index
+    is sorted by deadline, so that pruning only visits the expired entries. Expired entries are never returned, even
+    before they are pruned. Used as a context manager, the dict prunes itself every prune_period seconds in a native
+    thread (start_pruning / stop_pruning).
+
+    A ttl of 0 (or None) means default_ttl, a negative ttl means that the entry never expires.
+
+    An entry set with sliding=True gets its ttl again each time it is read. The reads don't write: they are buffered
+    in memory (several reads of a key count once) and written to the expiry index in one transaction every
+    flush_period seconds (start_flushing_touches / stop_flushing_touches, also started by the context manager). A read
+    that is not written yet still keeps its entry alive, and pruning writes the buffered reads first.
+
+    get_or_compute is a read-through get: concurrent misses of a key wait for one computation of its value. With a
+    stale_grace (in seconds), pruning keeps the expired entries that long, and get_or_compute returns them while a
+    single background thread computes their new value (stale-while-revalidate). The other reads ignore them.
+    """
+
+    def __cinit__(self, bytes dirname, bytes dbname=b'expiry', LmdbOptions opts=None, double default_ttl=3600,
+                  double prune_period=5, double flush_period=1, double stale_grace=0):
+        if opts is None:
+            opts = LmdbOptions()
+        self.ptr = expiry_dict_factory(tocbstring(dirname), tocbstring(dbname), (<LmdbOptions> opts).opts)
+        self.rmrf_at_delete = 0
+        self.flights = _SingleFlight()
+
+    def __init__(self, bytes dirname, bytes dbname=b'expiry', LmdbOptions opts=None, double default_ttl=3600,
+                 double prune_period=5, double flush_period=1, double stale_grace=0):
+        if prune_period <= 0:
+            raise ValueError("prune_period must be strictly positive")
+        if flush_period <= 0:
+            raise ValueError("flush_period must be strictly positive")
+        if stale_grace < 0:
+            raise ValueError("stale_grace must be positive")
+        self.default_ttl = default_ttl
+        self.prune_period = prune_period
+        self.flush_period = flush_period
+        self.stale_grace = stale_grace
+        self.ptr.get().set_stale_grace(<uint64_t> (stale_grace * 1000))
+
+    def __dealloc__(self):
+        if self.ptr.get():
+            with nogil:
+                self.ptr.get().stop_flushing_touches()
+                self.ptr.get().stop_pruning()
+            if self.rmrf_at_delete:
+                shutil.rmtree(self.dirname)
+                self.rmrf_at_delete = 0
+
+            with nogil:
+                self.ptr.reset()
+
+    def __repr__(self):
+        return u"PRawExpiryDict(dbname='{}', dirname='{}')".format(
+            make_unicode(self.dbname), make_unicode(self.dirname)
+        )
+
+    @classmethod
+    def make_temp(cls, destroy=True, LmdbOptions opts=None, double default_ttl=3600, double prune_period=5,
+                  double flush_period=1, double stale_grace=0):
+        cdef shared_ptr[TempDirectory] temp_dir_ptr = make_temp_directory(True, False)
+        d = cls(dirname=topy(temp_dir_ptr.get().get_path()), opts=opts, default_ttl=default_ttl,
+                prune_period=prune_period, flush_period=flush_period, stale_grace=stale_grace)
+        (<PRawExpiryDict>d).rmrf_at_delete = bool(destroy)
+        return d
+
+    property dirname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dirname())
+
+    property dbname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dbname())
+
+    property pruned:
+        def __get__(self):
+            return self.ptr.get().get_pruned()
+
+    def __enter__(self):
+        self.start_pruning()
+        self.start_flushing_touches()
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.stop_flushing_touches()
+        self.stop_pruning()
+
+    def start_pruning(self, period=None):
+        """
+        Prune the expired entries every 'period' seconds (by default prune_period) in a native thread.
+        """
+        cdef uint64_t period_ms = max(1, int((self.prune_period if period is None else period) * 1000))
+        with nogil:
+            self.ptr.get().start_pruning(period_ms)
+
+    def stop_pruning(self):
+        with nogil:
+            self.ptr.get().stop_pruning()
+
+    property pruning:
+        def __get__(self):
+            return self.ptr.get().is_pruning()
+
+    def start_flushing_touches(self, period=None):
+        """
+        Write the buffered reads of the sliding entries every 'period' seconds (by default flush_period) in a native
+        thread, or sooner when many reads are buffered.
+        """
+        cdef uint64_t period_ms = max(1, int((self.flush_period if period is None else period) * 1000))
+        with nogil:
+            self.ptr.get().start_flushing_touches(period_ms)
+
+    def stop_flushing_touches(self):
+        """
+        Stop the flushing thread, then write the reads that are still buffered.
+        """
+        with nogil:
+            self.ptr.get().stop_flushing_touches()
+
+    property flushing_touches:
+        def __get__(self):
+            return self.ptr.get().is_flushing_touches()
+
+    cpdef flush_touches(self):
+        """
+        Write the buffered reads of the sliding entries in one transaction. Return the number of entries whose
+        deadline moved.
+        """
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().flush_touches()
+        return n
+
+    cpdef enable_eviction(self, size_t max_entries=0, size_t max_bytes=0, policy='lru'):
+        """
+        Bound the size of the dict: a write that makes it go over max_entries entries or max_bytes bytes (of keys and
+        values) prunes the expired entries, then evicts a batch of the least recently ('lru') or least frequently
+        ('lfu') used ones, in its own transaction. The reads count as uses. 0 means no limit. Calling it again
+        changes the limits.
+        """
+        cdef eviction_policy p = _eviction_policy(policy)
+        with nogil:
+            self.ptr.get().enable_eviction(p, max_entries, max_bytes)
+
+    def eviction_stats(self):
+        cdef eviction_stats stats
+        with nogil:
+            stats = self.ptr.get().get_eviction_stats()
+        return _eviction_stats_dict(stats)
+
+    property flight_stats:
+        def __get__(self):
+            return self.flights.stats
+
+    property touch_stats:
+        def __get__(self):
+            cdef cppExpiryTouchStats stats = self.ptr.get().get_touch_stats()
+            return {
+                'touches': stats.touches,
+                'coalesced': stats.coalesced,
+                'flushed': stats.flushed,
+                'flushes': stats.flushes,
+                'pending': stats.pending
+            }
+
+    cdef uint64_t ttl_ms(self, ttl) except *:
+        # 0 means "never expires"
+        if ttl is None or ttl == 0:
+            ttl = self.default_ttl
+        if ttl < 0:
+            return 0
+        return max(1, int(ttl * 1000))
+
+    cdef uint64_t deadline(self, ttl) except *:
+        cdef uint64_t ms = self.ttl_ms(ttl)
+        if ms == 0:
+            return 0
+        return expiry_now_ms() + ms
+
+    def __len__(self):
+        """
+        The number of entries, including the expired entries that are not pruned yet.
+        """
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().size()
+        return n
+
+    def __contains__(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().contains(k)
+        return res
+
+    def __getitem__(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString value
+        cdef cpp_bool found
+        with nogil:
+            found = self.ptr.get().get(k, value)
+        if not found:
+            raise NotFound()
+        return topy(value)
+
+    cpdef get(self, key, default=None):
+        try:
+            return self[key]
+        except NotFound:
+            return default
+
+    def __setitem__(self, key, value):
+        self.set(key, value)
+
+    cpdef set(self, key, value, ttl=None, sliding=False):
+        """
+        Set key, that expires after ttl seconds. With sliding=True, each read of key gives it ttl seconds again.
+        """
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        if key_view.length() == 0:
+            raise EmptyKey()
+        if key_view.length() > 503:
+            # the index key is the 8 bytes deadline followed by the key
+            raise BadValSize("key is too long")
+        cdef uint64_t deadline = self.deadline(ttl)
+        cdef uint64_t sliding_ms = self.ttl_ms(ttl) if sliding else 0
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef PyBufferWrap value_view = move(PyBufferWrap(value))
+        cdef MDB_val v = value_view.get_mdb_val()
+        cdef MDB_val no_metadata
+        no_metadata.mv_size = 0
+        no_metadata.mv_data = NULL
+        with nogil:
+            self.ptr.get().insert(k, v, deadline, no_metadata, sliding_ms)
+
+    cpdef get_or_compute(self, key, loader, ttl=None, sliding=False):
+        """
+        The value of key. When key is missing or expired, loader(key) computes the value (bytes), that is set with
+        ttl and returned.
+
+        The concurrent misses of key (by the threads that use this dict object) don't call loader again: they wait for
+        the computation in flight and get the value it set, or its exception. An entry that expired less than
+        stale_grace seconds ago is returned right away, and the first of these stale reads starts a daemon thread that
+        calls loader and sets the new value.
+        """
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        if key_view.length() == 0:
             raise EmptyKey()
-        cdef time_t expiry
-        cdef PRawDictIterator index_it = PRawDictConstIterator(self.index_dict, key=key)
-        with index_it:
-            if index_it.has_reached_end():
-                return False
-            s_expiry = index_it.get_value_buf()
-            if s_expiry == b"none":
-                return False
-            expiry = int(s_expiry)
-            if c_time(NULL) < expiry:
-                return True
-            return False
-
-    def update(self, e=None, time_t expiry=0, **kwds):
-        cdef PRawDictIterator index_it = PRawDictIterator(self.index_dict)
-        cdef PRawDictIterator values_it = PRawDictIterator(self.values_dict)
-        cdef PRawDictIterator metadata_it = PRawDictIterator(self.metadata_dict)
-        if expiry == 0:
-            expiry = self.default_expiry
-        s_expiry = b"none" if expiry <= 0 else bytes(expiry + c_time(NULL))
-
-        with index_it:
-            with values_it:
-                with metadata_it:
-                    try:
-                        if e is not None:
-                            if hasattr(e, 'keys'):
-                                for key in e.keys():
-                                    index_it.set_item_buf(key, s_expiry)
-                                    values_it.set_item_buf(key, e[key])
-                                    metadata_it.set_item_buf(key, {})
-                            else:
-                                for (key, value) in e:
-                                    index_it.set_item_buf(key, s_expiry)
-                                    values_it.set_item_buf(key, value)
-                                    metadata_it.set_item_buf(key, {})
-                        for key in kwds:
-                            index_it.set_item_buf(key, s_expiry)
-                            values_it.set_item_buf(key, kwds[key])
-                            metadata_it.set_item_buf(key, {})
-                    except:
-                        index_it.set_rollback()
-                        values_it.set_rollback()
-                        metadata_it.set_rollback()
-                        raise
+        if key_view.length() > 503:
+            raise BadValSize("key is too long")
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString flight_key = tocbstring(key)
+        cdef CBString value
+        cdef cpp_bool found
+        cdef cpp_bool fresh = False
+        cdef single_flight_ticket ticket
+        with nogil:
+            found = self.ptr.get().get_stale(k, value, fresh)
+        if found and fresh:
+            return topy(value)
+        if found:
+            # a single refresh: the other stale reads don't wait for it
+            with nogil:
+                ticket = self.flights.table.get().try_lead(flight_key)
+            if ticket.leader:
+                self.flights.refresh_in_background(flight_key, ticket.id, partial(self._load, key, loader, ttl, sliding))
+            return topy(value)
+        with nogil:
+            ticket = self.flights.table.get().join(flight_key)
+        if not ticket.leader:
+            return topy(self.flights.wait(ticket.result, ticket.id))
+        return self.flights.lead(flight_key, ticket.id, partial(self._load, key, loader, ttl, sliding))
+
+    def _load(self, key, loader, ttl, sliding):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString current
+        cdef cpp_bool found
+        # the flight that just completed may have set key already
+        with nogil:
+            found = self.ptr.get().get(k, current)
+        if found:
+            value = topy(current)
+            return value, value
+        value = loader(key)
+        self.set(key, value, ttl, sliding)
+        return value, value
+
+    def update(self, e=None, ttl=None, sliding=False, **kwds):
+        """
+        Set several entries in one transaction.
+        """
+        cdef vector[CBString] keys
+        cdef vector[CBString] values
+        cdef vector[CBString] no_metadata
+        cdef uint64_t deadline = self.deadline(ttl)
+        cdef uint64_t sliding_ms = self.ttl_ms(ttl) if sliding else 0
+        pairs = []
+        if e is not None:
+            pairs = e.items() if hasattr(e, 'keys') else e
+        for key, value in itertools.chain(pairs, kwds.items()):
+            keys.push_back(tocbstring(key))
+            values.push_back(tocbstring(value))
+        with nogil:
+            self.ptr.get().insert_many(keys, values, no_metadata, deadline, sliding_ms)
+
+    def __delitem__(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef cpp_bool found
+        with nogil:
+            found = self.ptr.get().erase(k)
+        if not found:
+            raise NotFound()
+
+    cpdef pop(self, key, default=None):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString value
+        cdef cpp_bool found
+        with nogil:
+            found = self.ptr.get().pop(k, value)
+        if found:
+            return topy(value)
+        if default is None:
+            raise NotFound()
+        return default
+
+    cpdef popitem(self):
+        cdef CBString key
+        cdef CBString value
+        cdef cpp_bool found
+        with nogil:
+            found = self.ptr.get().pop_first(key, value)
+        if not found:
+            raise EmptyDatabase()
+        return topy(key), topy(value)
+
+    cpdef ttl(self, key):
+        """
+        The remaining time to live of key in seconds, or None if it does not expire.
+        """
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef uint64_t deadline
+        with nogil:
+            deadline = self.ptr.get().get_deadline(k)
+        if deadline == 0:
+            return None
+        return max(0, <int64_t> (deadline - expiry_now_ms())) / 1000.0
+
+    cpdef expire(self, key, ttl):
+        """
+        Give a new time to live to a live entry, that stops sliding. Return False if key is absent or expired.
+        """
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef uint64_t deadline = self.deadline(ttl)
+        cdef cpp_bool found
+        with nogil:
+            found = self.ptr.get().set_deadline(k, deadline)
+        return found
+
+    cpdef prune_expired(self, size_t max_entries=0):
+        """
+        Delete at most max_entries (0: all) expired entries in one transaction. Return their number.
+        """
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().prune_expired(max_entries)
+        return n
+
+    def migrate_legacy_layout(self, old_dirname):
+        """
+        Move the entries that the former ExpiryDict stored in the index, values and metadata environments of
+        old_dirname to this dict, in one transaction, then delete those environments. Return the number of entries
+        moved, 0 if old_dirname has no such environments.
+        """
+        cdef CBString d = tocbstring(old_dirname)
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().migrate_legacy_layout(d)
+        return n
+
+    def clear(self):
+        with nogil:
+            self.ptr.get().clear()
+
+    def items(self):
+        """
+        Iterate over the live (key, value) pairs, in key order and in one read snapshot.
+        """
+        cdef shared_ptr[cppExpiryConstIterator] it
+        with nogil:
+            it.reset(new cppExpiryConstIterator(self.ptr))
+        while not it.get().has_reached_end():
+            yield topy(it.get().get_key()), topy(it.get().get_value())
+            it.get().incr()
 
+    def keys(self):
+        for key, _ in self.items():
+            yield key
+
+    def values(self):
+        for _, value in self.items():
+            yield value
+
+    def __iter__(self):
+        return self.keys()
@@ -59,6 +59,9 @@ cdef inline topy(const CBString& s):
 
 
 cdef inline CBString tocbstring(s):
-    # todo: accept buffer protocol
+    cdef PyBufferWrap view
+    if not PyUnicode_Check(s) and PyObject_CheckBuffer(s):
+        view = move(PyBufferWrap(s))
+        return CBString(view.buf(), view.length())
     s = make_utf8(s)
     return CBString(<char*> s, len(s))
@@ -0,0 +1,39 @@
+/** @file lmdb_fraction.h
+ *	@brief Local extension of the vendored LMDB: not part of upstream LMDB.
+ *
+ *	mdb_cursor_fraction is defined in lmdb/mdb_fraction.c, that builds mdb.c
+ *	unchanged and adds the function next to it.
+ */
+#ifndef _LMDB_FRACTION_H_
+#define _LMDB_FRACTION_H_
+
+#include "lmdb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/** @brief Estimate the position of a cursor in its database.
+	 *
+	 * The position is computed from the page indices along the cursor stack,
+	 * assuming that the sibling subtrees hold the same number of items: no
+	 * page outside of the cursor stack is read.
+	 * @param[in] cursor A cursor handle returned by #mdb_cursor_open()
+	 * @param[out] fraction Address where the estimated fraction of the items
+	 * that sort before the cursor (between 0 and 1) will be stored
+	 * @param[out] uncertainty Address where the error bound of the estimate
+	 * will be stored. It only holds when the sibling subtrees sizes are within
+	 * 50% of their average: it is not a guaranteed bound.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EINVAL - cursor is not initialized, or an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_cursor_fraction(MDB_cursor *cursor, double *fraction, double *uncertainty);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LMDB_FRACTION_H_ */
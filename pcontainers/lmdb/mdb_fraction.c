@@ -0,0 +1,58 @@
+/**	@file mdb_fraction.c
+ *	@brief Local extension of the vendored LMDB: not part of upstream LMDB.
+ *
+ *	mdb_cursor_fraction needs the cursor stack, which is private to mdb.c. This
+ *	file is compiled instead of mdb.c and includes it, so that mdb.c and lmdb.h
+ *	stay the upstream sources and can be updated by copying them over.
+ */
+
+#include "mdb.c"
+#include "lmdb_fraction.h"
+
+/* Estimate the fraction of the items before the cursor, from the page indices of the cursor stack */
+int
+mdb_cursor_fraction(MDB_cursor *mc, double *fraction, double *uncertainty)
+{
+	double		 width = 1.0, f = 0.0, right = 0.0, high, low;
+	unsigned int i, nkeys, ki, after;
+
+	if (mc == NULL || fraction == NULL || uncertainty == NULL)
+		return EINVAL;
+
+	if (mc->mc_txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	if (!(mc->mc_flags & C_INITIALIZED))
+		return EINVAL;
+
+	if (!mc->mc_snum || (mc->mc_flags & C_EOF)) {
+		*fraction = 1.0;
+		*uncertainty = 0.0;
+		return MDB_SUCCESS;
+	}
+
+	for (i = 0; i < mc->mc_snum; i++) {
+		nkeys = NUMKEYS(mc->mc_pg[i]);
+		if (!nkeys)
+			break;
+		ki = mc->mc_ki[i];
+		if (ki > nkeys)
+			ki = nkeys;
+		width /= nkeys;
+		f += ki * width;
+		/* subtrees on the right of the cursor path */
+		after = nkeys - ki;
+		right += (after ? after - 1 : 0) * width;
+	}
+	if (f > 1.0)
+		f = 1.0;
+	/* worst cases, when the subtrees on one side of the cursor path are
+	 * 50% bigger than their average and the ones on the other side are
+	 * 50% smaller
+	 */
+	high = f + right > 0.0 ? 1.5 * f / (1.5 * f + 0.5 * right) : f;
+	low = f + right > 0.0 ? 0.5 * f / (0.5 * f + 1.5 * right) : f;
+	*fraction = f;
+	*uncertainty = high - f > f - low ? high - f : f - low;
+	return MDB_SUCCESS;
+}
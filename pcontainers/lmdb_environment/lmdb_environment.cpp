@@ -117,7 +117,7 @@ void environment::unfactory(environment* env) BOOST_NOEXCEPT_OR_NOTHROW {
     }
 }
 
-MDB_dbi environment::get_dbi(const CBString& dbname) {
+MDB_dbi environment::get_dbi(const CBString& dbname, unsigned int flags) {
     int res;
     MDB_dbi dbi;
     lock_guard<mutex> guard(environment::lock_dbis);
@@ -127,9 +127,9 @@ MDB_dbi environment::get_dbi(const CBString& dbname) {
         } else {
             boost::shared_ptr<transaction> txn = start_transaction(false);
             if (!dbname.length()) {
-                res = mdb_dbi_open(txn->txn, NULL, MDB_CREATE, &dbi);
+                res = mdb_dbi_open(txn->txn, NULL, MDB_CREATE | flags, &dbi);
             } else {
-                res = mdb_dbi_open(txn->txn, dbname, MDB_CREATE, &dbi);
+                res = mdb_dbi_open(txn->txn, dbname, MDB_CREATE | flags, &dbi);
             }
             if (res != 0) {
                 txn->set_rollback();
@@ -142,6 +142,22 @@ MDB_dbi environment::get_dbi(const CBString& dbname) {
     }
 }
 
+bool environment::has_dbi(const CBString& dbname) {
+    if (!dbname.length()) {
+        return true;
+    }
+    {
+        lock_guard<mutex> guard(environment::lock_dbis);
+        if (opened_dbis.count(dbname)) {
+            return true;
+        }
+    }
+    // the named databases are stored as keys of the main database
+    MDB_dbi main_dbi = get_dbi(CBString());
+    transaction_ptr txn = start_transaction();
+    return txn->make_cursor(main_dbi)->position(make_mdb_val(dbname)) == 0;
+}
+
 void environment::drop(MDB_dbi dbi) {
     boost::shared_ptr<transaction> txn = start_transaction(false);
     int res = mdb_drop(txn->txn, dbi, 0);
@@ -152,6 +168,15 @@ void environment::drop(MDB_dbi dbi) {
 }
 
 
+size_t environment::last_txnid() const {
+    MDB_envinfo info;
+    int res = mdb_env_info(ptr, &info);
+    if (res != 0) {
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return info.me_last_txnid;
+}
+
 environment::transaction_ptr environment::start_transaction() const {
     return transaction_ptr(new transaction(*this));
 }
@@ -207,10 +232,19 @@ environment::transaction::~transaction() {
             mdb_txn_reset(txn);
             env.read_transactions_stack.bounded_push(txn);
         } else {
+            size_t txnid = mdb_txn_id(txn);
+            bool commited = false;
             if (rollback.load()) {
                 mdb_txn_abort(txn);
             } else {
-                mdb_txn_commit(txn);
+                commited = mdb_txn_commit(txn) == 0;
+            }
+            for (std::vector< boost::function<void (size_t, bool)> >::iterator hook(end_hooks.begin()); hook != end_hooks.end(); ++hook) {
+                try {
+                    (*hook)(txnid, commited);
+                } catch (...) {
+                    _LOG_WARNING << "environment: a transaction hook has thrown";
+                }
             }
             env.write_transaction_ptr.reset();
         }
@@ -226,6 +260,15 @@ size_t environment::transaction::size(MDB_dbi d) const {
     return stat.ms_entries;
 }
 
+unsigned int environment::transaction::dbi_flags(MDB_dbi d) const {
+    unsigned int flags = 0;
+    int res = mdb_dbi_flags(txn, d, &flags);
+    if (res != 0) {
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return flags;
+}
+
 environment::transaction::cursor::cursor(transaction& t, MDB_dbi d): txn(t), dbi(d) {
     int res = mdb_cursor_open(txn.get(), dbi, &c);
     if (res != 0) {
@@ -381,5 +424,99 @@ void environment::transaction::cursor::del() {
     }
 }
 
+void environment::transaction::cursor::fraction(double& f, double& uncertainty) {
+    int res = mdb_cursor_fraction(c, &f, &uncertainty);
+    if (res != 0) {
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+}
+
+int environment::transaction::cursor::position(MDB_val key, MDB_val value) {
+    int res = _get(key, value, MDB_GET_BOTH);
+    if (res != 0 and res != MDB_NOTFOUND) {
+        txn.set_rollback();
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return res;
+}
+
+int environment::transaction::cursor::next_dup() {
+    MDB_val k = make_mdb_val();
+    MDB_val v = make_mdb_val();
+    int res = _get(k, v, MDB_NEXT_DUP);
+    if (res != 0 and res != MDB_NOTFOUND) {
+        txn.set_rollback();
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return res;
+}
+
+int environment::transaction::cursor::next_nodup() {
+    MDB_val k = make_mdb_val();
+    MDB_val v = make_mdb_val();
+    int res = _get(k, v, MDB_NEXT_NODUP);
+    if (res != 0 and res != MDB_NOTFOUND) {
+        txn.set_rollback();
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return res;
+}
+
+size_t environment::transaction::cursor::count_dups() {
+    size_t n = 0;
+    int res = mdb_cursor_count(c, &n);
+    if (res != 0) {
+        txn.set_rollback();
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return n;
+}
+
+int environment::transaction::cursor::get_multiple(MDB_val& values) {
+    MDB_val k = make_mdb_val();
+    int res = _get(k, values, MDB_GET_MULTIPLE);
+    if (res != 0 and res != MDB_NOTFOUND) {
+        txn.set_rollback();
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return res;
+}
+
+int environment::transaction::cursor::next_multiple(MDB_val& values) {
+    MDB_val k = make_mdb_val();
+    int res = _get(k, values, MDB_NEXT_MULTIPLE);
+    if (res != 0 and res != MDB_NOTFOUND) {
+        txn.set_rollback();
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return res;
+}
+
+bool environment::transaction::cursor::add_key_value(MDB_val key, MDB_val value) {
+    if (txn.readonly) {
+        BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("cursor::add_key_value: trying to write in a read-only transaction"));
+    }
+    int res = mdb_cursor_put(c, &key, &value, MDB_NODUPDATA);
+    if (res == MDB_KEYEXIST) {
+        return false;
+    }
+    if (res != 0) {
+        txn.set_rollback();
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+    return true;
+}
+
+void environment::transaction::cursor::del_dups() {
+    if (txn.readonly) {
+        BOOST_THROW_EXCEPTION(access_error() << lmdb_error::what("cursor::del_dups: trying to write in a read-only transaction"));
+    }
+    int res = mdb_cursor_del(c, MDB_NODUPDATA);
+    if (res != 0) {
+        txn.set_rollback();
+        BOOST_THROW_EXCEPTION(lmdb_error::factory(res));
+    }
+}
+
 
 }   // end NS lmdb
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <map>
+#include <vector>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 #include <boost/weak_ptr.hpp>
 
 #include <boost/core/explicit_operator_bool.hpp>
@@ -14,6 +16,7 @@
 #include <bstrlib/bstrwrap.h>
 #include "../utils/lmdb_options.h"
 #include "lmdb.h"
+#include "lmdb_fraction.h"
 
 
 namespace lmdb {
@@ -59,7 +62,8 @@ public:
     const MDB_env* get() const BOOST_NOEXCEPT_OR_NOTHROW { return ptr; }
     CBString get_dirname() const BOOST_NOEXCEPT_OR_NOTHROW { return dirname; }
     int get_maxkeysize() const BOOST_NOEXCEPT_OR_NOTHROW { return mdb_env_get_maxkeysize(ptr); }
-    MDB_dbi get_dbi(const CBString& dbname);    // can throw
+    MDB_dbi get_dbi(const CBString& dbname, unsigned int flags=0);    // MDB_CREATE is always added; can throw
+    bool has_dbi(const CBString& dbname);                               // doesn't create the database; can throw
 
     class transaction: private boost::noncopyable {
     friend class environment;
@@ -67,6 +71,7 @@ public:
         const environment& env;
         MDB_txn* txn;
         boost::atomic_bool rollback;
+        std::vector< boost::function<void (size_t, bool)> > end_hooks;
     protected:
         transaction(const environment& e);      // use factories instead; can throw
         transaction(environment& e, bool ro);   // use factories instead; can throw
@@ -77,7 +82,12 @@ public:
 
         ~transaction();
         size_t size(MDB_dbi d) const;           // can throw
+        unsigned int dbi_flags(MDB_dbi d) const;    // can throw
         void set_rollback(bool val=true) BOOST_NOEXCEPT_OR_NOTHROW { rollback.store(val); }
+        // the snapshot id of a read transaction, the id that a write transaction will have once commited
+        size_t id() const BOOST_NOEXCEPT_OR_NOTHROW { return mdb_txn_id(txn); }
+        // write transactions: f(id, commited) is called when the transaction is commited or aborted
+        void on_end(boost::function<void (size_t, bool)> f) { end_hooks.push_back(f); }
 
         class cursor: private boost::noncopyable {
         private:
@@ -115,6 +125,18 @@ public:
             void set_key_value(MDB_val key, MDB_val value);                 // can throw
             void append_key_value(MDB_val key, MDB_val value);              // can throw
             void del();     // can throw
+            // estimated fraction of the items before the cursor, from the B-tree pages of the cursor stack
+            void fraction(double& f, double& uncertainty);                  // can throw
+
+            // for MDB_DUPSORT databases
+            int position(MDB_val key, MDB_val value);                       // can throw
+            int next_dup();     // can throw
+            int next_nodup();   // can throw
+            size_t count_dups();                                            // can throw
+            int get_multiple(MDB_val& values);                              // MDB_DUPFIXED only; can throw
+            int next_multiple(MDB_val& values);                             // MDB_DUPFIXED only; can throw
+            bool add_key_value(MDB_val key, MDB_val value);                 // false if the pair already exists; can throw
+            void del_dups();    // can throw
 
         };      // END CLASS cursor
 
@@ -128,8 +150,15 @@ public:
 
     transaction_ptr start_transaction() const;          // read-only transaction; can throw
     transaction_ptr start_transaction(bool readonly);   // read-only or write transaction; can throw
+    // does the current thread hold a write transaction
+    bool in_write_transaction() const {
+        boost::weak_ptr<transaction>* weak_t = write_transaction_ptr.get();
+        return weak_t && !weak_t->expired();
+    }
 
     void drop(MDB_dbi dbi);     // can throw
+    // id of the last commited transaction, by any process
+    size_t last_txnid() const;  // can throw
 
     size_t size(MDB_dbi dbi) const {    // can throw
         return start_transaction()->size(dbi);
@@ -20,11 +20,12 @@ try:
 except ImportError:
     raise ImportError("filedepot is not installed. try 'pip install filedepot'")
 
-from .. import PRawDict, LmdbOptions, NotFound
+from .. import PRawDict, PBlobStore, LmdbOptions, NotFound
+from .._pdict import PBlobReader
 
 
 class LMDBStoredFile(StoredFile):
-    def __init__(self, file_id, files_pdict, metadatas_pdict):
+    def __init__(self, file_id, blobs, files_pdict, metadatas_pdict):
         _check_file_id(file_id)
 
         if file_id not in metadatas_pdict:
@@ -44,13 +45,31 @@ class LMDBStoredFile(StoredFile):
         except Exception:
             raise ValueError('Invalid metadata for %s' % file_id)
 
-        self._file = files_pdict.get_direct(file_id)
+        if file_id in blobs:
+            self._file = blobs.open_reader(file_id)
+        else:
+            # file stored as a single value by a previous version
+            self._file = files_pdict.get_direct(file_id)
         super(LMDBStoredFile, self).__init__(file_id=file_id, **metadata_info)
 
     def read(self, n=-1):
         return self._file.read(n)
 
+    def readinto(self, b):
+        return self._file.readinto(b)
+
+    def seekable(self):
+        return isinstance(self._file, PBlobReader)
+
+    def seek(self, offset, whence=0):
+        return self._file.seek(offset, whence)
+
+    def tell(self):
+        return self._file.tell()
+
     def close(self):
+        if self._file is not None and hasattr(self._file, 'close'):
+            self._file.close()
         self._file = None
 
     @property
@@ -67,22 +86,18 @@ class LMDBFileStorage(FileStorage):
         options = LmdbOptions(write_map=True, map_async=True)
         self.files_pdict = PRawDict(self.lmdb_path, "files", opts=options)
         self.metadata_pdict = PRawDict(self.lmdb_path, "metadatas", opts=options)
+        # files content is streamed by chunks: a file is never held in memory as a whole
+        self.blobs = PBlobStore(self.files_pdict)
 
     def get(self, file_or_id):
-        return LMDBStoredFile(self.fileid(file_or_id), self.files_pdict, self.metadata_pdict)
+        return LMDBStoredFile(self.fileid(file_or_id), self.blobs, self.files_pdict, self.metadata_pdict)
 
     def __save_file(self, file_id, content, filename, content_type=None):
 
-        if hasattr(content, 'read'):
-            c = content.read()
-            l = len(c)
-            self.files_pdict[file_id] = c
-            del c
-        else:
-            if isinstance(content, unicode_text):
-                raise TypeError('Only bytes can be stored, not unicode')
-            l = len(content)
-            self.files_pdict[file_id] = content
+        if not hasattr(content, 'read') and isinstance(content, unicode_text):
+            raise TypeError('Only bytes can be stored, not unicode')
+        # replaces atomically the previous content, if any
+        l = self.blobs.put(file_id, content)
 
         metadata = {'filename': filename,
                     'content_type': content_type,
@@ -109,8 +124,12 @@ class LMDBFileStorage(FileStorage):
         content, filename, content_type = self.fileinfo(content, filename, content_type,
                                                         lambda: self.get(fileid))
 
-        self.delete(fileid)
         self.__save_file(fileid, content, filename, content_type)
+        # the content of a previous version, stored as a single value
+        try:
+            del self.files_pdict[fileid]
+        except NotFound:
+            pass
         return fileid
 
     def delete(self, file_or_id):
@@ -119,6 +138,10 @@ class LMDBFileStorage(FileStorage):
 
         try:
             del self.metadata_pdict[fileid]
+        except NotFound:
+            pass
+        self.blobs.delete(fileid)
+        try:
             del self.files_pdict[fileid]
         except NotFound:
             pass
@@ -0,0 +1,12 @@
+# -*- coding: utf-8 -*-
+
+cdef class PRawMultiDict(object):
+    cdef shared_ptr[cppPersistentMultiDict] ptr
+    cdef bint rmrf_at_delete
+
+    cpdef add(self, key, value)
+    cpdef add_many(self, key, values)
+    cpdef discard(self, key, value)
+    cpdef getall(self, key)
+    cpdef count(self, key)
+    cpdef keys(self)
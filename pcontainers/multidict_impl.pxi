@@ -0,0 +1,164 @@
+# -*- coding: utf-8 -*-
+
+# noinspection PyPep8Naming
+cdef class PRawMultiDict(object):
+    """
+    A persistent multimap of bytes: every key maps to a sorted set of values. With fixed_size=True, all the values
+    must have the same length and are read in bulk.
+    """
+
+    def __cinit__(self, bytes dirname, bytes dbname, LmdbOptions opts=None, fixed_size=False):
+        if opts is None:
+            opts = LmdbOptions()
+        self.ptr = multidict_factory(tocbstring(dirname), tocbstring(dbname), (<LmdbOptions> opts).opts, bool(fixed_size))
+        self.rmrf_at_delete = 0
+
+    def __init__(self, bytes dirname, bytes dbname, LmdbOptions opts=None, fixed_size=False):
+        pass
+
+    def __dealloc__(self):
+        if self.ptr.get():
+            if self.rmrf_at_delete:
+                shutil.rmtree(self.dirname)
+                self.rmrf_at_delete = 0
+
+            with nogil:
+                self.ptr.reset()
+
+    def __repr__(self):
+        return u"PRawMultiDict(dbname='{}', dirname='{}')".format(
+            make_unicode(self.dbname), make_unicode(self.dirname)
+        )
+
+    @classmethod
+    def make_temp(cls, destroy=True, LmdbOptions opts=None, fixed_size=False):
+        cdef shared_ptr[TempDirectory] temp_dir_ptr = make_temp_directory(True, False)
+        d = cls(dirname=topy(temp_dir_ptr.get().get_path()), dbname=bytes(uuid.uuid1()), opts=opts, fixed_size=fixed_size)
+        (<PRawMultiDict>d).rmrf_at_delete = bool(destroy)
+        return d
+
+    property dirname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dirname())
+
+    property dbname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dbname())
+
+    property fixed_size:
+        def __get__(self):
+            return self.ptr.get().is_fixed_size()
+
+    def __len__(self):
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().size()
+        return n
+
+    def __contains__(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().contains(k)
+        return res
+
+    def __getitem__(self, key):
+        values = self.getall(key)
+        if not values:
+            raise NotFound()
+        return values
+
+    def __delitem__(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().erase(k)
+        if n == 0:
+            raise NotFound()
+
+    def __iter__(self):
+        return iter(self.keys())
+
+    def clear(self):
+        with nogil:
+            self.ptr.get().clear()
+
+    def has_item(self, key, value):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef PyBufferWrap value_view = move(PyBufferWrap(value))
+        cdef MDB_val v = value_view.get_mdb_val()
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().contains(k, v)
+        return res
+
+    cpdef add(self, key, value):
+        """
+        Add value to the values of key. Return False if the value was already there.
+        """
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        if key_view.length() == 0:
+            raise EmptyKey()
+        if key_view.length() > 511:
+            raise BadValSize("key is too long")
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef PyBufferWrap value_view = move(PyBufferWrap(value))
+        cdef MDB_val v = value_view.get_mdb_val()
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().insert(k, v)
+        return res
+
+    cpdef add_many(self, key, values):
+        """
+        Add several values to key in one transaction. Return the number of new values.
+        """
+        cdef CBString k = tocbstring(key)
+        cdef vector[CBString] vals
+        cdef size_t n
+        for value in values:
+            vals.push_back(tocbstring(value))
+        with nogil:
+            n = self.ptr.get().insert(k, vals)
+        return n
+
+    cpdef discard(self, key, value):
+        """
+        Remove one (key, value) pair. Return False if it was not there.
+        """
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef PyBufferWrap value_view = move(PyBufferWrap(value))
+        cdef MDB_val v = value_view.get_mdb_val()
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().erase(k, v)
+        return res
+
+    cpdef getall(self, key):
+        """
+        Return the sorted list of the values of key (empty if key is not there).
+        """
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef vector[CBString] vals
+        with nogil:
+            vals = self.ptr.get().values(k)
+        return [topy(v) for v in vals]
+
+    cpdef count(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().count(k)
+        return n
+
+    cpdef keys(self):
+        cdef vector[CBString] ks
+        with nogil:
+            ks = self.ptr.get().keys()
+        return [topy(k) for k in ks]
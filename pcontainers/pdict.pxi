@@ -29,9 +29,27 @@ cdef class DirectAccess(object):
     cdef object buf
     cpdef read(self, ssize_t n=?)
 
+cdef class Column(object):
+    cdef shared_ptr[column] col
+    cdef object format
+    cdef Py_ssize_t shape[1]
+    cdef Py_ssize_t strides[1]
+
+cdef class _ColumnBuffer(object):
+    cdef Column owner
+    cdef cpp_bool is_offsets
+    cdef Py_ssize_t shape[1]
+    cdef Py_ssize_t strides[1]
+
+    @staticmethod
+    cdef make(Column owner, cpp_bool offsets)
+
 cdef class PRawDict(object):
     cdef shared_ptr[cppPersistentDict] ptr
     cdef bint rmrf_at_delete
+    cdef object read_cache
+    cdef size_t read_cache_capacity
+    cdef _SingleFlight flights
 
     cpdef noiterkeys(self)
     cpdef noitervalues(self)
@@ -40,16 +58,39 @@ cdef class PRawDict(object):
     cpdef get(self, key, default=?)
     cpdef get_direct(self, item)
     cpdef setdefault(self, key, default=?)
+    cpdef get_or_compute(self, key, loader)
+    cpdef compare_and_swap(self, key, expected, new_value)
+    cpdef insert_if_absent(self, key, value)
+    cpdef replace_if_present(self, key, value)
+    cpdef get_version(self, key)
+    cpdef get_versioned(self, key)
+    cpdef set_versioned(self, key, value, uint64_t expected_version)
+    cpdef del_versioned(self, key, uint64_t expected_version)
+    cpdef enable_read_cache(self, size_t capacity)
+    cpdef enable_bloom_filter(self, cpp_bool sidecar=?)
+    cpdef enable_eviction(self, size_t max_entries=?, size_t max_bytes=?, policy=?)
+    cdef _cached_getitem(self, item)
+    cpdef enable_change_feed(self)
+    cpdef last_change(self)
+    cpdef changes_since(self, uint64_t seq=?, size_t limit=?)
+    cpdef wait_changes(self, uint64_t seq, timeout=?)
+    cpdef truncate_changes(self, uint64_t seq)
     cpdef pop(self, key, default=?)
     cpdef popitem(self)
     cpdef clear(self)
     cpdef has_key(self, key)
     cpdef transform_values(self, binary_funct)
     cpdef remove_if(self, binary_pred)
+    cpdef transform_values_batch(self, batch_funct, ssize_t batch_size=?, first=?, last=?)
+    cpdef remove_if_batch(self, batch_pred, ssize_t batch_size=?, first=?, last=?)
+    cpdef count_if_batch(self, batch_pred, ssize_t batch_size=?, first=?, last=?)
+    cpdef count_interval(self, first=?, last=?)
+    cpdef estimate_count(self, first=?, last=?)
     cpdef iterkeys(self, reverse=?)
     cpdef itervalues(self, reverse=?)
     cpdef iteritems(self, reverse=?)
     cpdef move_to(self, PRawDict other, ssize_t chunk_size=?)
+    cpdef sync_to(self, PRawDict other, first=?, last=?, cpp_bool delete=?, ssize_t chunk_size=?)
     cpdef remove_duplicates(self, first=?, last=?)
 
     cdef readonly Chain key_chain
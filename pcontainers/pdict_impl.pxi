@@ -1,5 +1,13 @@
 # -*- coding: utf-8 -*-
 
+cdef inline int check_key_size(size_t size) except -1:
+    # LMDB rejects the empty keys, and the keys longer than its maximal key size (511 bytes)
+    if size == 0:
+        raise EmptyKey()
+    if size > 511:
+        raise BadValSize("key is too long")
+    return 0
+
 # noinspection PyPep8Naming
 cdef class PRawDictAbstractIterator(object):
     def __init__(self, PRawDict d, int pos=0, key=None):
@@ -8,10 +16,7 @@ cdef class PRawDictAbstractIterator(object):
         self.key = None
         if key is not None:
             self.key = d.key_chain.dumps(key)
-            if len(self.key) == 0:
-                raise EmptyKey()
-            if len(self.key) > 511:
-                raise BadValSize("key is too long")
+            check_key_size(len(self.key))
 
     def start(self):
         raise NotImplementedError()
@@ -81,10 +86,7 @@ cdef class PRawDictAbstractIterator(object):
 
     def __getitem__(self, item):
         cdef PyBufferWrap key_view = move(PyBufferWrap(self.dict.key_chain.dumps(item)))
-        if key_view.length() == 0:
-            raise EmptyKey()
-        if key_view.length() > 511:
-            raise BadValSize("key is too long")
+        check_key_size(key_view.length())
         self.cpp_iterator_ptr.get().set_position(key_view.get_mdb_val())
         return self.get_value_buf()
 
@@ -117,10 +119,7 @@ cdef class PRawDictIterator(PRawDictAbstractIterator):
 
     cdef set_item_buf(self, k, v):
         cdef PyBufferWrap key_view = move(PyBufferWrap(self.dict.key_chain.dumps(k)))
-        if key_view.length() == 0:
-            raise EmptyKey()
-        if key_view.length() > 511:
-            raise BadValSize("key is too long")
+        check_key_size(key_view.length())
         cdef PyBufferWrap value_view = move(PyBufferWrap(self.dict.value_chain.dumps(v)))
         cdef cppIterator* it_ptr = <cppIterator*> self.cpp_iterator_ptr.get()
         with nogil:
@@ -148,10 +147,7 @@ cdef class PRawDictIterator(PRawDictAbstractIterator):
         if not self.cpp_iterator_ptr.get():
             raise NotInitialized()
         cdef PyBufferWrap key_view = move(PyBufferWrap(self.dict.key_chain.dumps(key)))
-        if key_view.length() == 0:
-            raise EmptyKey()
-        if key_view.length() > 511:
-            raise BadValSize("key is too long")
+        check_key_size(key_view.length())
         self.dlte(key)
 
 cdef class DirectAccess(object):
@@ -170,6 +166,195 @@ cdef class DirectAccess(object):
         return self.buf.read(n)
 
 
+_CHANGE_OPS = {ord('s'): 'set', ord('d'): 'del', ord('c'): 'clear'}
+_OFFSETS_TEMPLATE = array.array('Q')
+
+
+cdef inline _batch_field(vector[char]& data, size_t begin, size_t end, Chain chain, cpp_bool raw):
+    cdef MDB_val v
+    v.mv_data = <void*> (data.data() + begin)
+    v.mv_size = end - begin
+    if raw:
+        return PyBytes_FromStringAndSize(<char*> v.mv_data, v.mv_size)
+    return chain.loads(make_mbufferio(copy_mdb_val(v), v.mv_size, 1))
+
+
+cdef MDB_val _position_range(PRawDictAbstractIterator it, cpp_bool rev, PyBufferWrap* start_view, PyBufferWrap* stop_view) except *:
+    # moves the started iterator to the first record of [start, stop) (the last one if rev), and returns the bound that
+    # ends the range for fill_batch and fill_columns (empty when the range is not bounded)
+    cdef MDB_val bound
+    bound.mv_size = 0
+    bound.mv_data = NULL
+    if rev:
+        if stop_view != NULL:
+            it.cpp_iterator_ptr.get().set_range(stop_view.get_mdb_val())
+        it.decr()
+        if start_view != NULL:
+            bound = start_view.get_mdb_val()
+    else:
+        if start_view != NULL:
+            it.cpp_iterator_ptr.get().set_range(start_view.get_mdb_val())
+        if stop_view != NULL:
+            bound = stop_view.get_mdb_val()
+    return bound
+
+
+# noinspection PyPep8Naming
+cdef class Column(object):
+    """
+    A column of fields exported by PRawDict.export_columns.
+
+    The fields of a variable width column follow Arrow's binary layout: 'data' holds the fields end to end and
+    'offsets' (uint64) the start of each field followed by the end of the last one. The fields of a fixed width column
+    are packed in 'data' and there are no offsets. Both are read-only memoryviews on the column (no copy), and a fixed
+    width column also exports its data, typed by its format, through the buffer protocol: numpy.asarray(col).
+    """
+    def __init__(self):
+        raise TypeError("Columns are made by PRawDict.export_columns")
+
+    def __len__(self):
+        return self.col.get().size()
+
+    def __getitem__(self, ssize_t i):
+        cdef column* c = self.col.get()
+        cdef ssize_t n = c.size()
+        if i < 0:
+            i += n
+        if i < 0 or i >= n:
+            raise IndexError()
+        if c.width:
+            return PyBytes_FromStringAndSize(c.data.data() + i * c.width, c.width)
+        return PyBytes_FromStringAndSize(c.data.data() + c.offsets[i], c.offsets[i + 1] - c.offsets[i])
+
+    def __iter__(self):
+        for i in range(len(self)):
+            yield self[i]
+
+    property width:
+        def __get__(self):
+            return self.col.get().width
+
+    property nbytes:
+        def __get__(self):
+            return self.col.get().data.size()
+
+    property data:
+        def __get__(self):
+            return memoryview(_ColumnBuffer.make(self, False))
+
+    property offsets:
+        def __get__(self):
+            if self.col.get().width:
+                return None
+            return memoryview(_ColumnBuffer.make(self, True))
+
+    def __getbuffer__(self, Py_buffer* view, int flags):
+        if not self.col.get().width:
+            raise BufferError("only a fixed width column exports its data, use .data and .offsets")
+        _export_column(self, False, view, flags, self.shape, self.strides)
+        view.obj = self
+
+    def __releasebuffer__(self, Py_buffer* view):
+        pass
+
+    def to_arrow(self):
+        """
+        Wrap the column in a pyarrow array without copying it (large_binary, or fixed_size_binary).
+        """
+        import pyarrow
+        if self.col.get().width:
+            return pyarrow.Array.from_buffers(pyarrow.binary(self.width), len(self), [None, pyarrow.py_buffer(self.data)])
+        return pyarrow.Array.from_buffers(pyarrow.large_binary(), len(self),
+                                          [None, pyarrow.py_buffer(self.offsets), pyarrow.py_buffer(self.data)])
+
+
+# noinspection PyPep8Naming
+cdef class _ColumnBuffer(object):
+    # exports the data or the offsets of a column through the buffer protocol
+
+    @staticmethod
+    cdef make(Column owner, cpp_bool offsets):
+        cdef _ColumnBuffer buf = _ColumnBuffer.__new__(_ColumnBuffer)
+        buf.owner = owner
+        buf.is_offsets = offsets
+        return buf
+
+    def __getbuffer__(self, Py_buffer* view, int flags):
+        _export_column(self.owner, self.is_offsets, view, flags, self.shape, self.strides)
+        view.obj = self
+
+    def __releasebuffer__(self, Py_buffer* view):
+        pass
+
+
+cdef int _export_column(Column owner, cpp_bool offsets, Py_buffer* view, int flags, Py_ssize_t* shape,
+                        Py_ssize_t* strides) except -1:
+    # fills view (but view.obj) with the data or the offsets of a column
+    if flags & PyBUF_WRITABLE:
+        raise BufferError("columns are read-only")
+    cdef column* c = owner.col.get()
+    if offsets:
+        view.buf = <void*> c.offsets.data()
+        view.itemsize = sizeof(uint64_t)
+        view.format = b'Q'
+        shape[0] = c.offsets.size()
+    elif c.width:
+        view.buf = <void*> c.data.data()
+        view.itemsize = c.width
+        view.format = owner.format
+        shape[0] = c.size()
+    else:
+        view.buf = <void*> c.data.data()
+        view.itemsize = 1
+        view.format = b'B'
+        shape[0] = c.data.size()
+    strides[0] = view.itemsize
+    view.len = shape[0] * view.itemsize
+    view.readonly = 1
+    view.ndim = 1
+    view.shape = shape
+    view.strides = strides
+    view.suboffsets = NULL
+    view.internal = NULL
+    return 0
+
+
+cdef Column _new_column(fmt):
+    cdef Column col = Column.__new__(Column)
+    cdef size_t width = 0
+    if fmt is not None:
+        if isinstance(fmt, unicode):
+            fmt = fmt.encode('ascii')
+        width = struct.calcsize(fmt)
+        if width == 0:
+            raise ValueError("the format of a fixed width column must not be empty")
+    col.format = fmt
+    col.col.reset(new column(width))
+    return col
+
+
+cdef eviction_policy _eviction_policy(policy) except *:
+    if policy == 'lru':
+        return EVICT_LRU
+    if policy == 'lfu':
+        return EVICT_LFU
+    raise ValueError("the eviction policy must be 'lru' or 'lfu'")
+
+
+cdef _eviction_stats_dict(eviction_stats stats):
+    return {
+        'evictions': stats.evictions,
+        'batches': stats.batches,
+        'accesses': stats.accesses,
+        'dropped': stats.dropped,
+        'entries': stats.entries,
+        'bytes': stats.bytes,
+        'max_entries': stats.max_entries,
+        'max_bytes': stats.max_bytes,
+        'policy': 'lfu' if stats.policy == EVICT_LFU else 'lru'
+    }
+
+
 cdef class PRawDict(object):
 
     def __cinit__(self, bytes dirname, bytes dbname, LmdbOptions opts=None, mapping=None, Chain key_chain=None, Chain value_chain=None, **kwarg):
@@ -177,6 +362,9 @@ cdef class PRawDict(object):
             opts = LmdbOptions()
         self.ptr = dict_factory(tocbstring(dirname), tocbstring(dbname), (<LmdbOptions> opts).opts)
         self.rmrf_at_delete = 0
+        self.read_cache = None
+        self.read_cache_capacity = 0
+        self.flights = _SingleFlight()
         self.key_chain = NoneChain()
         self.value_chain = NoneChain()
 
@@ -238,10 +426,20 @@ cdef class PRawDict(object):
             return topy(self.ptr.get().get_dbname())
 
     def __getitem__(self, item):
+        if self.read_cache is not None:
+            return self._cached_getitem(item)
+        cdef PyBufferWrap key_view
+        if self.ptr.get().has_bloom_filter():
+            key_view = move(PyBufferWrap(self.key_chain.dumps(item)))
+            if key_view.length() and not self.ptr.get().may_contain(key_view.get_mdb_val()):
+                raise NotFound()
         cdef PRawDictConstIterator it = PRawDictConstIterator(self, key=item)
         with it:
             if it.has_reached_end():
                 raise NotFound()
+            if self.ptr.get().has_eviction():
+                key_view = move(PyBufferWrap(self.key_chain.dumps(item)))
+                self.ptr.get().record_access(key_view.get_mdb_val())
             return it.get_value_buf()
 
     cpdef get(self, item, default=b''):
@@ -257,16 +455,244 @@ cdef class PRawDict(object):
 
     cpdef setdefault(self, key, default=b''):
         cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
-        if key_view.length() == 0:
-            raise EmptyKey()
-        if key_view.length() > 511:
-            raise BadValSize("key is too long")
+        check_key_size(key_view.length())
         cdef PyBufferWrap default_view = move(PyBufferWrap(self.value_chain.dumps(default)))
         cdef CBString ret
         with nogil:
             ret = self.ptr.get().setdefault(key_view.get_mdb_val(), default_view.get_mdb_val())
         return self.value_chain.loads(topy(ret))
 
+    cpdef get_or_compute(self, key, loader):
+        """
+        The value of key. When key is missing, loader(key) computes the value, that is written, then returned.
+
+        The concurrent misses of key (by the threads that use this dict object) don't call loader again: they wait for
+        the computation in flight and get the value it wrote, or its exception.
+        """
+        try:
+            return self[key]
+        except NotFound:
+            pass
+        cdef CBString k = tocbstring(self.key_chain.dumps(key))
+        check_key_size(k.length())
+        cdef single_flight_ticket ticket
+        with nogil:
+            ticket = self.flights.table.get().join(k)
+        if not ticket.leader:
+            return self.value_chain.loads(topy(self.flights.wait(ticket.result, ticket.id)))
+        return self.flights.lead(k, ticket.id, partial(self._load, key, loader))
+
+    def _load(self, key, loader):
+        cdef CBString k = tocbstring(self.key_chain.dumps(key))
+        cdef CBString v
+        try:
+            # the flight that just completed may have written key already
+            with nogil:
+                v = self.ptr.get().at(k)
+            serialized = topy(v)
+            return self.value_chain.loads(serialized), serialized
+        except NotFound:
+            pass
+        value = loader(key)
+        serialized = self.value_chain.dumps(value)
+        v = tocbstring(serialized)
+        with nogil:
+            self.ptr.get().insert(k, v)
+        return value, serialized
+
+    property flight_stats:
+        def __get__(self):
+            return self.flights.stats
+
+    cpdef compare_and_swap(self, key, expected, new_value):
+        # the comparison is done on the serialized values
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
+        check_key_size(key_view.length())
+        cdef PyBufferWrap expected_view = move(PyBufferWrap(self.value_chain.dumps(expected)))
+        cdef PyBufferWrap new_value_view = move(PyBufferWrap(self.value_chain.dumps(new_value)))
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().compare_and_swap(key_view.get_mdb_val(), expected_view.get_mdb_val(), new_value_view.get_mdb_val())
+        return res
+
+    cpdef insert_if_absent(self, key, value):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
+        check_key_size(key_view.length())
+        cdef PyBufferWrap value_view = move(PyBufferWrap(self.value_chain.dumps(value)))
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().insert_if_absent(key_view.get_mdb_val(), value_view.get_mdb_val())
+        return res
+
+    cpdef replace_if_present(self, key, value):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
+        check_key_size(key_view.length())
+        cdef PyBufferWrap value_view = move(PyBufferWrap(self.value_chain.dumps(value)))
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().replace_if_present(key_view.get_mdb_val(), value_view.get_mdb_val())
+        return res
+
+    cpdef get_version(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
+        check_key_size(key_view.length())
+        cdef uint64_t version
+        with nogil:
+            version = self.ptr.get().get_version(key_view.get_mdb_val())
+        return version
+
+    cpdef get_versioned(self, key):
+        # returns (version, value)
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
+        check_key_size(key_view.length())
+        cdef pair[uint64_t, CBString] p
+        with nogil:
+            p = self.ptr.get().versioned_at(key_view.get_mdb_val())
+        return p.first, self.value_chain.loads(make_mbufferio_from_cbstring(p.second))
+
+    cpdef set_versioned(self, key, value, uint64_t expected_version):
+        # returns the new version, or 0 if the current version is not 'expected_version'
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
+        check_key_size(key_view.length())
+        cdef PyBufferWrap value_view = move(PyBufferWrap(self.value_chain.dumps(value)))
+        cdef uint64_t version
+        with nogil:
+            version = self.ptr.get().versioned_insert(key_view.get_mdb_val(), value_view.get_mdb_val(), expected_version)
+        return version
+
+    cpdef del_versioned(self, key, uint64_t expected_version):
+        # returns the new version, or 0 if the key is absent or if the current version is not 'expected_version'
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
+        check_key_size(key_view.length())
+        cdef uint64_t version
+        with nogil:
+            version = self.ptr.get().versioned_erase(key_view.get_mdb_val(), expected_version)
+        return version
+
+    cpdef enable_read_cache(self, size_t capacity):
+        """
+        Cache up to 'capacity' values read by d[key] and d.get(key), in C++ (raw values) and in Python (deserialized
+        values). The cache is invalidated by the writes of this dict and by the commits of other processes.
+        The deserialized values are shared between the readers: don't mutate them. A capacity of 0 disables the cache.
+        """
+        self.ptr.get().enable_read_cache(capacity)
+        self.read_cache_capacity = capacity
+        self.read_cache = {} if capacity else None
+
+    def read_cache_stats(self):
+        cdef read_cache_stats stats = self.ptr.get().get_read_cache_stats()
+        return {
+            'hits': stats.hits,
+            'misses': stats.misses,
+            'evictions': stats.evictions,
+            'invalidations': stats.invalidations,
+            'flushes': stats.flushes,
+            'size': stats.size,
+            'capacity': stats.capacity
+        }
+
+    cpdef enable_bloom_filter(self, cpp_bool sidecar=True):
+        """
+        Keep a Bloom filter of the keys, so that the lookups of absent keys (d[key], d.get(key), key in d) don't open
+        a LMDB transaction. The filter is built in the background; with sidecar=True it is saved in the directory
+        when the dict is closed, and reused at the next opening if the database was not modified in between.
+        """
+        with nogil:
+            self.ptr.get().enable_bloom_filter(sidecar)
+
+    cpdef enable_eviction(self, size_t max_entries=0, size_t max_bytes=0, policy='lru'):
+        """
+        Bound the size of the dict: a write that makes it go over max_entries entries or max_bytes bytes (of keys and
+        values) evicts a batch of the least recently ('lru') or least frequently ('lfu') used entries, in its own
+        transaction. The reads by d[key] and d.get(key) count as uses. 0 means no limit. Calling it again changes the
+        limits. The dict must have a dbname.
+        """
+        cdef eviction_policy p = _eviction_policy(policy)
+        with nogil:
+            self.ptr.get().enable_eviction(p, max_entries, max_bytes)
+
+    def eviction_stats(self):
+        cdef eviction_stats stats
+        with nogil:
+            stats = self.ptr.get().get_eviction_stats()
+        return _eviction_stats_dict(stats)
+
+    def bloom_filter_stats(self):
+        cdef bloom_filter_stats stats = self.ptr.get().get_bloom_filter_stats()
+        return {
+            'checks': stats.checks,
+            'negatives': stats.negatives,
+            'unknown': stats.unknown,
+            'rebuilds': stats.rebuilds,
+            'bits': stats.bits,
+            'keys': stats.keys,
+            'ready': stats.ready
+        }
+
+    cdef _cached_getitem(self, item):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(item)))
+        check_key_size(key_view.length())
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString v
+        cdef uint64_t entry_id = 0
+        cdef uint64_t known_id = 0
+        key = PyBytes_FromStringAndSize(<char*> k.mv_data, k.mv_size)
+        cached = self.read_cache.get(key)
+        if cached is not None:
+            known_id = entry_id = cached[0]
+        with nogil:
+            v = self.ptr.get().at(k, &entry_id)
+        if known_id and entry_id == known_id:
+            return cached[1]
+        value = self.value_chain.loads(make_mbufferio_from_cbstring(v))
+        if entry_id:
+            if key not in self.read_cache and len(self.read_cache) >= self.read_cache_capacity:
+                # the C++ cache does the CLOCK eviction: here the oldest object is dropped
+                del self.read_cache[next(iter(self.read_cache))]
+            self.read_cache[key] = (entry_id, value)
+        else:
+            self.read_cache.pop(key, None)
+        return value
+
+    cpdef enable_change_feed(self):
+        # from now on, each mutation of the dict appends a (seq, op, key) record to the change feed
+        self.ptr.get().enable_changes()
+
+    property change_feed_enabled:
+        def __get__(self):
+            return self.ptr.get().has_changes()
+
+    cpdef last_change(self):
+        cdef uint64_t seq
+        with nogil:
+            seq = self.ptr.get().last_change()
+        return seq
+
+    cpdef changes_since(self, uint64_t seq=0, size_t limit=1000):
+        # returns a list of (seq, op, key) with op in 'set', 'del', 'clear' (key is None for 'clear')
+        cdef vector[change] changes
+        with nogil:
+            changes = self.ptr.get().changes_since(seq, limit)
+        return [
+            (c.seq, _CHANGE_OPS[c.op], self.key_chain.loads(make_mbufferio_from_cbstring(c.key)) if c.key.length() else None)
+            for c in changes
+        ]
+
+    cpdef wait_changes(self, uint64_t seq, timeout=None):
+        # blocks until there is a change after seq (or timeout, in seconds); returns the last sequence
+        cdef long timeout_ms = -1 if timeout is None else max(0, int(timeout * 1000))
+        cdef uint64_t last
+        with nogil:
+            last = self.ptr.get().wait_changes(seq, timeout_ms)
+        return last
+
+    cpdef truncate_changes(self, uint64_t seq):
+        # removes the records older than seq (the last record is always kept); returns the number of removed records
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().truncate_changes(seq)
+        return n
+
     def __setitem__(self, key, value):
         cdef PRawDictIterator it = PRawDictIterator(self)
         with it:
@@ -295,10 +721,7 @@ cdef class PRawDict(object):
 
     cpdef pop(self, key, default=None):
         cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
-        if key_view.length() == 0:
-            raise EmptyKey()
-        if key_view.length() > 511:
-            raise BadValSize("key is too long")
+        check_key_size(key_view.length())
         cdef CBString v
         try:
             with nogil:
@@ -375,6 +798,105 @@ cdef class PRawDict(object):
     cpdef iteritems(self, reverse=False):
         return self.items(reverse)
 
+    def iter_batches(self, size_t n=1000, start=None, stop=None, reverse=False, what='items', contiguous=False):
+        """
+        Iterate over the records of [start, stop) by batches of n, in one read snapshot (in reverse order if reverse).
+        Each batch is copied by a C++ loop without the GIL, then returned as a list of keys, values or (key, value)
+        pairs according to 'what'. With contiguous, a batch is returned undecoded as (data, offsets): data is a bytes
+        object and offsets an array of the end offset of each field in data (the key, then the value for items).
+        """
+        if n == 0:
+            raise ValueError("n must be positive")
+        if what not in ('keys', 'values', 'items'):
+            raise ValueError("what must be 'keys', 'values' or 'items'")
+        cdef cpp_bool with_keys = what != 'values'
+        cdef cpp_bool with_values = what != 'keys'
+        cdef cpp_bool rev = bool(reverse)
+        cdef cpp_bool raw_keys = self.key_chain == NoneChain()
+        cdef cpp_bool raw_values = self.value_chain == NoneChain()
+        cdef PyBufferWrap start_view
+        cdef PyBufferWrap stop_view
+        cdef MDB_val bound
+        if start is not None:
+            start_view = move(PyBufferWrap(self.key_chain.dumps(start)))
+        if stop is not None:
+            stop_view = move(PyBufferWrap(self.key_chain.dumps(stop)))
+
+        cdef vector[char] data
+        cdef vector[size_t] offsets
+        cdef size_t count, i, f, begin
+        cdef array.array arr
+        cdef PRawDictConstIterator it = PRawDictConstIterator(self, pos=1 if (rev and stop is None) else 0)
+        with it:
+            bound = _position_range(it, rev, &start_view if start is not None else NULL,
+                                    &stop_view if stop is not None else NULL)
+            while True:
+                data.clear()
+                offsets.clear()
+                with nogil:
+                    count = it.cpp_iterator_ptr.get().fill_batch(n, with_keys, with_values, rev, bound, data, offsets)
+                if count == 0:
+                    return
+                if contiguous:
+                    arr = array.clone(_OFFSETS_TEMPLATE, offsets.size(), zero=False)
+                    for i in range(offsets.size()):
+                        arr.data.as_ulonglongs[i] = offsets[i]
+                    yield PyBytes_FromStringAndSize(data.data(), data.size()), arr
+                else:
+                    batch = []
+                    begin = 0
+                    f = 0
+                    for i in range(count):
+                        if with_keys and with_values:
+                            key = _batch_field(data, begin, offsets[f], self.key_chain, raw_keys)
+                            value = _batch_field(data, offsets[f], offsets[f + 1], self.value_chain, raw_values)
+                            batch.append((key, value))
+                        elif with_keys:
+                            batch.append(_batch_field(data, begin, offsets[f], self.key_chain, raw_keys))
+                        else:
+                            batch.append(_batch_field(data, begin, offsets[f], self.value_chain, raw_values))
+                        f += 2 if (with_keys and with_values) else 1
+                        begin = offsets[f - 1]
+                    yield batch
+                if count < n:
+                    return
+
+    def export_columns(self, start=None, stop=None, reverse=False, what='items', key_format=None, value_format=None):
+        """
+        Copy the keys and/or the values of [start, stop) (in reverse order if reverse), in one read snapshot and without
+        the GIL, into Column objects: (keys, values) for 'items', else the single column of 'keys' or 'values'.
+
+        The fields are exported as they are stored (the chains are not applied). A column is variable width, in Arrow's
+        binary layout, unless its format is given: a struct format (e.g. 'q', '<d', '16s') that makes it a fixed width
+        column and types its buffer. A field that does not have the size of the format raises ValueError.
+        """
+        if what not in ('keys', 'values', 'items'):
+            raise ValueError("what must be 'keys', 'values' or 'items'")
+        cdef cpp_bool rev = bool(reverse)
+        cdef Column keys = _new_column(key_format) if what != 'values' else None
+        cdef Column values = _new_column(value_format) if what != 'keys' else None
+        cdef column* keys_ptr = keys.col.get() if keys is not None else NULL
+        cdef column* values_ptr = values.col.get() if values is not None else NULL
+        cdef PyBufferWrap start_view
+        cdef PyBufferWrap stop_view
+        cdef MDB_val bound
+        if start is not None:
+            start_view = move(PyBufferWrap(self.key_chain.dumps(start)))
+        if stop is not None:
+            stop_view = move(PyBufferWrap(self.key_chain.dumps(stop)))
+
+        cdef PRawDictConstIterator it = PRawDictConstIterator(self, pos=1 if (rev and stop is None) else 0)
+        with it:
+            bound = _position_range(it, rev, &start_view if start is not None else NULL,
+                                    &stop_view if stop is not None else NULL)
+            with nogil:
+                it.cpp_iterator_ptr.get().fill_columns(rev, bound, keys_ptr, values_ptr)
+        if what == 'keys':
+            return keys
+        if what == 'values':
+            return values
+        return keys, values
+
     def __nonzero__(self):
         return self.ptr.get().is_initialized()
 
@@ -386,10 +908,7 @@ cdef class PRawDict(object):
 
     def __contains__(self, key):
         cdef PyBufferWrap key_view = move(PyBufferWrap(self.key_chain.dumps(key)))
-        if key_view.length() == 0:
-            raise EmptyKey()
-        if key_view.length() > 511:
-            raise BadValSize("key is too long")
+        check_key_size(key_view.length())
         return self.ptr.get().contains(key_view.get_mdb_val())
 
     cpdef has_key(self, key):
@@ -432,11 +951,61 @@ cdef class PRawDict(object):
         with nogil:
             self.ptr.get().remove_if(make_binary_predicate(binary_pred))
 
+    cpdef transform_values_batch(self, batch_funct, ssize_t batch_size=1000, first=None, last=None):
+        # batch_funct receives a list of (key, value) and must return the list of new values
+        cdef CBString firstkey = tocbstring(first)
+        cdef CBString lastkey = tocbstring(last)
+        with nogil:
+            self.ptr.get().transform_values_batch(make_batch_functor(batch_funct), firstkey, lastkey, batch_size)
+
+    cpdef remove_if_batch(self, batch_pred, ssize_t batch_size=1000, first=None, last=None):
+        # batch_pred receives a list of (key, value) and must return a sequence of booleans
+        cdef CBString firstkey = tocbstring(first)
+        cdef CBString lastkey = tocbstring(last)
+        with nogil:
+            self.ptr.get().remove_if_batch(make_batch_predicate(batch_pred), firstkey, lastkey, batch_size)
+
+    cpdef count_if_batch(self, batch_pred, ssize_t batch_size=1000, first=None, last=None):
+        cdef CBString firstkey = tocbstring(first)
+        cdef CBString lastkey = tocbstring(last)
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().count_interval_if_batch(make_batch_predicate(batch_pred), firstkey, lastkey, batch_size)
+        return n
+
+    cpdef count_interval(self, first=None, last=None):
+        # exact number of keys in [first, last)
+        cdef CBString firstkey = tocbstring(first)
+        cdef CBString lastkey = tocbstring(last)
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().count_interval(firstkey, lastkey)
+        return n
+
+    cpdef estimate_count(self, first=None, last=None):
+        # (estimate, low, high) for the number of keys in [first, last), without scanning the interval. low and high
+        # are the likely range of the count, not guaranteed bounds
+        cdef CBString firstkey = tocbstring(first)
+        cdef CBString lastkey = tocbstring(last)
+        cdef count_estimate e
+        with nogil:
+            e = self.ptr.get().estimate_interval(firstkey, lastkey)
+        return e.estimate, e.low, e.high
+
     cpdef move_to(self, PRawDict other, ssize_t chunk_size=-1):
         cdef CBString empt
         with nogil:
             self.ptr.get().move_to(other.ptr, empt, empt, chunk_size)
 
+    cpdef sync_to(self, PRawDict other, first=None, last=None, cpp_bool delete=False, ssize_t chunk_size=-1):
+        # makes [first, last) of other equal to this dict, writing only the differences; returns a summary
+        cdef CBString firstkey = tocbstring(first)
+        cdef CBString lastkey = tocbstring(last)
+        cdef sync_summary summary
+        with nogil:
+            summary = self.ptr.get().sync_to(other.ptr, firstkey, lastkey, delete, chunk_size)
+        return {'inserted': summary.inserted, 'updated': summary.updated, 'deleted': summary.deleted, 'unchanged': summary.unchanged}
+
     cpdef remove_duplicates(self, first="", last=""):
         cdef CBString firstkey = tocbstring(first)
         cdef CBString lastkey = tocbstring(last)
@@ -480,6 +1049,32 @@ cdef class PDict(PRawDict):
         with nogil:
             self.ptr.get().remove_if(make_binary_predicate(binary_pred))
 
+    cpdef transform_values_batch(self, batch_funct, ssize_t batch_size=1000, first=None, last=None):
+        batch_funct = _adapt_batch_functor(batch_funct, self.key_chain, self.value_chain)
+        return super(PDict, self).transform_values_batch(batch_funct, batch_size, self._encode_bound(first), self._encode_bound(last))
+
+    cpdef remove_if_batch(self, batch_pred, ssize_t batch_size=1000, first=None, last=None):
+        batch_pred = _adapt_batch_predicate(batch_pred, self.key_chain, self.value_chain)
+        return super(PDict, self).remove_if_batch(batch_pred, batch_size, self._encode_bound(first), self._encode_bound(last))
+
+    cpdef count_if_batch(self, batch_pred, ssize_t batch_size=1000, first=None, last=None):
+        batch_pred = _adapt_batch_predicate(batch_pred, self.key_chain, self.value_chain)
+        return super(PDict, self).count_if_batch(batch_pred, batch_size, self._encode_bound(first), self._encode_bound(last))
+
+    cpdef count_interval(self, first=None, last=None):
+        return super(PDict, self).count_interval(self._encode_bound(first), self._encode_bound(last))
+
+    cpdef estimate_count(self, first=None, last=None):
+        return super(PDict, self).estimate_count(self._encode_bound(first), self._encode_bound(last))
+
+    cpdef sync_to(self, PRawDict other, first=None, last=None, cpp_bool delete=False, ssize_t chunk_size=-1):
+        return super(PDict, self).sync_to(other, self._encode_bound(first), self._encode_bound(last), delete, chunk_size)
+
+    def _encode_bound(self, key):
+        if key is None:
+            return None
+        return self.key_chain.dumps(key).tobytes()
+
     cpdef remove_duplicates(self, first="", last=""):
         with nogil:
             self.ptr.get().remove_duplicates()
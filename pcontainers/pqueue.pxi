@@ -10,6 +10,12 @@ cdef class PRawQueue(object):
     cpdef pop_front(self)
     cpdef wait_and_pop_front(self, timeout=?)
     cpdef async_pop_front(self, timeout=?)
+    cdef shared_future[CBString] pop_front_future(self, timeout) except *
+    cpdef pop_front_many(self, size_t n, size_t max_bytes=?)
+    cpdef pop_back_many(self, size_t n, size_t max_bytes=?)
+    cpdef try_pop_many(self, size_t n, size_t max_bytes=?)
+    cpdef wait_and_pop_front_many(self, size_t n, size_t max_bytes=?, timeout=?)
+    cdef list _load_many(self, vector[CBString]& values)
     cpdef async_push_back(self, val)
 
     cpdef pop_all(self)
@@ -25,6 +31,8 @@ cdef class PRawQueue(object):
 
     cpdef transform_values(self, unary_funct)
     cpdef remove_if(self, unary_pred)
+    cpdef transform_values_batch(self, batch_funct, ssize_t batch_size=?)
+    cpdef remove_if_batch(self, batch_pred, ssize_t batch_size=?)
     cpdef move_to(self, other, ssize_t chunk_size=?)
     cpdef remove_duplicates(self)
 
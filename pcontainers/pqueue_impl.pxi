@@ -68,6 +68,17 @@ cdef class PRawQueue(object):
         py_future.set_boost_future(cpp_fut)
         return py_future
 
+    def aio_push_back(self, val, loop=None):
+        """
+        Like async_push_back, but return an asyncio future of the event loop (by default the running loop).
+        """
+        cdef AsyncioBridge bridge = asyncio_bridge(loop)
+        cdef PyBufferWrap view = move(PyBufferWrap(self.value_chain.dumps(val)))
+        cdef shared_future[cpp_bool] cpp_fut
+        with nogil:
+            cpp_fut = self.ptr.get().async_push_back(view.get_mdb_val())
+        return bridge.watch_bool(cpp_fut)
+
     cpdef pop_back(self):
         cdef CBString v
         with nogil:
@@ -80,7 +91,7 @@ cdef class PRawQueue(object):
             v = self.ptr.get().pop_front()
         return self.value_chain.loads(make_mbufferio_from_cbstring(v))
 
-    cpdef async_pop_front(self, timeout=None):
+    cdef shared_future[CBString] pop_front_future(self, timeout) except *:
         timeout = max(0, timeout) if timeout else 0
         if not isinstance(timeout, Number):
             raise TypeError()
@@ -88,7 +99,6 @@ cdef class PRawQueue(object):
         if timeout < 0:
             raise ValueError()
 
-        cdef CBStringFutureWrapper py_future = CBStringFutureWrapper(self.value_chain.pyloads)
         cdef shared_future[CBString] cpp_future
         cdef milliseconds ms
 
@@ -99,10 +109,28 @@ cdef class PRawQueue(object):
             ms = milliseconds(<long> timeout)
             with nogil:
                 cpp_future = self.ptr.get().async_wait_and_pop_front(ms)
+        return cpp_future
 
-        py_future.set_boost_future(cpp_future)
+    cpdef async_pop_front(self, timeout=None):
+        cdef CBStringFutureWrapper py_future = CBStringFutureWrapper(self.value_chain.pyloads)
+        py_future.set_boost_future(self.pop_front_future(timeout))
         return py_future
 
+    def aio_pop_front(self, timeout=None, loop=None):
+        """
+        Like async_pop_front, but return an asyncio future of the event loop (by default the running loop). If the
+        future is cancelled after an item was popped for it, the item is pushed back to the front of the queue.
+        """
+        cdef AsyncioBridge bridge = asyncio_bridge(loop)
+        return bridge.watch_cbstring(self.pop_front_future(timeout), self.value_chain.pyloads, None,
+                                     self._restore_front)
+
+    def _restore_front(self, raw):
+        # raw: a value as stored in the queue
+        cdef PyBufferWrap view = move(PyBufferWrap(raw))
+        with nogil:
+            self.ptr.get().push_front(view.get_mdb_val())
+
     cpdef wait_and_pop_front(self, timeout=None):
         timeout = max(0, timeout) if timeout else 0
         if not isinstance(timeout, Number):
@@ -121,6 +149,68 @@ cdef class PRawQueue(object):
             raise Empty()
         return self.value_chain.loads(make_mbufferio_from_cbstring(v))
 
+    cdef list _load_many(self, vector[CBString]& values):
+        cdef size_t i
+        loads = self.value_chain.loads
+        return [loads(make_mbufferio_from_cbstring(values[i])) for i in range(values.size())]
+
+    cpdef pop_front_many(self, size_t n, size_t max_bytes=0):
+        """
+        Pop up to n items from the front of the queue, in one transaction. If max_bytes is not 0, stop before the item
+        that would make the stored size of the popped items bigger than max_bytes (the first item is always popped).
+        Return a list, empty if the queue is empty.
+        """
+        cdef vector[CBString] values
+        with nogil:
+            values = self.ptr.get().pop_front_many(n, max_bytes)
+        return self._load_many(values)
+
+    cpdef pop_back_many(self, size_t n, size_t max_bytes=0):
+        """
+        Like pop_front_many, from the back of the queue.
+        """
+        cdef vector[CBString] values
+        with nogil:
+            values = self.ptr.get().pop_back_many(n, max_bytes)
+        return self._load_many(values)
+
+    cpdef try_pop_many(self, size_t n, size_t max_bytes=0):
+        """
+        Like pop_front_many, but never wait: raise BlockingIOError if another thread or process is using the queue.
+        Return an empty list if the queue is empty.
+        """
+        cdef vector[CBString] values
+        cdef cpp_bool acquired
+        with nogil:
+            acquired = self.ptr.get().try_pop_front_many(values, n, max_bytes)
+        if not acquired:
+            raise BlockingIOError("the queue is in use")
+        return self._load_many(values)
+
+    cpdef wait_and_pop_front_many(self, size_t n, size_t max_bytes=0, timeout=None):
+        """
+        Wait until the queue has one item at least (at most timeout seconds, forever if timeout is None), then pop up
+        to n items like pop_front_many. Raise Empty after the timeout.
+        """
+        cdef vector[CBString] values
+        cdef milliseconds ms
+        if timeout is None:
+            with nogil:
+                values = self.ptr.get().wait_and_pop_front_many(n, max_bytes)
+            return self._load_many(values)
+
+        if not isinstance(timeout, Number):
+            raise TypeError()
+        if timeout < 0:
+            raise ValueError("'timeout' must be a non-negative number")
+        ms = milliseconds(<long> int(timeout * 1000))
+        try:
+            with nogil:
+                values = self.ptr.get().wait_and_pop_front_many(n, max_bytes, ms)
+        except EmptyDatabase:
+            raise Empty()
+        return self._load_many(values)
+
     cpdef pop_all(self):
         l = []
         append = l.append
@@ -182,6 +272,16 @@ cdef class PRawQueue(object):
         with nogil:
             self.ptr.get().remove_if(make_unary_predicate(unary_pred))
 
+    cpdef transform_values_batch(self, batch_funct, ssize_t batch_size=1000):
+        # batch_funct receives a list of values and must return the list of new values
+        with nogil:
+            self.ptr.get().transform_values_batch(make_values_batch_functor(batch_funct), batch_size)
+
+    cpdef remove_if_batch(self, batch_pred, ssize_t batch_size=1000):
+        # batch_pred receives a list of values and must return a sequence of booleans
+        with nogil:
+            self.ptr.get().remove_if_batch(make_values_batch_predicate(batch_pred), batch_size)
+
     cpdef move_to(self, other, ssize_t chunk_size=-1):
         if not isinstance(other, PRawQueue):
             raise TypeError()
@@ -236,6 +336,16 @@ cdef class PQueue(PRawQueue):
         with nogil:
             self.ptr.get().remove_if(make_unary_predicate(unary_pred))
 
+    cpdef transform_values_batch(self, batch_funct, ssize_t batch_size=1000):
+        batch_funct = _adapt_values_batch_functor(batch_funct, self.value_chain)
+        with nogil:
+            self.ptr.get().transform_values_batch(make_values_batch_functor(batch_funct), batch_size)
+
+    cpdef remove_if_batch(self, batch_pred, ssize_t batch_size=1000):
+        batch_pred = _adapt_values_batch_predicate(batch_pred, self.value_chain)
+        with nogil:
+            self.ptr.get().remove_if_batch(make_values_batch_predicate(batch_pred), batch_size)
+
     cpdef move_to(self, other, ssize_t chunk_size=-1):
         if not isinstance(other, PQueue):
             raise TypeError()
@@ -0,0 +1,29 @@
+# -*- coding: utf-8 -*-
+
+cdef class PRawPriorityQueue(object):
+    cdef shared_ptr[cppPersistentPriorityQueue] ptr
+    cdef Chain value_chain
+
+    cdef tuple _element_to_item(self, CBString& element)
+    cdef list _elements_to_items(self, vector[CBString]& elements)
+    cdef shared_future[CBString] pop_future(self, timeout) except *
+    cpdef push(self, int64_t priority, val)
+    cpdef pop(self)
+    cpdef pop_many(self, size_t n, size_t max_bytes=?)
+    cpdef wait_and_pop(self, timeout=?)
+    cpdef wait_and_pop_many(self, size_t n, size_t max_bytes=?, timeout=?)
+    cpdef async_pop(self, timeout=?)
+    cpdef peek(self, with_handle=?)
+    cpdef change_priority(self, handle, int64_t priority)
+
+    cpdef clear(self)
+    cpdef empty(self)
+    cpdef qsize(self)
+    cpdef full(self)
+    cpdef put(self, item, block=?, timeout=?)
+    cpdef get(self, block=?, timeout=?)
+    cpdef put_nowait(self, item)
+    cpdef get_nowait(self)
+
+cdef class PPriorityQueue(PRawPriorityQueue):
+    pass
@@ -0,0 +1,259 @@
+# -*- coding: utf-8 -*-
+
+cdef inline milliseconds _timeout_ms(timeout) except *:
+    if not isinstance(timeout, Number):
+        raise TypeError()
+    if timeout < 0:
+        raise ValueError("'timeout' must be a non-negative number")
+    return milliseconds(<long> int(timeout * 1000))
+
+
+cdef inline MDB_val _element_mdb_val(CBString& element) nogil:
+    cdef MDB_val v
+    v.mv_data = <void*> element.data
+    v.mv_size = element.length()
+    return v
+
+
+cdef class PRawPriorityQueue(object):
+    """
+    A persistent priority queue: the items come out lowest priority first, and first in first out for one priority.
+
+    The priorities are 64 bits signed integers. Like with queue.PriorityQueue, the items of put and get are
+    (priority, value) tuples. put and push return the handle of the item (bytes), that change_priority uses to move
+    an item that is still in the queue.
+
+    A push and a pop cost one lookup in a B-tree. The waiting pops (get, wait_and_pop, async_pop, aio_pop) sleep until
+    a push, from any process, makes an item available.
+    """
+    def __cinit__(self, dirname, dbname, LmdbOptions opts=None, Chain value_chain=None):
+        cdef CBString dirn = tocbstring(dirname)
+        cdef CBString dbn = tocbstring(dbname)
+        if dirn.length() == 0:
+            raise ValueError("empty dirname")
+        if opts is None:
+            opts = LmdbOptions()
+        self.ptr = priority_queue_factory(dirn, dbn, (<LmdbOptions> opts).opts)
+        self.value_chain = NoneChain()
+
+    def __init__(self, dirname, dbname, LmdbOptions opts=None, Chain value_chain=None):
+        pass
+
+    def __dealloc__(self):
+        with nogil:
+            self.ptr.reset()
+
+    def __repr__(self):
+        return u"{}(dbname='{}', dirname='{}')".format(
+            self.__class__.__name__, make_unicode(self.dbname), make_unicode(self.dirname)
+        )
+
+    property dirname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dirname())
+
+    property dbname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dbname())
+
+    cdef tuple _element_to_item(self, CBString& element):
+        cdef MDB_val v = _element_mdb_val(element)
+        cdef CBString value = priority_queue_value_of(v)
+        return priority_queue_priority_of(v), self.value_chain.loads(make_mbufferio_from_cbstring(value))
+
+    cdef list _elements_to_items(self, vector[CBString]& elements):
+        cdef size_t i
+        return [self._element_to_item(elements[i]) for i in range(elements.size())]
+
+    def _load_element(self, buf):
+        # buf: an element as popped by the futures
+        buf.seek(0)
+        cdef CBString element = tocbstring(buf.read())
+        return self._element_to_item(element)
+
+    cpdef push(self, int64_t priority, val):
+        """
+        Push val with the given priority. Return the handle of the item.
+        """
+        cdef PyBufferWrap view = move(PyBufferWrap(self.value_chain.dumps(val)))
+        cdef CBString handle
+        with nogil:
+            handle = self.ptr.get().push(priority, view.get_mdb_val())
+        return topy(handle)
+
+    def push_many(self, items):
+        """
+        Push (priority, value) tuples in one transaction. Return the list of their handles.
+        """
+        cdef vector[int64_t] priorities
+        cdef vector[CBString] values
+        cdef vector[CBString] handles
+        cdef size_t i
+        for priority, val in items:
+            priorities.push_back(priority)
+            values.push_back(tocbstring(self.value_chain.dumps(val)))
+        with nogil:
+            handles = self.ptr.get().push(priorities, values)
+        return [topy(handles[i]) for i in range(handles.size())]
+
+    cpdef put(self, item, block=True, timeout=None):
+        priority, val = item
+        return self.push(priority, val)
+
+    cpdef put_nowait(self, item):
+        return self.put(item)
+
+    cpdef pop(self):
+        """
+        Pop the (priority, value) item with the lowest priority. Raise EmptyDatabase if the queue is empty.
+        """
+        cdef CBString element
+        with nogil:
+            element = self.ptr.get().pop()
+        return self._element_to_item(element)
+
+    cpdef pop_many(self, size_t n, size_t max_bytes=0):
+        """
+        Pop up to n items, lowest priority first, in one transaction. max_bytes limits the stored size of the items
+        like PRawQueue.pop_front_many. Return a list, empty if the queue is empty.
+        """
+        cdef vector[CBString] elements
+        with nogil:
+            elements = self.ptr.get().pop_many(n, max_bytes)
+        return self._elements_to_items(elements)
+
+    cpdef wait_and_pop(self, timeout=None):
+        """
+        Wait until the queue has an item (at most timeout seconds, forever if timeout is None), then pop it. Raise
+        Empty after the timeout.
+        """
+        cdef CBString element
+        cdef milliseconds ms
+        if timeout is None:
+            with nogil:
+                element = self.ptr.get().wait_and_pop()
+            return self._element_to_item(element)
+        ms = _timeout_ms(timeout)
+        try:
+            with nogil:
+                element = self.ptr.get().wait_and_pop(ms)
+        except EmptyDatabase:
+            raise Empty()
+        return self._element_to_item(element)
+
+    cpdef wait_and_pop_many(self, size_t n, size_t max_bytes=0, timeout=None):
+        """
+        Wait until the queue has one item at least (at most timeout seconds, forever if timeout is None), then pop up
+        to n items like pop_many. Raise Empty after the timeout.
+        """
+        cdef vector[CBString] elements
+        cdef milliseconds ms
+        if timeout is None:
+            with nogil:
+                elements = self.ptr.get().wait_and_pop_many(n, max_bytes)
+            return self._elements_to_items(elements)
+        ms = _timeout_ms(timeout)
+        try:
+            with nogil:
+                elements = self.ptr.get().wait_and_pop_many(n, max_bytes, ms)
+        except EmptyDatabase:
+            raise Empty()
+        return self._elements_to_items(elements)
+
+    cdef shared_future[CBString] pop_future(self, timeout) except *:
+        cdef shared_future[CBString] cpp_future
+        cdef milliseconds ms
+        if timeout is None:
+            with nogil:
+                cpp_future = self.ptr.get().async_wait_and_pop()
+        else:
+            ms = _timeout_ms(timeout)
+            with nogil:
+                cpp_future = self.ptr.get().async_wait_and_pop(ms)
+        return cpp_future
+
+    cpdef async_pop(self, timeout=None):
+        """
+        Pop the item with the lowest priority in a native thread, waiting at most timeout seconds (forever if timeout
+        is None). Return a future of the (priority, value) item.
+        """
+        cdef CBStringFutureWrapper py_future = CBStringFutureWrapper(self._load_element)
+        py_future.set_boost_future(self.pop_future(timeout))
+        return py_future
+
+    def aio_pop(self, timeout=None, loop=None):
+        """
+        Like async_pop, but return an asyncio future of the event loop (by default the running loop). If the future
+        is cancelled after an item was popped for it, the item is pushed again with its priority.
+        """
+        cdef AsyncioBridge bridge = asyncio_bridge(loop)
+        return bridge.watch_cbstring(self.pop_future(timeout), self._load_element, None, self._restore)
+
+    def _restore(self, raw):
+        # raw: an element as stored in the queue
+        cdef CBString element = tocbstring(raw)
+        cdef MDB_val v = _element_mdb_val(element)
+        cdef int64_t priority = priority_queue_priority_of(v)
+        cdef CBString value = priority_queue_value_of(v)
+        with nogil:
+            self.ptr.get().push(priority, _element_mdb_val(value))
+
+    cpdef get(self, block=True, timeout=None):
+        if not block:
+            return self.get_nowait()
+        return self.wait_and_pop(timeout)
+
+    cpdef get_nowait(self):
+        try:
+            return self.pop()
+        except EmptyDatabase:
+            raise Empty()
+
+    cpdef peek(self, with_handle=False):
+        """
+        Return the (priority, value) item with the lowest priority without popping it, or (handle, priority, value)
+        if with_handle is true. Raise Empty if the queue is empty.
+        """
+        cdef CBString handle
+        cdef CBString element
+        cdef cpp_bool found
+        with nogil:
+            found = self.ptr.get().peek(handle, element)
+        if not found:
+            raise Empty()
+        item = self._element_to_item(element)
+        if with_handle:
+            return (topy(handle),) + item
+        return item
+
+    cpdef change_priority(self, handle, int64_t priority):
+        """
+        Move the item of handle behind the items of the new priority. Return the new handle of the item, or None if
+        the item is not in the queue anymore.
+        """
+        cdef CBString h = tocbstring(handle)
+        cdef CBString new_handle
+        cdef cpp_bool found
+        with nogil:
+            found = self.ptr.get().change_priority(h, priority, new_handle)
+        if not found:
+            return None
+        return topy(new_handle)
+
+    cpdef qsize(self):
+        return self.ptr.get().size()
+
+    cpdef empty(self):
+        return self.ptr.get().empty()
+
+    cpdef full(self):
+        return False
+
+    cpdef clear(self):
+        with nogil:
+            self.ptr.get().clear()
+
+
+cdef class PPriorityQueue(PRawPriorityQueue):
+    def __cinit__(self, dirname, dbname, LmdbOptions opts=None, Chain value_chain=None):
+        self.value_chain = value_chain if value_chain else Chain(PickleSerializer(), None, None)
@@ -0,0 +1,30 @@
+cdef extern from "cpp_persistent_dict_queue/blobstore.h" namespace "quiet" nogil:
+
+    # noinspection PyPep8Naming
+    cppclass cppBlobWriter "quiet::BlobStore::Writer":
+        void write(const void* data, size_t n) except +custom_handler
+        uint64_t tell()
+        cpp_bool is_closed()
+        void commit() except +custom_handler
+        void abort() except +custom_handler
+
+    # noinspection PyPep8Naming
+    cppclass cppBlobReader "quiet::BlobStore::Reader":
+        uint64_t get_size()
+        uint64_t tell()
+        uint64_t seek(int64_t offset, int whence) except +custom_handler
+        size_t readinto(void* dst, size_t n) except +custom_handler
+        CBString read(ssize_t n) except +custom_handler
+        CBString read_range(uint64_t offset, size_t n) except +custom_handler
+
+    # noinspection PyPep8Naming
+    cppclass cppBlobStore "quiet::BlobStore":
+        cppBlobStore(shared_ptr[cppPersistentDict] d, size_t chunk_sz, size_t chunks_txn) except +custom_handler
+        size_t get_chunk_size()
+        cpp_bool exists(const CBString& name) except +custom_handler
+        uint64_t size(const CBString& name) except +custom_handler
+        cpp_bool erase(const CBString& name) except +custom_handler
+        vector[CBString] names() except +custom_handler
+        size_t sweep() except +custom_handler
+        shared_ptr[cppBlobWriter] open_writer(const CBString& name) except +custom_handler
+        shared_ptr[cppBlobReader] open_reader(const CBString& name) except +custom_handler
@@ -1,11 +1,32 @@
 cdef extern from "cpp_persistent_dict_queue/bufferedpersistentdict.h" namespace "quiet" nogil:
+    cppclass buffered_read_stats "quiet::BufferedPersistentDict::read_stats":
+        uint64_t submitted
+        uint64_t coalesced
+        uint64_t expired
+        uint64_t cancelled
+        uint64_t steals
+        size_t reader_threads
+
     cppclass cppBufferedPersistentDict "quiet::BufferedPersistentDict":
         cppBufferedPersistentDict(shared_ptr[cppPersistentDict] d, uint64_t flush_interval) except +custom_handler
+        cppBufferedPersistentDict(shared_ptr[cppPersistentDict] d, uint64_t flush_interval, binary_scalar_functor merge_op) except +custom_handler
+        cppBufferedPersistentDict(shared_ptr[cppPersistentDict] d, uint64_t flush_interval, binary_scalar_functor merge_op, size_t nb_reader_threads) except +custom_handler
         CBString at(const CBString& key) except +custom_handler
         CBString at(MDB_val key) except +custom_handler
         shared_future[CBString] async_at(const CBString& key) except +custom_handler
         shared_future[CBString] async_at(MDB_val key) except +custom_handler
+        shared_future[CBString] async_at(MDB_val key, uint64_t timeout) except +custom_handler
+        shared_future[CBString] async_at(MDB_val key, uint64_t timeout, uint64_t& read_id) except +custom_handler
+        cpp_bool cancel_read(uint64_t read_id) except +custom_handler
+        buffered_read_stats get_read_stats()
         shared_future[cpp_bool] erase(const CBString& key) except +custom_handler
         shared_future[cpp_bool] erase(MDB_val key) except +custom_handler
         shared_future[cpp_bool] insert_key_value "quiet::BufferedPersistentDict::insert" (const CBString& key, const CBString& value) except +custom_handler
         shared_future[cpp_bool] insert_key_value "quiet::BufferedPersistentDict::insert" (MDB_val key, MDB_val value) except +custom_handler
+        shared_future[cpp_bool] merge(const CBString& key, const CBString& operand) except +custom_handler
+        shared_future[cpp_bool] merge(MDB_val key, MDB_val operand) except +custom_handler
+
+cdef extern from "utils/merge_operators.h" namespace "utils" nogil:
+    binary_scalar_functor merge_operator_by_name(const CBString& name) except +custom_handler
+    vector[CBString] unpack_set(const CBString& packed) except +custom_handler
+    CBString pack_set(const vector[CBString]& members) except +custom_handler
@@ -0,0 +1,7 @@
+cdef extern from "utils/completion_queue.h" namespace "utils" nogil:
+    cppclass CompletionQueue "utils::CompletionQueue":
+        int fileno()
+        void watch[T](shared_future[T] fut, uint64_t token) except +custom_handler
+        size_t drain(vector[uint64_t]& tokens, size_t max_tokens)
+
+    shared_ptr[CompletionQueue] make_completion_queue "utils::CompletionQueue::factory"() except +custom_handler
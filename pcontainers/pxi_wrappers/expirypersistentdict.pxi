@@ -0,0 +1,61 @@
+cdef extern from "cpp_persistent_dict_queue/expirypersistentdict.h" namespace "quiet" nogil:
+
+    # noinspection PyPep8Naming
+    cdef struct cppExpiryTouchStats "quiet::ExpiryPersistentDict::touch_stats":
+        uint64_t touches
+        uint64_t coalesced
+        uint64_t flushed
+        uint64_t flushes
+        size_t pending
+
+    # noinspection PyPep8Naming
+    cppclass cppExpiryPersistentDict "quiet::ExpiryPersistentDict":
+        CBString get_dirname()
+        CBString get_dbname()
+        size_t size() except +custom_handler
+        void clear() except +custom_handler
+        cpp_bool get(MDB_val key, CBString& value) except +custom_handler
+        cpp_bool get_stale(MDB_val key, CBString& value, cpp_bool& fresh) except +custom_handler
+        cpp_bool contains(MDB_val key) except +custom_handler
+        uint64_t get_deadline(MDB_val key) except +custom_handler
+        void insert(MDB_val key, MDB_val value, uint64_t deadline) except +custom_handler
+        void insert(MDB_val key, MDB_val value, uint64_t deadline, MDB_val metadata) except +custom_handler
+        void insert(MDB_val key, MDB_val value, uint64_t deadline, MDB_val metadata, uint64_t sliding) except +custom_handler
+        void insert_many(const vector[CBString]& keys, const vector[CBString]& values, const vector[CBString]& metadata, uint64_t deadline) except +custom_handler
+        void insert_many(const vector[CBString]& keys, const vector[CBString]& values, const vector[CBString]& metadata, uint64_t deadline, uint64_t sliding) except +custom_handler
+        size_t migrate_legacy_layout(const CBString& old_dirname) except +custom_handler
+        cpp_bool get_metadata(MDB_val key, CBString& metadata) except +custom_handler
+        cpp_bool set_metadata(MDB_val key, MDB_val metadata) except +custom_handler
+        cpp_bool set_deadline(MDB_val key, uint64_t deadline) except +custom_handler
+        cpp_bool erase(MDB_val key) except +custom_handler
+        cpp_bool pop(MDB_val key, CBString& value) except +custom_handler
+        cpp_bool pop(MDB_val key, CBString& value, CBString& metadata) except +custom_handler
+        cpp_bool pop_first(CBString& key, CBString& value) except +custom_handler
+        cpp_bool pop_first(CBString& key, CBString& value, CBString& metadata) except +custom_handler
+        size_t prune_expired(size_t max_entries) except +custom_handler
+        uint64_t get_pruned()
+        void start_pruning(uint64_t period_ms) except +custom_handler
+        void stop_pruning()
+        cpp_bool is_pruning()
+        void set_stale_grace(uint64_t grace)
+        uint64_t get_stale_grace()
+        size_t flush_touches() except +custom_handler
+        cppExpiryTouchStats get_touch_stats()
+        void start_flushing_touches(uint64_t period_ms) except +custom_handler
+        void stop_flushing_touches()
+        cpp_bool is_flushing_touches()
+        void enable_eviction(eviction_policy policy, size_t max_entries, size_t max_bytes) except +custom_handler
+        eviction_stats get_eviction_stats() except +custom_handler
+
+    # noinspection PyPep8Naming
+    cppclass cppExpiryConstIterator "quiet::ExpiryPersistentDict::const_iterator":
+        cppExpiryConstIterator(shared_ptr[cppExpiryPersistentDict] d) except +custom_handler
+        cpp_bool has_reached_end()
+        CBString get_key() except +custom_handler
+        CBString get_value() except +custom_handler
+        uint64_t get_deadline() except +custom_handler
+        CBString get_metadata() except +custom_handler
+        cppExpiryConstIterator& incr "operator++"() except +custom_handler
+
+    shared_ptr[cppExpiryPersistentDict] expiry_dict_factory "quiet::ExpiryPersistentDict::factory"(const CBString& directory_name, const CBString& database_name, const lmdb_options& options) except +custom_handler
+    uint64_t expiry_now_ms "quiet::ExpiryPersistentDict::now_ms"()
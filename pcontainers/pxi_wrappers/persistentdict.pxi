@@ -1,5 +1,62 @@
 cdef extern from "cpp_persistent_dict_queue/persistentdict.h" namespace "quiet" nogil:
 
+    cppclass change "quiet::PersistentDict::change":
+        uint64_t seq
+        char op
+        CBString key
+
+    cppclass sync_summary "quiet::PersistentDict::sync_summary":
+        size_t inserted
+        size_t updated
+        size_t deleted
+        size_t unchanged
+
+    cppclass count_estimate "quiet::PersistentDict::count_estimate":
+        size_t estimate
+        size_t low
+        size_t high
+
+    cppclass column "quiet::PersistentDict::column":
+        column()
+        column(size_t w)
+        size_t width
+        vector[char] data
+        vector[uint64_t] offsets
+        size_t size()
+
+    cppclass read_cache_stats "quiet::ReadCache::stats":
+        uint64_t hits
+        uint64_t misses
+        uint64_t evictions
+        uint64_t invalidations
+        uint64_t flushes
+        size_t size
+        size_t capacity
+
+    cppclass bloom_filter_stats "quiet::BloomFilter::stats":
+        uint64_t checks
+        uint64_t negatives
+        uint64_t unknown
+        uint64_t rebuilds
+        size_t bits
+        size_t keys
+        cpp_bool ready
+
+    cppclass eviction_stats "quiet::Evictor::stats":
+        uint64_t evictions
+        uint64_t batches
+        uint64_t accesses
+        uint64_t dropped
+        size_t entries
+        size_t bytes
+        size_t max_entries
+        size_t max_bytes
+        int policy
+
+    cdef enum eviction_policy "quiet::Evictor::policy_type":
+        EVICT_LRU "quiet::Evictor::LRU"
+        EVICT_LFU "quiet::Evictor::LFU"
+
     # noinspection PyPep8Naming
     cppclass cppPersistentDict "quiet::PersistentDict":
         cpp_bool is_initialized()
@@ -9,8 +66,33 @@ cdef extern from "cpp_persistent_dict_queue/persistentdict.h" namespace "quiet"
         CBString get_dbname()
 
         CBString setdefault(MDB_val k, MDB_val dflt) except +custom_handler
+        cpp_bool compare_and_swap(MDB_val k, MDB_val expected, MDB_val new_value) except +custom_handler
+        cpp_bool insert_if_absent(MDB_val k, MDB_val v) except +custom_handler
+        cpp_bool replace_if_present(MDB_val k, MDB_val v) except +custom_handler
+        uint64_t get_version(MDB_val k) except +custom_handler
+        pair[uint64_t, CBString] versioned_at(MDB_val k) except +custom_handler
+        uint64_t versioned_insert(MDB_val k, MDB_val v, uint64_t expected_version) except +custom_handler
+        uint64_t versioned_erase(MDB_val k, uint64_t expected_version) except +custom_handler
+        void enable_changes() except +custom_handler
+        cpp_bool has_changes()
+        uint64_t last_change() except +custom_handler
+        vector[change] changes_since(uint64_t seq, size_t limit) except +custom_handler
+        uint64_t wait_changes(uint64_t seq, long timeout_ms) except +custom_handler
+        size_t truncate_changes(uint64_t seq) except +custom_handler
         CBString at(const CBString& key) except +custom_handler
         CBString at(MDB_val k) except +custom_handler
+        CBString at(MDB_val k, uint64_t* entry_id) except +custom_handler
+        void enable_read_cache(size_t capacity) except +custom_handler
+        size_t get_read_cache_capacity()
+        read_cache_stats get_read_cache_stats()
+        void enable_bloom_filter(cpp_bool sidecar) except +custom_handler
+        cpp_bool has_bloom_filter()
+        bloom_filter_stats get_bloom_filter_stats()
+        void enable_eviction(eviction_policy policy, size_t max_entries, size_t max_bytes) except +custom_handler
+        cpp_bool has_eviction()
+        void record_access(MDB_val key)
+        eviction_stats get_eviction_stats() except +custom_handler
+        cpp_bool may_contain(MDB_val k) except +custom_handler
         CBString get "quiet::PersistentDict::operator[]" (const CBString& key) except +custom_handler
         CBString pop(const CBString& key) except +custom_handler
         CBString pop(MDB_val k) except +custom_handler
@@ -54,6 +136,7 @@ cdef extern from "cpp_persistent_dict_queue/persistentdict.h" namespace "quiet"
         size_t count_interval() except +custom_handler
         size_t count_interval(const CBString& first_key) except +custom_handler
         size_t count_interval(const CBString& first_key, const CBString& last_key) except +custom_handler
+        count_estimate estimate_interval(const CBString& first_key, const CBString& last_key) except +custom_handler
 
         cpp_bool contains(const CBString& key) except +custom_handler
         cpp_bool contains(MDB_val key) except +custom_handler
@@ -68,10 +151,15 @@ cdef extern from "cpp_persistent_dict_queue/persistentdict.h" namespace "quiet"
         void remove_if(binary_predicate binary_pred, const CBString& first_key, const CBString& last_key) except +custom_handler
         void remove_if(binary_predicate binary_pred, const CBString& first_key, const CBString& last_key, ssize_t chunk_size) except +custom_handler
 
+        void transform_values_batch(batch_functor batch_funct, const CBString& first_key, const CBString& last_key, ssize_t batch_size) except +custom_handler
+        void remove_if_batch(batch_predicate batch_pred, const CBString& first_key, const CBString& last_key, ssize_t batch_size) except +custom_handler
+        size_t count_interval_if_batch(batch_predicate batch_pred, const CBString& first_key, const CBString& last_key, ssize_t batch_size) except +custom_handler
+
         void move_to(shared_ptr[cppPersistentDict] other) except +custom_handler
         void move_to(shared_ptr[cppPersistentDict] other, const CBString& first_key) except +custom_handler
         void move_to(shared_ptr[cppPersistentDict] other, const CBString& first_key, const CBString& last_key) except +custom_handler
         void move_to(shared_ptr[cppPersistentDict], const CBString& first_key, const CBString& last_key, ssize_t chunk_size) except +custom_handler
+        sync_summary sync_to(shared_ptr[cppPersistentDict] other, const CBString& first_key, const CBString& last_key, cpp_bool remove_extra, ssize_t chunk_size) except +custom_handler
 
 
         void remove_duplicates() except +custom_handler
@@ -111,6 +199,8 @@ cdef extern from "cpp_persistent_dict_queue/persistentdict.h" namespace "quiet"
         cpp_bool has_reached_beginning() except +custom_handler
         void set_position(MDB_val key) except +custom_handler
         void set_range(MDB_val key) except +custom_handler
+        size_t fill_batch(size_t n, cpp_bool with_keys, cpp_bool with_values, cpp_bool reverse, MDB_val bound, vector[char]& data, vector[size_t]& offsets) except +custom_handler
+        size_t fill_columns(cpp_bool reverse, MDB_val bound, column* keys, column* values) except +custom_handler
 
         void set_rollback(cpp_bool val)
 
@@ -0,0 +1,20 @@
+cdef extern from "cpp_persistent_dict_queue/persistentmultidict.h" namespace "quiet" nogil:
+
+    # noinspection PyPep8Naming
+    cppclass cppPersistentMultiDict "quiet::PersistentMultiDict":
+        CBString get_dirname()
+        CBString get_dbname()
+        cpp_bool is_fixed_size()
+        size_t size() except +custom_handler
+        void clear() except +custom_handler
+        cpp_bool insert(MDB_val key, MDB_val value) except +custom_handler
+        size_t insert(const CBString& key, const vector[CBString]& values) except +custom_handler
+        cpp_bool erase(MDB_val key, MDB_val value) except +custom_handler
+        size_t erase(MDB_val key) except +custom_handler
+        cpp_bool contains(MDB_val key) except +custom_handler
+        cpp_bool contains(MDB_val key, MDB_val value) except +custom_handler
+        size_t count(MDB_val key) except +custom_handler
+        vector[CBString] values(MDB_val key) except +custom_handler
+        vector[CBString] keys() except +custom_handler
+
+    shared_ptr[cppPersistentMultiDict] multidict_factory "quiet::PersistentMultiDict::factory"(const CBString& directory_name, const CBString& database_name, const lmdb_options& options, cpp_bool fixed_size) except +custom_handler
@@ -0,0 +1,26 @@
+
+cdef extern from "cpp_persistent_dict_queue/persistentpriorityqueue.h" namespace "quiet" nogil:
+
+    # noinspection PyPep8Naming
+    cdef cppclass cppPersistentPriorityQueue "quiet::PersistentPriorityQueue":
+        CBString get_dirname()
+        CBString get_dbname()
+        size_t size() except +custom_handler
+        cpp_bool empty() except +custom_handler
+        void clear() except +custom_handler
+        CBString push(int64_t priority, MDB_val value) except +custom_handler
+        vector[CBString] push(const vector[int64_t]& priorities, const vector[CBString]& values) except +custom_handler
+        cpp_bool peek(CBString& handle, CBString& element) except +custom_handler
+        cpp_bool change_priority(const CBString& handle, int64_t priority, CBString& new_handle) except +custom_handler
+        CBString pop() except +custom_handler
+        vector[CBString] pop_many(size_t n, size_t max_bytes) except +custom_handler
+        CBString wait_and_pop() except +custom_handler
+        CBString wait_and_pop(milliseconds ms) except +custom_handler
+        vector[CBString] wait_and_pop_many(size_t n, size_t max_bytes) except +custom_handler
+        vector[CBString] wait_and_pop_many(size_t n, size_t max_bytes, milliseconds ms) except +custom_handler
+        shared_future[CBString] async_wait_and_pop() except +custom_handler
+        shared_future[CBString] async_wait_and_pop(milliseconds ms) except +custom_handler
+
+    shared_ptr[cppPersistentPriorityQueue] priority_queue_factory "quiet::PersistentPriorityQueue::factory"(const CBString& directory_name, const CBString& database_name, const lmdb_options& options) except +custom_handler
+    int64_t priority_queue_priority_of "quiet::PersistentPriorityQueue::priority_of"(MDB_val element) except +custom_handler
+    CBString priority_queue_value_of "quiet::PersistentPriorityQueue::value_of"(MDB_val element) except +custom_handler
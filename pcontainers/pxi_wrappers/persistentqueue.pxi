@@ -25,6 +25,11 @@ cdef extern from "cpp_persistent_dict_queue/persistentqueue.h" namespace "quiet"
         CBString wait_and_pop_front(milliseconds) except +custom_handler
         shared_future[CBString] async_wait_and_pop_front() except +custom_handler
         shared_future[CBString] async_wait_and_pop_front(milliseconds) except +custom_handler
+        vector[CBString] pop_front_many(size_t n, size_t max_bytes) except +custom_handler
+        vector[CBString] pop_back_many(size_t n, size_t max_bytes) except +custom_handler
+        cpp_bool try_pop_front_many(vector[CBString]& values, size_t n, size_t max_bytes) except +custom_handler
+        vector[CBString] wait_and_pop_front_many(size_t n, size_t max_bytes) except +custom_handler
+        vector[CBString] wait_and_pop_front_many(size_t n, size_t max_bytes, milliseconds ms) except +custom_handler
 
         void pop_all[OutputIterator](OutputIterator oit) except +custom_handler
 
@@ -37,6 +42,8 @@ cdef extern from "cpp_persistent_dict_queue/persistentqueue.h" namespace "quiet"
 
         void remove_if(unary_predicate unary_pred) except +custom_handler
         void transform_values(unary_functor unary_funct) except +custom_handler
+        void remove_if_batch(batch_predicate batch_pred, ssize_t batch_size) except +custom_handler
+        void transform_values_batch(batch_functor batch_funct, ssize_t batch_size) except +custom_handler
         void remove_duplicates() except +custom_handler
 
     shared_ptr[cppPersistentQueue] queue_factory "quiet::PersistentQueue::factory"(const CBString& directory_name) except +custom_handler
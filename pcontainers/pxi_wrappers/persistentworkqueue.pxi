@@ -0,0 +1,34 @@
+
+cdef extern from "cpp_persistent_dict_queue/persistentworkqueue.h" namespace "quiet" nogil:
+
+    # noinspection PyPep8Naming
+    cdef cppclass cppLeasedElement "quiet::PersistentWorkQueue::leased_element":
+        uint64_t id
+        uint64_t attempts
+        CBString value
+
+    # noinspection PyPep8Naming
+    cdef cppclass cppPersistentWorkQueue "quiet::PersistentWorkQueue":
+        CBString get_dirname()
+        CBString get_dbname()
+        size_t size() except +custom_handler
+        size_t inflight_size() except +custom_handler
+        size_t dead_size() except +custom_handler
+        void clear() except +custom_handler
+        void push_back(MDB_val value) except +custom_handler
+        void push_back(const vector[CBString]& values) except +custom_handler
+        vector[cppLeasedElement] lease(size_t n, uint64_t visibility_ms) except +custom_handler
+        vector[cppLeasedElement] wait_and_lease(size_t n, uint64_t visibility_ms) except +custom_handler
+        vector[cppLeasedElement] wait_and_lease(size_t n, uint64_t visibility_ms, milliseconds ms) except +custom_handler
+        size_t ack(const vector[uint64_t]& ids) except +custom_handler
+        size_t release(const vector[uint64_t]& ids) except +custom_handler
+        size_t reap(size_t max_leases) except +custom_handler
+        uint64_t get_reaped()
+        vector[cppLeasedElement] pop_dead(size_t n) except +custom_handler
+        void set_max_attempts(uint64_t attempts)
+        uint64_t get_max_attempts()
+        void start_reaping(uint64_t period_ms) except +custom_handler
+        void stop_reaping()
+        cpp_bool is_reaping()
+
+    shared_ptr[cppPersistentWorkQueue] work_queue_factory "quiet::PersistentWorkQueue::factory"(const CBString& directory_name, const CBString& database_name, const lmdb_options& options, uint64_t max_attempts) except +custom_handler
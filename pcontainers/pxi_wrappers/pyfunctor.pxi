@@ -14,12 +14,22 @@ cdef extern from "utils/pyfunctor.h" namespace "quiet" nogil:
     # noinspection PyPep8Naming
     cppclass binary_functor:
         pass
+    # noinspection PyPep8Naming
+    cppclass batch_predicate:
+        pass
+    # noinspection PyPep8Naming
+    cppclass batch_functor:
+        pass
 
 
     cdef unary_predicate make_unary_predicate "quiet::PyPredicate::make_unary_predicate"(object obj) except +custom_handler
     cdef binary_predicate make_binary_predicate "quiet::PyPredicate::make_binary_predicate"(object obj) except +custom_handler
     cdef unary_functor make_unary_functor "quiet::PyFunctor::make_unary_functor"(object obj) except +custom_handler
     cdef binary_scalar_functor make_binary_scalar_functor "quiet::PyFunctor::make_binary_scalar_functor"(object obj) except +custom_handler
+    cdef batch_predicate make_batch_predicate "quiet::PyBatchPredicate::make_batch_predicate"(object obj) except +custom_handler
+    cdef batch_predicate make_values_batch_predicate "quiet::PyBatchPredicate::make_values_batch_predicate"(object obj) except +custom_handler
+    cdef batch_functor make_batch_functor "quiet::PyBatchFunctor::make_batch_functor"(object obj) except +custom_handler
+    cdef batch_functor make_values_batch_functor "quiet::PyBatchFunctor::make_values_batch_functor"(object obj) except +custom_handler
 
     # noinspection PyPep8Naming
     cdef cppclass PyStringInputIterator:
@@ -0,0 +1,34 @@
+cdef extern from "cpp_persistent_dict_queue/shardedpersistentdict.h" namespace "quiet" nogil:
+
+    ctypedef enum sharded_partitioning "quiet::ShardedPersistentDict::partitioning":
+        HASH_PARTITIONING "quiet::ShardedPersistentDict::HASH_PARTITIONING"
+        RANGE_PARTITIONING "quiet::ShardedPersistentDict::RANGE_PARTITIONING"
+
+    # noinspection PyPep8Naming
+    cppclass cppShardedIterator "quiet::ShardedPersistentDict::const_iterator":
+        cpp_bool has_reached_end()
+        size_t current_shard() except +custom_handler
+        CBString get_key() except +custom_handler
+        CBString get_value() except +custom_handler
+        pair[CBString, CBString] get_item() except +custom_handler
+        void next() except +custom_handler
+
+    # noinspection PyPep8Naming
+    cppclass cppShardedPersistentDict "quiet::ShardedPersistentDict":
+        CBString get_dbname()
+        sharded_partitioning get_partitioning()
+        size_t num_shards()
+        shared_ptr[cppPersistentDict] get_shard(size_t i) except +custom_handler
+        size_t shard_of(MDB_val key)
+        size_t size() except +custom_handler
+        cpp_bool empty() except +custom_handler
+        void clear() except +custom_handler
+        void insert(MDB_val k, MDB_val v) except +custom_handler
+        void insert(const vector[pair[CBString, CBString]]& kvs) except +custom_handler
+        CBString at(MDB_val k) except +custom_handler
+        cpp_bool contains(MDB_val k) except +custom_handler
+        cpp_bool erase(MDB_val k) except +custom_handler
+        size_t erase(const vector[CBString]& keys) except +custom_handler
+        shared_ptr[cppShardedIterator] make_iterator(const CBString& first_key, const CBString& last_key) except +custom_handler
+
+    shared_ptr[cppShardedPersistentDict] sharded_factory "quiet::ShardedPersistentDict::factory"(const vector[CBString]& directories, const CBString& database_name, const lmdb_options& options, sharded_partitioning p, const vector[CBString]& split_points) except +custom_handler
@@ -0,0 +1,22 @@
+cdef extern from "utils/single_flight.h" namespace "utils" nogil:
+    # noinspection PyPep8Naming
+    cppclass single_flight_ticket "utils::SingleFlight::ticket":
+        cpp_bool leader
+        uint64_t id
+        shared_future[CBString] result
+
+    cdef struct single_flight_stats "utils::SingleFlight::stats":
+        uint64_t leaders
+        uint64_t waiters
+        uint64_t failures
+        size_t in_flight
+
+    cppclass SingleFlight "utils::SingleFlight":
+        single_flight_ticket join(const CBString& key) except +custom_handler
+        single_flight_ticket try_lead(const CBString& key) except +custom_handler
+        void complete(const CBString& key, uint64_t id, const CBString& value) except +custom_handler
+        size_t fail(const CBString& key, uint64_t id) except +custom_handler
+        cpp_bool leave(uint64_t id)
+        single_flight_stats get_stats()
+
+    shared_ptr[SingleFlight] make_single_flight "utils::SingleFlight::factory"() except +custom_handler
@@ -0,0 +1,8 @@
+# -*- coding: utf-8 -*-
+
+cdef class PShardedDict(object):
+    cdef shared_ptr[cppShardedPersistentDict] ptr
+    cdef object temp_dirs
+
+    cpdef erase_many(self, keys)
+    cpdef shard_of(self, key)
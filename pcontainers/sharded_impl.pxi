@@ -0,0 +1,191 @@
+# -*- coding: utf-8 -*-
+
+# noinspection PyPep8Naming
+cdef class PShardedDict(object):
+    """
+    A persistent dict of bytes partitioned over several directories (one LMDB environment per shard), so that batch
+    writes to different shards are commited in parallel.
+
+    partitioning='hash' spreads the keys by a stable hash of the key; partitioning='range' needs len(dirnames) - 1
+    sorted split points, shard i holding the keys in [split_points[i - 1], split_points[i]). With a named database,
+    reopening a shard with another layout raises Incompatible.
+    """
+
+    def __cinit__(self, dirnames, bytes dbname=b'', LmdbOptions opts=None, partitioning='hash', split_points=None):
+        cdef vector[CBString] dirs
+        cdef vector[CBString] splits
+        cdef sharded_partitioning p
+        if opts is None:
+            opts = LmdbOptions()
+        if partitioning == 'hash':
+            p = HASH_PARTITIONING
+        elif partitioning == 'range':
+            p = RANGE_PARTITIONING
+        else:
+            raise ValueError("partitioning must be 'hash' or 'range'")
+        for dirname in dirnames:
+            dirs.push_back(tocbstring(dirname))
+        for split in (split_points or ()):
+            splits.push_back(tocbstring(split))
+        self.ptr = sharded_factory(dirs, tocbstring(dbname), (<LmdbOptions> opts).opts, p, splits)
+        self.temp_dirs = None
+
+    def __init__(self, dirnames, bytes dbname=b'', LmdbOptions opts=None, partitioning='hash', split_points=None):
+        pass
+
+    def __dealloc__(self):
+        if self.ptr.get():
+            with nogil:
+                self.ptr.reset()
+            if self.temp_dirs:
+                for dirname in self.temp_dirs:
+                    shutil.rmtree(dirname)
+                self.temp_dirs = None
+
+    def __repr__(self):
+        return u"PShardedDict(dbname='{}', dirnames={})".format(make_unicode(self.dbname), self.dirnames)
+
+    @classmethod
+    def make_temp(cls, num_shards, destroy=True, LmdbOptions opts=None, partitioning='hash', split_points=None):
+        cdef shared_ptr[TempDirectory] temp_dir_ptr
+        dirnames = []
+        for _ in range(num_shards):
+            temp_dir_ptr = make_temp_directory(True, False)
+            dirnames.append(topy(temp_dir_ptr.get().get_path()))
+        d = cls(dirnames, dbname=bytes(uuid.uuid1()), opts=opts, partitioning=partitioning, split_points=split_points)
+        if destroy:
+            (<PShardedDict> d).temp_dirs = dirnames
+        return d
+
+    property dbname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dbname())
+
+    property num_shards:
+        def __get__(self):
+            return self.ptr.get().num_shards()
+
+    property dirnames:
+        def __get__(self):
+            cdef size_t i
+            return [topy(self.ptr.get().get_shard(i).get().get_dirname()) for i in range(self.ptr.get().num_shards())]
+
+    property partitioning:
+        def __get__(self):
+            return 'hash' if self.ptr.get().get_partitioning() == HASH_PARTITIONING else 'range'
+
+    cpdef shard_of(self, key):
+        """
+        Return the index of the shard that holds key.
+        """
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        return self.ptr.get().shard_of(k)
+
+    def __len__(self):
+        cdef size_t n
+        with nogil:
+            n = self.ptr.get().size()
+        return n
+
+    def __contains__(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().contains(k)
+        return res
+
+    def __getitem__(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef CBString v
+        with nogil:
+            v = self.ptr.get().at(k)
+        return topy(v)
+
+    def get(self, key, default=None):
+        try:
+            return self[key]
+        except NotFound:
+            return default
+
+    def __setitem__(self, key, value):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        if key_view.length() == 0:
+            raise EmptyKey()
+        if key_view.length() > 511:
+            raise BadValSize("key is too long")
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef PyBufferWrap value_view = move(PyBufferWrap(value))
+        cdef MDB_val v = value_view.get_mdb_val()
+        with nogil:
+            self.ptr.get().insert(k, v)
+
+    def __delitem__(self, key):
+        cdef PyBufferWrap key_view = move(PyBufferWrap(key))
+        cdef MDB_val k = key_view.get_mdb_val()
+        cdef cpp_bool res
+        with nogil:
+            res = self.ptr.get().erase(k)
+        if not res:
+            raise NotFound()
+
+    def clear(self):
+        with nogil:
+            self.ptr.get().clear()
+
+    def update(self, e=None, **kwds):
+        """
+        Batch insertion: the items are grouped by shard, and the shards are written in parallel, one transaction each.
+        """
+        cdef vector[pair[CBString, CBString]] kvs
+        if e is not None:
+            if hasattr(e, 'keys'):
+                for key in e.keys():
+                    kvs.push_back(pair[CBString, CBString](tocbstring(key), tocbstring(e[key])))
+            else:
+                for key, value in e:
+                    kvs.push_back(pair[CBString, CBString](tocbstring(key), tocbstring(value)))
+        for key, value in kwds.items():
+            kvs.push_back(pair[CBString, CBString](tocbstring(key), tocbstring(value)))
+        with nogil:
+            self.ptr.get().insert(kvs)
+
+    cpdef erase_many(self, keys):
+        """
+        Batch deletion, in parallel over the shards. Return the number of deleted keys.
+        """
+        cdef vector[CBString] ks
+        cdef size_t n
+        for key in keys:
+            ks.push_back(tocbstring(key))
+        with nogil:
+            n = self.ptr.get().erase(ks)
+        return n
+
+    def iteritems(self, first=None, last=None):
+        """
+        Iterate in key order over the items of [first, last), merging the shards.
+        """
+        cdef shared_ptr[cppShardedIterator] it = self.ptr.get().make_iterator(
+            tocbstring(first or b''), tocbstring(last or b'')
+        )
+        cdef pair[CBString, CBString] item
+        while not it.get().has_reached_end():
+            item = it.get().get_item()
+            it.get().next()
+            yield topy(item.first), topy(item.second)
+
+    def iterkeys(self, first=None, last=None):
+        cdef shared_ptr[cppShardedIterator] it = self.ptr.get().make_iterator(
+            tocbstring(first or b''), tocbstring(last or b'')
+        )
+        cdef CBString key
+        while not it.get().has_reached_end():
+            key = it.get().get_key()
+            it.get().next()
+            yield topy(key)
+
+    def __iter__(self):
+        return self.iterkeys()
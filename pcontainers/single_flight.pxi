@@ -0,0 +1,8 @@
+# -*- coding: utf-8 -*-
+
+cdef class _SingleFlight(object):
+    cdef shared_ptr[SingleFlight] table
+    cdef dict errors
+    cdef lead(self, CBString key, uint64_t flight_id, compute)
+    cdef CBString wait(self, shared_future[CBString] result, uint64_t flight_id) except *
+    cdef refresh_in_background(self, CBString key, uint64_t flight_id, compute)
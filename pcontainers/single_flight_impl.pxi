@@ -0,0 +1,65 @@
+# -*- coding: utf-8 -*-
+
+_SINGLE_FLIGHT_LOGGER = logging.getLogger("pcontainers.single_flight")
+
+
+# noinspection PyPep8Naming
+cdef class _SingleFlight(object):
+    """
+    The in-flight computations of a dict, for get_or_compute (see utils/single_flight.h).
+
+    compute() returns the value for the caller and its serialized form, after it wrote it. The leader of a flight calls
+    it and completes the flight with the serialized value; the waiters get a copy. When compute() fails, its exception
+    is kept by flight id until the last waiter raised it too.
+    """
+    def __cinit__(self):
+        self.table = make_single_flight()
+        self.errors = {}
+
+    cdef lead(self, CBString key, uint64_t flight_id, compute):
+        cdef CBString raw
+        try:
+            result, serialized = compute()
+            raw = tocbstring(serialized)
+        except BaseException as ex:
+            # the waiters look the error up when they wake up
+            self.errors[flight_id] = ex
+            if self.table.get().fail(key, flight_id) == 0:
+                self.errors.pop(flight_id, None)
+            raise
+        with nogil:
+            self.table.get().complete(key, flight_id, raw)
+        return result
+
+    cdef CBString wait(self, shared_future[CBString] result, uint64_t flight_id) except *:
+        with nogil:
+            result.wait()
+        if result.has_exception():
+            error = self.errors.get(flight_id)
+            if self.table.get().leave(flight_id):
+                self.errors.pop(flight_id, None)
+            if error is None:
+                raise LmdbError("the computation of the value failed")
+            raise error
+        return result.get()
+
+    def _refresh(self, bytes key, uint64_t flight_id, compute):
+        try:
+            self.lead(tocbstring(key), flight_id, compute)
+        except Exception:
+            _SINGLE_FLIGHT_LOGGER.exception("the refresh of a stale value failed")
+
+    cdef refresh_in_background(self, CBString key, uint64_t flight_id, compute):
+        t = threading.Thread(target=self._refresh, args=(topy(key), flight_id, compute))
+        t.daemon = True
+        t.start()
+
+    property stats:
+        def __get__(self):
+            cdef single_flight_stats stats = self.table.get().get_stats()
+            return {
+                'leaders': stats.leaders,
+                'waiters': stats.waiters,
+                'failures': stats.failures,
+                'in_flight': stats.in_flight
+            }
@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/throw_exception.hpp>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "../lmdb_exceptions/lmdb_exceptions.h"
+#include "completion_queue.h"
+
+
+namespace utils {
+
+using lmdb::io_error;
+using lmdb::errinfo_errno;
+
+CompletionQueue::CompletionQueue(): completed(1024), signaled(false), read_fd(-1), write_fd(-1) {
+#ifdef __linux__
+    read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (read_fd == -1) {
+        BOOST_THROW_EXCEPTION(io_error() << errinfo_errno(errno));
+    }
+    write_fd = read_fd;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        BOOST_THROW_EXCEPTION(io_error() << errinfo_errno(errno));
+    }
+    read_fd = fds[0];
+    write_fd = fds[1];
+    for (int i = 0; i < 2; ++i) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+}
+
+CompletionQueue::~CompletionQueue() {
+    if (write_fd != read_fd) {
+        close(write_fd);
+    }
+    close(read_fd);
+}
+
+void CompletionQueue::signal() BOOST_NOEXCEPT_OR_NOTHROW {
+    uint64_t one = 1;
+    ssize_t res;
+    do {
+        res = write(write_fd, &one, sizeof(one));
+    } while (res == -1 && errno == EINTR);
+    // EAGAIN: the descriptor is already readable, which is all we need
+}
+
+void CompletionQueue::clear_signal() BOOST_NOEXCEPT_OR_NOTHROW {
+    uint64_t buf[16];
+    // an eventfd is reset by a single read, a pipe may hold several writes
+    while (read(read_fd, buf, sizeof(buf)) > 0) { }
+}
+
+void CompletionQueue::push(uint64_t token) BOOST_NOEXCEPT_OR_NOTHROW {
+    // push only fails when a node can not be allocated
+    while (!completed.push(token)) { }
+    // one write per wakeup of the loop, not one per completion
+    if (!signaled.exchange(true)) {
+        signal();
+    }
+}
+
+size_t CompletionQueue::drain(vector<uint64_t>& tokens, size_t max_tokens) {
+    clear_signal();
+    // a push that comes after this point signals again
+    signaled.store(false);
+    size_t n = 0;
+    uint64_t token;
+    while (n < max_tokens && completed.pop(token)) {
+        tokens.push_back(token);
+        ++n;
+    }
+    if (n == max_tokens && !completed.empty() && !signaled.exchange(true)) {
+        signal();
+    }
+    return n;
+}
+
+}   // END NS utils
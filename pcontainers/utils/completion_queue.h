@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/future.hpp>
+#include <stdint.h>
+
+namespace utils {
+
+using std::vector;
+using boost::shared_ptr;
+using boost::shared_future;
+using boost::enable_shared_from_this;
+
+// Collects the completions of boost futures for an event loop.
+//
+// watch() attaches a continuation to a future: when the future is ready, the thread that made it ready pushes the
+// token of the future into a lock-free queue and, if the loop was not signaled already, signals a file descriptor
+// (an eventfd on Linux, a pipe elsewhere). The loop waits for the descriptor to be readable, then drains the tokens
+// in batches. No GIL and no thread is involved on the producer side (continuations are synchronous, see
+// BOOST_THREAD_CONTINUATION_SYNC in setup.py).
+class CompletionQueue: public enable_shared_from_this<CompletionQueue>, private boost::noncopyable {
+private:
+    boost::lockfree::queue<uint64_t> completed;
+    boost::atomic_bool signaled;
+    int read_fd;
+    int write_fd;
+
+    CompletionQueue();      // can throw
+
+    void push(uint64_t token) BOOST_NOEXCEPT_OR_NOTHROW;
+    void signal() BOOST_NOEXCEPT_OR_NOTHROW;
+    void clear_signal() BOOST_NOEXCEPT_OR_NOTHROW;
+
+    template <typename T>
+    class notifier {
+    private:
+        shared_ptr<CompletionQueue> queue;
+        uint64_t token;
+    public:
+        typedef void result_type;
+        notifier(shared_ptr<CompletionQueue> q, uint64_t t): queue(q), token(t) { }
+        void operator()(shared_future<T>) const {
+            queue->push(token);
+        }
+    };
+
+public:
+    static shared_ptr<CompletionQueue> factory() {      // can throw
+        return shared_ptr<CompletionQueue>(new CompletionQueue());
+    }
+    ~CompletionQueue();
+
+    // the descriptor that becomes readable when tokens are available
+    int fileno() const { return read_fd; }
+
+    // token will be pushed when fut is ready (right away if it is ready already)
+    template <typename T>
+    void watch(shared_future<T> fut, uint64_t token) {      // can throw
+        fut.then(notifier<T>(shared_from_this(), token));
+    }
+
+    // moves at most max_tokens tokens to 'tokens' and returns their number. if some tokens are left, the descriptor
+    // stays readable.
+    size_t drain(vector<uint64_t>& tokens, size_t max_tokens);
+
+};  // END CLASS CompletionQueue
+
+}   // END NS utils
@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/throw_exception.hpp>
+#include "merge_operators.h"
+
+namespace utils {
+
+static long long cbstring_to_longlong(const CBString& s) {
+    if (s.length() == 0 || s.length() > 20) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("merge operand is not an integer"));
+    }
+    // CBString is always NUL terminated
+    const char* begin = (const char*) s.data;
+    char* end = NULL;
+    errno = 0;
+    long long result = strtoll(begin, &end, 10);
+    if (end != begin + s.length()) {
+        BOOST_THROW_EXCEPTION(std::invalid_argument("merge operand is not an integer"));
+    }
+    if (errno == ERANGE) {
+        BOOST_THROW_EXCEPTION(std::overflow_error("merge operand does not fit in 64 bits"));
+    }
+    return result;
+}
+
+CBString merge_int_add(const CBString& existing, const CBString& operand) {
+    long long x = cbstring_to_longlong(existing);
+    long long y = cbstring_to_longlong(operand);
+    if ((y > 0 && x > LLONG_MAX - y) || (y < 0 && x < LLONG_MIN - y)) {
+        BOOST_THROW_EXCEPTION(std::overflow_error("integer merge overflows 64 bits"));
+    }
+    return longlong_to_cbstring(x + y);
+}
+
+CBString merge_int_max(const CBString& existing, const CBString& operand) {
+    return cbstring_to_longlong(operand) > cbstring_to_longlong(existing) ? operand : existing;
+}
+
+CBString merge_int_min(const CBString& existing, const CBString& operand) {
+    return cbstring_to_longlong(operand) < cbstring_to_longlong(existing) ? operand : existing;
+}
+
+CBString merge_bytes_append(const CBString& existing, const CBString& operand) {
+    CBString result(existing);
+    result += operand;
+    return result;
+}
+
+vector<CBString> unpack_set(const CBString& packed) {
+    vector<CBString> members;
+    const unsigned char* p = (const unsigned char*) packed.data;
+    size_t remaining = packed.length();
+    while (remaining > 0) {
+        if (remaining < 4) {
+            BOOST_THROW_EXCEPTION(std::invalid_argument("malformed packed set"));
+        }
+        size_t l = (size_t(p[0]) << 24) | (size_t(p[1]) << 16) | (size_t(p[2]) << 8) | size_t(p[3]);
+        p += 4;
+        remaining -= 4;
+        if (l > remaining) {
+            BOOST_THROW_EXCEPTION(std::invalid_argument("malformed packed set"));
+        }
+        members.push_back(CBString(p, (int) l));
+        p += l;
+        remaining -= l;
+    }
+    return members;
+}
+
+CBString pack_set(const vector<CBString>& members) {
+    vector<CBString> sorted(members);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    CBString result;
+    for (vector<CBString>::const_iterator it(sorted.begin()); it != sorted.end(); ++it) {
+        size_t l = it->length();
+        unsigned char buf[4];
+        buf[0] = (unsigned char) (l >> 24);
+        buf[1] = (unsigned char) (l >> 16);
+        buf[2] = (unsigned char) (l >> 8);
+        buf[3] = (unsigned char) l;
+        result += CBString(buf, 4);
+        result += *it;
+    }
+    return result;
+}
+
+CBString merge_set_union(const CBString& existing, const CBString& operand) {
+    vector<CBString> members(unpack_set(existing));
+    vector<CBString> others(unpack_set(operand));
+    members.insert(members.end(), others.begin(), others.end());
+    return pack_set(members);
+}
+
+merge_operator merge_operator_by_name(const CBString& name) {
+    if (name == "add") {
+        return merge_operator(&merge_int_add);
+    }
+    if (name == "max") {
+        return merge_operator(&merge_int_max);
+    }
+    if (name == "min") {
+        return merge_operator(&merge_int_min);
+    }
+    if (name == "append") {
+        return merge_operator(&merge_bytes_append);
+    }
+    if (name == "union") {
+        return merge_operator(&merge_set_union);
+    }
+    BOOST_THROW_EXCEPTION(std::invalid_argument("unknown merge operator"));
+}
+
+}   // END NS utils
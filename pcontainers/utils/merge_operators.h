@@ -0,0 +1,29 @@
+#pragma once
+
+#include <bstrlib/bstrwrap.h>
+#include "utils.h"
+
+namespace utils {
+
+using Bstrlib::CBString;
+
+// A merge operator combines an existing value with an operand: result = merge(existing, operand).
+// Merge operators must be associative: consecutive operands are folded together before the existing value is known,
+// and an operand applied to a missing value is the operand itself.
+typedef binary_scalar_functor merge_operator;
+
+// integers are stored as signed 64 bits decimal strings
+CBString merge_int_add(const CBString& existing, const CBString& operand);         // can throw
+CBString merge_int_max(const CBString& existing, const CBString& operand);         // can throw
+CBString merge_int_min(const CBString& existing, const CBString& operand);         // can throw
+CBString merge_bytes_append(const CBString& existing, const CBString& operand);    // can throw
+
+// sets are stored as sorted unique members, each one prefixed by its length (4 bytes, big-endian)
+CBString merge_set_union(const CBString& existing, const CBString& operand);       // can throw
+vector<CBString> unpack_set(const CBString& packed);                                // can throw
+CBString pack_set(const vector<CBString>& members);                                 // can throw
+
+// "add", "max", "min", "append" or "union"
+merge_operator merge_operator_by_name(const CBString& name);                        // can throw
+
+}   // END NS utils
@@ -89,6 +89,11 @@ public:
         return expiry_posix_point;
     }
 
+    // not_a_date_time if the promise doesn't expire
+    ptime get_expiry_point() const BOOST_NOEXCEPT_OR_NOTHROW {
+        return expiry_posix_point;
+    }
+
 };
 
 
@@ -193,6 +193,123 @@ CBString PyFunctor::operator()(const CBString& key, const CBString& value) {
     return CBString(buffer, l);
 }
 
+PyBatchCallback::PyBatchCallback(PyObject* obj, bool only_values): callback(), values_only(only_values) {
+    if (obj) {
+        GilWrapper gil;
+        {
+            if (!PyCallable_Check(obj)) {
+                BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchCallback: obj is not a python callable") );
+            }
+            callback = PyNewRef(obj);
+            ++callback;
+        }
+    } else {
+        _LOG_DEBUG << "New trivial PyBatchCallback object";
+    }
+}
+
+PyNewRef PyBatchCallback::call(const items_batch& items) const {
+    // build a python list with the whole batch, then call python only once
+    PyNewRef py_items(PyList_New(items.size()));
+    if (!py_items) {
+        BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchCallback: PyList_New failed") );
+    }
+    for(size_t i = 0; i < items.size(); ++i) {
+        const CBString& key = items[i].first;
+        const CBString& value = items[i].second;
+        PyObject* py_item = NULL;
+        if (values_only) {
+            py_item = PyBytes_FromStringAndSize(value, value.length());
+        } else {
+            PyNewRef py_key(PyBytes_FromStringAndSize(key, key.length()));
+            PyNewRef py_value(PyBytes_FromStringAndSize(value, value.length()));
+            if (py_key && py_value) {
+                py_item = PyTuple_Pack(2, py_key.get(), py_value.get());
+            }
+        }
+        if (!py_item) {
+            BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchCallback: building the batch failed") );
+        }
+        PyList_SET_ITEM(py_items.get(), i, py_item);    // steals the reference
+    }
+    PyNewRef obj(PyObject_CallFunctionObjArgs(callback.get(), py_items.get(), NULL));
+    if (!obj) {
+        BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchCallback: Calling python callback failed") );
+    }
+    // the callback may return any sequence (list, tuple, bytes used as a bitmap...)
+    PyNewRef results(PySequence_Fast(obj.get(), "PyBatchCallback: the callback must return a sequence"));
+    if (!results) {
+        BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchCallback: the callback must return a sequence") );
+    }
+    if ((size_t) PySequence_Fast_GET_SIZE(results.get()) != items.size()) {
+        BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchCallback: the callback must return one result per item") );
+    }
+    return results;
+}
+
+vector<bool> PyBatchPredicate::operator()(const items_batch& items) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("This batch predicate is not initialized") );
+    }
+    vector<bool> results;
+    if (items.empty()) {
+        return results;
+    }
+    results.reserve(items.size());
+    GilWrapper gil;
+    {
+        PyNewRef py_results(call(items));
+        PyObject** py_results_items = PySequence_Fast_ITEMS(py_results.get());
+        for(size_t i = 0; i < items.size(); ++i) {
+            int res = PyObject_IsTrue(py_results_items[i]);
+            if (res == -1) {
+                BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchPredicate: Converting to bool failed") );
+            }
+            results.push_back((bool) res);
+        }
+    }
+    return results;
+}
+
+vector<CBString> PyBatchFunctor::operator()(const items_batch& items) {
+    if (!*this) {
+        BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("This batch functor is not initialized") );
+    }
+    vector<CBString> results;
+    if (items.empty()) {
+        return results;
+    }
+    results.reserve(items.size());
+    GilWrapper gil;
+    {
+        PyNewRef py_results(call(items));
+        PyObject** py_results_items = PySequence_Fast_ITEMS(py_results.get());
+        for(size_t i = 0; i < items.size(); ++i) {
+            PyNewRef obj(py_results_items[i]);
+            ++obj;
+            if (PyUnicode_Check(obj.get())) {
+                obj = PyNewRef(PyUnicode_AsUTF8String(obj.get()));
+                if (!obj) {
+                    BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchFunctor: converting result to UTF-8 failed :(") );
+                }
+            }
+            if (!PyBytes_Check(obj.get())) {
+                obj = PyNewRef(PyObject_Bytes(obj.get()));
+                if (!obj) {
+                    BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchFunctor: converting result to bytes failed :(") );
+                }
+            }
+            char* buffer = NULL;
+            Py_ssize_t l = 0;
+            if (PyBytes_AsStringAndSize(obj.get(), &buffer, &l) == -1) {
+                BOOST_THROW_EXCEPTION( runtime_error() << lmdb_error::what("PyBatchFunctor: converting result to C char* failed :(") );
+            }
+            results.push_back(CBString(buffer, l));
+        }
+    }
+    return results;
+}
+
 PyStringInputIterator::PyStringInputIterator(PyObject* obj): iterator(obj), finished(false), current_value("") {
     if (obj) {
         {
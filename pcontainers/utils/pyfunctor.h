@@ -2,6 +2,7 @@
 
 
 #include <utility>
+#include <vector>
 #include <boost/move/move.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/core/explicit_operator_bool.hpp>
@@ -18,6 +19,7 @@ namespace quiet {
 using namespace utils;
 using Bstrlib::CBString;
 using std::pair;
+using std::vector;
 
 
 class PyPredicate {
@@ -138,6 +140,83 @@ public:
 
 };
 
+class PyBatchCallback {
+protected:
+    PyNewRef callback;
+    bool values_only;
+
+    PyNewRef call(const items_batch& items) const;     // can throw, must be called with the GIL
+
+public:
+    BOOST_EXPLICIT_OPERATOR_BOOL_NOEXCEPT()
+    bool operator!() const BOOST_NOEXCEPT_OR_NOTHROW { return !bool(callback); }
+
+    PyBatchCallback() BOOST_NOEXCEPT_OR_NOTHROW: callback(), values_only(false) { }
+
+    // if only_values is true, the python callback receives a list of values, else a list of (key, value) tuples
+    PyBatchCallback(PyObject* obj, bool only_values);  // can throw
+
+    ~PyBatchCallback() {
+        if (callback) {
+            GilWrapper gil;
+            {
+                callback.reset();
+            }
+        }
+    }
+
+    PyBatchCallback(const PyBatchCallback& other) BOOST_NOEXCEPT_OR_NOTHROW: callback(), values_only(other.values_only) {
+        GilWrapper gil;
+        {
+            callback = other.callback;
+        }
+    }
+
+    PyBatchCallback& operator=(const PyBatchCallback& other) BOOST_NOEXCEPT_OR_NOTHROW {
+        if (callback != other.callback) {
+            GilWrapper gil;
+            {
+                callback = other.callback;
+            }
+        }
+        values_only = other.values_only;
+        return *this;
+    }
+
+};
+
+class PyBatchPredicate: public PyBatchCallback {
+public:
+    PyBatchPredicate() BOOST_NOEXCEPT_OR_NOTHROW: PyBatchCallback() { }
+    PyBatchPredicate(PyObject* obj, bool only_values): PyBatchCallback(obj, only_values) { }        // can throw
+
+    static inline batch_predicate make_batch_predicate(PyObject* obj) {                 // can throw
+        return batch_predicate(PyBatchPredicate(obj, false));
+    }
+
+    static inline batch_predicate make_values_batch_predicate(PyObject* obj) {          // can throw
+        return batch_predicate(PyBatchPredicate(obj, true));
+    }
+
+    vector<bool> operator()(const items_batch& items);                                  // can throw
+};
+
+class PyBatchFunctor: public PyBatchCallback {
+public:
+    PyBatchFunctor() BOOST_NOEXCEPT_OR_NOTHROW: PyBatchCallback() { }
+    PyBatchFunctor(PyObject* obj, bool only_values): PyBatchCallback(obj, only_values) { }          // can throw
+
+    static inline batch_functor make_batch_functor(PyObject* obj) {                     // can throw
+        return batch_functor(PyBatchFunctor(obj, false));
+    }
+
+    static inline batch_functor make_values_batch_functor(PyObject* obj) {              // can throw
+        return batch_functor(PyBatchFunctor(obj, true));
+    }
+
+    vector<CBString> operator()(const items_batch& items);                              // can throw
+};
+
 class PyStringInputIterator {
 private:
     BOOST_MOVABLE_BUT_NOT_COPYABLE(PyStringInputIterator)
@@ -0,0 +1,107 @@
+#include <stdexcept>
+#include <boost/thread/locks.hpp>
+#include <boost/exception_ptr.hpp>
+#include "single_flight.h"
+
+
+namespace utils {
+
+using boost::lock_guard;
+
+SingleFlight::ticket SingleFlight::start(const CBString& key) {
+    shared_ptr<flight> f(new flight(++last_id));
+    flights.insert(std::make_pair(key, f));
+    ++counters.leaders;
+    ticket t;
+    t.leader = true;
+    t.id = f->id;
+    t.result = f->result;
+    return t;
+}
+
+SingleFlight::ticket SingleFlight::join(const CBString& key) {
+    lock_guard<boost::mutex> guard(lock);
+    ticket t;
+    map<CBString, shared_ptr<flight> >::iterator it = flights.find(key);
+    if (it != flights.end()) {
+        ++it->second->waiters;
+        ++counters.waiters;
+        t.id = it->second->id;
+        t.result = it->second->result;
+        return t;
+    }
+    return start(key);
+}
+
+SingleFlight::ticket SingleFlight::try_lead(const CBString& key) {
+    lock_guard<boost::mutex> guard(lock);
+    ticket t;
+    if (flights.find(key) != flights.end()) {
+        return t;
+    }
+    return start(key);
+}
+
+shared_ptr<SingleFlight::flight> SingleFlight::take(const CBString& key, uint64_t id) {
+    map<CBString, shared_ptr<flight> >::iterator it = flights.find(key);
+    if (it == flights.end() || it->second->id != id) {
+        return shared_ptr<flight>();
+    }
+    shared_ptr<flight> f(it->second);
+    flights.erase(it);
+    return f;
+}
+
+void SingleFlight::complete(const CBString& key, uint64_t id, const CBString& value) {
+    shared_ptr<flight> f;
+    {
+        lock_guard<boost::mutex> guard(lock);
+        f = take(key, id);
+    }
+    // the continuations of the future run in this thread: not under the lock
+    if (f) {
+        f->promise.set_value(value);
+    }
+}
+
+size_t SingleFlight::fail(const CBString& key, uint64_t id) {
+    shared_ptr<flight> f;
+    size_t waiters = 0;
+    {
+        lock_guard<boost::mutex> guard(lock);
+        f = take(key, id);
+        if (!f) {
+            return 0;
+        }
+        ++counters.failures;
+        // no waiter can join anymore
+        waiters = f->waiters;
+        if (waiters) {
+            failed[id] = waiters;
+        }
+    }
+    f->promise.set_exception(boost::copy_exception(std::runtime_error("the computation of the value failed")));
+    return waiters;
+}
+
+bool SingleFlight::leave(uint64_t id) {
+    lock_guard<boost::mutex> guard(lock);
+    map<uint64_t, size_t>::iterator it = failed.find(id);
+    if (it == failed.end()) {
+        return false;
+    }
+    if (--it->second) {
+        return false;
+    }
+    failed.erase(it);
+    return true;
+}
+
+SingleFlight::stats SingleFlight::get_stats() const {
+    lock_guard<boost::mutex> guard(lock);
+    stats s(counters);
+    s.in_flight = flights.size();
+    return s;
+}
+
+}   // END NS utils
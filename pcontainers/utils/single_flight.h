@@ -0,0 +1,98 @@
+#pragma once
+
+#include <map>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/core/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/future.hpp>
+#include <bstrlib/bstrwrap.h>
+#include <stdint.h>
+
+namespace utils {
+
+using std::map;
+using boost::shared_ptr;
+using boost::shared_future;
+using boost::enable_shared_from_this;
+using Bstrlib::CBString;
+
+// A table of in-flight computations, one per key, for read-through loading.
+//
+// The first caller that misses a key joins the table as the leader of a flight: it computes the value, writes it and
+// completes the flight with the serialized value. The callers that miss the same key in the meantime join as waiters:
+// they get the shared future of the flight and wait for it, instead of computing the value again. Completing or
+// failing a flight removes it from the table, so the next miss starts a new one.
+//
+// When the leader fails, the future of the flight holds an exception. The table keeps counting the waiters of a
+// failed flight until they leave it, so that the caller can keep the original error around exactly as long as a
+// waiter may need it.
+class SingleFlight: public enable_shared_from_this<SingleFlight>, private boost::noncopyable {
+public:
+    struct ticket {
+        bool leader;
+        uint64_t id;
+        shared_future<CBString> result;
+        ticket(): leader(false), id(0), result() { }
+        // shared_future is copyable through the move emulation: the implicit assignment would take a non-const ticket
+        ticket(const ticket& other): leader(other.leader), id(other.id), result(other.result) { }
+        ticket& operator=(const ticket& other) {
+            leader = other.leader;
+            id = other.id;
+            result = other.result;
+            return *this;
+        }
+    };
+
+    struct stats {
+        uint64_t leaders;       // flights started
+        uint64_t waiters;       // misses that waited for a flight instead of computing
+        uint64_t failures;      // flights whose leader failed
+        size_t in_flight;
+        stats(): leaders(0), waiters(0), failures(0), in_flight(0) { }
+    };
+
+private:
+    struct flight {
+        uint64_t id;
+        boost::promise<CBString> promise;
+        shared_future<CBString> result;
+        size_t waiters;
+        explicit flight(uint64_t i): id(i), promise(), result(promise.get_future().share()), waiters(0) { }
+    };
+
+    mutable boost::mutex lock;
+    map<CBString, shared_ptr<flight> > flights;
+    map<uint64_t, size_t> failed;           // id -> waiters that did not leave the failed flight yet
+    uint64_t last_id;
+    stats counters;
+
+    SingleFlight(): lock(), flights(), failed(), last_id(0), counters() { }
+
+    // a new flight for key, under lock
+    ticket start(const CBString& key);
+    // removes the flight of key from the table, if it is still the flight 'id'
+    shared_ptr<flight> take(const CBString& key, uint64_t id);
+
+public:
+    static shared_ptr<SingleFlight> factory() {     // can throw
+        return shared_ptr<SingleFlight>(new SingleFlight());
+    }
+
+    // the leader of a new flight, or a waiter of the flight of key
+    ticket join(const CBString& key);                                   // can throw
+    // the leader of a new flight, unless key has a flight already (the ticket is then not a leader, and has no result)
+    ticket try_lead(const CBString& key);                               // can throw
+    // the leader of the flight 'id' wakes its waiters up with value
+    void complete(const CBString& key, uint64_t id, const CBString& value);     // can throw
+    // the leader of the flight 'id' failed: its waiters get an exception. returns their number
+    size_t fail(const CBString& key, uint64_t id);                      // can throw
+    // a waiter is done with the failed flight 'id'; true if it was the last one
+    bool leave(uint64_t id);
+
+    stats get_stats() const;
+
+};  // END CLASS SingleFlight
+
+}   // END NS utils
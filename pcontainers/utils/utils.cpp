@@ -35,6 +35,26 @@ CBString longlong_to_cbstring(long long i, int n) {
     return CBString(ss.str().c_str());
 }
 
+CBString uint64_to_cbstring_be(uint64_t i) {
+    unsigned char buf[8];
+    for(int j = 7; j >= 0; --j) {
+        buf[j] = (unsigned char) (i & 0xff);
+        i >>= 8;
+    }
+    return CBString(buf, 8);
+}
+
+uint64_t cbstring_be_to_uint64(MDB_val v) BOOST_NOEXCEPT_OR_NOTHROW {
+    // shorter buffers are read as if they were left-padded with zeros
+    uint64_t i = 0;
+    const unsigned char* buf = (const unsigned char*) v.mv_data;
+    size_t n = v.mv_size < 8 ? v.mv_size : 8;
+    for(size_t j = 0; j < n; ++j) {
+        i = (i << 8) | buf[j];
+    }
+    return i;
+}
+
 CBString cpp_realpath(const CBString& path) {
     char resolved_path[PATH_MAX + 1];
     char* res = realpath(path, resolved_path);
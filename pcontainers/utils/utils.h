@@ -1,18 +1,21 @@
 #pragma once
 
 #include <utility>
+#include <vector>
 #include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/core/noncopyable.hpp>
 #include <bstrlib/bstrwrap.h>
 #include <ftw.h>
+#include <string.h>
 #include "lmdb.h"
 
 namespace utils {
 
 using std::pair;
 using std::make_pair;
+using std::vector;
 using Bstrlib::CBString;
 
 
@@ -25,6 +28,11 @@ typedef boost::function < CBString (const CBString& x, const CBString& y) > bina
 typedef boost::function < pair<CBString, CBString> (const CBString& x, const CBString& y) > binary_functor;
 //typedef boost::function < CBString (boost::shared_future<CBString>&) > then_callback;
 
+// batched callbacks: called once per batch of (key, value) pairs, must return one result per pair
+typedef vector < pair<CBString, CBString> > items_batch;
+typedef boost::function < vector<bool> (const items_batch& items) > batch_predicate;
+typedef boost::function < vector<CBString> (const items_batch& items) > batch_functor;
+
 inline bool key_is_in_interval(const CBString& key, const CBString& first, const CBString& last) BOOST_NOEXCEPT_OR_NOTHROW {
     if (bool(first.length()) && (key < first)) {
         return false;
@@ -74,12 +82,36 @@ inline MDB_val make_mdb_val(const CBString& s) BOOST_NOEXCEPT_OR_NOTHROW {
     return m;
 }
 
+// LMDB default key order
+inline int compare_keys(MDB_val a, MDB_val b) BOOST_NOEXCEPT_OR_NOTHROW {
+    int r = memcmp(a.mv_data, b.mv_data, a.mv_size < b.mv_size ? a.mv_size : b.mv_size);
+    if (r != 0) {
+        return r;
+    }
+    return a.mv_size < b.mv_size ? -1 : (a.mv_size > b.mv_size ? 1 : 0);
+}
+
+// FNV-1a 64 bits: stable across processes and platforms, unlike boost::hash
+inline uint64_t fnv1a(const void* data, size_t n, uint64_t h=14695981039346656037ULL) BOOST_NOEXCEPT_OR_NOTHROW {
+    const unsigned char* p = (const unsigned char*) data;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
 inline CBString make_string(const MDB_val& m) {
     return CBString(m.mv_data, m.mv_size);          // can throw
 }
 
 CBString longlong_to_cbstring(long long i, int n=0);        // can throw
 
+// 8 bytes big-endian encoding: the lexicographic order of the encoded strings is the numeric order
+CBString uint64_to_cbstring_be(uint64_t i);                 // can throw
+uint64_t cbstring_be_to_uint64(MDB_val v) BOOST_NOEXCEPT_OR_NOTHROW;
+inline uint64_t cbstring_be_to_uint64(const CBString& s) BOOST_NOEXCEPT_OR_NOTHROW { return cbstring_be_to_uint64(make_mdb_val(s)); }
+
 CBString cpp_realpath(const CBString& path);                // can throw
 
 size_t my_copy(char *dst, const char *src, size_t siz) BOOST_NOEXCEPT_OR_NOTHROW;
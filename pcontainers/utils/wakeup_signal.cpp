@@ -0,0 +1,121 @@
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#include <boost/throw_exception.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "wakeup_signal.h"
+
+
+namespace utils {
+
+using boost::posix_time::time_duration;
+
+static ptime now() {
+    return boost::date_time::microsec_clock<ptime>::universal_time();
+}
+
+WakeupSignal::WakeupSignal(const std::string& filename): fd(-1), state(NULL) {
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        BOOST_THROW_EXCEPTION(std::runtime_error("can't open " + filename + ": " + strerror(errno)));
+    }
+    // a new file is filled with zeroes: sequence 0, no sleeper. growing a file that another process grew already
+    // doesn't touch its content
+    void* addr = MAP_FAILED;
+    if (::ftruncate(fd, sizeof(shared_state)) == 0) {
+        addr = ::mmap(NULL, sizeof(shared_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (addr == MAP_FAILED) {
+        int error = errno;
+        ::close(fd);
+        BOOST_THROW_EXCEPTION(std::runtime_error("can't map " + filename + ": " + strerror(error)));
+    }
+    state = static_cast<shared_state*>(addr);
+}
+
+WakeupSignal::~WakeupSignal() {
+    ::munmap(state, sizeof(shared_state));
+    ::close(fd);
+}
+
+uint32_t WakeupSignal::sequence() const {
+    return __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+}
+
+bool WakeupSignal::wait(uint32_t seen, const ptime& deadline) const {
+    // the producers advance the sequence, then read the sleepers: either they see this sleeper, or the sleep sees
+    // their sequence
+    __atomic_add_fetch(&state->sleepers, 1, __ATOMIC_SEQ_CST);
+    bool woken = sleep(seen, deadline);
+    __atomic_sub_fetch(&state->sleepers, 1, __ATOMIC_SEQ_CST);
+    return woken;
+}
+
+#ifdef __linux__
+
+bool WakeupSignal::sleep(uint32_t seen, const ptime& deadline) const {
+    while (true) {
+        if (__atomic_load_n(&state->sequence, __ATOMIC_SEQ_CST) != seen) {
+            return true;
+        }
+        struct timespec ts;
+        struct timespec* timeout = NULL;
+        if (!deadline.is_not_a_date_time()) {
+            time_duration left = deadline - now();
+            if (left.is_negative() || left.total_microseconds() == 0) {
+                return false;
+            }
+            ts.tv_sec = left.total_seconds();
+            ts.tv_nsec = (left.total_microseconds() % 1000000) * 1000;
+            timeout = &ts;
+        }
+        // not FUTEX_PRIVATE_FLAG: the futex is shared with the other processes that map the file.
+        // EAGAIN (the sequence moved already), EINTR and the wakeups are all checked by the next loop
+        if (::syscall(SYS_futex, &state->sequence, FUTEX_WAIT, seen, timeout, NULL, 0) == -1 && errno == ETIMEDOUT) {
+            return __atomic_load_n(&state->sequence, __ATOMIC_SEQ_CST) != seen;
+        }
+    }
+}
+
+void WakeupSignal::notify(uint32_t n) const {
+    __atomic_add_fetch(&state->sequence, 1, __ATOMIC_SEQ_CST);
+    if (n && __atomic_load_n(&state->sleepers, __ATOMIC_SEQ_CST)) {
+        ::syscall(SYS_futex, &state->sequence, FUTEX_WAKE, n > INT_MAX ? INT_MAX : (int) n, NULL, NULL, 0);
+    }
+}
+
+#else
+
+bool WakeupSignal::sleep(uint32_t seen, const ptime& deadline) const {
+    while (__atomic_load_n(&state->sequence, __ATOMIC_SEQ_CST) == seen) {
+        if (!deadline.is_not_a_date_time() && deadline <= now()) {
+            return false;
+        }
+        ::usleep(200);
+    }
+    return true;
+}
+
+void WakeupSignal::notify(uint32_t n) const {
+    (void) n;   // the sleepers all see the new sequence
+    __atomic_add_fetch(&state->sequence, 1, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+void WakeupSignal::notify_all() const {
+    notify(std::numeric_limits<uint32_t>::max());
+}
+
+}   // END NS utils
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <boost/core/noncopyable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <stdint.h>
+
+namespace utils {
+
+using boost::posix_time::ptime;
+
+// A wakeup channel between the processes that use the same queue: a sequence number and a count of sleepers, in a
+// small file mapped in shared memory.
+//
+// A consumer reads the sequence, looks at the queue, and sleeps until the sequence is not the one it read anymore: a
+// producer that commits between the look and the sleep makes the sleep return at once, so no wakeup is lost. A
+// producer advances the sequence after its commit and wakes up as many sleepers as it made elements available,
+// instead of all the consumers of all the processes. The producers make the wakeup call only when someone sleeps.
+//
+// On Linux the sleepers wait on a futex on the sequence. Elsewhere they poll the sequence in the shared memory (and
+// not the database).
+class WakeupSignal: private boost::noncopyable {
+private:
+    struct shared_state {
+        uint32_t sequence;
+        uint32_t sleepers;      // a process that dies sleeping leaves it too big: the producers then make useless calls
+    };
+
+    int fd;
+    shared_state* state;
+
+    // sleeps until the sequence is not 'seen' anymore, or until deadline
+    bool sleep(uint32_t seen, const ptime& deadline) const;
+
+public:
+    // opens (or creates) the file of the channel
+    explicit WakeupSignal(const std::string& filename);                         // can throw
+    ~WakeupSignal();
+
+    uint32_t sequence() const;
+
+    // waits until the sequence is not 'seen' anymore. false if the deadline passed first (not_a_date_time: no deadline)
+    bool wait(uint32_t seen, const ptime& deadline) const;
+    // advances the sequence and wakes up n sleepers
+    void notify(uint32_t n) const;
+    void notify_all() const;
+
+};  // END CLASS WakeupSignal
+
+}   // END NS utils
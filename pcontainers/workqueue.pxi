@@ -0,0 +1,21 @@
+# -*- coding: utf-8 -*-
+
+cdef class PRawWorkQueue(object):
+    cdef shared_ptr[cppPersistentWorkQueue] ptr
+    cdef readonly double reap_period
+    cdef Chain value_chain
+
+    cdef list _leased_to_list(self, vector[cppLeasedElement]& leased)
+    cpdef push(self, val)
+    cpdef lease(self, size_t n=?, visibility_timeout=?)
+    cpdef wait_and_lease(self, size_t n=?, visibility_timeout=?, timeout=?)
+    cpdef ack(self, ids)
+    cpdef release(self, ids)
+    cpdef reap(self, size_t max_leases=?)
+    cpdef pop_dead_letters(self, size_t n=?)
+    cpdef qsize(self)
+    cpdef empty(self)
+    cpdef clear(self)
+
+cdef class PWorkQueue(PRawWorkQueue):
+    pass
@@ -0,0 +1,225 @@
+# -*- coding: utf-8 -*-
+
+cdef inline uint64_t _visibility_ms(visibility_timeout) except *:
+    if not isinstance(visibility_timeout, Number):
+        raise TypeError()
+    if visibility_timeout <= 0:
+        raise ValueError("'visibility_timeout' must be a positive number")
+    return max(1, int(visibility_timeout * 1000))
+
+
+cdef inline vector[uint64_t] _lease_ids(ids) except *:
+    cdef vector[uint64_t] v
+    if isinstance(ids, Number):
+        v.push_back(ids)
+    else:
+        for i in ids:
+            v.push_back(i)
+    return v
+
+
+cdef class PRawWorkQueue(object):
+    """
+    A persistent queue whose consumers lease the items instead of popping them.
+
+    lease(n, visibility_timeout) takes up to n items out of the queue for visibility_timeout seconds and returns them as
+    (lease_id, attempts, value) tuples; ack(lease_ids) deletes them once they are processed. The items of a lease that
+    is not acknowledged in time are reaped: they go back to the front of the queue and are delivered again, unless they
+    were leased max_attempts times already (0: no limit); they then go to the dead letters (pop_dead_letters). The
+    reaping runs every reap_period seconds in a native thread (start_reaping / stop_reaping, also started by the
+    context manager), or when reap() is called.
+
+    Several consumers, in several processes, can lease from the same queue: a lease moves its items in one transaction.
+    """
+    def __cinit__(self, dirname, dbname, LmdbOptions opts=None, uint64_t max_attempts=5, double reap_period=1.0,
+                  Chain value_chain=None):
+        cdef CBString dirn = tocbstring(dirname)
+        cdef CBString dbn = tocbstring(dbname)
+        if dirn.length() == 0:
+            raise ValueError("empty dirname")
+        if reap_period <= 0:
+            raise ValueError("'reap_period' must be positive")
+        if opts is None:
+            opts = LmdbOptions()
+        self.ptr = work_queue_factory(dirn, dbn, (<LmdbOptions> opts).opts, max_attempts)
+        self.reap_period = reap_period
+        self.value_chain = NoneChain()
+
+    def __init__(self, dirname, dbname, LmdbOptions opts=None, uint64_t max_attempts=5, double reap_period=1.0,
+                 Chain value_chain=None):
+        pass
+
+    def __dealloc__(self):
+        with nogil:
+            self.ptr.reset()
+
+    def __repr__(self):
+        return u"{}(dbname='{}', dirname='{}')".format(
+            self.__class__.__name__, make_unicode(self.dbname), make_unicode(self.dirname)
+        )
+
+    def __enter__(self):
+        self.start_reaping()
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.stop_reaping()
+
+    property dirname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dirname())
+
+    property dbname:
+        def __get__(self):
+            return topy(self.ptr.get().get_dbname())
+
+    property max_attempts:
+        def __get__(self):
+            return self.ptr.get().get_max_attempts()
+
+        def __set__(self, uint64_t attempts):
+            self.ptr.get().set_max_attempts(attempts)
+
+    property reaped:
+        def __get__(self):
+            return self.ptr.get().get_reaped()
+
+    cdef list _leased_to_list(self, vector[cppLeasedElement]& leased):
+        cdef size_t i
+        loads = self.value_chain.loads
+        return [
+            (leased[i].id, leased[i].attempts, loads(make_mbufferio_from_cbstring(leased[i].value)))
+            for i in range(leased.size())
+        ]
+
+    cpdef push(self, val):
+        cdef PyBufferWrap view = move(PyBufferWrap(self.value_chain.dumps(val)))
+        with nogil:
+            self.ptr.get().push_back(view.get_mdb_val())
+
+    def push_many(self, vals):
+        cdef vector[CBString] values
+        for val in vals:
+            values.push_back(tocbstring(self.value_chain.dumps(val)))
+        with nogil:
+            self.ptr.get().push_back(values)
+
+    def put(self, item, block=True, timeout=None):
+        self.push(item)
+
+    cpdef lease(self, size_t n=1, visibility_timeout=30.0):
+        """
+        Lease up to n items for visibility_timeout seconds. Return a list of (lease_id, attempts, value), empty if the
+        queue is empty.
+        """
+        cdef uint64_t visibility_ms = _visibility_ms(visibility_timeout)
+        cdef vector[cppLeasedElement] leased
+        with nogil:
+            leased = self.ptr.get().lease(n, visibility_ms)
+        return self._leased_to_list(leased)
+
+    cpdef wait_and_lease(self, size_t n=1, visibility_timeout=30.0, timeout=None):
+        """
+        Wait until the queue has one item at least (at most timeout seconds, forever if timeout is None), then lease up
+        to n items like lease. Raise Empty after the timeout.
+        """
+        cdef uint64_t visibility_ms = _visibility_ms(visibility_timeout)
+        cdef vector[cppLeasedElement] leased
+        cdef milliseconds ms
+        if timeout is None:
+            with nogil:
+                leased = self.ptr.get().wait_and_lease(n, visibility_ms)
+            return self._leased_to_list(leased)
+
+        if not isinstance(timeout, Number):
+            raise TypeError()
+        if timeout < 0:
+            raise ValueError("'timeout' must be a non-negative number")
+        ms = milliseconds(<long> int(timeout * 1000))
+        try:
+            with nogil:
+                leased = self.ptr.get().wait_and_lease(n, visibility_ms, ms)
+        except EmptyDatabase:
+            raise Empty()
+        return self._leased_to_list(leased)
+
+    cpdef ack(self, ids):
+        """
+        Delete the leased items (a lease id or an iterable of lease ids) in one transaction. Return the number of
+        leases that were still in flight: an expired lease was reaped already, its item is delivered again.
+        """
+        cdef vector[uint64_t] v = _lease_ids(ids)
+        cdef size_t acked
+        with nogil:
+            acked = self.ptr.get().ack(v)
+        return acked
+
+    cpdef release(self, ids):
+        """
+        Give the leased items back to the front of the queue now, instead of waiting for the end of their lease.
+        Return their number.
+        """
+        cdef vector[uint64_t] v = _lease_ids(ids)
+        cdef size_t released
+        with nogil:
+            released = self.ptr.get().release(v)
+        return released
+
+    cpdef reap(self, size_t max_leases=0):
+        """
+        Handle the expired leases (at most max_leases, 0: all of them) in one transaction. Return their number.
+        """
+        cdef size_t reaped
+        with nogil:
+            reaped = self.ptr.get().reap(max_leases)
+        return reaped
+
+    def start_reaping(self, period=None):
+        """
+        Reap the expired leases every 'period' seconds (by default reap_period) in a native thread.
+        """
+        cdef uint64_t period_ms = max(1, int((self.reap_period if period is None else period) * 1000))
+        with nogil:
+            self.ptr.get().start_reaping(period_ms)
+
+    def stop_reaping(self):
+        with nogil:
+            self.ptr.get().stop_reaping()
+
+    property is_reaping:
+        def __get__(self):
+            return self.ptr.get().is_reaping()
+
+    cpdef pop_dead_letters(self, size_t n=1):
+        """
+        Remove up to n dead letters. Return a list of (lease_id, attempts, value), the oldest lease first.
+        """
+        cdef vector[cppLeasedElement] dead
+        with nogil:
+            dead = self.ptr.get().pop_dead(n)
+        return self._leased_to_list(dead)
+
+    cpdef qsize(self):
+        """
+        The number of items that wait for a lease.
+        """
+        return self.ptr.get().size()
+
+    cpdef empty(self):
+        return self.ptr.get().size() == 0
+
+    def inflight_size(self):
+        return self.ptr.get().inflight_size()
+
+    def dead_letter_size(self):
+        return self.ptr.get().dead_size()
+
+    cpdef clear(self):
+        with nogil:
+            self.ptr.get().clear()
+
+
+cdef class PWorkQueue(PRawWorkQueue):
+    def __cinit__(self, dirname, dbname, LmdbOptions opts=None, uint64_t max_attempts=5, double reap_period=1.0,
+                  Chain value_chain=None):
+        self.value_chain = value_chain if value_chain else Chain(PickleSerializer(), None, None)
@@ -42,16 +42,30 @@ pdict_sources = [
     'pcontainers/boost/thread.cpp',
     'pcontainers/boost/thread_clock.cpp',
     'pcontainers/boost/tss_null.cpp',
-    'pcontainers/lmdb/mdb.c',
+    'pcontainers/lmdb/mdb_fraction.c',
     'pcontainers/lmdb/midl.c',
     'pcontainers/cpp_persistent_dict_queue/persistentdict.cpp',
+    'pcontainers/cpp_persistent_dict_queue/read_cache.cpp',
+    'pcontainers/cpp_persistent_dict_queue/bloom_filter.cpp',
+    'pcontainers/cpp_persistent_dict_queue/evictor.cpp',
     'pcontainers/cpp_persistent_dict_queue/persistentqueue.cpp',
+    'pcontainers/cpp_persistent_dict_queue/persistentworkqueue.cpp',
+    'pcontainers/cpp_persistent_dict_queue/persistentpriorityqueue.cpp',
+    'pcontainers/cpp_persistent_dict_queue/persistentmultidict.cpp',
+    'pcontainers/cpp_persistent_dict_queue/expirypersistentdict.cpp',
+    'pcontainers/cpp_persistent_dict_queue/shardedpersistentdict.cpp',
+    'pcontainers/cpp_persistent_dict_queue/blobstore.cpp',
+    'pcontainers/cpp_persistent_dict_queue/reader_pool.cpp',
     'pcontainers/cpp_persistent_dict_queue/bufferedpersistentdict.cpp',
     'pcontainers/lmdb_environment/lmdb_environment.cpp',
     'pcontainers/logging/logging.cpp',
     'pcontainers/logging/pylogging.cpp',
     'pcontainers/utils/pyfunctor.cpp',
     'pcontainers/utils/utils.cpp',
+    'pcontainers/utils/merge_operators.cpp',
+    'pcontainers/utils/completion_queue.cpp',
+    'pcontainers/utils/single_flight.cpp',
+    'pcontainers/utils/wakeup_signal.cpp',
     'pcontainers/lmdb_exceptions/lmdb_exceptions.cpp',
     'pcontainers/includes/bstrlib/bstrlib.c',
     'pcontainers/includes/bstrlib/bstrwrap.cpp',
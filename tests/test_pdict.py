@@ -7,9 +7,11 @@ from __future__ import absolute_import
 
 import os
 import shutil
+import struct
 import pytest
 
 from pcontainers import PRawDict, NotFound, EmptyKey, set_logger, BadValSize, EmptyDatabase, LmdbError, PDict
+from pcontainers import NotInitialized, PRawMultiDict, PBlobStore, PShardedDict, Incompatible, PRawExpiryDict, ExpiryDict
 from pcontainers import LmdbOptions
 from pcontainers import Chain
 from pcontainers import PickleSerializer, JsonSerializer, MessagePackSerializer, NoneSerializer
@@ -421,6 +423,271 @@ class TestPRawDict(object):
         init_temp_raw_dict.transform_values(f)
         assert(dict(init_temp_raw_dict) == transformed_content)
 
+    def test_remove_if_batch(self, init_temp_raw_dict):
+        batches = []
+
+        def pred(items):
+            batches.append(len(items))
+            return [int(key) % 2 == 0 for key, val in items]
+
+        init_temp_raw_dict.remove_if_batch(pred, batch_size=4)
+        assert(batches == [4, 2])
+        assert(init_temp_raw_dict.noiterkeys() == [b'1', b'7', b'9'])
+
+    def test_transform_values_batch(self, init_temp_raw_dict):
+        f = lambda key, val: key + val
+        initial_content = dict(init_temp_raw_dict)
+        transformed_content = {key: f(key, val) for key, val in initial_content.items()}
+        init_temp_raw_dict.transform_values_batch(lambda items: [f(key, val) for key, val in items], batch_size=4)
+        assert(dict(init_temp_raw_dict) == transformed_content)
+
+    def test_count_if_batch(self, init_temp_raw_dict):
+        assert(init_temp_raw_dict.count_if_batch(lambda items: [int(key) > 3 for key, val in items], batch_size=4) == 4)
+        assert(init_temp_raw_dict.count_if_batch(lambda items: [True] * len(items), first=b'2', last=b'8') == 3)
+
+    def test_count_interval(self, init_temp_raw_dict):
+        assert(init_temp_raw_dict.count_interval() == 6)
+        assert(init_temp_raw_dict.count_interval(first=b'2', last=b'8') == 3)
+        assert(init_temp_raw_dict.count_interval(first=b'3') == 4)
+        assert(init_temp_raw_dict.count_interval(last=b'3') == 2)
+        assert(init_temp_raw_dict.count_interval(first=b'8', last=b'2') == 0)
+        assert(init_temp_raw_dict.estimate_count(first=b'2', last=b'8') == (3, 3, 3))
+
+    def test_estimate_count(self, temp_raw_dict):
+        temp_raw_dict.update({b'%06d' % i: b'x' * 20 for i in range(50000)})
+        for first, last in [(None, None), (b'010000', b'030000'), (b'025000', None), (None, b'000100')]:
+            exact = temp_raw_dict.count_interval(first, last)
+            estimate, low, high = temp_raw_dict.estimate_count(first, last)
+            assert(low <= exact <= high)
+            assert(low <= estimate <= high)
+        assert(temp_raw_dict.count_interval(b'010000', b'030000') == 20000)
+        assert(temp_raw_dict.count_interval(b'025000') == 25000)
+
+    def test_compare_and_swap(self, init_temp_raw_dict):
+        assert(not init_temp_raw_dict.compare_and_swap(b'1', b'bar2', b'foo'))
+        assert(init_temp_raw_dict[b'1'] == b'bar1')
+        assert(init_temp_raw_dict.compare_and_swap(b'1', b'bar1', b'foo'))
+        assert(init_temp_raw_dict[b'1'] == b'foo')
+        assert(not init_temp_raw_dict.compare_and_swap(b'3', b'bar3', b'foo'))
+        assert(b'3' not in init_temp_raw_dict)
+
+    def test_insert_if_absent_replace_if_present(self, init_temp_raw_dict):
+        assert(not init_temp_raw_dict.insert_if_absent(b'1', b'foo'))
+        assert(init_temp_raw_dict.insert_if_absent(b'3', b'bar3'))
+        assert(init_temp_raw_dict[b'1'] == b'bar1')
+        assert(init_temp_raw_dict[b'3'] == b'bar3')
+        assert(not init_temp_raw_dict.replace_if_present(b'5', b'bar5'))
+        assert(init_temp_raw_dict.replace_if_present(b'3', b'foo'))
+        assert(b'5' not in init_temp_raw_dict)
+        assert(init_temp_raw_dict[b'3'] == b'foo')
+
+    def test_versioned_writes(self, temp_raw_dict):
+        assert(temp_raw_dict.get_version(b'foo') == 0)
+        assert(temp_raw_dict.set_versioned(b'foo', b'bar', 0) == 1)
+        assert(temp_raw_dict.set_versioned(b'foo', b'zog', 0) == 0)
+        assert(temp_raw_dict.get_versioned(b'foo') == (1, b'bar'))
+        assert(temp_raw_dict.set_versioned(b'foo', b'zog', 1) == 2)
+        assert(temp_raw_dict[b'foo'] == b'zog')
+        assert(temp_raw_dict.del_versioned(b'foo', 1) == 0)
+        assert(temp_raw_dict.del_versioned(b'foo', 2) == 3)
+        assert(b'foo' not in temp_raw_dict)
+        assert(temp_raw_dict.get_version(b'foo') == 3)
+        assert(len(temp_raw_dict) == 0)
+
+    def test_change_feed(self, temp_raw_dict):
+        temp_raw_dict[b'before'] = b'x'
+        assert(temp_raw_dict.changes_since(0) == [])
+        temp_raw_dict.enable_change_feed()
+        assert(temp_raw_dict.change_feed_enabled)
+        temp_raw_dict[b'foo'] = b'bar'
+        temp_raw_dict[b'zog'] = b'bar'
+        del temp_raw_dict[b'foo']
+        temp_raw_dict.transform_values(lambda key, value: value + b'!')
+        assert(temp_raw_dict.changes_since(0) == [
+            (1, 'set', b'foo'), (2, 'set', b'zog'), (3, 'del', b'foo'), (4, 'set', b'before'), (5, 'set', b'zog')
+        ])
+        assert(temp_raw_dict.changes_since(3, limit=1) == [(4, 'set', b'before')])
+        # the feed is recorded by the other dicts opened on the same database
+        other = PRawDict(temp_raw_dict.dirname, temp_raw_dict.dbname)
+        assert(other.change_feed_enabled)
+        other.clear()
+        assert(temp_raw_dict.last_change() == 6)
+        assert(temp_raw_dict.changes_since(5) == [(6, 'clear', None)])
+        assert(temp_raw_dict.truncate_changes(5) == 4)
+        assert([c[0] for c in temp_raw_dict.changes_since(0)] == [5, 6])
+        assert(temp_raw_dict.truncate_changes(100) == 1)
+        temp_raw_dict[b'foo'] = b'bar'
+        assert(temp_raw_dict.changes_since(0) == [(6, 'clear', None), (7, 'set', b'foo')])
+
+    def test_change_feed_wait(self, temp_raw_dict):
+        import threading
+        temp_raw_dict.enable_change_feed()
+        assert(temp_raw_dict.wait_changes(0, timeout=0.05) == 0)
+        writer = threading.Timer(0.1, temp_raw_dict.__setitem__, (b'foo', b'bar'))
+        writer.start()
+        assert(temp_raw_dict.wait_changes(0, timeout=10) == 1)
+        writer.join()
+
+    def test_read_cache(self, temp_raw_dict):
+        for i in range(10):
+            temp_raw_dict[('key%d' % i).encode('ascii')] = b'value'
+        temp_raw_dict.enable_read_cache(4)
+        assert(temp_raw_dict[b'key1'] == b'value')
+        assert(temp_raw_dict[b'key1'] == b'value')
+        assert(temp_raw_dict[b'key2'] == b'value')
+        stats = temp_raw_dict.read_cache_stats()
+        assert((stats['hits'], stats['misses'], stats['size'], stats['capacity']) == (1, 2, 2, 4))
+        # a local write only invalidates its key
+        temp_raw_dict[b'key1'] = b'new'
+        assert(temp_raw_dict[b'key2'] == b'value')
+        assert(temp_raw_dict[b'key1'] == b'new')
+        stats = temp_raw_dict.read_cache_stats()
+        assert((stats['hits'], stats['invalidations'], stats['flushes']) == (2, 1, 0))
+        # bounded by the capacity
+        for i in range(10):
+            temp_raw_dict.get(('key%d' % i).encode('ascii'))
+        assert(temp_raw_dict.read_cache_stats()['size'] == 4)
+        assert(temp_raw_dict.read_cache_stats()['evictions'] > 0)
+        # the writes of another dict (another process) are seen
+        other = PRawDict(temp_raw_dict.dirname, temp_raw_dict.dbname)
+        other[b'key9'] = b'other'
+        assert(temp_raw_dict[b'key9'] == b'other')
+        assert(temp_raw_dict.read_cache_stats()['flushes'] == 1)
+        temp_raw_dict.clear()
+        with pytest.raises(NotFound):
+            temp_raw_dict[b'key9']
+        temp_raw_dict.enable_read_cache(0)
+        assert(temp_raw_dict.read_cache_stats()['capacity'] == 0)
+
+    def test_eviction_lru(self, temp_raw_dict):
+        for i in range(10):
+            temp_raw_dict[('key%d' % i).encode('ascii')] = b'value'
+        # the entries written before are tracked as the least recently used ones, in key order
+        temp_raw_dict.enable_eviction(max_entries=8)
+        assert(temp_raw_dict[b'key0'] == b'value')
+        temp_raw_dict[b'new'] = b'value'
+        assert(len(temp_raw_dict) == 8)
+        assert(sorted(temp_raw_dict.keys()) == [b'key0'] + [('key%d' % i).encode('ascii') for i in range(4, 10)] + [b'new'])
+        stats = temp_raw_dict.eviction_stats()
+        assert((stats['evictions'], stats['batches'], stats['entries'], stats['policy']) == (3, 1, 8, 'lru'))
+        assert(stats['accesses'] == 1)
+        # the deletions and the evictions keep the size up to date
+        del temp_raw_dict[b'new']
+        assert(temp_raw_dict.eviction_stats()['bytes'] == 7 * len(b'key0value'))
+        temp_raw_dict.enable_eviction(max_entries=0, max_bytes=100)
+        temp_raw_dict[b'big'] = b'x' * 50
+        stats = temp_raw_dict.eviction_stats()
+        assert(stats['bytes'] <= 100)
+        assert(b'big' in temp_raw_dict)
+        with pytest.raises(ValueError):
+            temp_raw_dict.enable_eviction(max_entries=8, policy='lfu')
+        temp_raw_dict.clear()
+        assert(temp_raw_dict.eviction_stats()['bytes'] == 0)
+
+    def test_eviction_lfu(self, temp_raw_dict):
+        temp_raw_dict.enable_eviction(max_entries=4, policy='lfu')
+        temp_raw_dict.update({b'a': b'1', b'b': b'2', b'c': b'3', b'd': b'4'})
+        for key in (b'a', b'a', b'b', b'd'):
+            assert(temp_raw_dict.get(key))
+        temp_raw_dict[b'e'] = b'5'
+        assert(sorted(temp_raw_dict.keys()) == [b'a', b'b', b'd', b'e'])
+        assert(temp_raw_dict.eviction_stats()['evictions'] == 1)
+
+    def test_get_or_compute(self, temp_raw_dict):
+        import threading
+        import time
+        calls = []
+
+        def loader(key):
+            calls.append(key)
+            time.sleep(0.2)
+            return b'computed ' + key
+
+        results = []
+        threads = [threading.Thread(target=lambda: results.append(temp_raw_dict.get_or_compute(b'foo', loader)))
+                   for _ in range(8)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        # one computation, one write, the same value for everybody
+        assert(calls == [b'foo'])
+        assert(results == [b'computed foo'] * 8)
+        assert(temp_raw_dict[b'foo'] == b'computed foo')
+        stats = temp_raw_dict.flight_stats
+        assert(stats['leaders'] + stats['waiters'] <= 8 and stats['in_flight'] == 0)
+        assert(temp_raw_dict.get_or_compute(b'foo', loader) == b'computed foo')
+        assert(len(calls) == 1)
+
+        def failing(key):
+            time.sleep(0.2)
+            raise ZeroDivisionError(key)
+
+        errors = []
+
+        def get():
+            try:
+                temp_raw_dict.get_or_compute(b'bar', failing)
+            except ZeroDivisionError as ex:
+                errors.append(ex)
+
+        threads = [threading.Thread(target=get) for _ in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert(len(errors) == 4)
+        assert(b'bar' not in temp_raw_dict)
+        assert(temp_raw_dict.flight_stats['failures'] == 1)
+
+    def test_read_cache_objects(self):
+        d = PDict.make_temp()
+        d['foo'] = [1, 2]
+        d.enable_read_cache(10)
+        first = d['foo']
+        assert(d['foo'] is first)
+        d['foo'] = [3]
+        assert(d['foo'] == [3])
+        assert(d.get('nope') is None)
+
+    def test_bloom_filter(self, temp_raw_dict):
+        import time
+
+        def wait_rebuilds(d, n):
+            deadline = time.time() + 10
+            while d.bloom_filter_stats()['rebuilds'] < n and time.time() < deadline:
+                time.sleep(0.01)
+            return d.bloom_filter_stats()
+
+        for i in range(100):
+            temp_raw_dict[('key%d' % i).encode('ascii')] = b'value'
+        d = PRawDict(temp_raw_dict.dirname, temp_raw_dict.dbname)
+        d.enable_bloom_filter()
+        assert(wait_rebuilds(d, 1)['ready'])
+        assert(b'nope' not in d)
+        assert(d.get(b'nope') == b'')
+        with pytest.raises(NotFound):
+            d[b'nope']
+        assert(d.bloom_filter_stats()['negatives'] == 3)
+        assert(b'key42' in d)
+        d[b'new'] = b'value'
+        assert(b'new' in d)
+        # a write by another dict (another process) is seen at once, the filter is rebuilt in the background
+        temp_raw_dict[b'other'] = b'value'
+        assert(d[b'other'] == b'value')
+        assert(wait_rebuilds(d, 2)['rebuilds'] == 2)
+        assert(b'nope' not in d)
+        # the filter is saved when the dict is closed, and reused if nothing changed in between
+        dirname, dbname = d.dirname, d.dbname
+        del d
+        assert(os.path.exists(os.path.join(dirname, dbname + b'.bloom')))
+        d = PRawDict(dirname, dbname)
+        d.enable_bloom_filter()
+        stats = d.bloom_filter_stats()
+        assert(stats['ready'] and stats['rebuilds'] == 0)
+        assert(b'nope' not in d)
+        assert(b'other' in d)
+
     def test_empty_remove_duplicates(self, temp_raw_dict):
         temp_raw_dict.remove_duplicates()
         assert(len(temp_raw_dict) == 0)
@@ -447,6 +714,25 @@ class TestPRawDict(object):
         assert(init_temp_raw_dict[b'foo'] == b'bar')
         assert (init_temp_raw_dict[b'foo2'] == b'bar2')
 
+    def test_sync_to(self, init_temp_raw_dict):
+        other = PRawDict.make_temp()
+        assert(init_temp_raw_dict.sync_to(other) == {'inserted': 6, 'updated': 0, 'deleted': 0, 'unchanged': 0})
+        assert(dict(other.noiteritems()) == dict(init_temp_raw_dict.noiteritems()))
+        other[b'1'] = b'changed'
+        other[b'3'] = b'extra'
+        other[b'99'] = b'extra'
+        del other[b'7']
+        summary = init_temp_raw_dict.sync_to(other, chunk_size=2)
+        assert(summary == {'inserted': 1, 'updated': 1, 'deleted': 0, 'unchanged': 4})
+        assert(other[b'3'] == b'extra')
+        summary = init_temp_raw_dict.sync_to(other, first=b'2', last=b'8', delete=True)
+        assert(summary == {'inserted': 0, 'updated': 0, 'deleted': 1, 'unchanged': 3})
+        assert(b'3' not in other)
+        assert(other[b'99'] == b'extra')
+        summary = init_temp_raw_dict.sync_to(other, delete=True, chunk_size=1)
+        assert(summary == {'inserted': 0, 'updated': 0, 'deleted': 1, 'unchanged': 6})
+        assert(dict(other.noiteritems()) == dict(init_temp_raw_dict.noiteritems()))
+
     def test_move_to(self, init_temp_raw_dict):
         other = PRawDict.make_temp()
         other['foo'] = 'bar'
@@ -456,6 +742,47 @@ class TestPRawDict(object):
         assert(len(other) == (l + 1))
         assert(other['foo'] == b'bar')
 
+    def test_iter_batches(self, temp_raw_dict):
+        for i in range(2500):
+            temp_raw_dict[b'%05d' % i] = b'v%d' % i
+        batches = list(temp_raw_dict.iter_batches(1000))
+        assert [len(batch) for batch in batches] == [1000, 1000, 500]
+        assert sum(batches, []) == list(temp_raw_dict.items())
+        assert sum(temp_raw_dict.iter_batches(7, what='keys'), []) == list(temp_raw_dict.keys())
+        assert sum(temp_raw_dict.iter_batches(7, what='values', reverse=True), []) == list(temp_raw_dict.values(reverse=True))
+        keys = sum(temp_raw_dict.iter_batches(100, start=b'00100', stop=b'00150', what='keys'), [])
+        assert keys == [b'%05d' % i for i in range(100, 150)]
+        keys = sum(temp_raw_dict.iter_batches(3, start=b'00100', stop=b'00150', reverse=True, what='keys'), [])
+        assert keys == [b'%05d' % i for i in reversed(range(100, 150))]
+        assert list(temp_raw_dict.iter_batches(10, start=b'z')) == []
+        data, offsets = next(temp_raw_dict.iter_batches(2, contiguous=True))
+        assert data == b'00000v000001v1'
+        assert list(offsets) == [5, 7, 12, 14]
+        with pytest.raises(ValueError):
+            next(temp_raw_dict.iter_batches(0))
+
+    def test_export_columns(self, temp_raw_dict):
+        for i in range(1000):
+            temp_raw_dict[b'%05d' % i] = struct.pack('<q', i * 3)
+        keys, values = temp_raw_dict.export_columns(value_format='<q')
+        assert len(keys) == len(values) == 1000
+        assert keys.width == 0 and values.width == 8
+        assert list(keys) == list(temp_raw_dict.keys())
+        assert keys.offsets.tolist() == list(range(0, 5001, 5))
+        assert keys.data.tobytes() == b''.join(temp_raw_dict.keys())
+        assert keys.offsets is not None and values.offsets is None
+        assert memoryview(values).format == '<q'
+        assert list(struct.unpack('<1000q', memoryview(values).tobytes())) == [i * 3 for i in range(1000)]
+        assert values[-1] == struct.pack('<q', 2997)
+        keys = temp_raw_dict.export_columns(start=b'00100', stop=b'00103', reverse=True, what='keys')
+        assert list(keys) == [b'00102', b'00101', b'00100']
+        assert keys.offsets.tolist() == [0, 5, 10, 15]
+        assert len(temp_raw_dict.export_columns(start=b'z', what='values')) == 0
+        with pytest.raises(BufferError):
+            memoryview(keys)
+        with pytest.raises(ValueError):
+            temp_raw_dict.export_columns(what='keys', key_format='i')
+
 
 # noinspection PyCompatibility
 class TestSimplePDict(object):
@@ -723,6 +1050,20 @@ class TestSimplePDict(object):
         init_temp_dict.transform_values(f)
         assert (dict(init_temp_dict) == transformed_content)
 
+    def test_remove_if_batch(self, init_temp_dict):
+        init_temp_dict[b'10'] = u'zog'
+        init_temp_dict[b'john'] = u'doh'
+        init_temp_dict.remove_if_batch(lambda items: [val.startswith(u"z") for key, val in items], batch_size=3)
+        assert (b'10' not in init_temp_dict)
+        assert (init_temp_dict[b'john'] == u'doh')
+        assert (len(init_temp_dict) == 7)
+
+    def test_transform_values_batch(self, init_temp_dict):
+        initial_content = dict(init_temp_dict)
+        transformed_content = {key: val.upper() for key, val in initial_content.items()}
+        init_temp_dict.transform_values_batch(lambda items: [val.upper() for key, val in items], batch_size=4)
+        assert (dict(init_temp_dict) == transformed_content)
+
     def test_empty_remove_duplicates(self, temp_dict):
         assert (len(temp_dict) == 0)
         temp_dict.remove_duplicates()
@@ -764,6 +1105,12 @@ class TestSimplePDict(object):
 # noinspection PyCompatibility
 class TestPDict(object):
 
+    def test_iter_batches(self, temp_all_dict):
+        for i in range(300):
+            temp_all_dict[u'key%d' % i] = u'value%d' % i
+        assert sum(temp_all_dict.iter_batches(64), []) == list(temp_all_dict.items())
+        assert sum(temp_all_dict.iter_batches(64, what='keys', reverse=True), []) == list(temp_all_dict.keys(reverse=True))
+
     def test_getitem_with_empty_dict(self, temp_all_dict):
         with pytest.raises(NotFound):
             val = temp_all_dict[u'foo']
@@ -1033,3 +1380,943 @@ class TestPDict(object):
         assert (len(init_temp_all_dict) == 0)
         assert (len(other) == (l + 1))
         assert (other[u'foo'] == u'bar')
+
+
+class TestBufferedPDict(object):
+    def test_merge_add(self, temp_raw_dict):
+        from pcontainers._pdict import BufferedPDictWrapper
+        temp_raw_dict[b'counter'] = b'10'
+        buffered = BufferedPDictWrapper(temp_raw_dict, 3600, merge_operator='add')
+        futures = [buffered.async_merge(b'counter', 1) for _ in range(5)]
+        futures.append(buffered.async_merge(b'new', -3))
+        # not flushed yet, but readers see the merged values
+        assert bytes(buffered.getitem(b'counter')) == b'15'
+        assert bytes(buffered.getitem(b'new')) == b'-3'
+        assert temp_raw_dict[b'counter'] == b'10'
+        del buffered
+        assert all(f.result() for f in futures)
+        assert temp_raw_dict[b'counter'] == b'15'
+        assert temp_raw_dict[b'new'] == b'-3'
+
+    def test_merge_after_insert_and_delete(self, temp_raw_dict):
+        from pcontainers._pdict import BufferedPDictWrapper
+        temp_raw_dict[b'a'] = b'foo'
+        temp_raw_dict[b'b'] = b'foo'
+        buffered = BufferedPDictWrapper(temp_raw_dict, 3600, merge_operator='append')
+        buffered.async_merge(b'a', b'bar')
+        superseded = buffered.async_merge(b'b', b'bar')
+        buffered.async_setitem(b'b', b'zog')
+        buffered.async_merge(b'b', b'!')
+        buffered.async_delitem(b'a')
+        buffered.async_merge(b'a', b'new')
+        assert bytes(buffered.getitem(b'a')) == b'new'
+        assert bytes(buffered.getitem(b'b')) == b'zog!'
+        del buffered
+        assert not superseded.result()
+        assert temp_raw_dict[b'a'] == b'new'
+        assert temp_raw_dict[b'b'] == b'zog!'
+
+    def test_merge_bad_stored_value(self, temp_raw_dict):
+        from pcontainers._pdict import BufferedPDictWrapper
+        temp_raw_dict[b'counter'] = b'not a number'
+        temp_raw_dict[b'gone'] = b'x'
+        buffered = BufferedPDictWrapper(temp_raw_dict, 3600, merge_operator='add')
+        failed = [buffered.async_merge(b'counter', 1), buffered.async_merge(b'counter', 2)]
+        others = [buffered.async_merge(b'other', 5), buffered.async_setitem(b'k', b'v'), buffered.async_delitem(b'gone')]
+        del buffered
+        # only the merges of the key with the bad value fail, the rest of the batch is commited
+        for f in failed:
+            with pytest.raises(ValueError):
+                f.result()
+        assert all(f.result() for f in others)
+        assert temp_raw_dict[b'counter'] == b'not a number'
+        assert temp_raw_dict[b'other'] == b'5'
+        assert temp_raw_dict[b'k'] == b'v'
+        assert b'gone' not in temp_raw_dict
+
+    def test_merge_max_min_union(self, temp_raw_dict):
+        from pcontainers._pdict import BufferedPDictWrapper, unpack_merged_set
+        for name, operands, expected in [('max', [3, 7, 5], b'7'), ('min', [3, 7, 5], b'3')]:
+            buffered = BufferedPDictWrapper(temp_raw_dict, 3600, merge_operator=name)
+            for operand in operands:
+                buffered.async_merge(name, operand)
+            del buffered
+            assert temp_raw_dict[name] == expected
+        buffered = BufferedPDictWrapper(temp_raw_dict, 3600, merge_operator='union')
+        buffered.async_merge(b'tags', {b'x', b'y'})
+        buffered.async_merge(b'tags', {b'y', b'z'})
+        assert unpack_merged_set(bytes(buffered.getitem(b'tags'))) == {b'x', b'y', b'z'}
+        del buffered
+        assert unpack_merged_set(temp_raw_dict[b'tags']) == {b'x', b'y', b'z'}
+
+    def test_merge_without_operator(self, temp_raw_dict):
+        from pcontainers._pdict import BufferedPDictWrapper
+        buffered = BufferedPDictWrapper(temp_raw_dict, 3600)
+        with pytest.raises(NotInitialized):
+            buffered.async_merge(b'counter', 1)
+        with pytest.raises(ValueError):
+            BufferedPDictWrapper(temp_raw_dict, 3600, merge_operator='foo')
+
+
+    def test_async_reads(self, temp_raw_dict):
+        from pcontainers._pdict import BufferedPDictWrapper
+        from pcontainers._py_exceptions import Expired
+        for i in range(10):
+            temp_raw_dict[b'key%d' % i] = b'value%d' % i
+        with pytest.raises(ValueError):
+            BufferedPDictWrapper(temp_raw_dict, 3600, reader_threads=0)
+        buffered = BufferedPDictWrapper(temp_raw_dict, 3600, reader_threads=4)
+        futures = [(i % 10, buffered.async_getitem(b'key%d' % (i % 10))) for i in range(1000)]
+        for i, f in futures:
+            assert bytes(f.result()) == b'value%d' % i
+        stats = buffered.read_stats()
+        assert stats['reader_threads'] == 4
+        # every read either went to a reader thread or joined one that was in flight
+        assert stats['submitted'] + stats['coalesced'] == 1000
+        assert stats['expired'] == stats['cancelled'] == 0
+        with pytest.raises(NotFound):
+            buffered.async_getitem(b'missing').result()
+        # a read that has already run can not be cancelled
+        assert not futures[0][1].cancel()
+
+        # with a deadline, a read either runs in time or fails with Expired
+        futures = [buffered.async_getitem(b'key%d' % (i % 10), timeout=0.001) for i in range(200)]
+        expired = 0
+        for f in futures:
+            try:
+                f.result()
+            except Expired:
+                expired += 1
+        # a dropped read fails every call that was coalesced with it
+        dropped = buffered.read_stats()['expired']
+        assert dropped <= expired
+        assert (dropped == 0) == (expired == 0)
+        del buffered
+
+    def test_cancel_reads(self):
+        from pcontainers._pdict import BufferedPDictWrapper
+        d = PRawDict.make_temp(opts=LmdbOptions(map_size=64 << 20))
+        d[b'key'] = b'value'
+        for i in range(16):
+            d[b'big%d' % i] = os.urandom(1) * (1 << 20)
+        buffered = BufferedPDictWrapper(d, 0.005, reader_threads=1)
+        # the reads of the big values keep the only reader thread busy: the next reads wait behind them
+        busy = [buffered.async_getitem(b'big%d' % i) for i in range(16)]
+        first = buffered.async_getitem(b'key')
+        second = buffered.async_getitem(b'key')
+        alone = buffered.async_getitem(b'other')
+        assert first.cancel()
+        assert first.cancelled()
+        assert alone.cancel()
+        # the read of key is still run for the caller that did not withdraw
+        assert bytes(second.result()) == b'value'
+        assert [len(f.result()) for f in busy] == [1 << 20] * 16
+        assert buffered.read_stats()['cancelled'] == 1
+
+        # a flush forgets the reads in flight, so the next read of key is a new one: cancelling the stale read must
+        # not withdraw it
+        busy = [buffered.async_getitem(b'big%d' % i) for i in range(16)]
+        stale = buffered.async_getitem(b'key')
+        assert buffered.async_setitem(b'flushed', b'1').result()
+        fresh = buffered.async_getitem(b'key')
+        stale.cancel()
+        assert bytes(fresh.result()) == b'value'
+        assert [len(f.result()) for f in busy] == [1 << 20] * 16
+        del buffered
+
+    def test_aio_cancel_reads(self):
+        import asyncio
+        from pcontainers import asyncio_bridge
+        from pcontainers._pdict import BufferedPDictWrapper
+        d = PRawDict.make_temp(opts=LmdbOptions(map_size=64 << 20))
+        d[b'key'] = b'value'
+        for i in range(16):
+            d[b'big%d' % i] = os.urandom(1) * (1 << 20)
+        buffered = BufferedPDictWrapper(d, 0.005, reader_threads=1)
+
+        async def scenario():
+            busy = [buffered.aio_getitem(b'big%d' % i) for i in range(16)]
+            stale = buffered.aio_getitem(b'key')
+            assert await buffered.aio_setitem(b'flushed', b'1')
+            fresh = buffered.aio_getitem(b'key')
+            # the canceller withdraws from the stale read only, not from the read of key that followed the flush
+            stale.cancel()
+            assert (await fresh) == b'value'
+            assert [len(v) for v in await asyncio.gather(*busy)] == [1 << 20] * 16
+            while asyncio_bridge().in_flight:
+                await asyncio.sleep(0.01)
+
+        loop = asyncio.new_event_loop()
+        try:
+            loop.run_until_complete(scenario())
+        finally:
+            asyncio_bridge(loop).close()
+            loop.close()
+        del buffered
+
+
+    def test_asyncio(self, temp_raw_dict, tmpdir):
+        import asyncio
+        from pcontainers import PRawQueue, asyncio_bridge
+        from pcontainers._pdict import BufferedPDictWrapper
+        temp_raw_dict[b'a'] = b'1'
+        buffered = BufferedPDictWrapper(temp_raw_dict, 0.05, reader_threads=2)
+        queue = PRawQueue(str(tmpdir), b'queue')
+
+        async def scenario():
+            assert (await buffered.aio_getitem(b'a')) == b'1'
+            with pytest.raises(NotFound):
+                await buffered.aio_getitem(b'missing')
+            # the flush thread resolves these ones
+            assert all(await asyncio.gather(*[buffered.aio_setitem(b'k%d' % i, b'v%d' % i) for i in range(100)]))
+            assert await buffered.aio_delitem(b'a')
+            values = await asyncio.gather(*[buffered.aio_getitem(b'k%d' % i) for i in range(100)])
+            assert values == [b'v%d' % i for i in range(100)]
+
+            # a waiting pop is resolved by a later push
+            popped = queue.aio_pop_front()
+            assert await queue.aio_push_back(b'item')
+            assert (await popped) == b'item'
+            popped = [queue.aio_pop_front() for _ in range(50)]
+            await asyncio.gather(*[queue.aio_push_back(b'%d' % i) for i in range(50)])
+            assert sorted(await asyncio.gather(*popped)) == sorted(b'%d' % i for i in range(50))
+            # an item popped for a cancelled future goes back to the queue
+            popped = queue.aio_pop_front()
+            popped.cancel()
+            assert await queue.aio_push_back(b'kept')
+            while asyncio_bridge().in_flight:
+                await asyncio.sleep(0.01)
+            assert queue.pop_front() == b'kept'
+
+        loop = asyncio.new_event_loop()
+        try:
+            loop.run_until_complete(scenario())
+        finally:
+            asyncio_bridge(loop).close()
+            loop.close()
+        del buffered
+        assert temp_raw_dict[b'k0'] == b'v0'
+        assert b'a' not in temp_raw_dict
+
+
+class TestPRawQueue(object):
+    def test_sequence_keys(self, tmpdir):
+        from pcontainers import PRawQueue
+        dirname = str(tmpdir).encode('utf-8')
+        # a queue written with the decimal keys of the previous format is migrated when it is opened
+        old = PRawDict(dirname, b'queue')
+        old.update({b'4611686018427387903': b'b', b'4611686018427387902': b'a', b'4611686018427387904': b'c'})
+        q = PRawQueue(dirname, b'queue')
+        assert(sorted(old.keys()) == [struct.pack('>Q', 4611686018427387902 + i) for i in range(3)])
+        q.push_back(b'd')
+        q.push_front(b'z')
+        assert(q.pop_front() == b'z')
+        assert(q.pop_back() == b'd')
+        # another queue object writes: the cached ends of the queue are reloaded
+        other = PRawQueue(dirname, b'queue')
+        other.push_back(b'd')
+        other.push_front(b'0')
+        q.push_back(b'e')
+        assert(q.pop_front() == b'0')
+        assert([q.pop_front() for _ in range(5)] == [b'a', b'b', b'c', b'd', b'e'])
+        assert(q.qsize() == 0)
+        q.push_back(b'x')
+        assert(sorted(old.keys()) == [struct.pack('>Q', 4611686018427387903)])
+        assert(other.pop_back() == b'x')
+
+    def test_pop_many(self, tmpdir):
+        import threading
+        from queue import Empty
+        from pcontainers import PRawQueue
+        q = PRawQueue(str(tmpdir).encode('utf-8'), b'queue')
+        assert(q.pop_front_many(10) == [])
+        assert(q.try_pop_many(10) == [])
+        q.push_back_many([b'a', b'bb', b'ccc', b'dddd', b'e'])
+        assert(q.pop_front_many(2) == [b'a', b'bb'])
+        # the first item is popped even if it is bigger than max_bytes
+        assert(q.pop_front_many(10, max_bytes=2) == [b'ccc'])
+        assert(q.pop_back_many(10, max_bytes=5) == [b'e', b'dddd'])
+        assert(q.qsize() == 0)
+        q.push_back_many([b'a', b'b', b'c'])
+        assert(q.try_pop_many(2) == [b'a', b'b'])
+        assert(q.wait_and_pop_front_many(10, timeout=0.1) == [b'c'])
+        with pytest.raises(Empty):
+            q.wait_and_pop_front_many(10, timeout=0.1)
+        # the blocking variant wakes up with the first push, then takes what is there
+        t = threading.Timer(0.2, q.push_back_many, ([b'x', b'y'],))
+        t.start()
+        assert(q.wait_and_pop_front_many(10, timeout=5) == [b'x', b'y'])
+        t.join()
+
+    def test_try_pop_many_busy(self, tmpdir):
+        import threading
+        from pcontainers import PRawQueue
+        dirname = str(tmpdir).encode('utf-8')
+        q = PRawQueue(dirname, b'queue')
+        q.push_back_many([b'%d' % i for i in range(50000)])
+        # a busy queue is told apart from an empty one
+        popper = threading.Thread(target=PRawQueue(dirname, b'queue').pop_front_many, args=(50000,))
+        popper.start()
+        busy = False
+        while popper.is_alive() and not busy:
+            try:
+                q.try_pop_many(1)
+            except BlockingIOError:
+                busy = True
+        popper.join()
+        assert(busy)
+        assert(q.try_pop_many(10) == [])
+
+    def test_transform_values_batch(self, tmpdir):
+        from pcontainers import PRawQueue, PQueue
+        dirname = str(tmpdir).encode('utf-8')
+        q = PRawQueue(dirname, b'queue')
+        q.push_back_many([b'%d' % i for i in range(10)])
+        batches = []
+
+        def funct(values):
+            batches.append(len(values))
+            return [v + b'!' for v in values]
+
+        q.transform_values_batch(funct, batch_size=4)
+        assert(batches == [4, 4, 2])
+        assert(q.pop_all() == [b'%d!' % i for i in range(10)])
+        # the values of a PQueue go through its value chain
+        objects = PQueue(dirname, b'objects')
+        objects.push_back_many([{'n': i} for i in range(5)])
+        objects.transform_values_batch(lambda values: [dict(v, twice=2 * v['n']) for v in values], batch_size=2)
+        assert(objects.pop_all() == [{'n': i, 'twice': 2 * i} for i in range(5)])
+
+    def test_remove_if_batch(self, tmpdir):
+        from pcontainers import PRawQueue, PQueue
+        dirname = str(tmpdir).encode('utf-8')
+        q = PRawQueue(dirname, b'queue')
+        q.push_back_many([b'%d' % i for i in range(10)])
+        batches = []
+
+        def pred(values):
+            batches.append(len(values))
+            return [int(v) % 2 == 0 for v in values]
+
+        q.remove_if_batch(pred, batch_size=4)
+        assert(batches == [4, 4, 2])
+        assert(q.pop_all() == [b'1', b'3', b'5', b'7', b'9'])
+        objects = PQueue(dirname, b'objects')
+        objects.push_back_many([{'n': i} for i in range(5)])
+        objects.remove_if_batch(lambda values: [v['n'] > 2 for v in values], batch_size=2)
+        assert(objects.pop_all() == [{'n': 0}, {'n': 1}, {'n': 2}])
+
+    def test_wakeup(self, tmpdir):
+        import threading
+        import time
+        from pcontainers import PRawQueue
+        dirname = str(tmpdir).encode('utf-8')
+        consumer = PRawQueue(dirname, b'queue')
+        # the wakeup channel is a small file beside the environment
+        assert([f for f in os.listdir(str(tmpdir)) if f.endswith('.wakeup')])
+        producer = PRawQueue(dirname, b'queue')
+        results = []
+
+        def consume():
+            results.extend(consumer.wait_and_pop_front_many(1, timeout=10))
+
+        # every sleeper gets an element: one push wakes up one of them, and the other one waits for the next push
+        threads = [threading.Thread(target=consume) for _ in range(2)]
+        for t in threads:
+            t.start()
+        time.sleep(0.2)
+        start = time.time()
+        producer.push_back(b'a')
+        time.sleep(0.2)
+        assert(results == [b'a'])
+        producer.push_back(b'b')
+        for t in threads:
+            t.join()
+        assert(time.time() - start < 5)
+        assert(sorted(results) == [b'a', b'b'])
+        # a push of several elements wakes up as many sleepers
+        threads = [threading.Thread(target=consume) for _ in range(3)]
+        for t in threads:
+            t.start()
+        time.sleep(0.2)
+        producer.push_back_many([b'x', b'y', b'z'])
+        for t in threads:
+            t.join()
+        assert(sorted(results) == [b'a', b'b', b'x', b'y', b'z'])
+
+
+class TestPRawWorkQueue(object):
+    def test_lease_ack(self, tmpdir):
+        import time
+        from pcontainers import PRawWorkQueue
+        q = PRawWorkQueue(str(tmpdir).encode('utf-8'), b'work', max_attempts=2)
+        assert(q.lease(10) == [])
+        q.push_many([b'a', b'b', b'c'])
+        leased = q.lease(2, visibility_timeout=0.2)
+        assert([(attempts, value) for _, attempts, value in leased] == [(1, b'a'), (1, b'b')])
+        assert(q.qsize() == 1)
+        assert(q.inflight_size() == 2)
+        assert(q.ack(leased[0][0]) == 1)
+        assert(q.ack([leased[0][0]]) == 0)
+        # the expired lease goes back to the front of the queue, with its attempt counted
+        assert(q.reap() == 0)
+        time.sleep(0.3)
+        assert(q.reap() == 1)
+        assert(q.ack(leased[1][0]) == 0)
+        leased = q.lease(10)
+        assert([(attempts, value) for _, attempts, value in leased] == [(2, b'b'), (1, b'c')])
+        assert(q.qsize() == 0)
+        # released items are ready again at once, unless they reached max_attempts
+        assert(q.release([lease_id for lease_id, _, _ in leased]) == 2)
+        assert(q.dead_letter_size() == 1)
+        assert(q.inflight_size() == 0)
+        assert([(attempts, value) for _, attempts, value in q.lease(10)] == [(2, b'c')])
+        # another queue object sees the same leases
+        other = PRawWorkQueue(str(tmpdir).encode('utf-8'), b'work')
+        assert(other.inflight_size() == 1)
+        assert([value for _, _, value in other.pop_dead_letters()] == [b'b'])
+        q.clear()
+        assert(q.inflight_size() == 0)
+
+    def test_lease_ids(self, tmpdir):
+        from pcontainers import PRawWorkQueue
+        q = PRawWorkQueue(str(tmpdir).encode('utf-8'), b'work')
+        q.push_many([b'a', b'b', b'c'])
+        ids = [lease_id for lease_id, _, _ in q.lease(2)]
+        ids += [lease_id for lease_id, _, _ in q.lease(1)]
+        assert(ids == sorted(set(ids)))
+        # the ids are not reused after a clear, an old ack does not delete a new lease
+        q.clear()
+        q.push(b'd')
+        (lease_id, _, _), = q.lease(1)
+        assert(lease_id > ids[-1])
+        assert(q.ack(ids) == 0)
+        assert(q.inflight_size() == 1)
+
+    def test_redelivery(self, tmpdir):
+        import threading
+        from queue import Empty
+        from pcontainers import PWorkQueue
+        with PWorkQueue(str(tmpdir).encode('utf-8'), b'work', max_attempts=2, reap_period=0.05) as q:
+            q.push({'job': 1})
+            (lease_id, attempts, value), = q.wait_and_lease(1, visibility_timeout=0.1, timeout=1)
+            assert((attempts, value) == (1, {'job': 1}))
+            # the consumer "dies": the reaper delivers the item again
+            (lease_id2, attempts, value), = q.wait_and_lease(1, visibility_timeout=0.1, timeout=5)
+            assert(lease_id2 != lease_id)
+            assert((attempts, value) == (2, {'job': 1}))
+            # after max_attempts leases, the item goes to the dead letters
+            with pytest.raises(Empty):
+                q.wait_and_lease(1, timeout=0.5)
+            assert(q.reaped == 2)
+            assert(q.dead_letter_size() == 1)
+            assert([(attempts, value) for _, attempts, value in q.pop_dead_letters(10)] == [(2, {'job': 1})])
+            # a waiting consumer is woken up by a push
+            t = threading.Timer(0.2, q.push, ({'job': 2},))
+            t.start()
+            (lease_id, attempts, value), = q.wait_and_lease(1, timeout=5)
+            t.join()
+            assert(value == {'job': 2})
+            assert(q.ack([lease_id]) == 1)
+            assert(q.inflight_size() == 0)
+
+
+class TestPRawPriorityQueue(object):
+    def test_order_and_handles(self, tmpdir):
+        from queue import Empty
+        from pcontainers import PRawPriorityQueue
+        q = PRawPriorityQueue(str(tmpdir).encode('utf-8'), b'prio')
+        assert(q.empty())
+        with pytest.raises(Empty):
+            q.get_nowait()
+        with pytest.raises(Empty):
+            q.peek()
+        q.put((5, b'five'))
+        handle = q.put((2**40, b'big'))
+        q.push_many([(-3, b'minus three'), (5, b'five again'), (0, b'zero')])
+        assert(q.qsize() == 5)
+        assert(q.peek() == (-3, b'minus three'))
+        # the lowest priority first, first in first out for one priority
+        assert(q.pop_many(2) == [(-3, b'minus three'), (0, b'zero')])
+        new_handle = q.change_priority(handle, 1)
+        assert(new_handle is not None)
+        assert(q.change_priority(handle, 7) is None)
+        first_handle, priority, value = q.peek(with_handle=True)
+        assert(first_handle == new_handle)
+        assert((priority, value) == (1, b'big'))
+        # another queue object sees the same items
+        other = PRawPriorityQueue(str(tmpdir).encode('utf-8'), b'prio')
+        assert(other.get() == (1, b'big'))
+        assert(q.get(timeout=1) == (5, b'five'))
+        assert(q.get_nowait() == (5, b'five again'))
+        assert(q.change_priority(new_handle, 7) is None)
+        with pytest.raises(Empty):
+            q.get(timeout=0.1)
+        assert(q.empty())
+
+    def test_handles_are_not_reused(self, tmpdir):
+        from pcontainers import PRawPriorityQueue
+        q = PRawPriorityQueue(str(tmpdir).encode('utf-8'), b'prio')
+        popped = q.push(4, b'a')
+        assert(q.pop() == (4, b'a'))
+        pushed = q.push(4, b'b')
+        assert(pushed != popped)
+        assert(q.change_priority(popped, 9) is None)
+        moved = q.push(6, b'c')
+        assert(q.change_priority(moved, 8) is not None)
+        q.clear()
+        assert(q.push(6, b'd') not in (popped, pushed, moved))
+        assert(q.change_priority(moved, 9) is None)
+        assert(q.pop() == (6, b'd'))
+
+    def test_wait(self, tmpdir):
+        import threading
+        from pcontainers import PPriorityQueue
+        q = PPriorityQueue(str(tmpdir).encode('utf-8'), b'prio')
+        # a waiting consumer is woken up by a push
+        t = threading.Timer(0.2, q.push_many, ([(3, {'job': 3}), (1, {'job': 1})],))
+        t.start()
+        assert(q.wait_and_pop_many(10, timeout=5) == [(1, {'job': 1}), (3, {'job': 3})])
+        t.join()
+        fut = q.async_pop(timeout=5)
+        q.put((2, 'two'))
+        assert(fut.result(timeout=5) == (2, 'two'))
+
+
+class TestPRawMultiDict(object):
+    def test_add_discard(self, lmdb_options):
+        d = PRawMultiDict.make_temp(opts=lmdb_options)
+        assert d.add(b'k', b'b')
+        assert d.add(b'k', b'a')
+        assert not d.add(b'k', b'a')
+        assert d.add(b'other', b'z')
+        assert len(d) == 3
+        assert d[b'k'] == [b'a', b'b']
+        assert d.count(b'k') == 2
+        assert d.has_item(b'k', b'a')
+        assert d.discard(b'k', b'a')
+        assert not d.discard(b'k', b'a')
+        assert not d.has_item(b'k', b'a')
+        assert d.getall(b'k') == [b'b']
+        assert d.keys() == [b'k', b'other']
+        del d[b'other']
+        assert b'other' not in d
+        with pytest.raises(NotFound):
+            d[b'other']
+        with pytest.raises(EmptyKey):
+            d.add(b'', b'a')
+
+    def test_str_keys(self, lmdb_options):
+        d = PRawMultiDict.make_temp(opts=lmdb_options)
+        for i in range(100):
+            assert d.add(u'key-%d' % i, u'value-%d' % i)
+        for i in range(100):
+            assert u'key-%d' % i in d
+            assert d.has_item(u'key-%d' % i, u'value-%d' % i)
+            assert not d.has_item(u'key-%d' % i, u'other')
+            assert d.count(u'key-%d' % i) == 1
+            assert d.getall(u'key-%d' % i) == [(u'value-%d' % i).encode('utf-8')]
+        assert d.discard(u'key-0', u'value-0')
+        assert not d.discard(u'key-0', u'value-0')
+        del d[u'key-1']
+        assert len(d) == 98
+
+    @pytest.mark.parametrize('fixed_size', [False, True])
+    def test_many_values(self, fixed_size):
+        d = PRawMultiDict.make_temp(fixed_size=fixed_size)
+        values = [('%08d' % i).encode('ascii') for i in range(10000)]
+        assert d.add_many(b'list', reversed(values)) == 10000
+        assert d.add_many(b'list', values[:10]) == 0
+        assert d.count(b'list') == 10000
+        assert d.getall(b'list') == values
+        assert d.getall(b'nope') == []
+        d.clear()
+        assert len(d) == 0
+
+
+class TestPShardedDict(object):
+    @pytest.mark.parametrize('partitioning,split_points', [('hash', None), ('range', [b'g', b'p'])])
+    def test_sharded(self, partitioning, split_points):
+        d = PShardedDict.make_temp(3, partitioning=partitioning, split_points=split_points)
+        assert d.num_shards == 3
+        items = dict((('%s%03d' % (c, i)).encode('ascii'), str(i).encode('ascii')) for c in 'amz' for i in range(100))
+        d.update(items)
+        assert len(d) == 300
+        assert d[b'm042'] == b'42'
+        assert b'm042' in d
+        assert d.get(b'nope') is None
+        if partitioning == 'range':
+            assert [d.shard_of(k) for k in (b'a', b'g', b'm', b'p', b'z')] == [0, 1, 1, 2, 2]
+        else:
+            assert len(set(d.shard_of(k) for k in items)) == 3
+        assert list(d.iterkeys()) == sorted(items)
+        assert list(d.iteritems(b'm', b'm010')) == [(('m%03d' % i).encode('ascii'), str(i).encode('ascii')) for i in range(10)]
+        d[b'new'] = b'value'
+        del d[b'new']
+        with pytest.raises(NotFound):
+            del d[b'new']
+        assert d.erase_many([b'a000', b'z099', b'nope']) == 2
+        assert len(d) == 298
+        d.clear()
+        assert len(d) == 0
+
+    def test_str_keys(self):
+        d = PShardedDict.make_temp(3)
+        for i in range(100):
+            d[u'key-%d' % i] = u'value-%d' % i
+        for i in range(100):
+            assert u'key-%d' % i in d
+            assert d[u'key-%d' % i] == (u'value-%d' % i).encode('utf-8')
+            assert d.shard_of(u'key-%d' % i) == d.shard_of((u'key-%d' % i).encode('utf-8'))
+        del d[u'key-0']
+        assert len(d) == 99
+
+    def test_layout_is_checked(self):
+        d = PShardedDict.make_temp(2, destroy=False)
+        dirnames, dbname = d.dirnames, d.dbname
+        d[b'key'] = b'value'
+        del d
+        try:
+            assert PShardedDict(dirnames, dbname)[b'key'] == b'value'
+            with pytest.raises(Incompatible):
+                PShardedDict(list(reversed(dirnames)), dbname)
+            with pytest.raises(Incompatible):
+                PShardedDict(dirnames, dbname, partitioning='range', split_points=[b'm'])
+            with pytest.raises(ValueError):
+                PShardedDict(dirnames, dbname, partitioning='range', split_points=[])
+        finally:
+            for dirname in dirnames:
+                shutil.rmtree(dirname)
+
+
+class TestPBlobStore(object):
+    def test_streaming_write_and_read(self, temp_raw_dict):
+        import io
+        store = PBlobStore(temp_raw_dict, chunk_size=1000, chunks_per_txn=3)
+        content = os.urandom(25500)
+        with store.open_writer(b'blob') as writer:
+            for i in range(0, len(content), 777):
+                writer.write(content[i:i + 777])
+            # not visible before the writer is closed
+            assert b'blob' not in store
+        assert store.size(b'blob') == len(content)
+        assert store.get(b'blob') == content
+        with store.open_reader(b'blob') as reader:
+            assert reader.read(10) == content[:10]
+            assert reader.seek(-500, 2) == len(content) - 500
+            buf = bytearray(1000)
+            assert reader.readinto(buf) == 500
+            assert bytes(buf[:500]) == content[-500:]
+            assert reader.read() == b''
+            assert reader.read_range(999, 1002) == content[999:2001]
+            assert reader.tell() == len(content)
+        assert store.put(b'other', io.BytesIO(content), read_size=4096) == len(content)
+        assert sorted(store.names()) == [b'blob', b'other']
+
+    def test_atomic_replace_and_delete(self, temp_raw_dict):
+        store = PBlobStore(temp_raw_dict, chunk_size=100)
+        store.put(b'blob', b'a' * 1050)
+        reader = store.open_reader(b'blob')
+        store.put(b'blob', b'b' * 250)
+        # the reader keeps its snapshot
+        assert reader.read() == b'a' * 1050
+        reader.close()
+        assert store.get(b'blob') == b'b' * 250
+        with pytest.raises(RuntimeError):
+            with store.open_writer(b'blob') as writer:
+                writer.write(b'c' * 500)
+                raise RuntimeError()
+        assert store.get(b'blob') == b'b' * 250
+        assert store.delete(b'blob')
+        assert not store.delete(b'blob')
+        with pytest.raises(NotFound):
+            store.open_reader(b'blob')
+        # only the generation counter is left
+        assert len(temp_raw_dict) == 1
+
+    def test_names_and_sweep(self, temp_raw_dict):
+        store = PBlobStore(temp_raw_dict, chunk_size=10, chunks_per_txn=1)
+        store.put(b'a', b'x' * 100)
+        store.put(b'c', b'y' * 5)
+        # a value that is not a blob, and the chunks of writers that crashed before their commit
+        temp_raw_dict[b'legacy'] = b'z'
+        temp_raw_dict[b'a\x00' + struct.pack('>QQ', 1000, 0)] = b'lost'
+        temp_raw_dict[b'b\x00' + struct.pack('>QQ', 1001, 0)] = b'lost'
+        temp_raw_dict[b'b\x00' + struct.pack('>QQ', 1001, 1)] = b'lost'
+        writer = store.open_writer(b'd')
+        writer.write(b'w' * 50)
+        assert sorted(store.names()) == [b'a', b'c']
+        # the chunks of the writer that is still open are kept
+        assert store.sweep() == 2
+        assert store.sweep() == 0
+        writer.close()
+        assert sorted(store.names()) == [b'a', b'c', b'd']
+        assert store.get(b'a') == b'x' * 100
+        assert store.get(b'd') == b'w' * 50
+        assert temp_raw_dict[b'legacy'] == b'z'
+        for name in (b'a', b'c', b'd'):
+            store.delete(name)
+        # the generation counter and the legacy value
+        assert len(temp_raw_dict) == 2
+
+    def test_chunk_size_bound(self, temp_raw_dict):
+        # the chunks are held in strings, whose length is an int
+        with pytest.raises(ValueError):
+            PBlobStore(temp_raw_dict, chunk_size=2 ** 31)
+        with pytest.raises(ValueError):
+            PBlobStore(temp_raw_dict, chunk_size=0)
+        assert PBlobStore(temp_raw_dict, chunk_size=2 ** 31 - 2).chunk_size == 2 ** 31 - 2
+
+
+class TestPRawExpiryDict(object):
+    def test_set_get_expire(self, lmdb_options):
+        import time
+        d = PRawExpiryDict.make_temp(opts=lmdb_options, default_ttl=0.2)
+        d[b'default'] = b'1'
+        d.set(b'short', b'2', ttl=0.05)
+        d.set(b'never', b'3', ttl=-1)
+        assert d[b'short'] == b'2'
+        assert d.ttl(b'never') is None
+        assert 0 < d.ttl(b'default') <= 0.2
+        assert sorted(d.items()) == [(b'default', b'1'), (b'never', b'3'), (b'short', b'2')]
+        time.sleep(0.1)
+        # expired, but not pruned yet
+        assert b'short' not in d
+        assert d.get(b'short') is None
+        with pytest.raises(NotFound):
+            d[b'short']
+        assert len(d) == 3
+        assert list(d.keys()) == [b'default', b'never']
+        assert d.prune_expired() == 1
+        assert len(d) == 2 and d.pruned == 1
+        assert d.expire(b'default', -1)
+        assert not d.expire(b'short', 10)
+        time.sleep(0.2)
+        assert d.prune_expired() == 0
+        assert d.pop(b'default') == b'1'
+        assert d.pop(b'default', b'x') == b'x'
+        with pytest.raises(NotFound):
+            del d[b'default']
+        assert d.popitem() == (b'never', b'3')
+        with pytest.raises(EmptyDatabase):
+            d.popitem()
+        with pytest.raises(EmptyKey):
+            d[b''] = b'v'
+
+    def test_pruning_thread(self):
+        import time
+        d = PRawExpiryDict.make_temp(prune_period=0.02)
+        d.update({b'%05d' % i: b'v' for i in range(1000)}, ttl=0.05)
+        d.set(b'kept', b'v', ttl=60)
+        # rewriting a key moves its index record
+        d.set(b'00000', b'v', ttl=60)
+        with d:
+            assert d.pruning
+            deadline = time.time() + 5
+            while len(d) > 2 and time.time() < deadline:
+                time.sleep(0.02)
+        assert not d.pruning
+        assert sorted(d.keys()) == [b'00000', b'kept']
+        assert d.pruned == 999
+
+    def test_sliding(self):
+        import time
+        d = PRawExpiryDict.make_temp()
+        d.set(b'sliding', b'v', ttl=0.3, sliding=True)
+        d.set(b'fixed', b'v', ttl=0.3)
+        end = time.time() + 0.6
+        while time.time() < end:
+            assert d[b'sliding'] == b'v'
+            time.sleep(0.02)
+        # the reads are buffered, but they keep the entry alive
+        assert b'fixed' not in d
+        assert b'sliding' in d
+        stats = d.touch_stats
+        assert stats['pending'] == 1
+        assert stats['coalesced'] == stats['touches'] - 1
+        assert stats['flushes'] == 0
+        # pruning writes the buffered reads before deleting anything
+        assert d.prune_expired() == 1
+        assert d.touch_stats['pending'] == 0
+        assert d.touch_stats['flushed'] == 1
+        assert 0 < d.ttl(b'sliding') <= 0.3
+        assert d[b'sliding'] == b'v'
+        assert d.flush_touches() == 1
+        assert d.touch_stats['flushes'] == 1
+        # expire() stops the sliding
+        assert d.expire(b'sliding', 0.1)
+        assert d[b'sliding'] == b'v'
+        assert d.flush_touches() == 0
+        time.sleep(0.15)
+        assert b'sliding' not in d
+
+    def test_flushing_thread(self):
+        import time
+        d = PRawExpiryDict.make_temp(flush_period=0.02)
+        d.update({b'a': b'1', b'b': b'2'}, ttl=60, sliding=True)
+        time.sleep(0.1)
+        with d:
+            assert d.flushing_touches
+            assert d[b'a'] == b'1'
+            deadline = time.time() + 5
+            while d.touch_stats['flushed'] == 0 and time.time() < deadline:
+                time.sleep(0.02)
+            assert d.touch_stats['pending'] == 0
+        assert not d.flushing_touches
+        # b was not read: its deadline did not move
+        assert d.ttl(b'a') > d.ttl(b'b') + 0.05
+
+
+    def test_eviction(self):
+        import time
+        d = PRawExpiryDict.make_temp()
+        d.enable_eviction(max_entries=3)
+        d.set(b'old', b'v', ttl=0.05)
+        for key in (b'a', b'b'):
+            d[key] = b'v'
+            time.sleep(0.01)
+        time.sleep(0.05)
+        # the expired entries are pruned before anything is evicted
+        d[b'c'] = b'v'
+        assert(sorted(d.keys()) == [b'a', b'b', b'c'])
+        assert(len(d) == 3)
+        assert(d.eviction_stats()['evictions'] == 0)
+        time.sleep(0.01)
+        assert(d[b'a'] == b'v')
+        time.sleep(0.01)
+        d[b'd'] = b'v'
+        assert(sorted(d.keys()) == [b'a', b'c', b'd'])
+        assert(d.eviction_stats()['evictions'] == 1)
+
+    def test_eviction_pending_touch(self):
+        import time
+        d = PRawExpiryDict.make_temp()
+        d.enable_eviction(max_entries=2)
+        d.set(b'a', b'v', ttl=0.1, sliding=True)
+        d[b'b'] = b'v'
+        time.sleep(0.06)
+        assert(d[b'a'] == b'v')
+        time.sleep(0.06)
+        # a is past its stored deadline, but its pending touch keeps it alive: the pruning before the eviction
+        # writes the touch instead of deleting a, and b is evicted
+        d[b'c'] = b'v'
+        assert(sorted(d.keys()) == [b'a', b'c'])
+        assert(d.eviction_stats()['evictions'] == 1)
+        assert(d[b'a'] == b'v')
+
+
+    def test_get_or_compute_stale(self):
+        import time
+        d = PRawExpiryDict.make_temp(stale_grace=10)
+        calls = []
+
+        def loader(key):
+            calls.append(key)
+            time.sleep(0.1)
+            return b'v%d' % len(calls)
+
+        assert(d.get_or_compute(b'foo', loader, ttl=0.05) == b'v1')
+        assert(d.get_or_compute(b'foo', loader, ttl=0.05) == b'v1')
+        time.sleep(0.1)
+        # expired: the other reads don't see it, get_or_compute serves it while one refresh runs in the background
+        assert(b'foo' not in d)
+        assert(d.prune_expired() == 0)
+        assert(d.get_or_compute(b'foo', loader, ttl=60) == b'v1')
+        assert(d.get_or_compute(b'foo', loader, ttl=60) == b'v1')
+        deadline = time.time() + 10
+        while b'foo' not in d and time.time() < deadline:
+            time.sleep(0.01)
+        assert(d[b'foo'] == b'v2')
+        assert(calls == [b'foo', b'foo'])
+        # without a grace period, an expired entry is computed again right away
+        e = PRawExpiryDict.make_temp()
+        e.set(b'foo', b'old', ttl=0.01)
+        time.sleep(0.02)
+        assert(e.get_or_compute(b'foo', loader) == b'v3')
+        assert(e.prune_expired() == 0)
+
+class TestExpiryDict(object):
+    @pytest.fixture
+    def expiry_dict(self, tmpdir):
+        return ExpiryDict(str(tmpdir).encode('utf-8'), default_expiry=60, metadata_chain=Chain(PickleSerializer(), None, None))
+
+    def test_single_environment(self, expiry_dict):
+        expiry_dict.set(b'foo', {u'a': 1}, metadata={u'm': 2})
+        expiry_dict[b'bar'] = 2
+        expiry_dict.update({b'baz': 3, b'qux': 4}, expiry=-1)
+        # one environment, the tables are named databases
+        assert sorted(os.listdir(expiry_dict.dirname)) == [b'data.mdb', b'lock.mdb']
+        assert expiry_dict[b'foo'] == {u'a': 1}
+        assert expiry_dict.get_metadata(b'foo') == {u'm': 2}
+        assert expiry_dict.get_metadata(b'bar') == {}
+        expiry_dict.set_metadata(b'bar', {u'x': 0})
+        assert sorted(expiry_dict.items()) == [(b'bar', 2, {u'x': 0}), (b'baz', 3, {}), (b'foo', {u'a': 1}, {u'm': 2}),
+                                               (b'qux', 4, {})]
+        assert expiry_dict.pop(b'foo') == ({u'a': 1}, {u'm': 2})
+        with pytest.raises(NotFound):
+            expiry_dict.pop(b'foo')
+        with pytest.raises(NotFound):
+            expiry_dict.get_metadata(b'foo')
+        del expiry_dict[b'bar']
+        assert b'bar' not in expiry_dict
+        assert expiry_dict.popitem() == (b'baz', 3, {})
+        assert list(expiry_dict.keys()) == [b'qux']
+        with pytest.raises(EmptyKey):
+            expiry_dict[b''] = 1
+
+    def test_str_keys(self, expiry_dict):
+        # the keys are encoded into new objects: they must stay alive until the end of the native calls
+        for i in range(100):
+            key = u'key-%d' % i
+            expiry_dict.set(key, i, metadata={u'i': i})
+            assert expiry_dict.set_metadata(key, {u'i': -i}) is None
+            assert expiry_dict.get_metadata(key) == {u'i': -i}
+            assert expiry_dict[key] == i
+            assert key in expiry_dict
+        assert expiry_dict.pop(u'key-0') == (0, {u'i': 0})
+        del expiry_dict[u'key-1']
+        assert u'key-1' not in expiry_dict
+        assert len(expiry_dict) == 98
+
+    def test_migrate_legacy_layout(self, tmpdir):
+        import pickle
+        import time
+        dirname = str(tmpdir).encode('utf-8')
+        index = PRawDict(os.path.join(dirname, b'index'), b'')
+        values = PRawDict(os.path.join(dirname, b'values'), b'')
+        metadata = PRawDict(os.path.join(dirname, b'metadata'), b'')
+        now = int(time.time())
+        for key, expiry in ((b'live', str(now + 60).encode('ascii')), (b'forever', b'none'),
+                            (b'expired', str(now - 1).encode('ascii'))):
+            index[key] = expiry
+            values[key] = pickle.dumps(key + b' value')
+            metadata[key] = pickle.dumps({u'm': key})
+        del index, values, metadata
+        d = ExpiryDict(dirname, metadata_chain=Chain(PickleSerializer(), None, None))
+        assert sorted(os.listdir(dirname)) == [b'data.mdb', b'lock.mdb']
+        assert sorted(d.keys()) == [b'forever', b'live']
+        assert d[b'live'] == b'live value'
+        assert d.get_metadata(b'forever') == {u'm': b'forever'}
+        raw = PRawExpiryDict(dirname, dbname=b'entries')
+        assert 58 <= raw.ttl(b'live') <= 60
+        assert raw.ttl(b'forever') is None
+
+    def test_get_or_compute(self, expiry_dict):
+        assert(expiry_dict.get_or_compute(b'foo', lambda key: {u'k': key}) == {u'k': b'foo'})
+        assert(expiry_dict.get_or_compute(b'foo', lambda key: 1 // 0) == {u'k': b'foo'})
+        assert(expiry_dict.get_metadata(b'foo') == {})
+        with pytest.raises(ZeroDivisionError):
+            expiry_dict.get_or_compute(b'bar', lambda key: 1 // 0)
+        assert(b'bar' not in expiry_dict)
+
+    def test_expiry(self, expiry_dict):
+        import time
+        expiry_dict.set(b'short', 1, expiry=1, metadata={u'm': 1})
+        expiry_dict.set(b'long', 2)
+        time.sleep(1.1)
+        assert b'short' not in expiry_dict
+        with pytest.raises(NotFound):
+            expiry_dict.set_metadata(b'short', {})
+        assert len(expiry_dict) == 2
+        assert expiry_dict.prune_expired() == 1
+        assert list(expiry_dict.items()) == [(b'long', 2, {})]